@@ -413,6 +413,36 @@ dnf_cmd_update(DnfUtilPrivate *priv, gchar **values, GError **error)
     return dnf_context_run(priv->context, NULL, error);
 }
 
+/**
+ * dnf_cmd_serve:
+ **/
+static gboolean
+dnf_cmd_serve(DnfUtilPrivate *priv, gchar **values, GError **error)
+{
+    g_autoptr(DnfSackServer) server = NULL;
+    g_autoptr(GMainLoop) loop = NULL;
+
+    if (g_strv_length(values) < 1) {
+        g_set_error_literal(error,
+                            DNF_ERROR,
+                            DNF_ERROR_INVALID_ARGUMENTS,
+                            "Not enough arguments, "
+                            "expected socket filename");
+        return FALSE;
+    }
+
+    /* keep the sack loaded and answer queries until killed */
+    if (!dnf_context_setup(priv->context, NULL, error))
+        return FALSE;
+    server = dnf_sack_server_new(priv->context);
+    if (!dnf_sack_server_start(server, values[0], error))
+        return FALSE;
+    g_print("Serving on %s\n", values[0]);
+    loop = g_main_loop_new(NULL, FALSE);
+    g_main_loop_run(loop);
+    return TRUE;
+}
+
 /**
  * dnf_cmd_ignore_cb:
  **/
@@ -488,6 +518,10 @@ main(int argc, char *argv[])
                 "clean", NULL,
                 "Clean all the metadata",
                 dnf_cmd_clean);
+    dnf_cmd_add(priv->cmd_array,
+                "serve", "[socket]",
+                "Keep the sack loaded and answer queries on a socket",
+                dnf_cmd_serve);
 
     /* sort by command name */
     g_ptr_array_sort(priv->cmd_array,
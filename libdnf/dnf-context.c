@@ -101,11 +101,17 @@ typedef struct
     gchar            *http_proxy;
     gchar            *user_agent;
     gboolean         cache_age;
+    guint            max_parallel_downloads;
+    guint            max_downloads_per_host;
+    guint            max_parallel_refresh;
     gboolean         check_disk_space;
     gboolean         check_transaction;
     gboolean         only_trusted;
     gboolean         enable_yumdb;
     gboolean         keep_cache;
+    gboolean         local_repos_in_place;
+    gboolean         use_deltarpm;
+    gboolean         prefetch;
     gboolean         enrollment_valid;
     DnfLock         *lock;
     DnfTransaction  *transaction;
@@ -190,6 +196,9 @@ dnf_context_init(DnfContext *context)
     priv->state = dnf_state_new();
     priv->lock = dnf_lock_new();
     priv->cache_age = 60 * 60 * 24 * 7; /* 1 week */
+    priv->max_parallel_downloads = 6;
+    priv->max_downloads_per_host = 3;
+    priv->max_parallel_refresh = 4;
     priv->override_macros = g_hash_table_new_full(g_str_hash, g_str_equal,
                                                   g_free, g_free);
     priv->user_agent = g_strdup("libdnf/" PACKAGE_VERSION);
@@ -654,6 +663,60 @@ dnf_context_get_check_transaction(DnfContext *context)
     return priv->check_transaction;
 }
 
+/**
+ * dnf_context_get_local_repos_in_place:
+ * @context: a #DnfContext instance.
+ *
+ * Gets if packages from checked local repos are installed in place
+ * without being checksummed first.
+ *
+ * Returns: %TRUE if local repo packages are installed in place
+ *
+ * Since: 0.8.0
+ **/
+gboolean
+dnf_context_get_local_repos_in_place(DnfContext *context)
+{
+    DnfContextPrivate *priv = GET_PRIVATE(context);
+    return priv->local_repos_in_place;
+}
+
+/**
+ * dnf_context_get_use_deltarpm:
+ * @context: a #DnfContext instance.
+ *
+ * Gets if updates are rebuilt from delta RPMs where that is cheaper
+ * than downloading the full package.
+ *
+ * Returns: %TRUE if delta RPMs are used
+ *
+ * Since: 0.8.0
+ **/
+gboolean
+dnf_context_get_use_deltarpm(DnfContext *context)
+{
+    DnfContextPrivate *priv = GET_PRIVATE(context);
+    return priv->use_deltarpm;
+}
+
+/**
+ * dnf_context_get_prefetch:
+ * @context: a #DnfContext instance.
+ *
+ * Gets if packages start downloading in the background as soon as a
+ * transaction has been depsolved.
+ *
+ * Returns: %TRUE if packages are prefetched
+ *
+ * Since: 0.8.0
+ **/
+gboolean
+dnf_context_get_prefetch(DnfContext *context)
+{
+    DnfContextPrivate *priv = GET_PRIVATE(context);
+    return priv->prefetch;
+}
+
 /**
  * dnf_context_get_keep_cache:
  * @context: a #DnfContext instance.
@@ -720,6 +783,60 @@ dnf_context_get_cache_age(DnfContext *context)
     return priv->cache_age;
 }
 
+/**
+ * dnf_context_get_max_parallel_downloads:
+ * @context: a #DnfContext instance.
+ *
+ * Gets the maximum number of packages downloaded at the same time, over
+ * all repos.
+ *
+ * Returns: number of downloads
+ *
+ * Since: 0.8.0
+ **/
+guint
+dnf_context_get_max_parallel_downloads(DnfContext *context)
+{
+    DnfContextPrivate *priv = GET_PRIVATE(context);
+    return priv->max_parallel_downloads;
+}
+
+/**
+ * dnf_context_get_max_downloads_per_host:
+ * @context: a #DnfContext instance.
+ *
+ * Gets the maximum number of packages downloaded at the same time from
+ * a single mirror.
+ *
+ * Returns: number of downloads
+ *
+ * Since: 0.8.0
+ **/
+guint
+dnf_context_get_max_downloads_per_host(DnfContext *context)
+{
+    DnfContextPrivate *priv = GET_PRIVATE(context);
+    return priv->max_downloads_per_host;
+}
+
+/**
+ * dnf_context_get_max_parallel_refresh:
+ * @context: a #DnfContext instance.
+ *
+ * Gets the maximum number of repos whose metadata is refreshed at the
+ * same time.
+ *
+ * Returns: number of repos
+ *
+ * Since: 0.8.0
+ **/
+guint
+dnf_context_get_max_parallel_refresh(DnfContext *context)
+{
+    DnfContextPrivate *priv = GET_PRIVATE(context);
+    return priv->max_parallel_refresh;
+}
+
 /**
  * dnf_context_get_installonly_pkgs:
  * @context: a #DnfContext instance.
@@ -957,6 +1074,62 @@ dnf_context_set_check_transaction(DnfContext *context, gboolean check_transactio
     priv->check_transaction = check_transaction;
 }
 
+/**
+ * dnf_context_set_local_repos_in_place:
+ * @context: a #DnfContext instance.
+ * @local_repos_in_place: %TRUE to install local repo packages in place
+ *
+ * Enables or disables installing packages from local and media repos
+ * straight from the repo without checksumming them first, as long as
+ * the repo metadata has been checked by dnf_repo_check(). rpm still
+ * verifies the package digests when installing.
+ *
+ * Since: 0.8.0
+ **/
+void
+dnf_context_set_local_repos_in_place(DnfContext *context, gboolean local_repos_in_place)
+{
+    DnfContextPrivate *priv = GET_PRIVATE(context);
+    priv->local_repos_in_place = local_repos_in_place;
+}
+
+/**
+ * dnf_context_set_use_deltarpm:
+ * @context: a #DnfContext instance.
+ * @use_deltarpm: %TRUE to use delta RPMs
+ *
+ * Enables or disables rebuilding updates from delta RPMs. This needs
+ * the deltarpm metadata, so it has to be set before the sack is set up,
+ * and applydeltarpm to be installed.
+ *
+ * Since: 0.8.0
+ **/
+void
+dnf_context_set_use_deltarpm(DnfContext *context, gboolean use_deltarpm)
+{
+    DnfContextPrivate *priv = GET_PRIVATE(context);
+    priv->use_deltarpm = use_deltarpm;
+}
+
+/**
+ * dnf_context_set_prefetch:
+ * @context: a #DnfContext instance.
+ * @prefetch: %TRUE to prefetch packages
+ *
+ * Enables or disables downloading the packages of a transaction in the
+ * background straight after it has been depsolved, while the frontend
+ * waits for confirmation. The repos must not be used until the
+ * transaction is downloaded or reset.
+ *
+ * Since: 0.8.0
+ **/
+void
+dnf_context_set_prefetch(DnfContext *context, gboolean prefetch)
+{
+    DnfContextPrivate *priv = GET_PRIVATE(context);
+    priv->prefetch = prefetch;
+}
+
 /**
  * dnf_context_set_keep_cache:
  * @context: a #DnfContext instance.
@@ -1023,6 +1196,57 @@ dnf_context_set_cache_age(DnfContext *context, guint cache_age)
     priv->cache_age = cache_age;
 }
 
+/**
+ * dnf_context_set_max_parallel_downloads:
+ * @context: a #DnfContext instance.
+ * @max_parallel_downloads: number of downloads, at least 1
+ *
+ * Sets the maximum number of packages downloaded at the same time, over
+ * all repos.
+ *
+ * Since: 0.8.0
+ **/
+void
+dnf_context_set_max_parallel_downloads(DnfContext *context, guint max_parallel_downloads)
+{
+    DnfContextPrivate *priv = GET_PRIVATE(context);
+    priv->max_parallel_downloads = MAX(max_parallel_downloads, 1);
+}
+
+/**
+ * dnf_context_set_max_downloads_per_host:
+ * @context: a #DnfContext instance.
+ * @max_downloads_per_host: number of downloads, at least 1
+ *
+ * Sets the maximum number of packages downloaded at the same time from
+ * a single mirror.
+ *
+ * Since: 0.8.0
+ **/
+void
+dnf_context_set_max_downloads_per_host(DnfContext *context, guint max_downloads_per_host)
+{
+    DnfContextPrivate *priv = GET_PRIVATE(context);
+    priv->max_downloads_per_host = MAX(max_downloads_per_host, 1);
+}
+
+/**
+ * dnf_context_set_max_parallel_refresh:
+ * @context: a #DnfContext instance.
+ * @max_parallel_refresh: number of repos, at least 1
+ *
+ * Sets the maximum number of repos whose metadata is refreshed at the
+ * same time.
+ *
+ * Since: 0.8.0
+ **/
+void
+dnf_context_set_max_parallel_refresh(DnfContext *context, guint max_parallel_refresh)
+{
+    DnfContextPrivate *priv = GET_PRIVATE(context);
+    priv->max_parallel_refresh = MAX(max_parallel_refresh, 1);
+}
+
 /**
  * dnf_context_set_os_release:
  **/
@@ -1144,9 +1368,17 @@ gboolean
 dnf_context_setup_sack(DnfContext *context, DnfState *state, GError **error)
 {
     DnfContextPrivate *priv = GET_PRIVATE(context);
+    DnfSackAddFlags flags;
     gboolean ret;
     g_autofree gchar *solv_dir_real = NULL;
 
+    /* drop any previous sack, and the goal that points into it */
+    if (priv->goal != NULL) {
+        hy_goal_free(priv->goal);
+        priv->goal = NULL;
+    }
+    g_clear_object(&priv->sack);
+
     /* create empty sack */
     solv_dir_real = dnf_realpath(priv->solv_dir);
     priv->sack = dnf_sack_new();
@@ -1167,18 +1399,19 @@ dnf_context_setup_sack(DnfContext *context, DnfState *state, GError **error)
     }
 
     /* add remote */
+    flags = DNF_SACK_ADD_FLAG_FILELISTS;
+    if (priv->use_deltarpm)
+        flags |= DNF_SACK_ADD_FLAG_PRESTO;
     ret = dnf_sack_add_repos(priv->sack,
                              priv->repos,
                              priv->cache_age,
-                             DNF_SACK_ADD_FLAG_FILELISTS,
+                             flags,
                              state,
                              error);
     if (!ret)
         return FALSE;
 
     /* create goal */
-    if (priv->goal != NULL)
-        hy_goal_free(priv->goal);
     priv->goal = hy_goal_create(priv->sack);
     return TRUE;
 }
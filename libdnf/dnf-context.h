@@ -87,9 +87,15 @@ const gchar     **dnf_context_get_installonly_pkgs      (DnfContext     *context
 gboolean         dnf_context_get_check_disk_space       (DnfContext     *context);
 gboolean         dnf_context_get_check_transaction      (DnfContext     *context);
 gboolean         dnf_context_get_keep_cache             (DnfContext     *context);
+gboolean         dnf_context_get_local_repos_in_place   (DnfContext     *context);
+gboolean         dnf_context_get_use_deltarpm           (DnfContext     *context);
+gboolean         dnf_context_get_prefetch               (DnfContext     *context);
 gboolean         dnf_context_get_only_trusted           (DnfContext     *context);
 gboolean         dnf_context_get_yumdb_enabled          (DnfContext     *context);
 guint            dnf_context_get_cache_age              (DnfContext     *context);
+guint            dnf_context_get_max_parallel_downloads (DnfContext     *context);
+guint            dnf_context_get_max_downloads_per_host (DnfContext     *context);
+guint            dnf_context_get_max_parallel_refresh   (DnfContext     *context);
 guint            dnf_context_get_installonly_limit      (DnfContext     *context);
 const gchar     *dnf_context_get_http_proxy             (DnfContext     *context);
 GPtrArray       *dnf_context_get_repos                  (DnfContext     *context);
@@ -129,12 +135,24 @@ void             dnf_context_set_check_transaction      (DnfContext     *context
                                                          gboolean        check_transaction);
 void             dnf_context_set_keep_cache             (DnfContext     *context,
                                                          gboolean        keep_cache);
+void             dnf_context_set_local_repos_in_place   (DnfContext     *context,
+                                                         gboolean        local_repos_in_place);
+void             dnf_context_set_use_deltarpm           (DnfContext     *context,
+                                                         gboolean        use_deltarpm);
+void             dnf_context_set_prefetch               (DnfContext     *context,
+                                                         gboolean        prefetch);
 void             dnf_context_set_only_trusted           (DnfContext     *context,
                                                          gboolean        only_trusted);
 void             dnf_context_set_yumdb_enabled          (DnfContext     *context,
                                                          gboolean        enable_yumdb);
 void             dnf_context_set_cache_age              (DnfContext     *context,
                                                          guint           cache_age);
+void             dnf_context_set_max_parallel_downloads (DnfContext     *context,
+                                                         guint           max_parallel_downloads);
+void             dnf_context_set_max_downloads_per_host (DnfContext     *context,
+                                                         guint           max_downloads_per_host);
+void             dnf_context_set_max_parallel_refresh   (DnfContext     *context,
+                                                         guint           max_parallel_refresh);
 
 void             dnf_context_set_rpm_macro              (DnfContext     *context,
                                                          const gchar    *key,
@@ -38,17 +38,41 @@
  *
  * Using the filesystem as a database probably wasn't a great design
  * decision.
+ *
+ * With %DNF_DB_BACKEND_STORE all the values are instead kept in a single
+ * file next to the yumdb directory, which is imported once when the file
+ * does not exist yet. Changes are appended as records, and the changes
+ * made between dnf_db_begin() and dnf_db_commit() are written with one
+ * fsync. Only whole commits are replayed when the file is loaded again,
+ * so a crash never leaves half a transaction behind.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
 
 #include "dnf-db.h"
 #include "dnf-package.h"
 #include "dnf-utils.h"
 
+#define DNF_DB_STORE_HEADER         "# dnf-db-store 1\n"
+#define DNF_DB_STORE_MIN_RECORDS    1000    /* before compacting */
+
 typedef struct
 {
     DnfContext      *context;    /* weak reference */
     gboolean         enabled;
+    DnfDbBackend     backend;
+    GHashTable      *store;      /* index:GHashTable(key:value), or NULL */
+    GHashTable      *store_cleared; /* index, removed from the store */
+    guint            store_records;
+    gboolean         store_compact;
+    GString         *pending;    /* records not yet committed */
+    guint            pending_records;
+    gboolean         in_batch;
 } DnfDbPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE(DnfDb, dnf_db, G_TYPE_OBJECT)
@@ -66,6 +90,13 @@ dnf_db_finalize(GObject *object)
     if (priv->context != NULL)
         g_object_remove_weak_pointer(G_OBJECT(priv->context),
                                      (void **) &priv->context);
+    if (priv->pending_records > 0)
+        g_warning("dropping %u uncommitted records", priv->pending_records);
+    if (priv->store != NULL)
+        g_hash_table_unref(priv->store);
+    if (priv->store_cleared != NULL)
+        g_hash_table_unref(priv->store_cleared);
+    g_string_free(priv->pending, TRUE);
 
     G_OBJECT_CLASS(dnf_db_parent_class)->finalize(object);
 }
@@ -76,6 +107,9 @@ dnf_db_finalize(GObject *object)
 static void
 dnf_db_init(DnfDb *db)
 {
+    DnfDbPrivate *priv = GET_PRIVATE(db);
+    priv->backend = DNF_DB_BACKEND_YUMDB;
+    priv->pending = g_string_new(NULL);
 }
 
 /**
@@ -108,12 +142,11 @@ dnf_db_create_dir(const gchar *dir, GError **error)
 }
 
 /**
- * dnf_db_get_dir_for_package:
+ * dnf_db_get_yumdb_dir:
  **/
 static gchar *
-dnf_db_get_dir_for_package(DnfDb *db, DnfPackage *package)
+dnf_db_get_yumdb_dir(DnfDb *db)
 {
-    const gchar *pkgid;
     DnfDbPrivate *priv = GET_PRIVATE(db);
     const gchar *instroot;
 #ifdef BUILDOPT_USE_DNF_YUMDB
@@ -122,18 +155,25 @@ dnf_db_get_dir_for_package(DnfDb *db, DnfPackage *package)
     static const gchar *yumdb_dir = "/var/lib/yum/yumdb";
 #endif
 
-    pkgid = dnf_package_get_pkgid(package);
-    if (pkgid == NULL)
-        return NULL;
-
     instroot = dnf_context_get_install_root(priv->context);
     if (g_strcmp0(instroot, "/") == 0)
         instroot = "";
+    return g_strdup_printf("%s%s", instroot, yumdb_dir);
+}
 
-    return g_strdup_printf("%s%s/%c/%s-%s-%s-%s-%s",
-                          instroot,
-                          yumdb_dir,
-                          dnf_package_get_name(package)[0],
+/**
+ * dnf_db_get_index_for_package:
+ **/
+static gchar *
+dnf_db_get_index_for_package(DnfPackage *package)
+{
+    const gchar *pkgid;
+
+    pkgid = dnf_package_get_pkgid(package);
+    if (pkgid == NULL)
+        return NULL;
+
+    return g_strdup_printf("%s-%s-%s-%s-%s",
                           pkgid,
                           dnf_package_get_name(package),
                           dnf_package_get_version(package),
@@ -141,6 +181,564 @@ dnf_db_get_dir_for_package(DnfDb *db, DnfPackage *package)
                           dnf_package_get_arch(package));
 }
 
+/**
+ * dnf_db_get_dir_for_package:
+ **/
+static gchar *
+dnf_db_get_dir_for_package(DnfDb *db, DnfPackage *package)
+{
+    g_autofree gchar *index = NULL;
+    g_autofree gchar *yumdb_dir = NULL;
+
+    index = dnf_db_get_index_for_package(package);
+    if (index == NULL)
+        return NULL;
+
+    yumdb_dir = dnf_db_get_yumdb_dir(db);
+    return g_strdup_printf("%s/%c/%s",
+                          yumdb_dir,
+                          dnf_package_get_name(package)[0],
+                          index);
+}
+
+/**
+ * dnf_db_read_index_dir:
+ **/
+static GHashTable *
+dnf_db_read_index_dir(const gchar *index_dir, GError **error)
+{
+    const gchar *filename;
+    g_autoptr(GDir) dir = NULL;
+    g_autoptr(GHashTable) values = NULL;
+
+    values = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    if (!g_file_test(index_dir, G_FILE_TEST_IS_DIR))
+        return g_steal_pointer(&values);
+
+    dir = g_dir_open(index_dir, 0, error);
+    if (dir == NULL)
+        return NULL;
+    while ((filename = g_dir_read_name(dir)) != NULL) {
+        gchar *value = NULL;
+        g_autofree gchar *index_file = NULL;
+
+        index_file = g_build_filename(index_dir, filename, NULL);
+        if (!g_file_get_contents(index_file, &value, NULL, error))
+            return NULL;
+        g_hash_table_insert(values, g_strdup(filename), value);
+    }
+    return g_steal_pointer(&values);
+}
+
+/**
+ * dnf_db_store_get_filename:
+ **/
+static gchar *
+dnf_db_store_get_filename(DnfDb *db)
+{
+    g_autofree gchar *yumdb_dir = dnf_db_get_yumdb_dir(db);
+    return g_strdup_printf("%s.store", yumdb_dir);
+}
+
+/**
+ * dnf_db_store_add_record:
+ **/
+static void
+dnf_db_store_add_record(GString *str,
+                        const gchar *op,
+                        const gchar *index,
+                        const gchar *key,
+                        const gchar *value)
+{
+    g_string_append(str, op);
+    if (index != NULL)
+        g_string_append_printf(str, "\t%s", index);
+    if (key != NULL)
+        g_string_append_printf(str, "\t%s", key);
+    if (value != NULL) {
+        g_autofree gchar *escaped = g_strescape(value, NULL);
+        g_string_append_printf(str, "\t%s", escaped);
+    }
+    g_string_append_c(str, '\n');
+}
+
+/**
+ * dnf_db_store_apply_record:
+ **/
+static gboolean
+dnf_db_store_apply_record(GHashTable *store,
+                          GHashTable *cleared,
+                          const gchar *line)
+{
+    GHashTable *values;
+    guint len;
+    g_auto(GStrv) split = g_strsplit(line, "\t", 4);
+
+    len = g_strv_length(split);
+    if (len == 4 && g_strcmp0(split[0], "set") == 0) {
+        values = g_hash_table_lookup(store, split[1]);
+        if (values == NULL) {
+            values = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+            g_hash_table_insert(store, g_strdup(split[1]), values);
+        }
+        g_hash_table_insert(values, g_strdup(split[2]), g_strcompress(split[3]));
+        return TRUE;
+    }
+    if (len == 3 && g_strcmp0(split[0], "del") == 0) {
+        values = g_hash_table_lookup(store, split[1]);
+        if (values != NULL)
+            g_hash_table_remove(values, split[2]);
+        return TRUE;
+    }
+    if (len == 2 && g_strcmp0(split[0], "clr") == 0) {
+        g_hash_table_remove(store, split[1]);
+        g_hash_table_add(cleared, g_strdup(split[1]));
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * dnf_db_store_count_values:
+ **/
+static guint
+dnf_db_store_count_values(GHashTable *store)
+{
+    GHashTableIter iter;
+    gpointer values;
+    guint cnt = 0;
+
+    g_hash_table_iter_init(&iter, store);
+    while (g_hash_table_iter_next(&iter, NULL, &values))
+        cnt += g_hash_table_size(values);
+    return cnt;
+}
+
+/**
+ * dnf_db_store_rewrite:
+ *
+ * Writes the whole store, which also commits anything pending. The
+ * cleared indexes are kept first so a later import does not bring
+ * them back from the yumdb tree.
+ **/
+static gboolean
+dnf_db_store_rewrite(DnfDb *db, GError **error)
+{
+    DnfDbPrivate *priv = GET_PRIVATE(db);
+    GHashTableIter iter;
+    GHashTableIter iter_values;
+    gpointer index;
+    gpointer values;
+    gpointer key;
+    gpointer value;
+    guint records = 1;
+    g_autofree gchar *dirname = NULL;
+    g_autofree gchar *filename = NULL;
+    g_autoptr(GString) str = g_string_new(DNF_DB_STORE_HEADER);
+
+    g_hash_table_iter_init(&iter, priv->store_cleared);
+    while (g_hash_table_iter_next(&iter, &index, NULL)) {
+        dnf_db_store_add_record(str, "clr", index, NULL, NULL);
+        records++;
+    }
+    g_hash_table_iter_init(&iter, priv->store);
+    while (g_hash_table_iter_next(&iter, &index, &values)) {
+        g_hash_table_iter_init(&iter_values, values);
+        while (g_hash_table_iter_next(&iter_values, &key, &value)) {
+            dnf_db_store_add_record(str, "set", index, key, value);
+            records++;
+        }
+    }
+    g_string_append(str, "commit\n");
+
+    filename = dnf_db_store_get_filename(db);
+    dirname = g_path_get_dirname(filename);
+    if (!dnf_db_create_dir(dirname, error))
+        return FALSE;
+    if (!g_file_set_contents(filename, str->str, str->len, error))
+        return FALSE;
+    priv->store_records = records;
+    priv->store_compact = FALSE;
+    g_string_truncate(priv->pending, 0);
+    priv->pending_records = 0;
+    return TRUE;
+}
+
+/**
+ * dnf_db_store_append:
+ **/
+static gboolean
+dnf_db_store_append(DnfDb *db, GError **error)
+{
+    DnfDbPrivate *priv = GET_PRIVATE(db);
+    gboolean exists;
+    int fd;
+    g_autofree gchar *dirname = NULL;
+    g_autofree gchar *filename = NULL;
+    g_autoptr(GString) str = g_string_new(NULL);
+
+    filename = dnf_db_store_get_filename(db);
+    exists = g_file_test(filename, G_FILE_TEST_EXISTS);
+    if (!exists) {
+        dirname = g_path_get_dirname(filename);
+        if (!dnf_db_create_dir(dirname, error))
+            return FALSE;
+        g_string_append(str, DNF_DB_STORE_HEADER);
+    }
+    g_string_append_len(str, priv->pending->str, priv->pending->len);
+    g_string_append(str, "commit\n");
+
+    fd = g_open(filename, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        g_set_error(error,
+                    DNF_ERROR,
+                    DNF_ERROR_FAILED,
+                    "failed to open %s: %s",
+                    filename, strerror(errno));
+        return FALSE;
+    }
+    if (write(fd, str->str, str->len) != (gssize) str->len || fsync(fd) != 0) {
+        g_set_error(error,
+                    DNF_ERROR,
+                    DNF_ERROR_FAILED,
+                    "failed to write %s: %s",
+                    filename, strerror(errno));
+        g_close(fd, NULL);
+        return FALSE;
+    }
+    if (!g_close(fd, error))
+        return FALSE;
+    priv->store_records += priv->pending_records + (exists ? 1 : 2);
+    g_string_truncate(priv->pending, 0);
+    priv->pending_records = 0;
+    return TRUE;
+}
+
+/**
+ * dnf_db_store_merge_values:
+ *
+ * Adds the values the store does not have yet, so anything changed
+ * through the store wins over the copy in the yumdb tree.
+ **/
+static void
+dnf_db_store_merge_values(GHashTable *store, const gchar *index, GHashTable *values)
+{
+    GHashTable *values_store;
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+
+    values_store = g_hash_table_lookup(store, index);
+    if (values_store == NULL) {
+        g_hash_table_insert(store, g_strdup(index), g_hash_table_ref(values));
+        return;
+    }
+    g_hash_table_iter_init(&iter, values);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        if (g_hash_table_contains(values_store, key))
+            continue;
+        g_hash_table_insert(values_store, g_strdup(key), g_strdup(value));
+    }
+}
+
+/**
+ * dnf_db_store_import_tree:
+ *
+ * Merges the yumdb tree into the store per key, keeping the store
+ * values and skipping the packages the store has cleared.
+ **/
+static gboolean
+dnf_db_store_import_tree(DnfDb *db, GError **error)
+{
+    DnfDbPrivate *priv = GET_PRIVATE(db);
+    const gchar *letter;
+    guint cnt = 0;
+    GHashTableIter iter;
+    gpointer index_cleared;
+    g_autoptr(GHashTable) seen = NULL;
+    g_autoptr(GDir) dir = NULL;
+    g_autoptr(GTimer) timer = g_timer_new();
+    g_autofree gchar *yumdb_dir = dnf_db_get_yumdb_dir(db);
+
+    if (!g_file_test(yumdb_dir, G_FILE_TEST_IS_DIR))
+        return TRUE;
+    dir = g_dir_open(yumdb_dir, 0, error);
+    if (dir == NULL)
+        return FALSE;
+    seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    /* the tree is <letter>/<pkgid>-<name>-<version>-<release>-<arch>/<key> */
+    while ((letter = g_dir_read_name(dir)) != NULL) {
+        const gchar *index;
+        g_autofree gchar *letter_dir = NULL;
+        g_autoptr(GDir) dir_letter = NULL;
+
+        letter_dir = g_build_filename(yumdb_dir, letter, NULL);
+        if (!g_file_test(letter_dir, G_FILE_TEST_IS_DIR))
+            continue;
+        dir_letter = g_dir_open(letter_dir, 0, error);
+        if (dir_letter == NULL)
+            return FALSE;
+        while ((index = g_dir_read_name(dir_letter)) != NULL) {
+            g_autofree gchar *index_dir = NULL;
+            g_autoptr(GHashTable) values = NULL;
+
+            index_dir = g_build_filename(letter_dir, index, NULL);
+            if (!g_file_test(index_dir, G_FILE_TEST_IS_DIR))
+                continue;
+            g_hash_table_add(seen, g_strdup(index));
+            if (g_hash_table_contains(priv->store_cleared, index))
+                continue;
+            values = dnf_db_read_index_dir(index_dir, error);
+            if (values == NULL)
+                return FALSE;
+            dnf_db_store_merge_values(priv->store, index, values);
+            cnt++;
+        }
+    }
+
+    /* nothing left in the tree to bring a cleared package back */
+    g_hash_table_iter_init(&iter, priv->store_cleared);
+    while (g_hash_table_iter_next(&iter, &index_cleared, NULL)) {
+        if (!g_hash_table_contains(seen, index_cleared))
+            g_hash_table_iter_remove(&iter);
+    }
+    g_debug("imported %u packages from %s in %.0fms",
+            cnt, yumdb_dir, g_timer_elapsed(timer, NULL) * 1000);
+    return TRUE;
+}
+
+/**
+ * dnf_db_store_load:
+ **/
+static gboolean
+dnf_db_store_load(DnfDb *db, GError **error)
+{
+    DnfDbPrivate *priv = GET_PRIVATE(db);
+    guint i;
+    guint j;
+    guint len;
+    g_auto(GStrv) lines = NULL;
+    g_autofree gchar *data = NULL;
+    g_autofree gchar *filename = NULL;
+    g_autoptr(GPtrArray) uncommitted = NULL;
+
+    if (priv->store != NULL)
+        return TRUE;
+    priv->store = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                        (GDestroyNotify) g_hash_table_unref);
+    g_clear_pointer(&priv->store_cleared, g_hash_table_unref);
+    priv->store_cleared = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                g_free, NULL);
+    priv->store_records = 0;
+    priv->store_compact = FALSE;
+
+    /* the first time the store is used the yumdb tree is imported */
+    filename = dnf_db_store_get_filename(db);
+    if (!g_file_test(filename, G_FILE_TEST_EXISTS)) {
+        if (!dnf_db_store_import_tree(db, error))
+            goto fail;
+        if (!priv->enabled || g_hash_table_size(priv->store) == 0)
+            return TRUE;
+        if (!dnf_db_store_rewrite(db, error))
+            goto fail;
+        return TRUE;
+    }
+
+    if (!g_file_get_contents(filename, &data, NULL, error))
+        goto fail;
+    if (!g_str_has_prefix(data, DNF_DB_STORE_HEADER)) {
+        g_set_error(error,
+                    DNF_ERROR,
+                    DNF_ERROR_FAILED,
+                    "%s is not a package store",
+                    filename);
+        goto fail;
+    }
+
+    /* only apply records followed by a commit; the last element is
+     * either empty or a line that was never completed */
+    lines = g_strsplit(data + strlen(DNF_DB_STORE_HEADER), "\n", -1);
+    len = g_strv_length(lines);
+    uncommitted = g_ptr_array_new();
+    for (i = 0; i + 1 < len; i++) {
+        priv->store_records++;
+        if (g_strcmp0(lines[i], "commit") != 0) {
+            g_ptr_array_add(uncommitted, lines[i]);
+            continue;
+        }
+        for (j = 0; j < uncommitted->len; j++) {
+            const gchar *line = g_ptr_array_index(uncommitted, j);
+            if (!dnf_db_store_apply_record(priv->store,
+                                           priv->store_cleared,
+                                           line))
+                g_debug("ignoring invalid record '%s' in %s", line, filename);
+        }
+        g_ptr_array_set_size(uncommitted, 0);
+    }
+
+    /* appending after a broken tail would hide the next commit */
+    if (uncommitted->len > 0 || (len > 0 && lines[len - 1][0] != '\0')) {
+        g_debug("ignoring %u uncommitted records in %s",
+                uncommitted->len, filename);
+        priv->store_compact = TRUE;
+    }
+    g_debug("loaded %u packages from %s",
+            g_hash_table_size(priv->store), filename);
+    return TRUE;
+fail:
+    g_clear_pointer(&priv->store, g_hash_table_unref);
+    return FALSE;
+}
+
+/**
+ * dnf_db_store_get_index:
+ **/
+static gchar *
+dnf_db_store_get_index(DnfDb *db, DnfPackage *package, GError **error)
+{
+    gchar *index;
+
+    if (!dnf_db_store_load(db, error))
+        return NULL;
+    index = dnf_db_get_index_for_package(package);
+    if (index == NULL) {
+        g_set_error(error,
+                    DNF_ERROR,
+                    DNF_ERROR_FAILED,
+                    "no index for %s as no pkgid",
+                    dnf_package_get_package_id(package));
+        return NULL;
+    }
+    return index;
+}
+
+/**
+ * dnf_db_store_get_string:
+ **/
+static gchar *
+dnf_db_store_get_string(DnfDb *db,
+                        DnfPackage *package,
+                        const gchar *key,
+                        GError **error)
+{
+    DnfDbPrivate *priv = GET_PRIVATE(db);
+    GHashTable *values;
+    const gchar *value = NULL;
+    g_autofree gchar *index = NULL;
+
+    index = dnf_db_store_get_index(db, package, error);
+    if (index == NULL)
+        return NULL;
+    values = g_hash_table_lookup(priv->store, index);
+    if (values != NULL)
+        value = g_hash_table_lookup(values, key);
+    if (value == NULL) {
+        g_set_error(error,
+                    DNF_ERROR,
+                    DNF_ERROR_FAILED,
+                    "%s key not found for %s",
+                    key, index);
+        return NULL;
+    }
+    return g_strdup(value);
+}
+
+/**
+ * dnf_db_store_set_string:
+ **/
+static gboolean
+dnf_db_store_set_string(DnfDb *db,
+                        DnfPackage *package,
+                        const gchar *key,
+                        const gchar *value,
+                        GError **error)
+{
+    DnfDbPrivate *priv = GET_PRIVATE(db);
+    GHashTable *values;
+    g_autofree gchar *index = NULL;
+
+    if (key[0] == '\0' || strpbrk(key, "\t\n/") != NULL) {
+        g_set_error(error,
+                    DNF_ERROR,
+                    DNF_ERROR_FAILED,
+                    "invalid key name '%s'",
+                    key);
+        return FALSE;
+    }
+    index = dnf_db_store_get_index(db, package, error);
+    if (index == NULL)
+        return FALSE;
+    values = g_hash_table_lookup(priv->store, index);
+    if (values == NULL) {
+        values = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+        g_hash_table_insert(priv->store, g_strdup(index), values);
+    }
+    g_hash_table_insert(values, g_strdup(key), g_strdup(value));
+    dnf_db_store_add_record(priv->pending, "set", index, key, value);
+    priv->pending_records++;
+    if (!priv->in_batch)
+        return dnf_db_commit(db, error);
+    return TRUE;
+}
+
+/**
+ * dnf_db_store_remove:
+ **/
+static gboolean
+dnf_db_store_remove(DnfDb *db,
+                    DnfPackage *package,
+                    const gchar *key,
+                    GError **error)
+{
+    DnfDbPrivate *priv = GET_PRIVATE(db);
+    GHashTable *values;
+    g_autofree gchar *index = NULL;
+
+    index = dnf_db_store_get_index(db, package, error);
+    if (index == NULL)
+        return FALSE;
+    values = g_hash_table_lookup(priv->store, index);
+    if (values == NULL || !g_hash_table_remove(values, key)) {
+        g_set_error(error,
+                    DNF_ERROR,
+                    DNF_ERROR_FAILED,
+                    "%s key not found for %s",
+                    key, index);
+        return FALSE;
+    }
+    g_debug("deleting %s from %s", key, index);
+    dnf_db_store_add_record(priv->pending, "del", index, key, NULL);
+    priv->pending_records++;
+    if (!priv->in_batch)
+        return dnf_db_commit(db, error);
+    return TRUE;
+}
+
+/**
+ * dnf_db_store_remove_all:
+ **/
+static gboolean
+dnf_db_store_remove_all(DnfDb *db, DnfPackage *package, GError **error)
+{
+    DnfDbPrivate *priv = GET_PRIVATE(db);
+    g_autofree gchar *index = NULL;
+
+    index = dnf_db_store_get_index(db, package, error);
+    if (index == NULL)
+        return FALSE;
+    if (!g_hash_table_remove(priv->store, index)) {
+        g_debug("Nothing to delete for %s", index);
+        return TRUE;
+    }
+    g_hash_table_add(priv->store_cleared, g_strdup(index));
+    dnf_db_store_add_record(priv->pending, "clr", index, NULL, NULL);
+    priv->pending_records++;
+    if (!priv->in_batch)
+        return dnf_db_commit(db, error);
+    return TRUE;
+}
+
 /**
  * dnf_db_get_string:
  * @db: a #DnfDb instance.
@@ -166,6 +764,9 @@ dnf_db_get_string(DnfDb *db, DnfPackage *package, const gchar *key, GError **err
     g_return_val_if_fail(key != NULL, NULL);
     g_return_val_if_fail(error == NULL || *error == NULL, NULL);
 
+    if (GET_PRIVATE(db)->backend == DNF_DB_BACKEND_STORE)
+        return dnf_db_store_get_string(db, package, key, error);
+
     /* get file contents */
     index_dir = dnf_db_get_dir_for_package(db, package);
     if (index_dir == NULL) {
@@ -228,6 +829,8 @@ dnf_db_set_string(DnfDb *db,
 
     if (!priv->enabled)
         return TRUE;
+    if (priv->backend == DNF_DB_BACKEND_STORE)
+        return dnf_db_store_set_string(db, package, key, value, error);
 
     /* create the index directory */
     index_dir = dnf_db_get_dir_for_package(db, package);
@@ -248,6 +851,107 @@ dnf_db_set_string(DnfDb *db,
     return g_file_set_contents(index_file, value, -1, error);
 }
 
+/**
+ * dnf_db_get_strings:
+ * @db: a #DnfDb instance.
+ * @package: A package to use as a reference
+ * @error: A #GError, or %NULL
+ *
+ * Gets all the values stored for a package.
+ *
+ * Returns: (transfer container) (element-type utf8 utf8): key:value,
+ * which is empty if nothing was stored, or %NULL for error
+ *
+ * Since: 0.8.0
+ **/
+GHashTable *
+dnf_db_get_strings(DnfDb *db, DnfPackage *package, GError **error)
+{
+    DnfDbPrivate *priv = GET_PRIVATE(db);
+    GHashTable *values;
+    GHashTable *values_tmp;
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+    g_autofree gchar *index = NULL;
+    g_autofree gchar *index_dir = NULL;
+
+    g_return_val_if_fail(DNF_IS_DB(db), NULL);
+    g_return_val_if_fail(package != NULL, NULL);
+    g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+    if (priv->backend == DNF_DB_BACKEND_STORE) {
+        index = dnf_db_store_get_index(db, package, error);
+        if (index == NULL)
+            return NULL;
+        values = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+        values_tmp = g_hash_table_lookup(priv->store, index);
+        if (values_tmp == NULL)
+            return values;
+        g_hash_table_iter_init(&iter, values_tmp);
+        while (g_hash_table_iter_next(&iter, &key, &value))
+            g_hash_table_insert(values, g_strdup(key), g_strdup(value));
+        return values;
+    }
+
+    index_dir = dnf_db_get_dir_for_package(db, package);
+    if (index_dir == NULL) {
+        g_set_error(error,
+                    DNF_ERROR,
+                    DNF_ERROR_FAILED,
+                    "cannot read index for %s",
+                    dnf_package_get_package_id(package));
+        return NULL;
+    }
+    return dnf_db_read_index_dir(index_dir, error);
+}
+
+/**
+ * dnf_db_set_strings:
+ * @db: a #DnfDb instance.
+ * @package: A package to use as a reference
+ * @values: (element-type utf8 utf8): key:value to save
+ * @error: A #GError, or %NULL
+ *
+ * Writes several values for a package. With %DNF_DB_BACKEND_STORE they
+ * are committed together unless a batch was started with dnf_db_begin().
+ *
+ * Returns: %TRUE for success, %FALSE otherwise
+ *
+ * Since: 0.8.0
+ **/
+gboolean
+dnf_db_set_strings(DnfDb *db,
+                   DnfPackage *package,
+                   GHashTable *values,
+                   GError **error)
+{
+    DnfDbPrivate *priv = GET_PRIVATE(db);
+    GHashTableIter iter;
+    gboolean in_batch;
+    gpointer key;
+    gpointer value;
+
+    g_return_val_if_fail(DNF_IS_DB(db), FALSE);
+    g_return_val_if_fail(package != NULL, FALSE);
+    g_return_val_if_fail(values != NULL, FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    in_batch = priv->in_batch;
+    priv->in_batch = TRUE;
+    g_hash_table_iter_init(&iter, values);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        if (!dnf_db_set_string(db, package, key, value, error)) {
+            if (!in_batch)
+                dnf_db_rollback(db);
+            return FALSE;
+        }
+    }
+    if (in_batch)
+        return TRUE;
+    return dnf_db_commit(db, error);
+}
+
 /**
  * dnf_db_remove:
  * @db: a #DnfDb instance.
@@ -279,6 +983,8 @@ dnf_db_remove(DnfDb *db,
 
     if (!priv->enabled)
         return TRUE;
+    if (priv->backend == DNF_DB_BACKEND_STORE)
+        return dnf_db_store_remove(db, package, key, error);
 
     /* create the index directory */
     index_dir = dnf_db_get_dir_for_package(db, package);
@@ -325,6 +1031,8 @@ dnf_db_remove_all(DnfDb *db, DnfPackage *package, GError **error)
 
     if (!priv->enabled)
         return TRUE;
+    if (priv->backend == DNF_DB_BACKEND_STORE)
+        return dnf_db_store_remove_all(db, package, error);
 
     /* get the folder */
     index_dir = dnf_db_get_dir_for_package(db, package);
@@ -457,3 +1165,172 @@ dnf_db_set_enabled(DnfDb *db, gboolean enabled)
     DnfDbPrivate *priv = GET_PRIVATE(db);
     priv->enabled = enabled;
 }
+
+/**
+ * dnf_db_get_backend:
+ * @db: a #DnfDb instance.
+ *
+ * Gets where the package details are stored.
+ *
+ * Returns: a #DnfDbBackend, e.g. %DNF_DB_BACKEND_YUMDB
+ *
+ * Since: 0.8.0
+ **/
+DnfDbBackend
+dnf_db_get_backend(DnfDb *db)
+{
+    DnfDbPrivate *priv = GET_PRIVATE(db);
+    return priv->backend;
+}
+
+/**
+ * dnf_db_set_backend:
+ * @db: a #DnfDb instance.
+ * @backend: a #DnfDbBackend, e.g. %DNF_DB_BACKEND_STORE
+ *
+ * Sets where the package details are stored. The yumdb tree is read by
+ * other tools, so only use %DNF_DB_BACKEND_STORE if nothing else needs
+ * the files to be kept up to date.
+ *
+ * Since: 0.8.0
+ **/
+void
+dnf_db_set_backend(DnfDb *db, DnfDbBackend backend)
+{
+    DnfDbPrivate *priv = GET_PRIVATE(db);
+    g_return_if_fail(backend < DNF_DB_BACKEND_LAST);
+    g_return_if_fail(priv->pending_records == 0);
+    priv->backend = backend;
+}
+
+/**
+ * dnf_db_begin:
+ * @db: a #DnfDb instance.
+ *
+ * Starts a batch of changes that are only written when dnf_db_commit()
+ * is called. Values that were set in the batch can be read back before
+ * that. This does nothing for %DNF_DB_BACKEND_YUMDB, which writes each
+ * value as it is set.
+ *
+ * Since: 0.8.0
+ **/
+void
+dnf_db_begin(DnfDb *db)
+{
+    DnfDbPrivate *priv = GET_PRIVATE(db);
+    g_return_if_fail(DNF_IS_DB(db));
+    if (priv->in_batch)
+        g_warning("batch already started, changes will be merged");
+    priv->in_batch = TRUE;
+}
+
+/**
+ * dnf_db_commit:
+ * @db: a #DnfDb instance.
+ * @error: A #GError, or %NULL
+ *
+ * Writes all the changes made since dnf_db_begin() as one commit.
+ *
+ * Returns: %TRUE for success, %FALSE otherwise
+ *
+ * Since: 0.8.0
+ **/
+gboolean
+dnf_db_commit(DnfDb *db, GError **error)
+{
+    DnfDbPrivate *priv = GET_PRIVATE(db);
+    gboolean ret;
+    guint records;
+    g_autoptr(GTimer) timer = NULL;
+
+    g_return_val_if_fail(DNF_IS_DB(db), FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    priv->in_batch = FALSE;
+    if (priv->pending_records == 0)
+        return TRUE;
+
+    /* rewrite the file when it is mostly overwritten values */
+    timer = g_timer_new();
+    records = priv->pending_records;
+    if (priv->store_compact ||
+        (priv->store_records > DNF_DB_STORE_MIN_RECORDS &&
+         priv->store_records > 4 * (dnf_db_store_count_values(priv->store) +
+                                    g_hash_table_size(priv->store_cleared)))) {
+        g_debug("compacting store of %u records", priv->store_records);
+        ret = dnf_db_store_rewrite(db, error);
+    } else {
+        ret = dnf_db_store_append(db, error);
+    }
+    if (!ret) {
+        dnf_db_rollback(db);
+        return FALSE;
+    }
+    g_debug("committed %u records in %.0fms",
+            records, g_timer_elapsed(timer, NULL) * 1000);
+    return TRUE;
+}
+
+/**
+ * dnf_db_rollback:
+ * @db: a #DnfDb instance.
+ *
+ * Drops all the changes made since dnf_db_begin(). This cannot undo
+ * values already written with %DNF_DB_BACKEND_YUMDB.
+ *
+ * Since: 0.8.0
+ **/
+void
+dnf_db_rollback(DnfDb *db)
+{
+    DnfDbPrivate *priv = GET_PRIVATE(db);
+    g_return_if_fail(DNF_IS_DB(db));
+
+    priv->in_batch = FALSE;
+    if (priv->pending_records == 0)
+        return;
+    g_debug("dropping %u uncommitted records", priv->pending_records);
+    g_string_truncate(priv->pending, 0);
+    priv->pending_records = 0;
+
+    /* read back what was committed */
+    g_clear_pointer(&priv->store, g_hash_table_unref);
+}
+
+/**
+ * dnf_db_import_yumdb:
+ * @db: a #DnfDb instance.
+ * @error: A #GError, or %NULL
+ *
+ * Copies the yumdb tree into the store used by %DNF_DB_BACKEND_STORE.
+ * This is done automatically when the store does not exist yet, and
+ * can be used again to pick up the changes made by other tools. The
+ * tree is merged per key: values already in the store are kept, and
+ * packages removed through the store are not brought back.
+ *
+ * Returns: %TRUE for success, %FALSE otherwise
+ *
+ * Since: 0.8.0
+ **/
+gboolean
+dnf_db_import_yumdb(DnfDb *db, GError **error)
+{
+    DnfDbPrivate *priv = GET_PRIVATE(db);
+    g_autofree gchar *filename = NULL;
+
+    g_return_val_if_fail(DNF_IS_DB(db), FALSE);
+    g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+    /* loading imports it the first time */
+    filename = dnf_db_store_get_filename(db);
+    if (priv->store == NULL && !g_file_test(filename, G_FILE_TEST_EXISTS))
+        return dnf_db_store_load(db, error);
+
+    if (!dnf_db_store_load(db, error))
+        return FALSE;
+    if (!dnf_db_store_import_tree(db, error))
+        return FALSE;
+    if (!priv->enabled)
+        return TRUE;
+    return dnf_db_store_rewrite(db, error);
+}
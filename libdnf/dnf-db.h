@@ -29,6 +29,20 @@
 
 G_BEGIN_DECLS
 
+/**
+ * DnfDbBackend:
+ * @DNF_DB_BACKEND_YUMDB:                     One file per key, compatible with yum
+ * @DNF_DB_BACKEND_STORE:                     A single append-only indexed file
+ *
+ * Where the package details are stored.
+ **/
+typedef enum {
+        DNF_DB_BACKEND_YUMDB,
+        DNF_DB_BACKEND_STORE,
+        /*< private >*/
+        DNF_DB_BACKEND_LAST
+} DnfDbBackend;
+
 #define DNF_TYPE_DB (dnf_db_get_type ())
 G_DECLARE_DERIVABLE_TYPE (DnfDb, dnf_db, DNF, DB, GObject)
 
@@ -50,12 +64,18 @@ DnfDb           *dnf_db_new                     (DnfContext     *context);
 
 void             dnf_db_set_enabled             (DnfDb          *db,
                                                  gboolean        enabled);
+DnfDbBackend     dnf_db_get_backend             (DnfDb          *db);
+void             dnf_db_set_backend             (DnfDb          *db,
+                                                 DnfDbBackend    backend);
 
 /* getters */
 gchar           *dnf_db_get_string              (DnfDb          *db,
                                                  DnfPackage *      package,
                                                  const gchar    *key,
                                                  GError         **error);
+GHashTable      *dnf_db_get_strings             (DnfDb          *db,
+                                                 DnfPackage *      package,
+                                                 GError         **error);
 
 /* setters */
 gboolean         dnf_db_set_string              (DnfDb          *db,
@@ -63,6 +83,10 @@ gboolean         dnf_db_set_string              (DnfDb          *db,
                                                  const gchar    *key,
                                                  const gchar    *value,
                                                  GError         **error);
+gboolean         dnf_db_set_strings             (DnfDb          *db,
+                                                 DnfPackage *      package,
+                                                 GHashTable     *values,
+                                                 GError         **error);
 
 /* object methods */
 gboolean         dnf_db_remove                  (DnfDb          *db,
@@ -76,6 +100,12 @@ void             dnf_db_ensure_origin_pkg       (DnfDb          *db,
                                                  DnfPackage *      pkg);
 void             dnf_db_ensure_origin_pkglist   (DnfDb          *db,
                                                  GPtrArray *  pkglist);
+void             dnf_db_begin                   (DnfDb          *db);
+gboolean         dnf_db_commit                  (DnfDb          *db,
+                                                 GError         **error);
+void             dnf_db_rollback                (DnfDb          *db);
+gboolean         dnf_db_import_yumdb            (DnfDb          *db,
+                                                 GError         **error);
 
 G_END_DECLS
 
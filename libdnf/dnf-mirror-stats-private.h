@@ -0,0 +1,51 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef __DNF_MIRROR_STATS_PRIVATE_H
+#define __DNF_MIRROR_STATS_PRIVATE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _DnfMirrorStats DnfMirrorStats;
+
+DnfMirrorStats  *dnf_mirror_stats_new                   (const gchar    *filename);
+void             dnf_mirror_stats_free                  (DnfMirrorStats *stats);
+gboolean         dnf_mirror_stats_save                  (DnfMirrorStats *stats,
+                                                         GError        **error);
+void             dnf_mirror_stats_set_mirrors           (DnfMirrorStats *stats,
+                                                         const gchar * const *urls);
+void             dnf_mirror_stats_add_transfer          (DnfMirrorStats *stats,
+                                                         const gchar    *url,
+                                                         guint64         bytes,
+                                                         gdouble         seconds,
+                                                         gdouble         latency);
+void             dnf_mirror_stats_add_failure           (DnfMirrorStats *stats,
+                                                         const gchar    *url);
+gchar          **dnf_mirror_stats_sort_urls             (DnfMirrorStats *stats,
+                                                         const gchar * const *baseurls);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(DnfMirrorStats, dnf_mirror_stats_free)
+
+G_END_DECLS
+
+#endif /* __DNF_MIRROR_STATS_PRIVATE_H */
@@ -0,0 +1,467 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/**
+ * SECTION:dnf-mirror-stats
+ * @short_description: Remembers how well the mirrors of a repo performed
+ * @include: libdnf.h
+ * @stability: Unstable
+ *
+ * librepo tries mirrors in the order they are listed, which is the order
+ * the mirrorlist server chose and knows nothing about how the mirror
+ * behaves from where we are.
+ *
+ * This keeps the throughput, the latency and the number of failures
+ * seen for each mirror in a small file in the repo cache directory, and
+ * uses them to put the mirrors that did best first. Samples lose half
+ * their weight every few days, so a mirror that was slow or broken once
+ * is tried again eventually.
+ *
+ * A #DnfMirrorStats is not thread safe; each repo has its own.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dnf-mirror-stats-private.h"
+
+/* samples lose half their weight in this many seconds */
+#define DNF_MIRROR_STATS_HALF_LIFE      (3 * 24 * 60 * 60)
+
+/* the transfer size mirrors are compared for */
+#define DNF_MIRROR_STATS_TYPICAL_SIZE   (1024.0 * 1024.0)
+
+/* below this, what we know about a mirror is too old to matter */
+#define DNF_MIRROR_STATS_MIN_WEIGHT     0.1
+
+typedef struct {
+    gint64       timestamp;             /* seconds, wall clock */
+    gdouble      weight;                /* decayed number of transfers */
+    gdouble      throughput;            /* bytes per second */
+    gdouble      latency;               /* seconds to the first byte */
+    gdouble      failures;              /* decayed number of failures */
+    gint         position;              /* in the last mirror list, or -1 */
+} DnfMirrorEntry;
+
+struct _DnfMirrorStats {
+    gchar       *filename;
+    GHashTable  *entries;               /* url:DnfMirrorEntry */
+};
+
+typedef struct {
+    const gchar *url;
+    guint        idx;
+    gint         rank;
+    gdouble      cost;
+} DnfMirrorCandidate;
+
+/**
+ * dnf_mirror_stats_decay:
+ *
+ * Returns how much of the weight of a sample @age seconds old is left,
+ * halving every half life and linear in between.
+ **/
+static gdouble
+dnf_mirror_stats_decay(gint64 age)
+{
+    gdouble factor = 1.0;
+    gint64 halvings;
+    gdouble frac;
+
+    if (age <= 0)
+        return 1.0;
+    halvings = age / DNF_MIRROR_STATS_HALF_LIFE;
+    if (halvings >= 32)
+        return 0.0;
+    for (gint64 i = 0; i < halvings; i++)
+        factor *= 0.5;
+    frac = (gdouble) (age % DNF_MIRROR_STATS_HALF_LIFE) / DNF_MIRROR_STATS_HALF_LIFE;
+    return factor * (1.0 - 0.5 * frac);
+}
+
+/**
+ * dnf_mirror_entry_age:
+ *
+ * Decays the entry to @now.
+ **/
+static void
+dnf_mirror_entry_age(DnfMirrorEntry *entry, gint64 now)
+{
+    gdouble decay = dnf_mirror_stats_decay(now - entry->timestamp);
+    entry->weight *= decay;
+    entry->failures *= decay;
+    entry->timestamp = now;
+}
+
+/**
+ * dnf_mirror_stats_lookup:
+ *
+ * Finds the entry of the mirror @url is on, or creates one for @url.
+ **/
+static DnfMirrorEntry *
+dnf_mirror_stats_lookup(DnfMirrorStats *stats, const gchar *url, gboolean create)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    DnfMirrorEntry *entry;
+    gsize best_len = 0;
+
+    entry = g_hash_table_lookup(stats->entries, url);
+    if (entry != NULL)
+        return entry;
+
+    /* librepo reports failures with the URL of the file */
+    g_hash_table_iter_init(&iter, stats->entries);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        gsize len = strlen(key);
+        if (len > best_len && g_str_has_prefix(url, key)) {
+            entry = value;
+            best_len = len;
+        }
+    }
+    if (entry != NULL || !create)
+        return entry;
+
+    entry = g_slice_new0(DnfMirrorEntry);
+    entry->timestamp = g_get_real_time() / G_USEC_PER_SEC;
+    entry->position = -1;
+    g_hash_table_insert(stats->entries, g_strdup(url), entry);
+    return entry;
+}
+
+/**
+ * dnf_mirror_entry_free:
+ **/
+static void
+dnf_mirror_entry_free(DnfMirrorEntry *entry)
+{
+    g_slice_free(DnfMirrorEntry, entry);
+}
+
+/**
+ * dnf_mirror_stats_new:
+ * @filename: the file the statistics are kept in
+ *
+ * Loads the mirror statistics from @filename, which does not need to
+ * exist yet.
+ *
+ * Returns: a new #DnfMirrorStats
+ *
+ * Since: 0.8.0
+ **/
+DnfMirrorStats *
+dnf_mirror_stats_new(const gchar *filename)
+{
+    DnfMirrorStats *stats;
+    guint i;
+    g_autofree gchar *data = NULL;
+    g_auto(GStrv) lines = NULL;
+
+    stats = g_slice_new0(DnfMirrorStats);
+    stats->filename = g_strdup(filename);
+    stats->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                           (GDestroyNotify) dnf_mirror_entry_free);
+    if (!g_file_get_contents(filename, &data, NULL, NULL))
+        return stats;
+
+    lines = g_strsplit(data, "\n", -1);
+    for (i = 0; lines[i] != NULL; i++) {
+        DnfMirrorEntry *entry;
+        g_auto(GStrv) split = NULL;
+
+        if (lines[i][0] == '\0')
+            continue;
+        split = g_strsplit(lines[i], "\t", -1);
+        if (g_strv_length(split) != 7)
+            continue;
+        entry = g_slice_new0(DnfMirrorEntry);
+        entry->timestamp = g_ascii_strtoll(split[1], NULL, 10);
+        entry->weight = g_ascii_strtod(split[2], NULL);
+        entry->throughput = g_ascii_strtod(split[3], NULL);
+        entry->latency = g_ascii_strtod(split[4], NULL);
+        entry->failures = g_ascii_strtod(split[5], NULL);
+        entry->position = atoi(split[6]);
+        g_hash_table_insert(stats->entries, g_strdup(split[0]), entry);
+    }
+    return stats;
+}
+
+/**
+ * dnf_mirror_stats_free:
+ * @stats: a #DnfMirrorStats
+ *
+ * Frees the statistics without saving them.
+ *
+ * Since: 0.8.0
+ **/
+void
+dnf_mirror_stats_free(DnfMirrorStats *stats)
+{
+    g_free(stats->filename);
+    g_hash_table_unref(stats->entries);
+    g_slice_free(DnfMirrorStats, stats);
+}
+
+/**
+ * dnf_mirror_stats_save:
+ * @stats: a #DnfMirrorStats
+ * @error: a #GError or %NULL
+ *
+ * Writes the statistics back, dropping the mirrors that are no longer
+ * listed and that nothing useful is known about.
+ *
+ * Returns: %TRUE for success
+ *
+ * Since: 0.8.0
+ **/
+gboolean
+dnf_mirror_stats_save(DnfMirrorStats *stats, GError **error)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+    g_autoptr(GString) str = g_string_new(NULL);
+
+    g_hash_table_iter_init(&iter, stats->entries);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        DnfMirrorEntry *entry = value;
+        gchar buf[4][G_ASCII_DTOSTR_BUF_SIZE];
+
+        dnf_mirror_entry_age(entry, now);
+        if (entry->position < 0 &&
+            entry->weight < DNF_MIRROR_STATS_MIN_WEIGHT &&
+            entry->failures < DNF_MIRROR_STATS_MIN_WEIGHT) {
+            g_hash_table_iter_remove(&iter);
+            continue;
+        }
+        g_string_append_printf(str, "%s\t%" G_GINT64_FORMAT "\t%s\t%s\t%s\t%s\t%i\n",
+                               (const gchar *) key,
+                               entry->timestamp,
+                               g_ascii_dtostr(buf[0], sizeof(buf[0]), entry->weight),
+                               g_ascii_dtostr(buf[1], sizeof(buf[1]), entry->throughput),
+                               g_ascii_dtostr(buf[2], sizeof(buf[2]), entry->latency),
+                               g_ascii_dtostr(buf[3], sizeof(buf[3]), entry->failures),
+                               entry->position);
+    }
+    return g_file_set_contents(stats->filename, str->str, str->len, error);
+}
+
+/**
+ * dnf_mirror_stats_set_mirrors:
+ * @stats: a #DnfMirrorStats
+ * @urls: the mirrors the repo currently has
+ *
+ * Records the current list of mirrors, so that mirrors which have been
+ * removed from it are never tried first again.
+ *
+ * Since: 0.8.0
+ **/
+void
+dnf_mirror_stats_set_mirrors(DnfMirrorStats *stats, const gchar * const *urls)
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    g_hash_table_iter_init(&iter, stats->entries);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+        ((DnfMirrorEntry *) value)->position = -1;
+    for (guint i = 0; urls != NULL && urls[i] != NULL; i++) {
+        DnfMirrorEntry *entry = g_hash_table_lookup(stats->entries, urls[i]);
+        if (entry == NULL) {
+            entry = g_slice_new0(DnfMirrorEntry);
+            entry->timestamp = g_get_real_time() / G_USEC_PER_SEC;
+            g_hash_table_insert(stats->entries, g_strdup(urls[i]), entry);
+        }
+        if (entry->position < 0)
+            entry->position = i;
+    }
+}
+
+/**
+ * dnf_mirror_stats_add_transfer:
+ * @stats: a #DnfMirrorStats
+ * @url: the mirror the file was downloaded from
+ * @bytes: the size of the file
+ * @seconds: how long the transfer took
+ * @latency: how long it took for the first data to arrive
+ *
+ * Records a successful transfer, averaged with the earlier ones by how
+ * much weight they have left.
+ *
+ * Since: 0.8.0
+ **/
+void
+dnf_mirror_stats_add_transfer(DnfMirrorStats *stats,
+                              const gchar *url,
+                              guint64 bytes,
+                              gdouble seconds,
+                              gdouble latency)
+{
+    DnfMirrorEntry *entry;
+    gdouble throughput;
+
+    /* too small to say anything about the mirror */
+    if (bytes == 0 || seconds <= 0)
+        return;
+
+    entry = dnf_mirror_stats_lookup(stats, url, TRUE);
+    dnf_mirror_entry_age(entry, g_get_real_time() / G_USEC_PER_SEC);
+    throughput = bytes / seconds;
+    entry->throughput = (entry->throughput * entry->weight + throughput) /
+                        (entry->weight + 1);
+    entry->latency = (entry->latency * entry->weight + latency) /
+                     (entry->weight + 1);
+    entry->weight += 1;
+}
+
+/**
+ * dnf_mirror_stats_add_failure:
+ * @stats: a #DnfMirrorStats
+ * @url: the mirror, or the URL of the file that failed to download
+ *
+ * Records that a transfer from a mirror failed.
+ *
+ * Since: 0.8.0
+ **/
+void
+dnf_mirror_stats_add_failure(DnfMirrorStats *stats, const gchar *url)
+{
+    DnfMirrorEntry *entry;
+
+    /* only count failures against mirrors we know about */
+    entry = dnf_mirror_stats_lookup(stats, url, FALSE);
+    if (entry == NULL)
+        return;
+    dnf_mirror_entry_age(entry, g_get_real_time() / G_USEC_PER_SEC);
+    entry->failures += 1;
+}
+
+/**
+ * dnf_mirror_candidate_cmp:
+ **/
+static gint
+dnf_mirror_candidate_cmp(gconstpointer a, gconstpointer b)
+{
+    const DnfMirrorCandidate *ca = a;
+    const DnfMirrorCandidate *cb = b;
+
+    if (ca->rank != cb->rank)
+        return ca->rank - cb->rank;
+    if (ca->cost < cb->cost)
+        return -1;
+    if (ca->cost > cb->cost)
+        return 1;
+    return (gint) ca->idx - (gint) cb->idx;
+}
+
+/**
+ * dnf_mirror_stats_position_cmp:
+ **/
+static gint
+dnf_mirror_stats_position_cmp(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    DnfMirrorStats *stats = user_data;
+    DnfMirrorEntry *ea = g_hash_table_lookup(stats->entries, *(const gchar **) a);
+    DnfMirrorEntry *eb = g_hash_table_lookup(stats->entries, *(const gchar **) b);
+    return ea->position - eb->position;
+}
+
+/**
+ * dnf_mirror_stats_sort_urls:
+ * @stats: a #DnfMirrorStats
+ * @baseurls: the configured base URLs, or %NULL
+ *
+ * Orders @baseurls and the listed mirrors by how they performed. The
+ * mirrors with recent transfers come first, fastest first for a typical
+ * package and with each failure counting as one more try. Then the
+ * mirrors nothing is known about, in the order they were configured or
+ * listed, and last the ones that only ever failed.
+ *
+ * Returns: (transfer full): the ordered URLs, or %NULL if nothing is
+ * known that would change the order
+ *
+ * Since: 0.8.0
+ **/
+gchar **
+dnf_mirror_stats_sort_urls(DnfMirrorStats *stats, const gchar * const *baseurls)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    gboolean useful = FALSE;
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+    guint i;
+    gchar **urls;
+    g_autoptr(GArray) candidates = g_array_new(FALSE, FALSE, sizeof(DnfMirrorCandidate));
+    g_autoptr(GHashTable) seen = g_hash_table_new(g_str_hash, g_str_equal);
+    g_autoptr(GPtrArray) listed = g_ptr_array_new();
+
+    /* configured first, then listed, with no duplicates */
+    for (i = 0; baseurls != NULL && baseurls[i] != NULL; i++) {
+        DnfMirrorCandidate c = { baseurls[i], candidates->len, 1, 0 };
+        if (g_hash_table_add(seen, (gpointer) baseurls[i]))
+            g_array_append_val(candidates, c);
+    }
+    g_hash_table_iter_init(&iter, stats->entries);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        if (((DnfMirrorEntry *) value)->position >= 0)
+            g_ptr_array_add(listed, key);
+    }
+    g_ptr_array_sort_with_data(listed, dnf_mirror_stats_position_cmp, stats);
+    for (i = 0; i < listed->len; i++) {
+        const gchar *url = g_ptr_array_index(listed, i);
+        DnfMirrorCandidate c = { url, candidates->len, 1, 0 };
+        if (g_hash_table_add(seen, (gpointer) url))
+            g_array_append_val(candidates, c);
+    }
+
+    /* rank each one by what is left of its samples */
+    for (i = 0; i < candidates->len; i++) {
+        DnfMirrorCandidate *c = &g_array_index(candidates, DnfMirrorCandidate, i);
+        DnfMirrorEntry *entry = g_hash_table_lookup(stats->entries, c->url);
+        gdouble decay;
+        gdouble failures;
+
+        if (entry == NULL)
+            continue;
+        decay = dnf_mirror_stats_decay(now - entry->timestamp);
+        failures = entry->failures * decay;
+        if (entry->weight * decay >= DNF_MIRROR_STATS_MIN_WEIGHT &&
+            entry->throughput > 0) {
+            c->rank = 0;
+            c->cost = (entry->latency +
+                       DNF_MIRROR_STATS_TYPICAL_SIZE / entry->throughput) *
+                      (1 + failures);
+            useful = TRUE;
+        } else if (failures >= DNF_MIRROR_STATS_MIN_WEIGHT) {
+            c->rank = 2;
+            c->cost = failures;
+            useful = TRUE;
+        }
+    }
+    if (!useful)
+        return NULL;
+
+    g_array_sort(candidates, dnf_mirror_candidate_cmp);
+    urls = g_new0(gchar *, candidates->len + 1);
+    for (i = 0; i < candidates->len; i++)
+        urls[i] = g_strdup(g_array_index(candidates, DnfMirrorCandidate, i).url);
+    return urls;
+}
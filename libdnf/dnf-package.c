@@ -41,6 +41,7 @@
 #include "dnf-package.h"
 #include "dnf-types.h"
 #include "dnf-utils.h"
+#include "dnf-verified-cache-private.h"
 #include "dnf-reldep.h"
 #include "dnf-reldep-list.h"
 #include "hy-util.h"
@@ -607,48 +608,43 @@ dnf_repo_checksum_hy_to_lr(GChecksumType checksum)
 }
 
 /**
- * dnf_package_check_filename:
- * @pkg: a #DnfPackage *instance.
- * @valid: Set to %TRUE if the package is valid.
- * @error: a #GError or %NULL..
+ * dnf_package_check_file:
  *
- * Checks the package is already downloaded and valid.
- *
- * Returns: %TRUE if the package was checked successfully
- *
- * Since: 0.1.0
+ * Does the work of dnf_package_check_filename() without touching the
+ * package or the pool, so it is safe to call from any thread.
  **/
-gboolean
-dnf_package_check_filename(DnfPackage *pkg, gboolean *valid, GError **error)
+static gboolean
+dnf_package_check_file(const gchar *path,
+                       LrChecksumType checksum_type_lr,
+                       const gchar *checksum_valid,
+                       gboolean *valid,
+                       GError **error)
 {
-    LrChecksumType checksum_type_lr;
-    char *checksum_valid = NULL;
-    const gchar *path;
-    const unsigned char *checksum;
-    gboolean ret = TRUE;
-    int checksum_type_hy;
+    gboolean ret;
     int fd;
 
     /* check if the file does not exist */
-    path = dnf_package_get_filename(pkg);
     g_debug("checking if %s already exists...", path);
     if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
         *valid = FALSE;
-        goto out;
+        return TRUE;
+    }
+
+    /* verified before and not changed since */
+    if (dnf_verified_cache_check_checksum(path, checksum_type_lr, checksum_valid)) {
+        g_debug("%s is already verified", path);
+        *valid = TRUE;
+        return TRUE;
     }
 
     /* check the checksum */
-    checksum = dnf_package_get_chksum(pkg, &checksum_type_hy);
-    checksum_valid = hy_chksum_str(checksum, checksum_type_hy);
-    checksum_type_lr = dnf_repo_checksum_hy_to_lr(checksum_type_hy);
     fd = g_open(path, O_RDONLY, 0);
     if (fd < 0) {
-        ret = FALSE;
         g_set_error(error,
                  DNF_ERROR,
                  DNF_ERROR_INTERNAL_ERROR,
                  "Failed to open %s", path);
-        goto out;
+        return FALSE;
     }
     ret = lr_checksum_fd_cmp(checksum_type_lr,
                  fd,
@@ -658,13 +654,179 @@ dnf_package_check_filename(DnfPackage *pkg, gboolean *valid, GError **error)
                  error);
     if (!ret) {
         g_close(fd, NULL);
-        goto out;
+        return FALSE;
     }
-    ret = g_close(fd, error);
-    if (!ret)
-        goto out;
-out:
-    g_free(checksum_valid);
+    if (!g_close(fd, error))
+        return FALSE;
+    if (*valid)
+        dnf_verified_cache_add_checksum(path, checksum_type_lr, checksum_valid);
+    return TRUE;
+}
+
+/**
+ * dnf_package_check_filename:
+ * @pkg: a #DnfPackage *instance.
+ * @valid: Set to %TRUE if the package is valid.
+ * @error: a #GError or %NULL..
+ *
+ * Checks the package is already downloaded and valid.
+ *
+ * Returns: %TRUE if the package was checked successfully
+ *
+ * Since: 0.1.0
+ **/
+gboolean
+dnf_package_check_filename(DnfPackage *pkg, gboolean *valid, GError **error)
+{
+    const unsigned char *checksum;
+    int checksum_type_hy;
+    g_autofree gchar *checksum_valid = NULL;
+
+    checksum = dnf_package_get_chksum(pkg, &checksum_type_hy);
+    checksum_valid = hy_chksum_str(checksum, checksum_type_hy);
+    return dnf_package_check_file(dnf_package_get_filename(pkg),
+                                  dnf_repo_checksum_hy_to_lr(checksum_type_hy),
+                                  checksum_valid,
+                                  valid,
+                                  error);
+}
+
+typedef struct {
+    gchar               *path;
+    LrChecksumType       checksum_type;
+    gchar               *checksum;
+    guint64              size;
+    gboolean             valid;
+    GError              *error;
+} DnfPackageCheckJob;
+
+typedef struct {
+    GMutex               mutex;
+    GCond                cond;
+    guint                done;
+    guint64              bytes;
+} DnfPackageCheckHelper;
+
+/**
+ * dnf_package_check_job_cb:
+ **/
+static void
+dnf_package_check_job_cb(gpointer data, gpointer user_data)
+{
+    DnfPackageCheckJob *job = data;
+    DnfPackageCheckHelper *helper = user_data;
+
+    dnf_package_check_file(job->path, job->checksum_type, job->checksum,
+                           &job->valid, &job->error);
+
+    g_mutex_lock(&helper->mutex);
+    helper->done++;
+    helper->bytes += job->size;
+    g_cond_signal(&helper->cond);
+    g_mutex_unlock(&helper->mutex);
+}
+
+/**
+ * dnf_package_array_check_filenames:
+ * @packages: an array of packages.
+ * @invalid: an array the packages that are missing or fail their checksum
+ *           are added to.
+ * @state: (allow-none): the #DnfState, or %NULL.
+ * @error: a #GError or %NULL..
+ *
+ * Checks several packages are already downloaded and valid, like
+ * dnf_package_check_filename(). The files are checksummed on a pool of
+ * threads and the checksum throughput is reported as the speed of
+ * @state, if set. A reference to each package that needs downloading is added
+ * to @invalid, in the same order as in @packages.
+ *
+ * Returns: %TRUE if the packages were checked successfully
+ *
+ * Since: 0.8.0
+ **/
+gboolean
+dnf_package_array_check_filenames(GPtrArray *packages,
+                                  GPtrArray *invalid,
+                                  DnfState *state,
+                                  GError **error)
+{
+    DnfPackageCheckHelper helper = { 0, };
+    DnfPackageCheckJob *jobs;
+    GThreadPool *pool;
+    gboolean ret = TRUE;
+    guint done = 0;
+    guint i;
+    g_autoptr(GTimer) timer = NULL;
+
+    if (packages->len == 0)
+        return TRUE;
+
+    /* the pool is not thread safe, so get everything from it up front */
+    jobs = g_new0(DnfPackageCheckJob, packages->len);
+    for (i = 0; i < packages->len; i++) {
+        DnfPackage *pkg = g_ptr_array_index(packages, i);
+        const unsigned char *checksum;
+        int checksum_type_hy;
+
+        checksum = dnf_package_get_chksum(pkg, &checksum_type_hy);
+        jobs[i].path = g_strdup(dnf_package_get_filename(pkg));
+        jobs[i].checksum = hy_chksum_str(checksum, checksum_type_hy);
+        jobs[i].checksum_type = dnf_repo_checksum_hy_to_lr(checksum_type_hy);
+        jobs[i].size = dnf_package_get_downloadsize(pkg);
+    }
+
+    /* hashing is CPU bound, so use a thread per core */
+    g_mutex_init(&helper.mutex);
+    g_cond_init(&helper.cond);
+    pool = g_thread_pool_new(dnf_package_check_job_cb, &helper,
+                             (gint) MIN(g_get_num_processors(), packages->len),
+                             TRUE, NULL);
+    for (i = 0; i < packages->len; i++)
+        g_thread_pool_push(pool, &jobs[i], NULL);
+
+    /* report progress from this thread as DnfState is not thread safe */
+    timer = g_timer_new();
+    if (state != NULL)
+        dnf_state_set_number_steps(state, packages->len);
+    while (ret && done < packages->len) {
+        guint64 bytes;
+        guint done_now;
+
+        g_mutex_lock(&helper.mutex);
+        while (helper.done == done)
+            g_cond_wait(&helper.cond, &helper.mutex);
+        done_now = helper.done;
+        bytes = helper.bytes;
+        g_mutex_unlock(&helper.mutex);
+
+        if (state == NULL) {
+            done = done_now;
+            continue;
+        }
+        dnf_state_set_speed(state, bytes / MAX(g_timer_elapsed(timer, NULL), 0.001));
+        for (; ret && done < done_now; done++)
+            ret = dnf_state_done(state, error);
+    }
+
+    /* on cancel, drop the jobs that have not started yet */
+    g_thread_pool_free(pool, !ret, TRUE);
+    g_mutex_clear(&helper.mutex);
+    g_cond_clear(&helper.cond);
+
+    /* collect the results in order */
+    for (i = 0; i < packages->len; i++) {
+        if (ret && jobs[i].error != NULL) {
+            g_propagate_error(error, jobs[i].error);
+            jobs[i].error = NULL;
+            ret = FALSE;
+        }
+        if (ret && !jobs[i].valid)
+            g_ptr_array_add(invalid, g_object_ref(g_ptr_array_index(packages, i)));
+        g_clear_error(&jobs[i].error);
+        g_free(jobs[i].path);
+        g_free(jobs[i].checksum);
+    }
+    g_free(jobs);
     return ret;
 }
 
@@ -706,7 +868,8 @@ dnf_package_download(DnfPackage *pkg,
  * @state: the #DnfState.
  * @error: a #GError or %NULL..
  *
- * Downloads an array of packages.
+ * Downloads an array of packages. Packages from different repos are
+ * downloaded at the same time.
  *
  * Returns: %TRUE for success
  *
@@ -718,53 +881,9 @@ dnf_package_array_download(GPtrArray *packages,
                 DnfState *state,
                 GError **error)
 {
-    DnfState *state_local;
-    GHashTableIter hiter;
-    gpointer key, value;
-    guint i;
-    g_autoptr(GHashTable) repo_to_packages = NULL;
-
-    /* map packages to repos */
-    repo_to_packages = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)g_ptr_array_unref);
-    for (i = 0; i < packages->len; i++) {
-        DnfPackage *pkg = g_ptr_array_index(packages, i);
-        DnfRepo *repo;
-        GPtrArray *repo_packages;
-
-        repo = dnf_package_get_repo(pkg);
-        if (repo == NULL) {
-            g_set_error_literal(error,
-                                DNF_ERROR,
-                                DNF_ERROR_INTERNAL_ERROR,
-                                "package repo is unset");
-            return FALSE;
-        }
-        repo_packages = g_hash_table_lookup(repo_to_packages, repo);
-        if (repo_packages == NULL) {
-            repo_packages = g_ptr_array_new();
-            g_hash_table_insert(repo_to_packages, repo, repo_packages);
-        }
-        g_ptr_array_add(repo_packages, pkg);
-    }
-
-    /* set steps according to the number of repos we are going to download from */
-    dnf_state_set_number_steps(state, g_hash_table_size(repo_to_packages));
-
-    /* download all packages from each repo in one go */
-    g_hash_table_iter_init(&hiter, repo_to_packages);
-    while (g_hash_table_iter_next(&hiter, &key, &value)) {
-        DnfRepo *repo = key;
-        GPtrArray *repo_packages = value;
-
-        state_local = dnf_state_get_child(state);
-        if (!dnf_repo_download_packages(repo, repo_packages, directory, state_local, error))
-            return FALSE;
-
-        /* done */
-        if (!dnf_state_done(state, error))
-            return FALSE;
-    }
-    return TRUE;
+    /* download from all repos concurrently */
+    return dnf_repo_download_packages_all(packages, directory, NULL, NULL,
+                                          state, error);
 }
 
 /**
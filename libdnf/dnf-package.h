@@ -94,6 +94,10 @@ gboolean         dnf_package_array_download             (GPtrArray      *package
                                                          const gchar    *directory,
                                                          DnfState       *state,
                                                          GError         **error);
+gboolean         dnf_package_array_check_filenames      (GPtrArray      *packages,
+                                                         GPtrArray      *invalid,
+                                                         DnfState       *state,
+                                                         GError         **error);
 guint64          dnf_package_array_get_download_size    (GPtrArray      *packages);
 
 #endif /* __DNF_PACKAGE_H */
@@ -38,6 +38,11 @@
 #include "dnf-packagedelta-private.h"
 #include "hy-iutil.h"
 
+/* rebuilding reads the installed files back and recompresses the whole
+ * payload, which costs about as much time as downloading this fraction
+ * of the full package */
+#define DNF_PACKAGEDELTA_REBUILD_COST   0.25
+
 typedef struct
 {
     char            *location;
@@ -187,3 +192,28 @@ dnf_packagedelta_get_chksum(DnfPackageDelta *delta, int *type)
         *type = priv->checksum_type;
     return priv->checksum;
 }
+
+/**
+ * dnf_packagedelta_is_worthwhile:
+ * @delta: a #DnfPackageDelta instance.
+ * @full_size: the download size of the full package
+ *
+ * Decides if downloading the delta and rebuilding the package from it is
+ * cheaper than downloading the full package. The rebuild is counted as
+ * the equivalent of downloading a quarter of the full package, so a
+ * delta has to save more than that to be used.
+ *
+ * Returns: %TRUE if the delta should be used
+ *
+ * Since: 0.8.0
+ */
+gboolean
+dnf_packagedelta_is_worthwhile(DnfPackageDelta *delta, guint64 full_size)
+{
+    DnfPackageDeltaPrivate *priv = GET_PRIVATE(delta);
+    if (priv->location == NULL || priv->checksum == NULL)
+        return FALSE;
+    if (priv->downloadsize == 0 || full_size == 0)
+        return FALSE;
+    return priv->downloadsize + full_size * DNF_PACKAGEDELTA_REBUILD_COST < full_size;
+}
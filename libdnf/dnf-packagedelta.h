@@ -50,6 +50,7 @@ const char      *dnf_packagedelta_get_location          (DnfPackageDelta *delta)
 const char      *dnf_packagedelta_get_baseurl           (DnfPackageDelta *delta);
 guint64          dnf_packagedelta_get_downloadsize      (DnfPackageDelta *delta);
 const unsigned char *dnf_packagedelta_get_chksum        (DnfPackageDelta *delta, int *type);
+gboolean         dnf_packagedelta_is_worthwhile         (DnfPackageDelta *delta, guint64 full_size);
 
 G_END_DECLS
 
@@ -34,8 +34,15 @@
  */
 
 
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
 #include <strings.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
 #include <glib/gstdio.h>
 #include "hy-util.h"
 #include <librepo/librepo.h>
@@ -46,6 +53,8 @@
 #include "dnf-repo.h"
 #include "dnf-types.h"
 #include "dnf-utils.h"
+#include "dnf-mirror-stats-private.h"
+#include "dnf-verified-cache-private.h"
 
 typedef struct
 {
@@ -68,6 +77,7 @@ typedef struct
     gint64           timestamp_generated;   /* µs */
     gint64           timestamp_modified;    /* µs */
     GError          *last_check_error;
+    gboolean         checked;               /* metadata checksums verified */
     GKeyFile        *keyfile;
     GHashTable      *filenames_md;          /* key:filename */
     DnfContext      *context;               /* weak reference */
@@ -76,6 +86,7 @@ typedef struct
     LrHandle        *repo_handle;
     LrResult        *repo_result;
     LrUrlVars       *urlvars;
+    DnfMirrorStats  *mirror_stats;          /* loaded on first use */
 } DnfRepoPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE(DnfRepo, dnf_repo, G_TYPE_OBJECT)
@@ -103,6 +114,8 @@ dnf_repo_finalize(GObject *object)
     g_free(priv->pubkey);
     g_hash_table_unref(priv->filenames_md);
     g_clear_error(&priv->last_check_error);
+    if (priv->mirror_stats != NULL)
+        dnf_mirror_stats_free(priv->mirror_stats);
     if (priv->repo_result != NULL)
         lr_result_free(priv->repo_result);
     if (priv->repo_handle != NULL)
@@ -775,6 +788,62 @@ dnf_repo_get_boolean(GKeyFile *keyfile,
     return FALSE;
 }
 
+/**
+ * dnf_repo_get_mirror_stats:
+ *
+ * Loads the statistics of the mirrors of a remote repo from its cache
+ * directory the first time they are needed.
+ **/
+static DnfMirrorStats *
+dnf_repo_get_mirror_stats(DnfRepo *repo)
+{
+    DnfRepoPrivate *priv = GET_PRIVATE(repo);
+
+    if (priv->mirror_stats == NULL) {
+        g_autofree gchar *filename = NULL;
+        filename = g_build_filename(priv->location, "mirrorstats", NULL);
+        priv->mirror_stats = dnf_mirror_stats_new(filename);
+    }
+    return priv->mirror_stats;
+}
+
+/**
+ * dnf_repo_save_mirror_stats:
+ **/
+static void
+dnf_repo_save_mirror_stats(DnfRepo *repo)
+{
+    DnfRepoPrivate *priv = GET_PRIVATE(repo);
+    g_autoptr(GError) error_local = NULL;
+
+    if (priv->mirror_stats == NULL)
+        return;
+    if (!dnf_mirror_stats_save(priv->mirror_stats, &error_local))
+        g_debug("failed to save mirror stats for %s: %s",
+                priv->id, error_local->message);
+}
+
+/**
+ * dnf_repo_get_baseurls:
+ *
+ * Gets the base URLs from the keyfile with the variables substituted, as
+ * librepo reports them.
+ **/
+static gchar **
+dnf_repo_get_baseurls(DnfRepo *repo)
+{
+    DnfRepoPrivate *priv = GET_PRIVATE(repo);
+    gchar **baseurls;
+
+    baseurls = g_key_file_get_string_list(priv->keyfile, priv->id, "baseurl", NULL, NULL);
+    for (guint i = 0; baseurls != NULL && baseurls[i] != NULL; i++) {
+        gchar *tmp = baseurls[i];
+        baseurls[i] = dnf_repo_substitute(repo, tmp);
+        g_free(tmp);
+    }
+    return baseurls;
+}
+
 /**
  * dnf_repo_set_keyfile_data:
  */
@@ -855,6 +924,16 @@ dnf_repo_set_keyfile_data(DnfRepo *repo, GError **error)
         dnf_repo_set_location_tmp(repo, tmp->str);
     }
 
+    /* try the mirrors that did best before first */
+    if (priv->kind == DNF_REPO_KIND_REMOTE) {
+        g_auto(GStrv) urls = NULL;
+        g_auto(GStrv) baseurls_subst = dnf_repo_get_baseurls(repo);
+        urls = dnf_mirror_stats_sort_urls(dnf_repo_get_mirror_stats(repo),
+                                          (const gchar * const *) baseurls_subst);
+        if (urls != NULL && !lr_handle_setopt(priv->repo_handle, error, LRO_URLS, urls))
+            return FALSE;
+    }
+
     /* gpgkey is optional for gpgcheck=1, but required for repo_gpgcheck=1 */
     g_strfreev(priv->gpgkeys);
     tmp_strval = g_key_file_get_string(priv->keyfile, priv->id, "gpgkey", NULL);
@@ -1021,6 +1100,7 @@ dnf_repo_setup(DnfRepo *repo, GError **error)
 typedef struct
 {
     DnfState *state;
+    DnfMirrorStats *mirror_stats;
     gchar *last_mirror_url;
     gchar *last_mirror_failure_message;
 } RepoUpdateData;
@@ -1104,6 +1184,7 @@ dnf_repo_check_internal(DnfRepo *repo,
         "filelists",
         "group",
         "updateinfo",
+        "prestodelta",
         "appstream",
         "appstream-icons",
         NULL};
@@ -1226,6 +1307,13 @@ dnf_repo_check_internal(DnfRepo *repo,
                             g_strdup("updateinfo"),
                             g_strdup(tmp));
     }
+    tmp = lr_yum_repo_path(yum_repo, "prestodelta");
+    if (tmp != NULL) {
+        hy_repo_set_string(priv->repo, HY_REPO_PRESTO_FN, tmp);
+        g_hash_table_insert(priv->filenames_md,
+                            g_strdup("prestodelta"),
+                            g_strdup(tmp));
+    }
     tmp = lr_yum_repo_path(yum_repo, "group");
     if (tmp != NULL) {
         g_hash_table_insert(priv->filenames_md,
@@ -1273,15 +1361,35 @@ dnf_repo_check(DnfRepo *repo,
 {
     DnfRepoPrivate *priv = GET_PRIVATE(repo);
     g_clear_error(&priv->last_check_error);
+    priv->checked = FALSE;
     if (!dnf_repo_check_internal(repo, permissible_cache_age, state,
                                  &priv->last_check_error)) {
         if (error)
             *error = g_error_copy(priv->last_check_error);
         return FALSE;
     }
+    priv->checked = TRUE;
     return TRUE;
 }
 
+/**
+ * dnf_repo_is_checked:
+ * @repo: a #DnfRepo instance.
+ *
+ * Gets if the last dnf_repo_check() of the repo succeeded, i.e. the
+ * metadata was found with valid checksums.
+ *
+ * Returns: %TRUE if the repo metadata has been checked
+ *
+ * Since: 0.8.0
+ **/
+gboolean
+dnf_repo_is_checked(DnfRepo *repo)
+{
+    DnfRepoPrivate *priv = GET_PRIVATE(repo);
+    return priv->checked;
+}
+
 
 /**
  * dnf_repo_get_filename_md:
@@ -1421,6 +1529,9 @@ repo_mirrorlist_failure_cb(void *user_data,
 {
     RepoUpdateData *data = user_data;
 
+    if (data->mirror_stats != NULL)
+        dnf_mirror_stats_add_failure(data->mirror_stats, url);
+
     if (data->last_mirror_url)
         goto out;
 
@@ -1431,23 +1542,45 @@ repo_mirrorlist_failure_cb(void *user_data,
 }
 
 /**
- * dnf_repo_update:
- * @repo: a #DnfRepo instance.
- * @flags: #DnfRepoUpdateFlags, e.g. %DNF_REPO_UPDATE_FLAG_FORCE
- * @state: a #DnfState instance.
- * @error: a #%GError or %NULL.
- *
- * Updates the repo.
+ * dnf_repo_set_mirror_list:
  *
- * Returns: %TRUE for success, %FALSE otherwise
+ * Records the base URLs and the mirrors librepo found in the mirrorlist
+ * or metalink, in the order they were listed.
+ **/
+static void
+dnf_repo_set_mirror_list(DnfRepo *repo)
+{
+    DnfRepoPrivate *priv = GET_PRIVATE(repo);
+    char **mirrors = NULL;
+    g_auto(GStrv) baseurls = dnf_repo_get_baseurls(repo);
+    g_autoptr(GPtrArray) urls = g_ptr_array_new();
+    g_autoptr(GError) error_local = NULL;
+
+    if (!lr_handle_getinfo(priv->repo_handle, &error_local, LRI_MIRRORS, &mirrors)) {
+        g_debug("failed to get mirrors for %s: %s", priv->id, error_local->message);
+        return;
+    }
+    for (guint i = 0; baseurls != NULL && baseurls[i] != NULL; i++)
+        g_ptr_array_add(urls, baseurls[i]);
+    for (guint i = 0; mirrors != NULL && mirrors[i] != NULL; i++)
+        g_ptr_array_add(urls, mirrors[i]);
+    g_ptr_array_add(urls, NULL);
+    dnf_mirror_stats_set_mirrors(dnf_repo_get_mirror_stats(repo),
+                                 (const gchar * const *) urls->pdata);
+    g_strfreev(mirrors);
+}
+
+/**
+ * dnf_repo_update_internal:
  *
- * Since: 0.1.0
+ * Updates the repo, taking the metadata lock only if @take_lock is set.
  **/
-gboolean
-dnf_repo_update(DnfRepo *repo,
-                DnfRepoUpdateFlags flags,
-                DnfState *state,
-                GError **error)
+static gboolean
+dnf_repo_update_internal(DnfRepo *repo,
+                         DnfRepoUpdateFlags flags,
+                         gboolean take_lock,
+                         DnfState *state,
+                         GError **error)
 {
     DnfRepoPrivate *priv = GET_PRIVATE(repo);
     DnfState *state_local;
@@ -1493,12 +1626,14 @@ dnf_repo_update(DnfRepo *repo,
         return FALSE;
 
     /* take lock */
-    ret = dnf_state_take_lock(state,
-                              DNF_LOCK_TYPE_METADATA,
-                              DNF_LOCK_MODE_PROCESS,
-                              error);
-    if (!ret)
-        goto out;
+    if (take_lock) {
+        ret = dnf_state_take_lock(state,
+                                  DNF_LOCK_TYPE_METADATA,
+                                  DNF_LOCK_MODE_PROCESS,
+                                  error);
+        if (!ret)
+            goto out;
+    }
 
     /* set state */
     ret = dnf_state_set_steps(state, error,
@@ -1564,6 +1699,7 @@ dnf_repo_update(DnfRepo *repo,
 
     /* Callback to display progress of downloading */
     state_local = updatedata.state = dnf_state_get_child(state);
+    updatedata.mirror_stats = dnf_repo_get_mirror_stats(repo);
     ret = lr_handle_setopt(priv->repo_handle, error,
                            LRO_PROGRESSDATA, &updatedata);
     if (!ret)
@@ -1599,6 +1735,9 @@ dnf_repo_update(DnfRepo *repo,
         goto out;
     }
 
+    /* remember the mirrors so that the next refresh can order them */
+    dnf_repo_set_mirror_list(repo);
+
     /* check the newer metadata is newer */
     ret = lr_result_getinfo(priv->repo_result, &error_local,
                             LRR_YUM_TIMESTAMP, &timestamp_new);
@@ -1692,12 +1831,175 @@ out:
     }
     g_free(updatedata.last_mirror_failure_message);
     g_free(updatedata.last_mirror_url);
+    dnf_repo_save_mirror_stats(repo);
     dnf_state_release_locks(state);
     lr_handle_setopt(priv->repo_handle, NULL, LRO_PROGRESSCB, NULL);
     lr_handle_setopt(priv->repo_handle, NULL, LRO_PROGRESSDATA, 0xdeadbeef);
     return ret;
 }
 
+/**
+ * dnf_repo_update:
+ * @repo: a #DnfRepo instance.
+ * @flags: #DnfRepoUpdateFlags, e.g. %DNF_REPO_UPDATE_FLAG_FORCE
+ * @state: a #DnfState instance.
+ * @error: a #%GError or %NULL.
+ *
+ * Updates the repo.
+ *
+ * Returns: %TRUE for success, %FALSE otherwise
+ *
+ * Since: 0.1.0
+ **/
+gboolean
+dnf_repo_update(DnfRepo *repo,
+                DnfRepoUpdateFlags flags,
+                DnfState *state,
+                GError **error)
+{
+    return dnf_repo_update_internal(repo, flags, TRUE, state, error);
+}
+
+typedef struct {
+    DnfRepo             *repo;
+    GError              *error;
+} DnfRepoUpdateJob;
+
+typedef struct {
+    DnfRepoUpdateFlags   flags;
+    GCancellable        *cancellable;
+    GMutex               mutex;
+    GCond                cond;
+    guint                done;
+} DnfRepoUpdateHelper;
+
+/**
+ * dnf_repo_update_job_cb:
+ **/
+static void
+dnf_repo_update_job_cb(gpointer data, gpointer user_data)
+{
+    DnfRepoUpdateJob *job = data;
+    DnfRepoUpdateHelper *helper = user_data;
+    g_autoptr(DnfState) state_job = dnf_state_new();
+
+    /* DnfState is not thread safe, so each job gets one of its own */
+    dnf_state_set_cancellable(state_job, helper->cancellable);
+    dnf_repo_update_internal(job->repo, helper->flags, FALSE,
+                             state_job, &job->error);
+
+    g_mutex_lock(&helper->mutex);
+    helper->done++;
+    g_cond_signal(&helper->cond);
+    g_mutex_unlock(&helper->mutex);
+}
+
+/**
+ * dnf_repo_update_all:
+ * @repos: an array of repos.
+ * @flags: #DnfRepoUpdateFlags, e.g. %DNF_REPO_UPDATE_FLAG_FORCE
+ * @failed: an array the optional repos that could not be fetched are
+ *          added to.
+ * @state: a #DnfState instance.
+ * @error: a #%GError or %NULL.
+ *
+ * Updates several repos like dnf_repo_update(), running up to
+ * dnf_context_get_max_parallel_refresh() updates at the same time.
+ *
+ * A repo that is not required and cannot be fetched is not an error;
+ * a warning is printed and a reference to it is added to @failed.
+ *
+ * Returns: %TRUE for success, %FALSE otherwise
+ *
+ * Since: 0.8.0
+ **/
+gboolean
+dnf_repo_update_all(GPtrArray *repos,
+                    DnfRepoUpdateFlags flags,
+                    GPtrArray *failed,
+                    DnfState *state,
+                    GError **error)
+{
+    DnfRepoPrivate *priv;
+    DnfRepoUpdateHelper helper = { 0, };
+    DnfRepoUpdateJob *jobs;
+    GThreadPool *pool;
+    gboolean ret = TRUE;
+    guint done = 0;
+    guint i;
+
+    if (repos->len == 0)
+        return TRUE;
+
+    /* take the lock once for all the jobs */
+    if (!dnf_state_take_lock(state,
+                             DNF_LOCK_TYPE_METADATA,
+                             DNF_LOCK_MODE_PROCESS,
+                             error))
+        return FALSE;
+
+    jobs = g_new0(DnfRepoUpdateJob, repos->len);
+    for (i = 0; i < repos->len; i++)
+        jobs[i].repo = g_ptr_array_index(repos, i);
+
+    /* the transfers are network bound, so use the configured limit */
+    priv = GET_PRIVATE(jobs[0].repo);
+    helper.flags = flags;
+    helper.cancellable = dnf_state_get_cancellable(state);
+    g_mutex_init(&helper.mutex);
+    g_cond_init(&helper.cond);
+    pool = g_thread_pool_new(dnf_repo_update_job_cb, &helper,
+                             (gint) MIN(dnf_context_get_max_parallel_refresh(priv->context),
+                                        repos->len),
+                             TRUE, NULL);
+    for (i = 0; i < repos->len; i++)
+        g_thread_pool_push(pool, &jobs[i], NULL);
+
+    /* report progress from this thread as DnfState is not thread safe */
+    dnf_state_set_number_steps(state, repos->len);
+    dnf_state_action_start(state, DNF_STATE_ACTION_DOWNLOAD_METADATA, NULL);
+    while (ret && done < repos->len) {
+        guint done_now;
+
+        g_mutex_lock(&helper.mutex);
+        while (helper.done == done)
+            g_cond_wait(&helper.cond, &helper.mutex);
+        done_now = helper.done;
+        g_mutex_unlock(&helper.mutex);
+
+        for (; ret && done < done_now; done++)
+            ret = dnf_state_done(state, error);
+    }
+
+    /* on cancel, drop the jobs that have not started yet */
+    g_thread_pool_free(pool, !ret, TRUE);
+    g_mutex_clear(&helper.mutex);
+    g_cond_clear(&helper.cond);
+    dnf_state_release_locks(state);
+
+    /* collect the results in order */
+    for (i = 0; i < repos->len; i++) {
+        if (ret && jobs[i].error != NULL) {
+            if (!dnf_repo_get_required(jobs[i].repo) &&
+                g_error_matches(jobs[i].error,
+                                DNF_ERROR,
+                                DNF_ERROR_CANNOT_FETCH_SOURCE)) {
+                g_warning("Skipping refresh of %s: %s",
+                          dnf_repo_get_id(jobs[i].repo),
+                          jobs[i].error->message);
+                g_ptr_array_add(failed, g_object_ref(jobs[i].repo));
+            } else {
+                g_propagate_error(error, jobs[i].error);
+                jobs[i].error = NULL;
+                ret = FALSE;
+            }
+        }
+        g_clear_error(&jobs[i].error);
+    }
+    g_free(jobs);
+    return ret;
+}
+
 /**
  * dnf_repo_set_data:
  * @repo: a #DnfRepo instance.
@@ -1780,6 +2082,63 @@ dnf_repo_copy_progress_cb(goffset current, goffset total, gpointer user_data)
     dnf_state_set_percentage(state, 100.0f * current / total);
 }
 
+/**
+ * dnf_repo_copy_file_fast:
+ *
+ * Makes @dest have the contents of @src without reading them through
+ * userspace where possible: a reflink, then copy_file_range(). @dest is
+ * never a hardlink, as the cache copy may later be rewritten in place.
+ *
+ * Returns: %TRUE if @dest was created, %FALSE to fall back to a copy
+ **/
+static gboolean
+dnf_repo_copy_file_fast(const gchar *src, const gchar *dest)
+{
+    gboolean ret = FALSE;
+    int fd_src = -1;
+    int fd_dest = -1;
+    struct stat st;
+
+    fd_src = g_open(src, O_RDONLY | O_CLOEXEC, 0);
+    if (fd_src < 0)
+        goto out;
+    if (fstat(fd_src, &st) != 0)
+        goto out;
+    fd_dest = g_open(dest, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd_dest < 0)
+        goto out;
+
+#ifdef FICLONE
+    /* copy-on-write filesystems share the extents */
+    if (ioctl(fd_dest, FICLONE, fd_src) == 0) {
+        g_debug("reflinked %s to %s", src, dest);
+        ret = TRUE;
+        goto out;
+    }
+#endif
+
+#ifdef HAVE_COPY_FILE_RANGE
+    /* let the kernel copy, which NFS can do server side */
+    while (st.st_size > 0) {
+        ssize_t len = copy_file_range(fd_src, NULL, fd_dest, NULL, st.st_size, 0);
+        if (len <= 0)
+            goto out;
+        st.st_size -= len;
+    }
+    g_debug("copied %s to %s in the kernel", src, dest);
+    ret = TRUE;
+#endif
+out:
+    if (fd_src >= 0)
+        g_close(fd_src, NULL);
+    if (fd_dest >= 0) {
+        g_close(fd_dest, NULL);
+        if (!ret)
+            g_unlink(dest);
+    }
+    return ret;
+}
+
 /**
  * dnf_repo_copy_package:
  **/
@@ -1794,10 +2153,13 @@ dnf_repo_copy_package(DnfPackage *pkg,
     g_autoptr(GFile) file_dest = NULL;
     g_autoptr(GFile) file_repo = NULL;
 
-    /* copy the file with progress */
-    file_repo = g_file_new_for_path(dnf_package_get_filename(pkg));
     basename = g_path_get_basename(dnf_package_get_location(pkg));
     dest = g_build_filename(directory, basename, NULL);
+    if (dnf_repo_copy_file_fast(dnf_package_get_filename(pkg), dest))
+        return TRUE;
+
+    /* copy the file with progress */
+    file_repo = g_file_new_for_path(dnf_package_get_filename(pkg));
     file_dest = g_file_new_for_path(dest);
     return g_file_copy(file_repo, file_dest, G_FILE_COPY_NONE,
                        dnf_state_get_cancellable(state),
@@ -1810,16 +2172,202 @@ typedef struct
     gchar *last_mirror_failure_message;
     guint64 downloaded;
     guint64 download_size;
+    DnfRepoDownloadedFunc downloaded_func;
+    gpointer downloaded_data;
+    GHashTable *transfers;      /* LrPackageTarget:DnfRepoTransfer */
+    GHashTable *repos;          /* repos with new mirror stats */
+    GPtrArray *failures;        /* messages for the files that failed */
 } GlobalDownloadData;
 
 typedef struct
 {
     DnfPackage *pkg;
+    DnfRepo *repo;
     DnfState *state;
+    LrPackageTarget *target;
     guint64 downloaded;
+    gint64 time_started;        /* µs, monotonic */
+    gint64 time_first_byte;     /* µs, monotonic */
+    gchar *path;
+    gchar *dest;                /* path, or the partial file */
+    gchar *dest_info;           /* what the partial file is for */
+    guint64 size;
+    LrChecksumType checksum_type;
+    gchar *checksum;
     GlobalDownloadData *global_download_data;
 } PackageDownloadData;
 
+typedef struct
+{
+    DnfRepo *repo;
+    guint64 bytes;
+    gdouble seconds;
+    gdouble latency;
+} DnfRepoTransfer;
+
+/**
+ * global_download_data_clear:
+ **/
+static void
+global_download_data_clear(GlobalDownloadData *global_data)
+{
+    g_free(global_data->last_mirror_failure_message);
+    g_free(global_data->last_mirror_url);
+    if (global_data->transfers != NULL)
+        g_hash_table_unref(global_data->transfers);
+    if (global_data->repos != NULL)
+        g_hash_table_unref(global_data->repos);
+    if (global_data->failures != NULL)
+        g_ptr_array_unref(global_data->failures);
+}
+
+/**
+ * global_download_data_add_repo:
+ **/
+static void
+global_download_data_add_repo(GlobalDownloadData *global_data, DnfRepo *repo)
+{
+    if (global_data->repos == NULL)
+        global_data->repos = g_hash_table_new(NULL, NULL);
+    g_hash_table_add(global_data->repos, repo);
+}
+
+/**
+ * dnf_repo_record_transfers:
+ *
+ * librepo only says which mirror each package came from once the whole
+ * batch is done, so the timings taken by the callbacks are matched up
+ * with the targets here and the stats of every repo involved are saved.
+ **/
+static void
+dnf_repo_record_transfers(GSList *package_targets, GlobalDownloadData *global_data)
+{
+    GHashTableIter iter;
+    gpointer key;
+
+    for (GSList *l = package_targets; l != NULL; l = l->next) {
+        LrPackageTarget *target = l->data;
+        DnfRepoTransfer *transfer;
+
+        if (global_data->transfers == NULL || target->usedmirror == NULL)
+            continue;
+        transfer = g_hash_table_lookup(global_data->transfers, target);
+        if (transfer == NULL)
+            continue;
+        dnf_mirror_stats_add_transfer(dnf_repo_get_mirror_stats(transfer->repo),
+                                      target->usedmirror,
+                                      transfer->bytes,
+                                      transfer->seconds,
+                                      transfer->latency);
+        global_download_data_add_repo(global_data, transfer->repo);
+    }
+    if (global_data->repos == NULL)
+        return;
+    g_hash_table_iter_init(&iter, global_data->repos);
+    while (g_hash_table_iter_next(&iter, &key, NULL))
+        dnf_repo_save_mirror_stats(key);
+}
+
+/**
+ * package_download_data_free:
+ **/
+static void
+package_download_data_free(PackageDownloadData *data)
+{
+    g_free(data->path);
+    g_free(data->dest);
+    g_free(data->dest_info);
+    g_free(data->checksum);
+    g_slice_free(PackageDownloadData, data);
+}
+
+/**
+ * package_download_targets_free:
+ *
+ * Frees targets that were never passed to librepo, and so still own the
+ * data the end callback would have freed.
+ **/
+static void
+package_download_targets_free(GSList *package_targets)
+{
+    for (GSList *l = package_targets; l != NULL; l = l->next) {
+        LrPackageTarget *target = l->data;
+        package_download_data_free(target->cbdata);
+    }
+    g_slist_free_full(package_targets, (GDestroyNotify)lr_packagetarget_free);
+}
+
+/**
+ * package_download_data_set_dest:
+ *
+ * New downloads go to a partial file next to the package, with a note
+ * of the size and checksum it is for, so an interrupted download can be
+ * resumed with a range request and is never mistaken for the package.
+ * A partial file left behind for a different package is thrown away.
+ **/
+static void
+package_download_data_set_dest(PackageDownloadData *data, guint64 size)
+{
+    struct stat st;
+    g_autofree gchar *info = NULL;
+    g_autofree gchar *info_old = NULL;
+    g_autoptr(GError) error_local = NULL;
+
+    data->size = size;
+
+    /* let librepo check and resume an existing file as before */
+    if (g_file_test(data->path, G_FILE_TEST_EXISTS)) {
+        data->dest = g_strdup(data->path);
+        return;
+    }
+
+    data->dest = g_strconcat(data->path, ".part", NULL);
+    data->dest_info = g_strconcat(data->path, ".part.info", NULL);
+    info = g_strdup_printf("%" G_GUINT64_FORMAT "\t%i\t%s\n",
+                           size, data->checksum_type, data->checksum);
+    if (g_file_get_contents(data->dest_info, &info_old, NULL, NULL) &&
+        g_strcmp0(info, info_old) == 0 &&
+        g_stat(data->dest, &st) == 0 &&
+        (guint64) st.st_size < size) {
+        g_debug("resuming %s from %" G_GUINT64_FORMAT " bytes",
+                data->path, (guint64) st.st_size);
+        return;
+    }
+    g_unlink(data->dest);
+    if (!g_file_set_contents(data->dest_info, info, -1, &error_local))
+        g_debug("failed to write %s: %s", data->dest_info, error_local->message);
+}
+
+/**
+ * package_download_data_finish_dest:
+ *
+ * Moves a completed partial file into place, or drops one that can not
+ * be resumed because it is already as big as the package.
+ **/
+static gboolean
+package_download_data_finish_dest(PackageDownloadData *data, gboolean success)
+{
+    struct stat st;
+
+    if (data->dest_info == NULL)
+        return success;
+    if (!success) {
+        if (g_stat(data->dest, &st) == 0 &&
+            (guint64) st.st_size >= data->size) {
+            g_unlink(data->dest);
+            g_unlink(data->dest_info);
+        }
+        return FALSE;
+    }
+    g_unlink(data->dest_info);
+    if (g_rename(data->dest, data->path) != 0) {
+        g_warning("failed to move %s to %s: %s",
+                  data->dest, data->path, strerror(errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
 static int
 package_download_update_state_cb(void *user_data,
                                  gdouble total_to_download,
@@ -1839,6 +2387,12 @@ package_download_update_state_cb(void *user_data,
     if (total_to_download < 0 || now_downloaded < 0)
         return 0;
 
+    /* for the mirror stats */
+    if (data->time_started == 0)
+        data->time_started = g_get_monotonic_time();
+    if (data->time_first_byte == 0 && now_downloaded > 0)
+        data->time_first_byte = g_get_monotonic_time();
+
     dnf_state_action_start(data->state,
                            DNF_STATE_ACTION_DOWNLOAD_PACKAGES,
                            dnf_package_get_package_id(data->pkg));
@@ -1866,8 +2420,46 @@ package_download_end_cb(void *user_data,
                         const char *msg)
 {
     PackageDownloadData *data = user_data;
+    GlobalDownloadData *global_data = data->global_download_data;
+    gboolean success;
+
+    /* put the completed file in place, or keep it to resume later */
+    success = status == LR_TRANSFER_SUCCESSFUL || status == LR_TRANSFER_ALREADYEXISTS;
+    success = package_download_data_finish_dest(data, success);
+
+    /* librepo has checked the checksum, so remember it */
+    if (success)
+        dnf_verified_cache_add_checksum(data->path, data->checksum_type, data->checksum);
+
+    /* reported once the other files are done */
+    if (!success) {
+        g_autofree gchar *basename = g_path_get_basename(data->path);
+        if (global_data->failures == NULL)
+            global_data->failures = g_ptr_array_new_with_free_func(g_free);
+        g_ptr_array_add(global_data->failures,
+                        g_strdup_printf("%s: %s", basename,
+                                        msg != NULL ? msg : "failed to move into place"));
+    }
 
-    g_slice_free(PackageDownloadData, data);
+    /* time the transfer, the mirror is only known when the batch is done */
+    if (status == LR_TRANSFER_SUCCESSFUL &&
+        data->time_first_byte > 0 && data->target != NULL) {
+        DnfRepoTransfer *transfer = g_new0(DnfRepoTransfer, 1);
+        gint64 now = g_get_monotonic_time();
+        transfer->repo = data->repo;
+        transfer->bytes = data->downloaded;
+        transfer->seconds = (gdouble) (now - data->time_started) / G_USEC_PER_SEC;
+        transfer->latency = (gdouble) (data->time_first_byte - data->time_started) / G_USEC_PER_SEC;
+        if (global_data->transfers == NULL)
+            global_data->transfers = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+        g_hash_table_insert(global_data->transfers, data->target, transfer);
+    }
+
+    /* let the caller start working on the file straight away */
+    if (global_data->downloaded_func != NULL && success)
+        global_data->downloaded_func(data->pkg, global_data->downloaded_data);
+
+    package_download_data_free(data);
 
     return LR_CB_OK;
 }
@@ -1880,6 +2472,9 @@ mirrorlist_failure_cb(void *user_data,
     PackageDownloadData *data = user_data;
     GlobalDownloadData *global_data = data->global_download_data;
 
+    dnf_mirror_stats_add_failure(dnf_repo_get_mirror_stats(data->repo), url);
+    global_download_data_add_repo(global_data, data->repo);
+
     if (global_data->last_mirror_url)
         goto out;
 
@@ -1938,78 +2533,95 @@ dnf_repo_download_package(DnfRepo *repo,
 }
 
 /**
- * dnf_repo_download_packages:
- * @repo: a #DnfRepo instance.
- * @packages: (element-type DnfPackage): an array of packages, must be from this repo
- * @directory: the destination directory.
- * @state: a #DnfState.
- * @error: a #GError or %NULL.
- *
- * Downloads multiple packages from a repo. The target filename will be
- * equivalent to `g_path_get_basename (dnf_package_get_location (pkg))`.
+ * dnf_repo_download_setup:
  *
- * Returns: %TRUE for success, %FALSE otherwise
- *
- * Since: 0.2.3
+ * Resets the repo handle and works out the directory packages from this
+ * repo are downloaded to.
  **/
-gboolean
-dnf_repo_download_packages(DnfRepo *repo,
-                           GPtrArray *packages,
-                           const gchar *directory,
-                           DnfState *state,
-                           GError **error)
+static gboolean
+dnf_repo_download_setup(DnfRepo *repo,
+                        const gchar *directory,
+                        gchar **directory_slash,
+                        GError **error)
 {
     DnfRepoPrivate *priv = GET_PRIVATE(repo);
-    gboolean ret = FALSE;
-    guint i;
-    GSList *package_targets = NULL;
-    GlobalDownloadData global_data = { 0, };
-    g_autoptr(GError) error_local = NULL;
-    g_autofree gchar *directory_slash = NULL;
 
     /* ensure we reset the values from the keyfile */
     if (!dnf_repo_set_keyfile_data(repo, error))
-        goto out;
+        return FALSE;
 
     /* if nothing specified then use cachedir */
     if (directory == NULL) {
-        directory_slash = g_build_filename(priv->packages, "/", NULL);
-        if (!g_file_test(directory_slash, G_FILE_TEST_EXISTS)) {
-            if (g_mkdir(directory_slash, 0755) != 0) {
+        *directory_slash = g_build_filename(priv->packages, "/", NULL);
+        if (!g_file_test(*directory_slash, G_FILE_TEST_EXISTS)) {
+            if (g_mkdir(*directory_slash, 0755) != 0) {
                 g_set_error(error,
                             DNF_ERROR,
                             DNF_ERROR_INTERNAL_ERROR,
                             "Failed to create %s",
-                            directory_slash);
-                goto out;
+                            *directory_slash);
+                return FALSE;
             }
         }
     } else {
         /* librepo uses the GNU basename() function to find out if the
          * output directory is fully specified as a filename, but
          * basename needs a trailing '/' to detect it's not a filename */
-        directory_slash = g_build_filename(directory, "/", NULL);
+        *directory_slash = g_build_filename(directory, "/", NULL);
     }
+    return TRUE;
+}
 
-    /* is a local repo, i.e. we just need to copy */
-    if (dnf_repo_is_local(repo)) {
-        /* the number of packages to copy */
-        dnf_state_set_number_steps(state, packages->len);
+/**
+ * dnf_repo_copy_packages:
+ *
+ * Copies packages from a local repo, one step per package.
+ **/
+static gboolean
+dnf_repo_copy_packages(DnfRepo *repo,
+                       GPtrArray *packages,
+                       const gchar *directory,
+                       DnfState *state,
+                       GError **error)
+{
+    guint i;
 
-        for (i = 0; i < packages->len; i++) {
-            DnfPackage *pkg = packages->pdata[i];
-            DnfState *state_loop = dnf_state_get_child(state);
+    /* the number of packages to copy */
+    dnf_state_set_number_steps(state, packages->len);
 
-            dnf_package_set_repo(pkg, repo);
-            if (!dnf_repo_copy_package(pkg, directory, state_loop, error))
-                goto out;
-            if (!dnf_state_done(state, error))
-                goto out;
-        }
-        goto done;
+    for (i = 0; i < packages->len; i++) {
+        DnfPackage *pkg = packages->pdata[i];
+        DnfState *state_loop = dnf_state_get_child(state);
+
+        dnf_package_set_repo(pkg, repo);
+        if (!dnf_repo_copy_package(pkg, directory, state_loop, error))
+            return FALSE;
+        if (!dnf_state_done(state, error))
+            return FALSE;
     }
+    return TRUE;
+}
+
+/**
+ * dnf_repo_add_package_targets:
+ *
+ * Prepends a librepo target for each package to @package_targets. Every
+ * target is bound to the handle of @repo so that mirrors and
+ * credentials are taken from the right repo, while progress is reported
+ * into the shared @global_data.
+ **/
+static gboolean
+dnf_repo_add_package_targets(DnfRepo *repo,
+                             GPtrArray *packages,
+                             const gchar *directory_slash,
+                             DnfState *state,
+                             GlobalDownloadData *global_data,
+                             GSList **package_targets,
+                             GError **error)
+{
+    DnfRepoPrivate *priv = GET_PRIVATE(repo);
+    guint i;
 
-    global_data.download_size = dnf_package_array_get_download_size(packages);
     for (i = 0; i < packages->len; i++) {
         DnfPackage *pkg = packages->pdata[i];
         PackageDownloadData *data;
@@ -2017,6 +2629,7 @@ dnf_repo_download_packages(DnfRepo *repo,
         const unsigned char *checksum;
         int checksum_type;
         g_autofree char *checksum_str = NULL;
+        g_autofree gchar *basename = NULL;
 
         g_debug("downloading %s to %s",
                 dnf_package_get_location(pkg),
@@ -2024,15 +2637,21 @@ dnf_repo_download_packages(DnfRepo *repo,
 
         data = g_slice_new0(PackageDownloadData);
         data->pkg = pkg;
+        data->repo = repo;
         data->state = state;
-        data->global_download_data = &global_data;
+        data->global_download_data = global_data;
 
         checksum = dnf_package_get_chksum(pkg, &checksum_type);
         checksum_str = hy_chksum_str(checksum, checksum_type);
+        basename = g_path_get_basename(dnf_package_get_location(pkg));
+        data->path = g_build_filename(directory_slash, basename, NULL);
+        data->checksum_type = dnf_repo_checksum_hy_to_lr(checksum_type);
+        data->checksum = g_strdup(checksum_str);
+        package_download_data_set_dest(data, dnf_package_get_downloadsize(pkg));
 
         target = lr_packagetarget_new_v2(priv->repo_handle,
                                          dnf_package_get_location(pkg),
-                                         directory_slash,
+                                         data->dest,
                                          dnf_repo_checksum_hy_to_lr(checksum_type),
                                          checksum_str,
                                          dnf_package_get_downloadsize(pkg),
@@ -2043,37 +2662,692 @@ dnf_repo_download_packages(DnfRepo *repo,
                                          package_download_end_cb,
                                          mirrorlist_failure_cb,
                                          error);
-        if (target == NULL)
-            goto out;
+        if (target == NULL) {
+            package_download_data_free(data);
+            return FALSE;
+        }
+        data->target = target;
 
-        package_targets = g_slist_prepend(package_targets, target);
+        *package_targets = g_slist_prepend(*package_targets, target);
     }
+    return TRUE;
+}
 
-    ret = lr_download_packages(package_targets, LR_PACKAGEDOWNLOAD_FAILFAST, &error_local);
-    if (!ret) {
-        if (g_error_matches(error_local,
-                            LR_PACKAGE_DOWNLOADER_ERROR,
-                            LRE_ALREADYDOWNLOADED)) {
-            /* ignore */
-            g_clear_error(&error_local);
+/**
+ * dnf_repo_run_package_targets:
+ *
+ * Downloads all the targets in one librepo call. A file that fails does
+ * not stop the others, the failures are all reported at the end.
+ **/
+static gboolean
+dnf_repo_run_package_targets(GSList *package_targets,
+                             GlobalDownloadData *global_data,
+                             GError **error)
+{
+    g_autoptr(GError) error_local = NULL;
+    gboolean ret;
+
+    ret = lr_download_packages(package_targets, 0, &error_local);
+    dnf_repo_record_transfers(package_targets, global_data);
+    if (ret && global_data->failures == NULL)
+        return TRUE;
+
+    /* ignore, unless one of the other files failed */
+    if (global_data->failures == NULL &&
+        g_error_matches(error_local,
+                        LR_PACKAGE_DOWNLOADER_ERROR,
+                        LRE_ALREADYDOWNLOADED))
+        return TRUE;
+
+    /* the files that failed say more than what librepo returned */
+    if (global_data->failures != NULL) {
+        g_autofree gchar *joined = NULL;
+        g_clear_error(&error_local);
+        g_ptr_array_add(global_data->failures, NULL);
+        joined = g_strjoinv("; ", (gchar **) global_data->failures->pdata);
+        g_ptr_array_remove_index(global_data->failures,
+                                 global_data->failures->len - 1);
+        error_local = g_error_new(DNF_ERROR,
+                                  DNF_ERROR_CANNOT_FETCH_SOURCE,
+                                  "failed to download %u %s: %s",
+                                  global_data->failures->len,
+                                  global_data->failures->len == 1 ? "file" : "files",
+                                  joined);
+    }
+
+    if (global_data->last_mirror_failure_message) {
+        g_autofree gchar *orig_message = error_local->message;
+        error_local->message = g_strconcat(orig_message, "; Last error: ", global_data->last_mirror_failure_message, NULL);
+    }
+    g_propagate_error(error, error_local);
+    error_local = NULL;
+    return FALSE;
+}
+
+/**
+ * dnf_repo_download_packages:
+ * @repo: a #DnfRepo instance.
+ * @packages: (element-type DnfPackage): an array of packages, must be from this repo
+ * @directory: the destination directory.
+ * @state: a #DnfState.
+ * @error: a #GError or %NULL.
+ *
+ * Downloads multiple packages from a repo. The target filename will be
+ * equivalent to `g_path_get_basename (dnf_package_get_location (pkg))`.
+ *
+ * Returns: %TRUE for success, %FALSE otherwise
+ *
+ * Since: 0.2.3
+ **/
+gboolean
+dnf_repo_download_packages(DnfRepo *repo,
+                           GPtrArray *packages,
+                           const gchar *directory,
+                           DnfState *state,
+                           GError **error)
+{
+    DnfRepoPrivate *priv = GET_PRIVATE(repo);
+    gboolean ret = FALSE;
+    GSList *package_targets = NULL;
+    GlobalDownloadData global_data = { 0, };
+    g_autofree gchar *directory_slash = NULL;
+
+    if (!dnf_repo_download_setup(repo, directory, &directory_slash, error))
+        goto out;
+
+    /* is a local repo, i.e. we just need to copy */
+    if (dnf_repo_is_local(repo)) {
+        ret = dnf_repo_copy_packages(repo, packages, directory_slash, state, error);
+        goto out;
+    }
+
+    global_data.download_size = dnf_package_array_get_download_size(packages);
+    if (!dnf_repo_add_package_targets(repo, packages, directory_slash, state,
+                                      &global_data, &package_targets, error))
+        goto out;
+    ret = dnf_repo_run_package_targets(package_targets, &global_data, error);
+out:
+    lr_handle_setopt(priv->repo_handle, NULL, LRO_PROGRESSCB, NULL);
+    lr_handle_setopt(priv->repo_handle, NULL, LRO_PROGRESSDATA, 0xdeadbeef);
+    global_download_data_clear(&global_data);
+    g_slist_free_full(package_targets, (GDestroyNotify)lr_packagetarget_free);
+    return ret;
+}
+
+/**
+ * dnf_repo_download_packages_all:
+ * @packages: (element-type DnfPackage): an array of packages, from any repo
+ * @directory: the destination directory, or %NULL for each repo cachedir.
+ * @downloaded_func: (scope call) (allow-none): called as each package is available
+ * @downloaded_data: user data for @downloaded_func
+ * @state: a #DnfState.
+ * @error: a #GError or %NULL.
+ *
+ * Downloads packages from several repos at the same time. Packages from
+ * local repos are copied first, then the remaining packages from all
+ * repos are handed to librepo as a single batch so that a slow mirror
+ * of one repo does not hold up the others. The number of concurrent
+ * transfers is limited by dnf_context_get_max_parallel_downloads() in
+ * total and by dnf_context_get_max_downloads_per_host() per mirror.
+ *
+ * @downloaded_func is called from this thread as soon as each package
+ * has been copied or downloaded and checksummed, while the other
+ * transfers are still running.
+ *
+ * Returns: %TRUE for success, %FALSE otherwise
+ *
+ * Since: 0.8.0
+ **/
+gboolean
+dnf_repo_download_packages_all(GPtrArray *packages,
+                               const gchar *directory,
+                               DnfRepoDownloadedFunc downloaded_func,
+                               gpointer downloaded_data,
+                               DnfState *state,
+                               GError **error)
+{
+    DnfState *state_local;
+    GHashTableIter hiter;
+    gpointer key, value;
+    gboolean ret = FALSE;
+    guint i;
+    GSList *package_targets = NULL;
+    GlobalDownloadData global_data = { 0, };
+    g_autoptr(GHashTable) repo_to_packages = NULL;
+    g_autoptr(GPtrArray) local_packages = g_ptr_array_new();
+    g_autoptr(GPtrArray) remote_repos = g_ptr_array_new();
+    g_autoptr(GPtrArray) directories = g_ptr_array_new_with_free_func(g_free);
+
+    /* map packages to repos */
+    repo_to_packages = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)g_ptr_array_unref);
+    for (i = 0; i < packages->len; i++) {
+        DnfPackage *pkg = g_ptr_array_index(packages, i);
+        DnfRepo *repo;
+        GPtrArray *repo_packages;
+
+        repo = dnf_package_get_repo(pkg);
+        if (repo == NULL) {
+            g_set_error_literal(error,
+                                DNF_ERROR,
+                                DNF_ERROR_INTERNAL_ERROR,
+                                "package repo is unset");
+            return FALSE;
+        }
+        repo_packages = g_hash_table_lookup(repo_to_packages, repo);
+        if (repo_packages == NULL) {
+            repo_packages = g_ptr_array_new();
+            g_hash_table_insert(repo_to_packages, repo, repo_packages);
+        }
+        g_ptr_array_add(repo_packages, pkg);
+    }
+
+    /* copy from local repos, then download everything else in one go */
+    ret = dnf_state_set_steps(state, error,
+                              10, /* copy */
+                              90, /* download */
+                              -1);
+    if (!ret)
+        return FALSE;
+    ret = FALSE;
+
+    g_hash_table_iter_init(&hiter, repo_to_packages);
+    while (g_hash_table_iter_next(&hiter, &key, &value)) {
+        DnfRepo *repo = key;
+        GPtrArray *repo_packages = value;
+        if (dnf_repo_is_local(repo)) {
+            for (i = 0; i < repo_packages->len; i++)
+                g_ptr_array_add(local_packages, repo_packages->pdata[i]);
         } else {
-            if (global_data.last_mirror_failure_message) {
-                g_autofree gchar *orig_message = error_local->message;
-                error_local->message = g_strconcat(orig_message, "; Last error: ", global_data.last_mirror_failure_message, NULL);
-            }
-            g_propagate_error(error, error_local);
-            error_local = NULL;
-            goto out;
+            g_ptr_array_add(remote_repos, repo);
         }
-    } 
+    }
+
+    /* copy, one step per package whatever repo it comes from */
+    state_local = dnf_state_get_child(state);
+    dnf_state_set_number_steps(state_local, MAX(local_packages->len, 1));
+    for (i = 0; i < local_packages->len; i++) {
+        DnfPackage *pkg = local_packages->pdata[i];
+        DnfRepo *repo = dnf_package_get_repo(pkg);
+        DnfState *state_loop = dnf_state_get_child(state_local);
+        g_autofree gchar *directory_slash = NULL;
+
+        if (!dnf_repo_download_setup(repo, directory, &directory_slash, error))
+            goto out;
+        if (!dnf_repo_copy_package(pkg, directory_slash, state_loop, error))
+            goto out;
+        if (downloaded_func != NULL)
+            downloaded_func(pkg, downloaded_data);
+        if (!dnf_state_done(state_local, error))
+            goto out;
+    }
+    if (local_packages->len == 0 && !dnf_state_done(state_local, error))
+        goto out;
+    if (!dnf_state_done(state, error))
+        goto out;
+
+    /* build one target list over all the remote repos */
+    state_local = dnf_state_get_child(state);
+    global_data.downloaded_func = downloaded_func;
+    global_data.downloaded_data = downloaded_data;
+    for (i = 0; i < remote_repos->len; i++) {
+        DnfRepo *repo = remote_repos->pdata[i];
+        DnfRepoPrivate *priv = GET_PRIVATE(repo);
+        GPtrArray *repo_packages = g_hash_table_lookup(repo_to_packages, repo);
+        gchar *directory_slash = NULL;
+        long max_parallel;
+        long max_per_host;
+
+        if (!dnf_repo_download_setup(repo, directory, &directory_slash, error))
+            goto out;
+        g_ptr_array_add(directories, directory_slash);
+
+        /* librepo takes the limits from the target handles */
+        max_parallel = dnf_context_get_max_parallel_downloads(priv->context);
+        max_per_host = dnf_context_get_max_downloads_per_host(priv->context);
+        if (!lr_handle_setopt(priv->repo_handle, error,
+                              LRO_MAXPARALLELDOWNLOADS, max_parallel))
+            goto out;
+        if (!lr_handle_setopt(priv->repo_handle, error,
+                              LRO_MAXDOWNLOADSPERMIRROR, max_per_host))
+            goto out;
+
+        global_data.download_size += dnf_package_array_get_download_size(repo_packages);
+        if (!dnf_repo_add_package_targets(repo, repo_packages, directory_slash,
+                                          state_local, &global_data,
+                                          &package_targets, error))
+            goto out;
+    }
+    if (package_targets != NULL) {
+        ret = dnf_repo_run_package_targets(package_targets, &global_data, error);
+        g_slist_free_full(package_targets, (GDestroyNotify)lr_packagetarget_free);
+        package_targets = NULL;
+        if (!ret)
+            goto out;
+        ret = FALSE;
+    }
+    if (!dnf_state_done(state, error))
+        goto out;
 
-done:
     ret = TRUE;
 out:
-    lr_handle_setopt(priv->repo_handle, NULL, LRO_PROGRESSCB, NULL);
-    lr_handle_setopt(priv->repo_handle, NULL, LRO_PROGRESSDATA, 0xdeadbeef);
-    g_free(global_data.last_mirror_failure_message);
-    g_free(global_data.last_mirror_url);
+    for (i = 0; i < remote_repos->len; i++) {
+        DnfRepoPrivate *priv = GET_PRIVATE(remote_repos->pdata[i]);
+        lr_handle_setopt(priv->repo_handle, NULL, LRO_PROGRESSCB, NULL);
+        lr_handle_setopt(priv->repo_handle, NULL, LRO_PROGRESSDATA, 0xdeadbeef);
+    }
+    global_download_data_clear(&global_data);
+    package_download_targets_free(package_targets);
+    return ret;
+}
+
+typedef struct {
+    gchar               *path;
+    gchar               *dest;
+    gchar               *dest_info;
+    LrChecksumType       checksum_type;
+    gchar               *checksum;
+} DnfRepoPrefetchFile;
+
+struct _DnfRepoPrefetch {
+    GThread             *thread;
+    GMutex               mutex;
+    GCond                cond;
+    gboolean             done;
+    gboolean             ret;
+    GError              *error;
+    GCancellable        *cancellable;
+    DnfState            *state;
+    GSList              *package_targets;
+    GlobalDownloadData   global_data;
+    GPtrArray           *repos;
+    GArray              *files;         /* of DnfRepoPrefetchFile */
+};
+
+/**
+ * dnf_repo_prefetch_thread:
+ **/
+static gpointer
+dnf_repo_prefetch_thread(gpointer user_data)
+{
+    DnfRepoPrefetch *prefetch = user_data;
+    GError *error_local = NULL;
+    gboolean ret;
+
+    ret = dnf_repo_run_package_targets(prefetch->package_targets,
+                                       &prefetch->global_data,
+                                       &error_local);
+    g_mutex_lock(&prefetch->mutex);
+    prefetch->ret = ret;
+    prefetch->error = error_local;
+    prefetch->done = TRUE;
+    g_cond_signal(&prefetch->cond);
+    g_mutex_unlock(&prefetch->mutex);
+    return NULL;
+}
+
+/**
+ * dnf_repo_prefetch_reset_repos:
+ *
+ * Resets the progress options of the repo handles, as every download
+ * does once it is done.
+ **/
+static void
+dnf_repo_prefetch_reset_repos(DnfRepoPrefetch *prefetch)
+{
+    for (guint i = 0; i < prefetch->repos->len; i++) {
+        DnfRepoPrivate *priv = GET_PRIVATE(g_ptr_array_index(prefetch->repos, i));
+        lr_handle_setopt(priv->repo_handle, NULL, LRO_PROGRESSCB, NULL);
+        lr_handle_setopt(priv->repo_handle, NULL, LRO_PROGRESSDATA, 0xdeadbeef);
+    }
+}
+
+/**
+ * dnf_repo_prefetch_start:
+ * @packages: (element-type DnfPackage): packages that need downloading
+ * @error: a #GError or %NULL.
+ *
+ * Starts downloading @packages into the cachedir of their repos on a
+ * background thread, for instance while the user is asked to confirm
+ * the transaction. Packages from local repos are left alone.
+ *
+ * Everything that needs the package pool is looked up before this
+ * returns, but the repos of @packages must not be used again until
+ * dnf_repo_prefetch_wait() or dnf_repo_prefetch_cancel() is called.
+ *
+ * Returns: a #DnfRepoPrefetch, or %NULL if nothing needs prefetching
+ * or for error
+ *
+ * Since: 0.8.0
+ **/
+DnfRepoPrefetch *
+dnf_repo_prefetch_start(GPtrArray *packages, GError **error)
+{
+    DnfRepoPrefetch *prefetch;
+    guint i;
+    g_autoptr(GHashTable) repo_to_packages = NULL;
+
+    prefetch = g_slice_new0(DnfRepoPrefetch);
+    g_mutex_init(&prefetch->mutex);
+    g_cond_init(&prefetch->cond);
+    prefetch->cancellable = g_cancellable_new();
+    prefetch->state = dnf_state_new();
+    dnf_state_set_cancellable(prefetch->state, prefetch->cancellable);
+    prefetch->repos = g_ptr_array_new_with_free_func((GDestroyNotify) g_object_unref);
+    prefetch->files = g_array_new(FALSE, TRUE, sizeof(DnfRepoPrefetchFile));
+
+    /* map packages to remote repos */
+    repo_to_packages = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)g_ptr_array_unref);
+    for (i = 0; i < packages->len; i++) {
+        DnfPackage *pkg = g_ptr_array_index(packages, i);
+        DnfRepo *repo = dnf_package_get_repo(pkg);
+        GPtrArray *repo_packages;
+
+        if (repo == NULL || dnf_repo_is_local(repo))
+            continue;
+        repo_packages = g_hash_table_lookup(repo_to_packages, repo);
+        if (repo_packages == NULL) {
+            repo_packages = g_ptr_array_new();
+            g_hash_table_insert(repo_to_packages, repo, repo_packages);
+            g_ptr_array_add(prefetch->repos, g_object_ref(repo));
+        }
+        g_ptr_array_add(repo_packages, pkg);
+
+        /* the progress callback uses this, so cache it now */
+        dnf_package_get_package_id(pkg);
+    }
+    if (prefetch->repos->len == 0) {
+        dnf_repo_prefetch_free(prefetch);
+        return NULL;
+    }
+
+    /* build the targets here, the pool is not thread safe */
+    for (i = 0; i < prefetch->repos->len; i++) {
+        DnfRepo *repo = g_ptr_array_index(prefetch->repos, i);
+        DnfRepoPrivate *priv = GET_PRIVATE(repo);
+        GPtrArray *repo_packages = g_hash_table_lookup(repo_to_packages, repo);
+        g_autofree gchar *directory_slash = NULL;
+
+        if (!dnf_repo_download_setup(repo, NULL, &directory_slash, error))
+            goto fail;
+        if (!lr_handle_setopt(priv->repo_handle, error, LRO_MAXPARALLELDOWNLOADS,
+                              (long) dnf_context_get_max_parallel_downloads(priv->context)))
+            goto fail;
+        if (!lr_handle_setopt(priv->repo_handle, error, LRO_MAXDOWNLOADSPERMIRROR,
+                              (long) dnf_context_get_max_downloads_per_host(priv->context)))
+            goto fail;
+        prefetch->global_data.download_size += dnf_package_array_get_download_size(repo_packages);
+        if (!dnf_repo_add_package_targets(repo, repo_packages, directory_slash,
+                                          prefetch->state, &prefetch->global_data,
+                                          &prefetch->package_targets, error))
+            goto fail;
+    }
+
+    /* remember what is written, to clean up if cancelled */
+    for (GSList *l = prefetch->package_targets; l != NULL; l = l->next) {
+        LrPackageTarget *target = l->data;
+        PackageDownloadData *data = target->cbdata;
+        DnfRepoPrefetchFile file;
+
+        file.path = g_strdup(data->path);
+        file.dest = g_strdup(data->dest);
+        file.dest_info = g_strdup(data->dest_info);
+        file.checksum_type = data->checksum_type;
+        file.checksum = g_strdup(data->checksum);
+        g_array_append_val(prefetch->files, file);
+    }
+
+    g_debug("prefetching %u packages", packages->len);
+    prefetch->thread = g_thread_new("dnf-prefetch", dnf_repo_prefetch_thread, prefetch);
+    return prefetch;
+fail:
+    /* no thread, so nothing has freed the target data or reset the repos */
+    package_download_targets_free(prefetch->package_targets);
+    prefetch->package_targets = NULL;
+    dnf_repo_prefetch_reset_repos(prefetch);
+    dnf_repo_prefetch_free(prefetch);
+    return NULL;
+}
+
+/**
+ * dnf_repo_prefetch_join:
+ *
+ * Waits for the thread and resets the repos so they can be used again.
+ **/
+static void
+dnf_repo_prefetch_join(DnfRepoPrefetch *prefetch)
+{
+    if (prefetch->thread == NULL)
+        return;
+    g_thread_join(prefetch->thread);
+    prefetch->thread = NULL;
+    dnf_repo_prefetch_reset_repos(prefetch);
+}
+
+/**
+ * dnf_repo_prefetch_wait:
+ * @prefetch: a #DnfRepoPrefetch
+ * @state: a #DnfState.
+ * @error: a #GError or %NULL.
+ *
+ * Waits for the prefetch to complete. If @state is cancelled while
+ * waiting, the prefetch is cancelled as with dnf_repo_prefetch_cancel().
+ *
+ * Returns: %TRUE if all the packages were downloaded
+ *
+ * Since: 0.8.0
+ **/
+gboolean
+dnf_repo_prefetch_wait(DnfRepoPrefetch *prefetch, DnfState *state, GError **error)
+{
+    dnf_state_action_start(state, DNF_STATE_ACTION_DOWNLOAD_PACKAGES, NULL);
+    g_mutex_lock(&prefetch->mutex);
+    while (!prefetch->done) {
+        g_cond_wait_until(&prefetch->cond, &prefetch->mutex,
+                          g_get_monotonic_time() + G_USEC_PER_SEC / 10);
+        if (prefetch->done)
+            break;
+        g_mutex_unlock(&prefetch->mutex);
+        if (!dnf_state_check(state, error)) {
+            dnf_repo_prefetch_cancel(prefetch);
+            return FALSE;
+        }
+        g_mutex_lock(&prefetch->mutex);
+    }
+    g_mutex_unlock(&prefetch->mutex);
+    dnf_repo_prefetch_join(prefetch);
+
+    if (!prefetch->ret) {
+        g_propagate_error(error, prefetch->error);
+        prefetch->error = NULL;
+        return FALSE;
+    }
+    return dnf_state_finished(state, error);
+}
+
+/**
+ * dnf_repo_prefetch_cancel:
+ * @prefetch: a #DnfRepoPrefetch
+ *
+ * Stops the prefetch and waits for it to stop. Partial downloads and
+ * any file that was not verified are removed, so only complete packages
+ * with the right checksum are left in the cache.
+ *
+ * Since: 0.8.0
+ **/
+void
+dnf_repo_prefetch_cancel(DnfRepoPrefetch *prefetch)
+{
+    if (prefetch->thread == NULL)
+        return;
+    g_cancellable_cancel(prefetch->cancellable);
+    dnf_repo_prefetch_join(prefetch);
+
+    for (guint i = 0; i < prefetch->files->len; i++) {
+        DnfRepoPrefetchFile *file = &g_array_index(prefetch->files, DnfRepoPrefetchFile, i);
+
+        /* a verified partial file has been renamed already */
+        if (file->dest_info != NULL) {
+            g_unlink(file->dest);
+            g_unlink(file->dest_info);
+            continue;
+        }
+        if (!dnf_verified_cache_check_checksum(file->path,
+                                               file->checksum_type,
+                                               file->checksum))
+            g_unlink(file->path);
+    }
+}
+
+/**
+ * dnf_repo_prefetch_free:
+ * @prefetch: a #DnfRepoPrefetch
+ *
+ * Frees the prefetch, cancelling it first if it is still running.
+ *
+ * Since: 0.8.0
+ **/
+void
+dnf_repo_prefetch_free(DnfRepoPrefetch *prefetch)
+{
+    dnf_repo_prefetch_cancel(prefetch);
+    for (guint i = 0; i < prefetch->files->len; i++) {
+        DnfRepoPrefetchFile *file = &g_array_index(prefetch->files, DnfRepoPrefetchFile, i);
+        g_free(file->path);
+        g_free(file->dest);
+        g_free(file->dest_info);
+        g_free(file->checksum);
+    }
+    g_array_unref(prefetch->files);
+    g_slist_free_full(prefetch->package_targets, (GDestroyNotify)lr_packagetarget_free);
+    global_download_data_clear(&prefetch->global_data);
+    g_ptr_array_unref(prefetch->repos);
+    g_clear_error(&prefetch->error);
+    g_object_unref(prefetch->state);
+    g_object_unref(prefetch->cancellable);
+    g_mutex_clear(&prefetch->mutex);
+    g_cond_clear(&prefetch->cond);
+    g_slice_free(DnfRepoPrefetch, prefetch);
+}
+
+/**
+ * dnf_repo_download_deltas:
+ * @packages: (element-type DnfPackage): the packages to rebuild
+ * @deltas: (element-type DnfPackageDelta): a delta for each of @packages
+ * @downloaded_func: (scope call): called as each delta is available
+ * @downloaded_data: user data for @downloaded_func
+ * @state: a #DnfState.
+ * @error: a #GError or %NULL.
+ *
+ * Downloads delta RPMs from all repos at the same time, into the
+ * packages directory of the repo of each package. A delta that fails to
+ * download is not an error, @downloaded_func is just not called for its
+ * package so the caller can fall back to the full package.
+ *
+ * Returns: %TRUE for success, %FALSE otherwise
+ *
+ * Since: 0.8.0
+ **/
+gboolean
+dnf_repo_download_deltas(GPtrArray *packages,
+                         GPtrArray *deltas,
+                         DnfRepoDownloadedFunc downloaded_func,
+                         gpointer downloaded_data,
+                         DnfState *state,
+                         GError **error)
+{
+    gboolean ret = FALSE;
+    guint i;
+    GSList *package_targets = NULL;
+    GlobalDownloadData global_data = { 0, };
+    g_autoptr(GPtrArray) repos = g_ptr_array_new();
+    g_autoptr(GHashTable) repos_set = g_hash_table_new(NULL, NULL);
+    g_autoptr(GError) error_local = NULL;
+
+    global_data.downloaded_func = downloaded_func;
+    global_data.downloaded_data = downloaded_data;
+    for (i = 0; i < packages->len; i++) {
+        DnfPackage *pkg = g_ptr_array_index(packages, i);
+        DnfPackageDelta *delta = g_ptr_array_index(deltas, i);
+        DnfRepo *repo = dnf_package_get_repo(pkg);
+        DnfRepoPrivate *priv;
+        PackageDownloadData *data;
+        LrPackageTarget *target;
+        const unsigned char *checksum;
+        int checksum_type;
+        g_autofree gchar *checksum_str = NULL;
+        g_autofree gchar *directory_slash = NULL;
+        g_autofree gchar *basename = NULL;
+
+        if (repo == NULL || dnf_repo_is_local(repo))
+            continue;
+        priv = GET_PRIVATE(repo);
+        if (!dnf_repo_download_setup(repo, NULL, &directory_slash, error))
+            goto out;
+        if (g_hash_table_add(repos_set, repo)) {
+            if (!lr_handle_setopt(priv->repo_handle, error, LRO_MAXPARALLELDOWNLOADS,
+                                  (long) dnf_context_get_max_parallel_downloads(priv->context)))
+                goto out;
+            if (!lr_handle_setopt(priv->repo_handle, error, LRO_MAXDOWNLOADSPERMIRROR,
+                                  (long) dnf_context_get_max_downloads_per_host(priv->context)))
+                goto out;
+            g_ptr_array_add(repos, repo);
+        }
+
+        data = g_slice_new0(PackageDownloadData);
+        data->pkg = pkg;
+        data->repo = repo;
+        data->state = state;
+        data->global_download_data = &global_data;
+        checksum = dnf_packagedelta_get_chksum(delta, &checksum_type);
+        checksum_str = hy_chksum_str(checksum, checksum_type);
+        basename = g_path_get_basename(dnf_packagedelta_get_location(delta));
+        data->path = g_build_filename(directory_slash, basename, NULL);
+        data->checksum_type = dnf_repo_checksum_hy_to_lr(checksum_type);
+        data->checksum = g_strdup(checksum_str);
+        package_download_data_set_dest(data, dnf_packagedelta_get_downloadsize(delta));
+        global_data.download_size += dnf_packagedelta_get_downloadsize(delta);
+
+        g_debug("downloading delta %s to %s",
+                dnf_packagedelta_get_location(delta),
+                directory_slash);
+        target = lr_packagetarget_new_v2(priv->repo_handle,
+                                         dnf_packagedelta_get_location(delta),
+                                         data->dest,
+                                         data->checksum_type,
+                                         checksum_str,
+                                         dnf_packagedelta_get_downloadsize(delta),
+                                         dnf_packagedelta_get_baseurl(delta),
+                                         TRUE,
+                                         package_download_update_state_cb,
+                                         data,
+                                         package_download_end_cb,
+                                         mirrorlist_failure_cb,
+                                         error);
+        if (target == NULL) {
+            package_download_data_free(data);
+            goto out;
+        }
+        data->target = target;
+        package_targets = g_slist_prepend(package_targets, target);
+    }
+
+    /* not failfast, a missing delta only means the full package is used */
+    if (package_targets != NULL &&
+        !lr_download_packages(package_targets, 0, &error_local))
+        g_debug("failed to download deltas: %s", error_local->message);
+    dnf_repo_record_transfers(package_targets, &global_data);
+
+    /* but do not carry on if the user cancelled */
+    if (!dnf_state_check(state, error))
+        goto out;
+    ret = dnf_state_finished(state, error);
+out:
+    for (i = 0; i < repos->len; i++) {
+        DnfRepoPrivate *priv = GET_PRIVATE(repos->pdata[i]);
+        lr_handle_setopt(priv->repo_handle, NULL, LRO_PROGRESSCB, NULL);
+        lr_handle_setopt(priv->repo_handle, NULL, LRO_PROGRESSDATA, 0xdeadbeef);
+    }
+    global_download_data_clear(&global_data);
     g_slist_free_full(package_targets, (GDestroyNotify)lr_packagetarget_free);
     return ret;
 }
@@ -101,6 +101,18 @@ typedef enum {
         DNF_REPO_ENABLED_LAST
 } DnfRepoEnabled;
 
+/**
+ * DnfRepoDownloadedFunc:
+ * @pkg: the package that is now available locally
+ * @user_data: user data
+ *
+ * Called as each package of a batch becomes available.
+ **/
+typedef void (*DnfRepoDownloadedFunc)   (DnfPackage     *pkg,
+                                         gpointer        user_data);
+
+typedef struct _DnfRepoPrefetch DnfRepoPrefetch;
+
 DnfRepo         *dnf_repo_new                   (DnfContext           *context);
 
 /* getters */
@@ -126,6 +138,7 @@ HyRepo           dnf_repo_get_repo              (DnfRepo              *repo);
 #endif
 gboolean         dnf_repo_is_devel              (DnfRepo              *repo);
 gboolean         dnf_repo_is_local              (DnfRepo              *repo);
+gboolean         dnf_repo_is_checked            (DnfRepo              *repo);
 gboolean         dnf_repo_is_repo             (DnfRepo              *repo);
 
 /* setters */
@@ -167,6 +180,11 @@ gboolean         dnf_repo_update                (DnfRepo              *repo,
                                                  DnfRepoUpdateFlags    flags,
                                                  DnfState             *state,
                                                  GError              **error);
+gboolean         dnf_repo_update_all            (GPtrArray            *repos,
+                                                 DnfRepoUpdateFlags    flags,
+                                                 GPtrArray            *failed,
+                                                 DnfState             *state,
+                                                 GError              **error);
 gboolean         dnf_repo_clean                 (DnfRepo              *repo,
                                                  GError              **error);
 gboolean         dnf_repo_set_data              (DnfRepo              *repo,
@@ -193,6 +211,25 @@ gboolean         dnf_repo_download_packages     (DnfRepo              *repo,
                                                  const gchar          *directory,
                                                  DnfState             *state,
                                                  GError              **error);
+gboolean         dnf_repo_download_packages_all (GPtrArray            *pkgs,
+                                                 const gchar          *directory,
+                                                 DnfRepoDownloadedFunc downloaded_func,
+                                                 gpointer              downloaded_data,
+                                                 DnfState             *state,
+                                                 GError              **error);
+gboolean         dnf_repo_download_deltas       (GPtrArray            *pkgs,
+                                                 GPtrArray            *deltas,
+                                                 DnfRepoDownloadedFunc downloaded_func,
+                                                 gpointer              downloaded_data,
+                                                 DnfState             *state,
+                                                 GError              **error);
+DnfRepoPrefetch *dnf_repo_prefetch_start        (GPtrArray            *pkgs,
+                                                 GError              **error);
+gboolean         dnf_repo_prefetch_wait         (DnfRepoPrefetch      *prefetch,
+                                                 DnfState             *state,
+                                                 GError              **error);
+void             dnf_repo_prefetch_cancel       (DnfRepoPrefetch      *prefetch);
+void             dnf_repo_prefetch_free         (DnfRepoPrefetch      *prefetch);
 #endif
 
 G_END_DECLS
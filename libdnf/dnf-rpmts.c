@@ -41,35 +41,14 @@
 #include "dnf-utils.h"
 
 /**
- * dnf_rpmts_add_install_filename:
- * @ts: a #rpmts instance.
- * @filename: the package.
- * @allow_untrusted: is we can add untrusted packages.
- * @is_update: if the package is an update.
- * @error: a #GError or %NULL..
- *
- * Add to the transaction a package to be installed.
- *
- * Returns: %TRUE for success, %FALSE otherwise
- *
- * Since: 0.1.0
+ * dnf_rpmts_check_read_result:
  **/
-gboolean
-dnf_rpmts_add_install_filename(rpmts ts,
-                               const gchar *filename,
-                               gboolean allow_untrusted,
-                               gboolean is_update,
-                               GError **error)
+static gboolean
+dnf_rpmts_check_read_result(const gchar *filename,
+                            rpmRC res,
+                            gboolean allow_untrusted,
+                            GError **error)
 {
-    gboolean ret = TRUE;
-    gint res;
-    Header hdr;
-    FD_t fd;
-
-    /* open this */
-    fd = Fopen(filename, "r.ufdio");
-    res = rpmReadPackageFile(ts, fd, filename, &hdr);
-
     /* be less strict when we're allowing untrusted transactions */
     if (allow_untrusted) {
         switch(res) {
@@ -79,81 +58,140 @@ dnf_rpmts_add_install_filename(rpmts ts,
         case RPMRC_OK:
             break;
         case RPMRC_FAIL:
-            ret = FALSE;
             g_set_error(error,
                         DNF_ERROR,
                         DNF_ERROR_INTERNAL_ERROR,
                         "signature does not verify for %s",
                         filename);
-            goto out;
+            return FALSE;
         default:
-            ret = FALSE;
             g_set_error(error,
                         DNF_ERROR,
                         DNF_ERROR_INTERNAL_ERROR,
                         "failed to open(generic error): %s",
                         filename);
-            goto out;
+            return FALSE;
         }
     } else {
         switch(res) {
         case RPMRC_OK:
             break;
         case RPMRC_NOTTRUSTED:
-            ret = FALSE;
             g_set_error(error,
                         DNF_ERROR,
                         DNF_ERROR_INTERNAL_ERROR,
                         "failed to verify key for %s",
                         filename);
-            goto out;
+            return FALSE;
         case RPMRC_NOKEY:
-            ret = FALSE;
             g_set_error(error,
                         DNF_ERROR,
                         DNF_ERROR_INTERNAL_ERROR,
                         "public key unavailable for %s",
                         filename);
-            goto out;
+            return FALSE;
         case RPMRC_NOTFOUND:
-            ret = FALSE;
             g_set_error(error,
                         DNF_ERROR,
                         DNF_ERROR_INTERNAL_ERROR,
                         "signature not found for %s",
                         filename);
-            goto out;
+            return FALSE;
         case RPMRC_FAIL:
-            ret = FALSE;
             g_set_error(error,
                         DNF_ERROR,
                         DNF_ERROR_INTERNAL_ERROR,
                         "signature does not verify for %s",
                         filename);
-            goto out;
+            return FALSE;
         default:
-            ret = FALSE;
             g_set_error(error,
                         DNF_ERROR,
                         DNF_ERROR_INTERNAL_ERROR,
                         "failed to open(generic error): %s",
                         filename);
-            goto out;
+            return FALSE;
         }
     }
+    return TRUE;
+}
+
+/**
+ * dnf_rpmts_add_install_header:
+ * @ts: a #rpmts instance.
+ * @filename: the package.
+ * @hdr: the header read from @filename.
+ * @res: the result rpmReadPackageFile() returned when reading @hdr.
+ * @allow_untrusted: is we can add untrusted packages.
+ * @is_update: if the package is an update.
+ * @error: a #GError or %NULL..
+ *
+ * Add to the transaction a package to be installed, using a header that
+ * has already been read, for instance while other packages were still
+ * downloading.
+ *
+ * Returns: %TRUE for success, %FALSE otherwise
+ *
+ * Since: 0.8.0
+ **/
+gboolean
+dnf_rpmts_add_install_header(rpmts ts,
+                             const gchar *filename,
+                             Header hdr,
+                             rpmRC res,
+                             gboolean allow_untrusted,
+                             gboolean is_update,
+                             GError **error)
+{
+    gint rc;
+
+    if (!dnf_rpmts_check_read_result(filename, res, allow_untrusted, error))
+        return FALSE;
 
     /* add to the transaction */
-    res = rpmtsAddInstallElement(ts, hdr, (fnpyKey) filename, is_update, NULL);
-    if (res != 0) {
-        ret = FALSE;
+    rc = rpmtsAddInstallElement(ts, hdr, (fnpyKey) filename, is_update, NULL);
+    if (rc != 0) {
         g_set_error(error,
                     DNF_ERROR,
                     DNF_ERROR_INTERNAL_ERROR,
                     "failed to add install element: %s [%i]",
-                    filename, res);
-        goto out;
+                    filename, rc);
+        return FALSE;
     }
-out:
+    return TRUE;
+}
+
+/**
+ * dnf_rpmts_add_install_filename:
+ * @ts: a #rpmts instance.
+ * @filename: the package.
+ * @allow_untrusted: is we can add untrusted packages.
+ * @is_update: if the package is an update.
+ * @error: a #GError or %NULL..
+ *
+ * Add to the transaction a package to be installed.
+ *
+ * Returns: %TRUE for success, %FALSE otherwise
+ *
+ * Since: 0.1.0
+ **/
+gboolean
+dnf_rpmts_add_install_filename(rpmts ts,
+                               const gchar *filename,
+                               gboolean allow_untrusted,
+                               gboolean is_update,
+                               GError **error)
+{
+    gboolean ret;
+    rpmRC res;
+    Header hdr = NULL;
+    FD_t fd;
+
+    /* open this */
+    fd = Fopen(filename, "r.ufdio");
+    res = rpmReadPackageFile(ts, fd, filename, &hdr);
+    ret = dnf_rpmts_add_install_header(ts, filename, hdr, res,
+                                       allow_untrusted, is_update, error);
     Fclose(fd);
     headerFree(hdr);
     return ret;
@@ -422,3 +460,117 @@ out:
         headerFree(hdr);
     return ret;
 }
+
+/**
+ * dnf_rpmts_offset_cmp:
+ **/
+static gint
+dnf_rpmts_offset_cmp(gconstpointer a, gconstpointer b)
+{
+    guint offset_a = *((const guint *) a);
+    guint offset_b = *((const guint *) b);
+    if (offset_a < offset_b)
+        return -1;
+    if (offset_a > offset_b)
+        return 1;
+    return 0;
+}
+
+/**
+ * dnf_rpmts_add_remove_pkgs:
+ * @ts: a #rpmts instance.
+ * @pkgs: (element-type DnfPackage): installed packages
+ * @error: a #GError or %NULL..
+ *
+ * Adds to the transaction several packages to be removed. All the headers
+ * are read with a single rpmdb iterator in database order, rather than
+ * setting up an iterator for each package.
+ *
+ * Returns: %TRUE for success, %FALSE otherwise
+ *
+ * Since: 0.8.0
+ **/
+gboolean
+dnf_rpmts_add_remove_pkgs(rpmts ts, GPtrArray *pkgs, GError **error)
+{
+    gboolean ret = FALSE;
+    gint retval;
+    guint i;
+    guint offset;
+    Header hdr;
+    DnfPackage *pkg;
+    rpmdbMatchIterator iter = NULL;
+    g_autoptr(GArray) offsets = NULL;
+    g_autoptr(GHashTable) headers = NULL;
+    g_autoptr(GString) rpm_error = NULL;
+
+    if (pkgs->len == 0)
+        return TRUE;
+
+    /* sorted, so the database is read in order */
+    offsets = g_array_sized_new(FALSE, FALSE, sizeof(guint), pkgs->len);
+    for (i = 0; i < pkgs->len; i++) {
+        pkg = g_ptr_array_index(pkgs, i);
+        offset = dnf_package_get_rpmdbid(pkg);
+        g_array_append_val(offsets, offset);
+    }
+    g_array_sort(offsets, dnf_rpmts_offset_cmp);
+
+    /* db-id:Header */
+    headers = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                    NULL, (GDestroyNotify) headerFree);
+    rpmlogSetCallback(dnf_rpmts_log_handler_cb, &rpm_error);
+    iter = rpmtsInitIterator(ts, RPMDBI_PACKAGES, NULL, 0);
+    if (iter == NULL) {
+        if (rpm_error != NULL) {
+            g_set_error_literal(error,
+                                DNF_ERROR,
+                                DNF_ERROR_UNFINISHED_TRANSACTION,
+                                rpm_error->str);
+        } else {
+            g_set_error_literal(error,
+                                DNF_ERROR,
+                                DNF_ERROR_UNFINISHED_TRANSACTION,
+                                "Fatal error, run database recovery");
+        }
+        goto out;
+    }
+    rpmdbAppendIterator(iter, (const unsigned int *) offsets->data, offsets->len);
+    while ((hdr = rpmdbNextIterator(iter)) != NULL) {
+        offset = rpmdbGetIteratorOffset(iter);
+        g_hash_table_insert(headers, GUINT_TO_POINTER(offset), headerLink(hdr));
+    }
+    rpmdbFreeIterator(iter);
+    iter = NULL;
+    rpmlogSetCallback(NULL, NULL);
+
+    /* remove them, in the order they were given */
+    for (i = 0; i < pkgs->len; i++) {
+        pkg = g_ptr_array_index(pkgs, i);
+        offset = dnf_package_get_rpmdbid(pkg);
+        hdr = g_hash_table_lookup(headers, GUINT_TO_POINTER(offset));
+        if (hdr == NULL) {
+            g_set_error(error,
+                        DNF_ERROR,
+                        DNF_ERROR_FILE_NOT_FOUND,
+                        "failed to find package %s",
+                        dnf_package_get_name(pkg));
+            goto out;
+        }
+        retval = rpmtsAddEraseElement(ts, hdr, -1);
+        if (retval != 0) {
+            g_set_error(error,
+                        DNF_ERROR,
+                        DNF_ERROR_INTERNAL_ERROR,
+                        "could not add erase element %s(%i)",
+                        dnf_package_get_name(pkg), retval);
+            goto out;
+        }
+    }
+    ret = TRUE;
+out:
+    rpmlogSetCallback(NULL, NULL);
+    if (iter != NULL)
+        rpmdbFreeIterator(iter);
+    return ret;
+}
@@ -31,9 +31,19 @@ gboolean         dnf_rpmts_add_install_filename (rpmts           ts,
                                                  gboolean        allow_untrusted,
                                                  gboolean        is_update,
                                                  GError         **error);
+gboolean         dnf_rpmts_add_install_header   (rpmts           ts,
+                                                 const gchar    *filename,
+                                                 Header          hdr,
+                                                 rpmRC           res,
+                                                 gboolean        allow_untrusted,
+                                                 gboolean        is_update,
+                                                 GError         **error);
 gboolean         dnf_rpmts_add_remove_pkg       (rpmts           ts,
                                                  DnfPackage *      pkg,
                                                  GError         **error);
+gboolean         dnf_rpmts_add_remove_pkgs      (rpmts           ts,
+                                                 GPtrArray      *pkgs,
+                                                 GError         **error);
 gboolean         dnf_rpmts_look_for_problems    (rpmts           ts,
                                                  GError         **error);
 
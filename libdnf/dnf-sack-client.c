@@ -0,0 +1,268 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/**
+ * SECTION:dnf-sack-client
+ * @short_description: Query a resident sack server
+ * @include: libdnf.h
+ * @stability: Unstable
+ *
+ * A thin synchronous client for the line protocol spoken by #DnfSackServer.
+ * The connection is opened on the first request and kept for later ones.
+ *
+ * See also: #DnfSackServer
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+
+#include "dnf-sack-client.h"
+#include "dnf-types.h"
+
+typedef struct
+{
+    gchar               *socket_path;
+    GSocketConnection   *connection;
+    GDataInputStream    *input;
+} DnfSackClientPrivate;
+
+G_DEFINE_TYPE_WITH_PRIVATE(DnfSackClient, dnf_sack_client, G_TYPE_OBJECT)
+#define GET_PRIVATE(o) (dnf_sack_client_get_instance_private (o))
+
+/**
+ * dnf_sack_client_finalize:
+ **/
+static void
+dnf_sack_client_finalize(GObject *object)
+{
+    DnfSackClient *client = DNF_SACK_CLIENT(object);
+    DnfSackClientPrivate *priv = GET_PRIVATE(client);
+
+    g_free(priv->socket_path);
+    g_clear_object(&priv->input);
+    g_clear_object(&priv->connection);
+
+    G_OBJECT_CLASS(dnf_sack_client_parent_class)->finalize(object);
+}
+
+/**
+ * dnf_sack_client_init:
+ **/
+static void
+dnf_sack_client_init(DnfSackClient *client)
+{
+}
+
+/**
+ * dnf_sack_client_class_init:
+ **/
+static void
+dnf_sack_client_class_init(DnfSackClientClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    object_class->finalize = dnf_sack_client_finalize;
+}
+
+/**
+ * dnf_sack_client_disconnect:
+ **/
+static void
+dnf_sack_client_disconnect(DnfSackClient *client)
+{
+    DnfSackClientPrivate *priv = GET_PRIVATE(client);
+    g_clear_object(&priv->input);
+    g_clear_object(&priv->connection);
+}
+
+/**
+ * dnf_sack_client_connect:
+ * @client: a #DnfSackClient instance.
+ * @error: a #GError or %NULL
+ *
+ * Connects to the server. Calling this is optional, as
+ * dnf_sack_client_request() connects on demand.
+ *
+ * Returns: %TRUE for success, %FALSE otherwise
+ *
+ * Since: 0.8.0
+ **/
+gboolean
+dnf_sack_client_connect(DnfSackClient *client, GError **error)
+{
+    DnfSackClientPrivate *priv = GET_PRIVATE(client);
+    g_autoptr(GSocketClient) socket_client = NULL;
+    g_autoptr(GSocketAddress) address = NULL;
+    g_autoptr(GError) error_local = NULL;
+
+    g_return_val_if_fail(DNF_IS_SACK_CLIENT(client), FALSE);
+
+    if (priv->connection != NULL)
+        return TRUE;
+
+    socket_client = g_socket_client_new();
+    address = g_unix_socket_address_new(priv->socket_path);
+    priv->connection = g_socket_client_connect(socket_client,
+                                               G_SOCKET_CONNECTABLE(address),
+                                               NULL, &error_local);
+    if (priv->connection == NULL) {
+        g_set_error(error,
+                    DNF_ERROR,
+                    DNF_ERROR_FAILED,
+                    "failed to connect to %s: %s",
+                    priv->socket_path, error_local->message);
+        return FALSE;
+    }
+    priv->input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(priv->connection)));
+    return TRUE;
+}
+
+/**
+ * dnf_sack_client_read_line:
+ **/
+static gchar *
+dnf_sack_client_read_line(DnfSackClient *client, GError **error)
+{
+    DnfSackClientPrivate *priv = GET_PRIVATE(client);
+    gchar *line;
+    g_autoptr(GError) error_local = NULL;
+
+    line = g_data_input_stream_read_line(priv->input, NULL, NULL, &error_local);
+    if (line == NULL) {
+        g_set_error(error,
+                    DNF_ERROR,
+                    DNF_ERROR_FAILED,
+                    "connection to %s lost: %s",
+                    priv->socket_path,
+                    error_local != NULL ? error_local->message : "end of stream");
+        return NULL;
+    }
+    return line;
+}
+
+/**
+ * dnf_sack_client_request:
+ * @client: a #DnfSackClient instance.
+ * @command: the protocol command, e.g. "name" or "install"
+ * @argument: (nullable): the command argument, or %NULL
+ * @error: a #GError or %NULL
+ *
+ * Sends a request and waits for the response. Each result line is a
+ * package NEVRA followed by its repo name; resolve requests prefix every
+ * line with the action, e.g. "install" or "erase".
+ *
+ * Returns: (transfer full): the result lines, or %NULL on error
+ *
+ * Since: 0.8.0
+ **/
+gchar **
+dnf_sack_client_request(DnfSackClient *client,
+                        const gchar *command,
+                        const gchar *argument,
+                        GError **error)
+{
+    DnfSackClientPrivate *priv = GET_PRIVATE(client);
+    GOutputStream *output;
+    gchar *endptr = NULL;
+    guint64 count = 0;
+    g_autofree gchar *request = NULL;
+    g_autofree gchar *status = NULL;
+    g_autoptr(GPtrArray) lines = NULL;
+
+    g_return_val_if_fail(DNF_IS_SACK_CLIENT(client), NULL);
+    g_return_val_if_fail(command != NULL, NULL);
+
+    if (!dnf_sack_client_connect(client, error))
+        return NULL;
+
+    if (argument != NULL)
+        request = g_strdup_printf("%s %s\n", command, argument);
+    else
+        request = g_strdup_printf("%s\n", command);
+    output = g_io_stream_get_output_stream(G_IO_STREAM(priv->connection));
+    if (!g_output_stream_write_all(output, request, strlen(request),
+                                   NULL, NULL, error)) {
+        dnf_sack_client_disconnect(client);
+        return NULL;
+    }
+
+    status = dnf_sack_client_read_line(client, error);
+    if (status == NULL) {
+        dnf_sack_client_disconnect(client);
+        return NULL;
+    }
+    if (g_str_has_prefix(status, "ERR ")) {
+        g_autofree gchar *message = g_strcompress(status + 4);
+        g_set_error_literal(error,
+                            DNF_ERROR,
+                            DNF_ERROR_FAILED,
+                            message);
+        return NULL;
+    }
+    if (g_str_has_prefix(status, "OK "))
+        count = g_ascii_strtoull(status + 3, &endptr, 10);
+    if (endptr == NULL || *endptr != '\0') {
+        g_set_error(error,
+                    DNF_ERROR,
+                    DNF_ERROR_FAILED,
+                    "invalid response: %s", status);
+        dnf_sack_client_disconnect(client);
+        return NULL;
+    }
+
+    lines = g_ptr_array_new_with_free_func(g_free);
+    for (guint64 i = 0; i < count; i++) {
+        gchar *line = dnf_sack_client_read_line(client, error);
+        if (line == NULL) {
+            dnf_sack_client_disconnect(client);
+            return NULL;
+        }
+        g_ptr_array_add(lines, line);
+    }
+    g_ptr_array_add(lines, NULL);
+    g_ptr_array_set_free_func(lines, NULL);
+    return (gchar **) g_ptr_array_free(g_steal_pointer(&lines), FALSE);
+}
+
+/**
+ * dnf_sack_client_new:
+ * @socket_path: the filename of the server socket
+ *
+ * Creates a new #DnfSackClient.
+ *
+ * Returns:(transfer full): a #DnfSackClient
+ *
+ * Since: 0.8.0
+ **/
+DnfSackClient *
+dnf_sack_client_new(const gchar *socket_path)
+{
+    DnfSackClient *client;
+    DnfSackClientPrivate *priv;
+
+    client = g_object_new(DNF_TYPE_SACK_CLIENT, NULL);
+    priv = GET_PRIVATE(client);
+    priv->socket_path = g_strdup(socket_path);
+    return DNF_SACK_CLIENT(client);
+}
@@ -28,6 +28,13 @@
 
 typedef Id  (*dnf_sack_running_kernel_fn_t) (DnfSack    *sack);
 
+typedef struct {
+    guint       full_recomputes;        /* considered map rebuilt from scratch */
+    guint       incremental_updates;    /* exclude/include deltas applied in place */
+    guint       whatprovides_rebuilds;  /* pool_createwhatprovides() calls */
+    guint       whatprovides_avoided;   /* rebuilds coalesced into a later one */
+} DnfSackConsideredStats;
+
 void         dnf_sack_make_provides_ready   (DnfSack    *sack);
 Id           dnf_sack_running_kernel        (DnfSack    *sack);
 int          dnf_sack_knows                 (DnfSack    *sack,
@@ -35,11 +42,18 @@ int          dnf_sack_knows                 (DnfSack    *sack,
                                              const char *version,
                                              int         flags);
 void         dnf_sack_recompute_considered  (DnfSack    *sack);
+void         dnf_sack_add_repo_excludes     (DnfSack    *sack,
+                                             GPtrArray  *repos);
+void         dnf_sack_get_considered_stats  (DnfSack    *sack,
+                                             DnfSackConsideredStats *stats);
 Pool        *dnf_sack_get_pool              (DnfSack    *sack);
 Id           dnf_sack_last_solvable         (DnfSack    *sack);
 
 Queue       *dnf_sack_get_installonly       (DnfSack    *sack);
 void         dnf_sack_set_running_kernel_fn (DnfSack    *sack,
                                              dnf_sack_running_kernel_fn_t fn);
+GHashTable  *dnf_sack_get_solution_cache    (DnfSack    *sack);
+void         dnf_sack_set_solution_cache    (DnfSack    *sack,
+                                             GHashTable *cache);
 
 #endif // HY_SACK_INTERNAL_H
@@ -0,0 +1,614 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/**
+ * SECTION:dnf-sack-server
+ * @short_description: Serve queries against a resident sack
+ * @include: libdnf.h
+ * @stability: Unstable
+ *
+ * This object keeps the sack of a #DnfContext loaded and answers query and
+ * resolve requests from other processes over a UNIX domain socket, so that
+ * short-lived tools do not pay the setup cost on every invocation.
+ *
+ * The protocol is line based. Each request is a single line of the form
+ * "COMMAND [ARGUMENT]" and each response is either "ERR message" or
+ * "OK n" followed by exactly n result lines. The message is escaped with
+ * g_strescape(), as errors such as solver problems can span lines.
+ *
+ * The sack is reloaded lazily on the next request after the rpmdb or the
+ * repo directory has changed.
+ *
+ * See also: #DnfSackClient
+ */
+
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+
+#include "dnf-repo-loader.h"
+#include "dnf-sack-server.h"
+#include "dnf-types.h"
+#include "hy-goal.h"
+#include "hy-package.h"
+#include "hy-query.h"
+#include "hy-selector.h"
+
+typedef struct
+{
+    DnfContext          *context;
+    GSocketService      *service;
+    gchar               *socket_path;
+    gboolean             sack_valid;
+    guint                requests;
+    guint                reloads;
+    gulong               invalidate_id;
+    gulong               repos_changed_id;
+} DnfSackServerPrivate;
+
+typedef struct {
+    DnfSackServer       *server;
+    GSocketConnection   *connection;
+    GDataInputStream    *input;
+    GOutputStream       *output;
+} DnfSackServerClient;
+
+G_DEFINE_TYPE_WITH_PRIVATE(DnfSackServer, dnf_sack_server, G_TYPE_OBJECT)
+#define GET_PRIVATE(o) (dnf_sack_server_get_instance_private (o))
+
+/**
+ * dnf_sack_server_finalize:
+ **/
+static void
+dnf_sack_server_finalize(GObject *object)
+{
+    DnfSackServer *server = DNF_SACK_SERVER(object);
+    DnfSackServerPrivate *priv = GET_PRIVATE(server);
+
+    dnf_sack_server_stop(server);
+    g_signal_handler_disconnect(priv->context, priv->invalidate_id);
+    g_signal_handler_disconnect(dnf_context_get_repo_loader(priv->context),
+                                priv->repos_changed_id);
+    g_object_unref(priv->context);
+
+    G_OBJECT_CLASS(dnf_sack_server_parent_class)->finalize(object);
+}
+
+/**
+ * dnf_sack_server_init:
+ **/
+static void
+dnf_sack_server_init(DnfSackServer *server)
+{
+}
+
+/**
+ * dnf_sack_server_class_init:
+ **/
+static void
+dnf_sack_server_class_init(DnfSackServerClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    object_class->finalize = dnf_sack_server_finalize;
+}
+
+/**
+ * dnf_sack_server_invalidate_cb:
+ **/
+static void
+dnf_sack_server_invalidate_cb(DnfContext *context,
+                              const gchar *message,
+                              DnfSackServer *server)
+{
+    DnfSackServerPrivate *priv = GET_PRIVATE(server);
+    g_debug("sack server invalidated: %s", message);
+    priv->sack_valid = FALSE;
+}
+
+/**
+ * dnf_sack_server_repos_changed_cb:
+ **/
+static void
+dnf_sack_server_repos_changed_cb(DnfRepoLoader *repo_loader,
+                                 DnfSackServer *server)
+{
+    DnfSackServerPrivate *priv = GET_PRIVATE(server);
+    g_debug("sack server invalidated: repos changed");
+    priv->sack_valid = FALSE;
+}
+
+/**
+ * dnf_sack_server_ensure_sack:
+ *
+ * Reloads the sack if the rpmdb or the repos changed since the last request.
+ **/
+static gboolean
+dnf_sack_server_ensure_sack(DnfSackServer *server, GError **error)
+{
+    DnfSackServerPrivate *priv = GET_PRIVATE(server);
+    DnfRepoLoader *repo_loader;
+    DnfState *state;
+    g_autoptr(GPtrArray) repos = NULL;
+
+    if (priv->sack_valid && dnf_context_get_sack(priv->context) != NULL)
+        return TRUE;
+
+    /* the loader re-reads repos.d into the array the context also holds */
+    repo_loader = dnf_context_get_repo_loader(priv->context);
+    repos = dnf_repo_loader_get_repos(repo_loader, error);
+    if (repos == NULL)
+        return FALSE;
+
+    state = dnf_context_get_state(priv->context);
+    dnf_state_reset(state);
+    if (!dnf_context_setup_sack(priv->context, state, error))
+        return FALSE;
+    priv->sack_valid = TRUE;
+    priv->reloads++;
+    return TRUE;
+}
+
+/**
+ * dnf_sack_server_append_packages:
+ **/
+static void
+dnf_sack_server_append_packages(GString *str, GPtrArray *pkglist, const gchar *prefix)
+{
+    guint i;
+
+    for (i = 0; i < pkglist->len; i++) {
+        DnfPackage *pkg = g_ptr_array_index(pkglist, i);
+        if (prefix != NULL)
+            g_string_append_printf(str, "%s ", prefix);
+        g_string_append_printf(str, "%s %s\n",
+                               dnf_package_get_nevra(pkg),
+                               dnf_package_get_reponame(pkg));
+    }
+}
+
+/**
+ * dnf_sack_server_append_error:
+ **/
+static void
+dnf_sack_server_append_error(GString *str, const gchar *message)
+{
+    g_autofree gchar *escaped = g_strescape(message, NULL);
+    g_string_append_printf(str, "ERR %s\n", escaped);
+}
+
+/**
+ * dnf_sack_server_query:
+ **/
+static GPtrArray *
+dnf_sack_server_query(DnfSack *sack,
+                      const gchar *command,
+                      const gchar *argument,
+                      GError **error)
+{
+    hy_autoquery HyQuery query = NULL;
+
+    query = hy_query_create(sack);
+    if (g_strcmp0(command, "upgrades") == 0) {
+        hy_query_filter(query, HY_PKG_REPONAME, HY_NEQ, HY_SYSTEM_REPO_NAME);
+        hy_query_filter_upgrades(query, 1);
+        hy_query_filter_latest_per_arch(query, 1);
+        return hy_query_run(query);
+    }
+    if (argument == NULL) {
+        g_set_error(error,
+                    DNF_ERROR,
+                    DNF_ERROR_FAILED,
+                    "%s requires an argument", command);
+        return NULL;
+    }
+    if (g_strcmp0(command, "name") == 0) {
+        hy_query_filter(query, HY_PKG_NAME, HY_GLOB, argument);
+    } else if (g_strcmp0(command, "provides") == 0) {
+        hy_query_filter(query, HY_PKG_PROVIDES, HY_EQ, argument);
+    } else if (g_strcmp0(command, "file") == 0) {
+        hy_query_filter(query, HY_PKG_FILE, HY_EQ, argument);
+    } else if (g_strcmp0(command, "search") == 0) {
+        hy_query_filter(query, HY_PKG_SUMMARY, HY_SUBSTR | HY_ICASE, argument);
+    } else {
+        g_set_error(error,
+                    DNF_ERROR,
+                    DNF_ERROR_FAILED,
+                    "unknown command: %s", command);
+        return NULL;
+    }
+    return hy_query_run(query);
+}
+
+/**
+ * dnf_sack_server_resolve:
+ **/
+static gboolean
+dnf_sack_server_resolve(DnfSack *sack,
+                        const gchar *command,
+                        const gchar *argument,
+                        GString *str,
+                        GError **error)
+{
+    gboolean ret = FALSE;
+    guint count = 0;
+    DnfGoalActions flags = 0;
+    HyGoal goal;
+    HySelector sltr = NULL;
+    g_autoptr(GString) body = g_string_new("");
+    const struct {
+        const gchar *action;
+        GPtrArray *(*list)(HyGoal, GError **);
+    } lists[] = {
+        { "install",    hy_goal_list_installs },
+        { "upgrade",    hy_goal_list_upgrades },
+        { "downgrade",  hy_goal_list_downgrades },
+        { "reinstall",  hy_goal_list_reinstalls },
+        { "erase",      hy_goal_list_erasures },
+        { "obsolete",   hy_goal_list_obsoleted },
+        { NULL,         NULL }
+    };
+
+    goal = hy_goal_create(sack);
+    if (g_strcmp0(command, "upgrade-all") == 0) {
+        hy_goal_upgrade_all(goal);
+    } else {
+        if (argument == NULL) {
+            g_set_error(error,
+                        DNF_ERROR,
+                        DNF_ERROR_FAILED,
+                        "%s requires an argument", command);
+            goto out;
+        }
+        sltr = hy_selector_create(sack);
+        hy_selector_set(sltr, HY_PKG_NAME, HY_EQ, argument);
+        if (g_strcmp0(command, "install") == 0) {
+            if (!hy_goal_install_selector(goal, sltr, error))
+                goto out;
+        } else if (g_strcmp0(command, "erase") == 0) {
+            hy_goal_erase_selector(goal, sltr);
+        } else {
+            hy_goal_upgrade_selector(goal, sltr);
+        }
+    }
+
+    if (g_strcmp0(command, "erase") == 0)
+        flags |= DNF_ALLOW_UNINSTALL;
+    if (hy_goal_run_flags(goal, flags)) {
+        g_autofree gchar *problem = NULL;
+        problem = hy_goal_count_problems(goal) > 0 ?
+            hy_goal_describe_problem(goal, 0) : g_strdup("no solution");
+        g_set_error_literal(error,
+                            DNF_ERROR,
+                            DNF_ERROR_PACKAGE_CONFLICTS,
+                            problem);
+        goto out;
+    }
+
+    for (guint i = 0; lists[i].action != NULL; i++) {
+        g_autoptr(GPtrArray) pkglist = lists[i].list(goal, NULL);
+        if (pkglist == NULL)
+            continue;
+        dnf_sack_server_append_packages(body, pkglist, lists[i].action);
+        count += pkglist->len;
+    }
+    g_string_append_printf(str, "OK %u\n%s", count, body->str);
+    ret = TRUE;
+out:
+    if (sltr != NULL)
+        hy_selector_free(sltr);
+    hy_goal_free(goal);
+    return ret;
+}
+
+/**
+ * dnf_sack_server_handle_line:
+ * @server: a #DnfSackServer instance.
+ * @line: a request line, without the trailing newline
+ *
+ * Answers a single protocol request. This is what the socket handler calls
+ * for every line it reads; it is public so the protocol can be driven
+ * without a socket.
+ *
+ * Returns: (transfer full): the complete response, newline terminated
+ *
+ * Since: 0.8.0
+ **/
+gchar *
+dnf_sack_server_handle_line(DnfSackServer *server, const gchar *line)
+{
+    DnfSackServerPrivate *priv = GET_PRIVATE(server);
+    DnfSack *sack;
+    const gchar *argument;
+    GString *str = g_string_new(NULL);
+    g_auto(GStrv) split = NULL;
+    g_autoptr(GError) error = NULL;
+
+    g_return_val_if_fail(DNF_IS_SACK_SERVER(server), NULL);
+    g_return_val_if_fail(line != NULL, NULL);
+
+    priv->requests++;
+    split = g_strsplit(line, " ", 2);
+    if (split[0] == NULL || split[0][0] == '\0') {
+        g_string_append(str, "ERR empty request\n");
+        return g_string_free(str, FALSE);
+    }
+    argument = split[1];
+    if (g_strcmp0(split[0], "ping") == 0) {
+        g_string_append(str, "OK 0\n");
+        return g_string_free(str, FALSE);
+    }
+
+    if (!dnf_sack_server_ensure_sack(server, &error)) {
+        dnf_sack_server_append_error(str, error->message);
+        return g_string_free(str, FALSE);
+    }
+    sack = dnf_context_get_sack(priv->context);
+
+    if (g_strcmp0(split[0], "install") == 0 ||
+        g_strcmp0(split[0], "erase") == 0 ||
+        g_strcmp0(split[0], "upgrade") == 0 ||
+        g_strcmp0(split[0], "upgrade-all") == 0) {
+        if (!dnf_sack_server_resolve(sack, split[0], argument, str, &error))
+            dnf_sack_server_append_error(str, error->message);
+    } else {
+        g_autoptr(GPtrArray) pkglist = NULL;
+        pkglist = dnf_sack_server_query(sack, split[0], argument, &error);
+        if (pkglist == NULL) {
+            dnf_sack_server_append_error(str, error->message);
+        } else {
+            g_string_append_printf(str, "OK %u\n", pkglist->len);
+            dnf_sack_server_append_packages(str, pkglist, NULL);
+        }
+    }
+    return g_string_free(str, FALSE);
+}
+
+/**
+ * dnf_sack_server_client_free:
+ **/
+static void
+dnf_sack_server_client_free(DnfSackServerClient *client)
+{
+    g_object_unref(client->input);
+    g_object_unref(client->connection);
+    g_object_unref(client->server);
+    g_free(client);
+}
+
+/**
+ * dnf_sack_server_read_line_cb:
+ **/
+static void
+dnf_sack_server_read_line_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+    DnfSackServerClient *client = (DnfSackServerClient *) user_data;
+    gsize len;
+    g_autofree gchar *line = NULL;
+    g_autofree gchar *response = NULL;
+    g_autoptr(GError) error = NULL;
+
+    line = g_data_input_stream_read_line_finish(client->input, res, &len, &error);
+    if (line == NULL) {
+        if (error != NULL)
+            g_debug("sack server client dropped: %s", error->message);
+        dnf_sack_server_client_free(client);
+        return;
+    }
+
+    /* responses are small and the peer is local, so write synchronously */
+    g_strchomp(line);
+    response = dnf_sack_server_handle_line(client->server, line);
+    if (!g_output_stream_write_all(client->output, response, strlen(response),
+                                   NULL, NULL, &error)) {
+        g_debug("failed to write response: %s", error->message);
+        dnf_sack_server_client_free(client);
+        return;
+    }
+
+    g_data_input_stream_read_line_async(client->input, G_PRIORITY_DEFAULT, NULL,
+                                        dnf_sack_server_read_line_cb, client);
+}
+
+/**
+ * dnf_sack_server_incoming_cb:
+ **/
+static gboolean
+dnf_sack_server_incoming_cb(GSocketService *service,
+                            GSocketConnection *connection,
+                            GObject *source_object,
+                            DnfSackServer *server)
+{
+    DnfSackServerClient *client;
+
+    client = g_new0(DnfSackServerClient, 1);
+    client->server = g_object_ref(server);
+    client->connection = g_object_ref(connection);
+    client->input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+    client->output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+    g_data_input_stream_read_line_async(client->input, G_PRIORITY_DEFAULT, NULL,
+                                        dnf_sack_server_read_line_cb, client);
+    return TRUE;
+}
+
+/**
+ * dnf_sack_server_get_socket_path:
+ * @server: a #DnfSackServer instance.
+ *
+ * Gets the path of the listening socket.
+ *
+ * Returns: the path, or %NULL if the server is not running
+ *
+ * Since: 0.8.0
+ **/
+const gchar *
+dnf_sack_server_get_socket_path(DnfSackServer *server)
+{
+    DnfSackServerPrivate *priv = GET_PRIVATE(server);
+    g_return_val_if_fail(DNF_IS_SACK_SERVER(server), NULL);
+    return priv->socket_path;
+}
+
+/**
+ * dnf_sack_server_get_requests:
+ * @server: a #DnfSackServer instance.
+ *
+ * Gets the number of requests answered so far.
+ *
+ * Returns: the request count
+ *
+ * Since: 0.8.0
+ **/
+guint
+dnf_sack_server_get_requests(DnfSackServer *server)
+{
+    DnfSackServerPrivate *priv = GET_PRIVATE(server);
+    g_return_val_if_fail(DNF_IS_SACK_SERVER(server), 0);
+    return priv->requests;
+}
+
+/**
+ * dnf_sack_server_get_reloads:
+ * @server: a #DnfSackServer instance.
+ *
+ * Gets the number of times the sack has been (re)loaded.
+ *
+ * Returns: the reload count
+ *
+ * Since: 0.8.0
+ **/
+guint
+dnf_sack_server_get_reloads(DnfSackServer *server)
+{
+    DnfSackServerPrivate *priv = GET_PRIVATE(server);
+    g_return_val_if_fail(DNF_IS_SACK_SERVER(server), 0);
+    return priv->reloads;
+}
+
+/**
+ * dnf_sack_server_start:
+ * @server: a #DnfSackServer instance.
+ * @socket_path: the filename of the UNIX socket to listen on
+ * @error: a #GError or %NULL
+ *
+ * Loads the sack and starts listening for requests. A stale socket file
+ * left by a previous server is removed. Requests are served from the
+ * thread-default main context, so the caller has to run a main loop.
+ *
+ * Returns: %TRUE for success, %FALSE otherwise
+ *
+ * Since: 0.8.0
+ **/
+gboolean
+dnf_sack_server_start(DnfSackServer *server, const gchar *socket_path, GError **error)
+{
+    DnfSackServerPrivate *priv = GET_PRIVATE(server);
+    g_autoptr(GSocketAddress) address = NULL;
+
+    g_return_val_if_fail(DNF_IS_SACK_SERVER(server), FALSE);
+    g_return_val_if_fail(socket_path != NULL, FALSE);
+    g_return_val_if_fail(priv->service == NULL, FALSE);
+
+    /* load up front so the first client does not pay for it */
+    if (!dnf_sack_server_ensure_sack(server, error))
+        return FALSE;
+
+    if (unlink(socket_path) != 0 && errno != ENOENT) {
+        g_set_error(error,
+                    DNF_ERROR,
+                    DNF_ERROR_FAILED,
+                    "failed to remove %s: %s",
+                    socket_path, strerror(errno));
+        return FALSE;
+    }
+    priv->service = g_socket_service_new();
+    address = g_unix_socket_address_new(socket_path);
+    if (!g_socket_listener_add_address(G_SOCKET_LISTENER(priv->service),
+                                       address,
+                                       G_SOCKET_TYPE_STREAM,
+                                       G_SOCKET_PROTOCOL_DEFAULT,
+                                       NULL, NULL, error)) {
+        g_clear_object(&priv->service);
+        return FALSE;
+    }
+    g_signal_connect(priv->service, "incoming",
+                     G_CALLBACK(dnf_sack_server_incoming_cb), server);
+    g_socket_service_start(priv->service);
+    priv->socket_path = g_strdup(socket_path);
+    return TRUE;
+}
+
+/**
+ * dnf_sack_server_stop:
+ * @server: a #DnfSackServer instance.
+ *
+ * Stops listening and removes the socket file. Connected clients are
+ * served until they disconnect.
+ *
+ * Since: 0.8.0
+ **/
+void
+dnf_sack_server_stop(DnfSackServer *server)
+{
+    DnfSackServerPrivate *priv = GET_PRIVATE(server);
+
+    g_return_if_fail(DNF_IS_SACK_SERVER(server));
+
+    if (priv->service == NULL)
+        return;
+    g_socket_service_stop(priv->service);
+    g_socket_listener_close(G_SOCKET_LISTENER(priv->service));
+    g_clear_object(&priv->service);
+    unlink(priv->socket_path);
+    g_clear_pointer(&priv->socket_path, g_free);
+}
+
+/**
+ * dnf_sack_server_new:
+ * @context: a #DnfContext that has already been set up
+ *
+ * Creates a new #DnfSackServer. The sack of @context is replaced whenever
+ * the rpmdb or the repo directory changes.
+ *
+ * Returns:(transfer full): a #DnfSackServer
+ *
+ * Since: 0.8.0
+ **/
+DnfSackServer *
+dnf_sack_server_new(DnfContext *context)
+{
+    DnfSackServer *server;
+    DnfSackServerPrivate *priv;
+
+    server = g_object_new(DNF_TYPE_SACK_SERVER, NULL);
+    priv = GET_PRIVATE(server);
+    priv->context = g_object_ref(context);
+    priv->invalidate_id =
+        g_signal_connect(context, "invalidate",
+                         G_CALLBACK(dnf_sack_server_invalidate_cb), server);
+    priv->repos_changed_id =
+        g_signal_connect(dnf_context_get_repo_loader(context), "changed",
+                         G_CALLBACK(dnf_sack_server_repos_changed_cb), server);
+    return DNF_SACK_SERVER(server);
+}
@@ -35,6 +35,7 @@
 #define _GNU_SOURCE
 #include <assert.h>
 #include <errno.h>
+#include <fnmatch.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -82,12 +83,17 @@ typedef struct
     Queue                installonly;
     Repo                *cmdline_repo;
     gboolean             considered_uptodate;
+    gboolean             considered_changed;
+    gboolean             whatprovides_stale;
     gboolean             have_set_arch;
     gboolean             all_arch;
     gboolean             provides_ready;
+    gchar               *arch;
     gchar               *cache_dir;
     dnf_sack_running_kernel_fn_t  running_kernel_fn;
     guint                installonly_limit;
+    DnfSackConsideredStats considered_stats;
+    GHashTable          *solution_cache;
 } DnfSackPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE(DnfSack, dnf_sack, G_TYPE_OBJECT)
@@ -112,8 +118,11 @@ dnf_sack_finalize(GObject *object)
             continue;
         hy_repo_free(hrepo);
     }
+    g_free(priv->arch);
     g_free(priv->cache_dir);
     queue_free(&priv->installonly);
+    if (priv->solution_cache != NULL)
+        g_hash_table_unref(priv->solution_cache);
 
     free_map_fully(priv->pkg_excludes);
     free_map_fully(priv->pkg_includes);
@@ -266,11 +275,52 @@ dnf_sack_last_solvable(DnfSack *sack)
     return dnf_sack_get_pool(sack)->nsolvables - 1;
 }
 
+static int
+map_in_bounds(const Map *m, Id id)
+{
+    return id < (m->size << 3);
+}
+
+static int
+map_tst_bounded(const Map *m, Id id)
+{
+    return map_in_bounds(m, id) && MAPTST(m, id);
+}
+
+/* the whatprovides index no longer matches pool->considered, the rebuild is
+ * left to the next dnf_sack_make_provides_ready() */
+static void
+mark_whatprovides_stale(DnfSackPrivate *priv)
+{
+    if (priv->whatprovides_stale)
+        priv->considered_stats.whatprovides_avoided++;
+    priv->whatprovides_stale = TRUE;
+}
+
+/* an exclude/include delta was applied to pool->considered in place */
+static void
+considered_delta_applied(DnfSackPrivate *priv)
+{
+    priv->considered_changed = TRUE;
+    priv->considered_stats.incremental_updates++;
+}
+
+/* whether an existing considered map can absorb a delta in place */
+static gboolean
+considered_is_incremental(DnfSackPrivate *priv)
+{
+    return priv->considered_uptodate && priv->pool->considered != NULL;
+}
+
 /**
  * dnf_sack_recompute_considered:
  * @sack: a #DnfSack instance.
  *
- * DOES SOMETHING.
+ * Brings pool->considered up to date with the sack excludes and includes.
+ * Deltas added since the last call are already applied in place, so a full
+ * recomputation only happens after set_excludes()/set_includes() or when new
+ * solvables were loaded. The whatprovides index is not rebuilt here, see
+ * dnf_sack_make_provides_ready().
  *
  * Since: 0.7.0
  */
@@ -279,8 +329,13 @@ dnf_sack_recompute_considered(DnfSack *sack)
 {
     DnfSackPrivate *priv = GET_PRIVATE(sack);
     Pool *pool = dnf_sack_get_pool(sack);
-    if (priv->considered_uptodate)
+    if (priv->considered_uptodate) {
+        if (priv->considered_changed) {
+            priv->considered_changed = FALSE;
+            mark_whatprovides_stale(priv);
+        }
         return;
+    }
     if (!pool->considered) {
         if (!priv->repo_excludes && !priv->pkg_excludes)
             return;
@@ -297,8 +352,26 @@ dnf_sack_recompute_considered(DnfSack *sack)
         map_subtract(pool->considered, priv->pkg_excludes);
     if (priv->pkg_includes)
         map_and(pool->considered, priv->pkg_includes);
-    pool_createwhatprovides(priv->pool);
     priv->considered_uptodate = TRUE;
+    priv->considered_changed = FALSE;
+    priv->considered_stats.full_recomputes++;
+    mark_whatprovides_stale(priv);
+}
+
+/**
+ * dnf_sack_get_considered_stats: (skip)
+ * @sack: a #DnfSack instance.
+ * @stats: (out): where to store the counters.
+ *
+ * Gets the counters of the considered map and whatprovides maintenance.
+ *
+ * Since: 0.8.0
+ */
+void
+dnf_sack_get_considered_stats(DnfSack *sack, DnfSackConsideredStats *stats)
+{
+    DnfSackPrivate *priv = GET_PRIVATE(sack);
+    *stats = priv->considered_stats;
 }
 
 static void
@@ -784,6 +857,8 @@ dnf_sack_set_arch (DnfSack *sack, const gchar *value, GError **error)
 
     g_debug("Architecture is: %s", arch);
     pool_setarch(pool, arch);
+    g_free(priv->arch);
+    priv->arch = g_strdup(arch);
 
     /* Since one of commits after 0.6.20 libsolv allowes custom arches
      * which means it will be 'newcoolarch' and 'noarch' always. */
@@ -1083,6 +1158,41 @@ dnf_sack_get_installonly_limit(DnfSack *sack)
     return priv->installonly_limit;
 }
 
+/**
+ * dnf_sack_get_solution_cache: (skip)
+ * @sack: a #DnfSack instance.
+ *
+ * Gets the table of goal solutions computed against this sack.
+ *
+ * Returns: a #GHashTable, or %NULL if no solution was cached yet
+ *
+ * Since: 0.8.0
+ */
+GHashTable *
+dnf_sack_get_solution_cache(DnfSack *sack)
+{
+    DnfSackPrivate *priv = GET_PRIVATE(sack);
+    return priv->solution_cache;
+}
+
+/**
+ * dnf_sack_set_solution_cache: (skip)
+ * @sack: a #DnfSack instance.
+ * @cache: (transfer full): a #GHashTable, or %NULL.
+ *
+ * Sets the table of goal solutions, the sack takes ownership of it.
+ *
+ * Since: 0.8.0
+ */
+void
+dnf_sack_set_solution_cache(DnfSack *sack, GHashTable *cache)
+{
+    DnfSackPrivate *priv = GET_PRIVATE(sack);
+    if (priv->solution_cache != NULL)
+        g_hash_table_unref(priv->solution_cache);
+    priv->solution_cache = cache;
+}
+
 static Repo *
 dnf_sack_setup_cmdline_repo(DnfSack *sack)
 {
@@ -1178,7 +1288,11 @@ dnf_sack_add_excludes(DnfSack *sack, DnfPackageSet *pset)
         priv->pkg_excludes = excl;
     }
     map_or(excl, nexcl);
-    priv->considered_uptodate = FALSE;
+    if (considered_is_incremental(priv)) {
+        map_subtract(pool->considered, nexcl);
+        considered_delta_applied(priv);
+    } else
+        priv->considered_uptodate = FALSE;
 }
 
 /**
@@ -1199,13 +1313,30 @@ dnf_sack_add_includes(DnfSack *sack, DnfPackageSet *pset)
     Map *nincl = dnf_packageset_get_map(pset);
 
     if (incl == NULL) {
+        /* the first include narrows everything, recompute in full */
         incl = g_malloc0(sizeof(Map));
         map_init(incl, pool->nsolvables);
         priv->pkg_includes = incl;
+        priv->considered_uptodate = FALSE;
     }
     assert(incl->size >= nincl->size);
     map_or(incl, nincl);
-    priv->considered_uptodate = FALSE;
+    if (!considered_is_incremental(priv)) {
+        priv->considered_uptodate = FALSE;
+        return;
+    }
+
+    Map *considered = pool->considered;
+    for (Id p = 1; p < (nincl->size << 3); ++p) {
+        if (!MAPTST(nincl, p) || !map_in_bounds(considered, p))
+            continue;
+        if (priv->repo_excludes && map_tst_bounded(priv->repo_excludes, p))
+            continue;
+        if (priv->pkg_excludes && map_tst_bounded(priv->pkg_excludes, p))
+            continue;
+        MAPSET(considered, p);
+    }
+    considered_delta_applied(priv);
 }
 
 /**
@@ -1293,7 +1424,23 @@ dnf_sack_repo_enabled(DnfSack *sack, const char *reponame, int enabled)
     else
         FOR_REPO_SOLVABLES(repo, p, s)
             MAPCLR(priv->repo_excludes, p);
-    priv->considered_uptodate = FALSE;
+    if (!considered_is_incremental(priv)) {
+        priv->considered_uptodate = FALSE;
+        return 0;
+    }
+
+    Map *considered = pool->considered;
+    FOR_REPO_SOLVABLES(repo, p, s) {
+        if (!map_in_bounds(considered, p))
+            continue;
+        if (repo->disabled ||
+            (priv->pkg_excludes && map_tst_bounded(priv->pkg_excludes, p)) ||
+            (priv->pkg_includes && !map_tst_bounded(priv->pkg_includes, p)))
+            MAPCLR(considered, p);
+        else
+            MAPSET(considered, p);
+    }
+    considered_delta_applied(priv);
     return 0;
 }
 
@@ -1484,6 +1631,176 @@ dnf_sack_load_repo(DnfSack *sack, HyRepo repo, int flags, GError **error)
     return TRUE;
 }
 
+/* copy a solvable-indexed map into the id space of a snapshot */
+static Map *
+snapshot_map(const Map *map, const Id *solvable_map, int nsolvables,
+             int snap_nsolvables)
+{
+    Map *copy;
+
+    if (map == NULL)
+        return NULL;
+    copy = g_malloc0(sizeof(Map));
+    map_init(copy, snap_nsolvables);
+    for (Id p = 1; p < nsolvables; ++p)
+        if (solvable_map[p] && map_tst_bounded(map, p))
+            MAPSET(copy, solvable_map[p]);
+    return copy;
+}
+
+/* copy one repo through an in-memory solv image, recording where each of
+ * its solvables ended up in the snapshot */
+static Repo *
+snapshot_repo(DnfSack *snap, Repo *repo, Id *solvable_map, GError **error)
+{
+    Pool *snap_pool = dnf_sack_get_pool(snap);
+    HyRepo hrepo = repo->appdata;
+    HyRepo snap_hrepo;
+    Repo *snap_repo;
+    Solvable *s;
+    Id p, q;
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *fp;
+    int rc;
+
+    fp = open_memstream(&buf, &len);
+    if (fp == NULL) {
+        g_set_error(error,
+                    DNF_ERROR,
+                    DNF_ERROR_INTERNAL_ERROR,
+                    "failed to snapshot %s: %s",
+                    repo->name, strerror(errno));
+        return NULL;
+    }
+    rc = repo_write(repo, fp);
+    fclose(fp);
+    snap_repo = repo_create(snap_pool, repo->name);
+    if (rc == 0) {
+        fp = fmemopen(buf, len, "r");
+        rc = fp == NULL || repo_add_solv(snap_repo, fp, 0);
+        if (fp != NULL)
+            fclose(fp);
+    }
+    free(buf);
+    if (rc != 0 || snap_repo->nsolvables != repo->nsolvables) {
+        g_set_error(error,
+                    DNF_ERROR,
+                    DNF_ERROR_INTERNAL_ERROR,
+                    "failed to snapshot %s", repo->name);
+        repo_free(snap_repo, 1);
+        return NULL;
+    }
+
+    /* solvables are written and read back in repo order */
+    q = snap_repo->start;
+    FOR_REPO_SOLVABLES(repo, p, s) {
+        while (snap_pool->solvables[q].repo != snap_repo)
+            q++;
+        solvable_map[p] = q++;
+    }
+
+    snap_repo->disabled = repo->disabled;
+    if (hrepo == NULL)
+        return snap_repo;
+    snap_hrepo = hy_repo_create(repo->name);
+    snap_hrepo->cost = hrepo->cost;
+    snap_hrepo->priority = hrepo->priority;
+    snap_hrepo->state_main = _HY_LOADED_CACHE;
+    snap_hrepo->state_filelists = hrepo->state_filelists == _HY_NEW ? _HY_NEW : _HY_LOADED_CACHE;
+    snap_hrepo->state_presto = hrepo->state_presto == _HY_NEW ? _HY_NEW : _HY_LOADED_CACHE;
+    snap_hrepo->state_updateinfo = hrepo->state_updateinfo == _HY_NEW ? _HY_NEW : _HY_LOADED_CACHE;
+    memcpy(snap_hrepo->checksum, hrepo->checksum, CHKSUM_BYTES);
+    /* a snapshot never writes to the cache directory */
+    snap_hrepo->load_flags = hrepo->load_flags & ~DNF_SACK_LOAD_FLAG_BUILD_CACHE;
+    snap_hrepo->main_nsolvables = snap_repo->nsolvables;
+    snap_hrepo->main_nrepodata = snap_repo->nrepodata;
+    snap_hrepo->main_end = snap_repo->end;
+    repo_finalize_init(snap_hrepo, snap_repo);
+    hy_repo_free(snap_hrepo);
+    return snap_repo;
+}
+
+/**
+ * dnf_sack_snapshot:
+ * @sack: a #DnfSack instance.
+ * @error: a #GError or %NULL.
+ *
+ * Creates an independent copy of the sack, e.g. for resolving several goals
+ * in parallel threads. libsolv cannot share repodata between pools, so each
+ * repo is copied through an in-memory solv image, which avoids parsing or
+ * reading any metadata again. The copy has its own considered map, provides
+ * index and solver state, and carries over excludes, includes, disabled
+ * repos and the installonly settings. It never writes to the cache directory.
+ *
+ * The snapshot has to be taken in the thread that uses @sack, but it can
+ * then be handed to and used by another thread.
+ *
+ * Returns: (transfer full): a new #DnfSack, or %NULL on error
+ *
+ * Since: 0.8.0
+ */
+DnfSack *
+dnf_sack_snapshot(DnfSack *sack, GError **error)
+{
+    DnfSackPrivate *priv = GET_PRIVATE(sack);
+    DnfSackPrivate *snap_priv;
+    Pool *pool = priv->pool;
+    Pool *snap_pool;
+    Repo *repo;
+    Repo *snap_repo;
+    Id *solvable_map;
+    int i;
+    g_autoptr(DnfSack) snap = NULL;
+
+    /* this adds the file provides to the repos, so the copies carry them */
+    dnf_sack_make_provides_ready(sack);
+
+    snap = dnf_sack_new();
+    snap_priv = GET_PRIVATE(snap);
+    snap_pool = snap_priv->pool;
+    snap_priv->cache_dir = g_strdup(priv->cache_dir);
+    snap_priv->all_arch = priv->all_arch;
+    if (priv->arch != NULL && !dnf_sack_set_arch(snap, priv->arch, error))
+        return NULL;
+    snap_priv->installonly_limit = priv->installonly_limit;
+    for (i = 0; i < priv->installonly.count; ++i) {
+        const char *name = pool_id2str(pool, priv->installonly.elements[i]);
+        queue_push(&snap_priv->installonly, pool_str2id(snap_pool, name, 1));
+    }
+    snap_priv->running_kernel_fn = priv->running_kernel_fn;
+
+    solvable_map = g_new0(Id, pool->nsolvables);
+    FOR_REPOS(i, repo) {
+        snap_repo = snapshot_repo(snap, repo, solvable_map, error);
+        if (snap_repo == NULL) {
+            g_free(solvable_map);
+            return NULL;
+        }
+        if (repo == pool->installed)
+            pool_set_installed(snap_pool, snap_repo);
+        if (repo == priv->cmdline_repo)
+            snap_priv->cmdline_repo = snap_repo;
+    }
+    if (priv->running_kernel_id > 0)
+        snap_priv->running_kernel_id = solvable_map[priv->running_kernel_id];
+    else
+        snap_priv->running_kernel_id = priv->running_kernel_id;
+    snap_priv->pkg_excludes = snapshot_map(priv->pkg_excludes, solvable_map,
+                                           pool->nsolvables, snap_pool->nsolvables);
+    snap_priv->pkg_includes = snapshot_map(priv->pkg_includes, solvable_map,
+                                           pool->nsolvables, snap_pool->nsolvables);
+    snap_priv->repo_excludes = snapshot_map(priv->repo_excludes, solvable_map,
+                                            pool->nsolvables, snap_pool->nsolvables);
+    g_free(solvable_map);
+
+    /* build the considered map first so the index is only built once */
+    snap_priv->considered_uptodate = FALSE;
+    dnf_sack_recompute_considered(snap);
+    dnf_sack_make_provides_ready(snap);
+    return g_steal_pointer(&snap);
+}
+
 // internal to hawkey
 
 // return true if q1 is a superset of q2
@@ -1573,8 +1890,14 @@ dnf_sack_make_provides_ready(DnfSack *sack)
 {
     DnfSackPrivate *priv = GET_PRIVATE(sack);
 
-    if (priv->provides_ready)
+    if (priv->provides_ready) {
+        if (priv->whatprovides_stale) {
+            pool_createwhatprovides(priv->pool);
+            priv->whatprovides_stale = FALSE;
+            priv->considered_stats.whatprovides_rebuilds++;
+        }
         return;
+    }
     repo_internalize_all_trigger(priv->pool);
     Queue addedfileprovides;
     Queue addedfileprovides_inst;
@@ -1587,6 +1910,11 @@ dnf_sack_make_provides_ready(DnfSack *sack)
     queue_free(&addedfileprovides);
     queue_free(&addedfileprovides_inst);
     pool_createwhatprovides(priv->pool);
+    /* one index build covers the pending considered change as well */
+    if (priv->whatprovides_stale)
+        priv->considered_stats.whatprovides_avoided++;
+    priv->whatprovides_stale = FALSE;
+    priv->considered_stats.whatprovides_rebuilds++;
     priv->provides_ready = 1;
 }
 
@@ -1668,44 +1996,120 @@ dnf_sack_get_pool(DnfSack *sack)
 
 /**********************************************************************/
 
-static void
-process_excludes(DnfSack *sack, DnfRepo *repo)
+typedef struct {
+    const char  *pattern;
+    gsize        prefix_len;    /* literal part before the first wildcard */
+} ExcludeGlob;
+
+/* returns TRUE if any glob of the repo matches the package name */
+static gboolean
+exclude_globs_match(GArray *globs, const char *name)
 {
-    gchar **excludes = dnf_repo_get_exclude_packages(repo);
-    gchar **iter;
+    for (guint i = 0; i < globs->len; i++) {
+        ExcludeGlob *glob = &g_array_index(globs, ExcludeGlob, i);
+        if (strncmp(name, glob->pattern, glob->prefix_len) != 0)
+            continue;
+        if (fnmatch(glob->pattern, name, 0) == 0)
+            return TRUE;
+    }
+    return FALSE;
+}
 
-    if (excludes == NULL)
-        return;
+/**
+ * dnf_sack_add_repo_excludes:
+ *
+ * Excludes the packages named by the exclude= option of every repo in a
+ * single pass: exact names are looked up through the name Id of each
+ * solvable, globs are only fnmatch()ed when their literal prefix matches.
+ * Source packages are never excluded.
+ **/
+void
+dnf_sack_add_repo_excludes(DnfSack *sack, GPtrArray *repos)
+{
+    Pool *pool = dnf_sack_get_pool(sack);
+    DnfPackageSet *pkgset = NULL;
+    Map *excl = NULL;
+    Map names;
+    g_autoptr(GArray) globs = g_array_new(FALSE, FALSE, sizeof(ExcludeGlob));
+    Queue name_ids;
+    guint i;
 
-    for (iter = excludes; *iter; iter++) {
-        const char *name = *iter;
-        HyQuery query;
-        DnfPackageSet *pkgset;
+    map_init(&names, pool->ss.nstrings);
+    queue_init(&name_ids);
+    for (i = 0; i < repos->len; i++) {
+        DnfRepo *repo = g_ptr_array_index(repos, i);
+        gchar **excludes = dnf_repo_get_exclude_packages(repo);
+        Repo *r;
+        Solvable *s;
+        Id p;
 
-        query = hy_query_create(sack);
-        hy_query_filter(query, HY_PKG_REPONAME, HY_EQ, dnf_repo_get_id(repo));
-        hy_query_filter(query, HY_PKG_ARCH, HY_NEQ, "src");
-        hy_query_filter(query, HY_PKG_NAME, HY_EQ, name);
-        pkgset = hy_query_run_set(query);
+        if (excludes == NULL)
+            continue;
+        r = repo_by_name(sack, dnf_repo_get_id(repo));
+        if (r == NULL)
+            continue;
 
-        if (dnf_packageset_count(pkgset) > 0)
-            dnf_sack_add_excludes(sack, pkgset);
+        /* compile the patterns of this repo */
+        g_array_set_size(globs, 0);
+        for (gchar **iter = excludes; *iter; iter++) {
+            const char *pattern = *iter;
+            const char *wildcard = strpbrk(pattern, "*?[");
+            if (*pattern == '\0')
+                continue;
+            if (wildcard != NULL) {
+                ExcludeGlob glob = { pattern, wildcard - pattern };
+                g_array_append_val(globs, glob);
+                continue;
+            }
+            Id id = pool_str2id(pool, pattern, 0);
+            if (id != 0 && !MAPTST(&names, id)) {
+                MAPSET(&names, id);
+                queue_push(&name_ids, id);
+            }
+        }
+        if (name_ids.count == 0 && globs->len == 0)
+            continue;
 
-        hy_query_free(query);
-        g_object_unref(pkgset);
+        if (pkgset == NULL) {
+            pkgset = dnf_packageset_new(sack);
+            excl = dnf_packageset_get_map(pkgset);
+        }
+        FOR_REPO_SOLVABLES(r, p, s) {
+            if (s->arch == ARCH_SRC || !is_package(pool, s))
+                continue;
+            if (MAPTST(&names, s->name) ||
+                (globs->len > 0 &&
+                 exclude_globs_match(globs, pool_id2str(pool, s->name))))
+                MAPSET(excl, p);
+        }
+
+        /* reset the name index for the next repo */
+        for (int j = 0; j < name_ids.count; j++)
+            MAPCLR(&names, name_ids.elements[j]);
+        queue_empty(&name_ids);
     }
+    queue_free(&name_ids);
+    map_free(&names);
+
+    if (pkgset == NULL)
+        return;
+    if (dnf_packageset_count(pkgset) > 0)
+        dnf_sack_add_excludes(sack, pkgset);
+    g_object_unref(pkgset);
 }
 
 /**
- * dnf_sack_add_repo:
+ * dnf_sack_add_repo_internal:
+ * @checked: %TRUE if the caller has just checked the repo successfully
  */
-gboolean
-dnf_sack_add_repo(DnfSack *sack,
-                    DnfRepo *repo,
-                    guint permissible_cache_age,
-                    DnfSackAddFlags flags,
-                    DnfState *state,
-                    GError **error)
+static gboolean
+dnf_sack_add_repo_internal(DnfSack *sack,
+                           DnfRepo *repo,
+                           guint permissible_cache_age,
+                           DnfSackAddFlags flags,
+                           gboolean checked,
+                           DnfState *state,
+                           GError **error)
 {
     gboolean ret = TRUE;
     GError *error_local = NULL;
@@ -1720,12 +2124,16 @@ dnf_sack_add_repo(DnfSack *sack,
     if (!ret)
         return FALSE;
 
-    /* check repo */
+    /* check repo, unless that has just been done */
     state_local = dnf_state_get_child(state);
-    ret = dnf_repo_check(repo,
-                         permissible_cache_age,
-                         state_local,
-                         &error_local);
+    if (checked) {
+        ret = TRUE;
+    } else {
+        ret = dnf_repo_check(repo,
+                             permissible_cache_age,
+                             state_local,
+                             &error_local);
+    }
     if (!ret) {
         g_debug("failed to check, attempting update: %s",
                 error_local->message);
@@ -1767,6 +2175,8 @@ dnf_sack_add_repo(DnfSack *sack,
         flags_hy |= DNF_SACK_LOAD_FLAG_USE_FILELISTS;
     if ((flags & DNF_SACK_ADD_FLAG_UPDATEINFO) > 0)
         flags_hy |= DNF_SACK_LOAD_FLAG_USE_UPDATEINFO;
+    if ((flags & DNF_SACK_ADD_FLAG_PRESTO) > 0)
+        flags_hy |= DNF_SACK_LOAD_FLAG_USE_PRESTO;
 
     /* load solv */
     g_debug("Loading repo %s", dnf_repo_get_id(repo));
@@ -1778,6 +2188,34 @@ dnf_sack_add_repo(DnfSack *sack,
     return dnf_state_done(state, error);
 }
 
+/**
+ * dnf_sack_add_repo:
+ */
+gboolean
+dnf_sack_add_repo(DnfSack *sack,
+                    DnfRepo *repo,
+                    guint permissible_cache_age,
+                    DnfSackAddFlags flags,
+                    DnfState *state,
+                    GError **error)
+{
+    return dnf_sack_add_repo_internal(sack, repo, permissible_cache_age,
+                                      flags, FALSE, state, error);
+}
+
+/**
+ * dnf_sack_repo_array_contains:
+ */
+static gboolean
+dnf_sack_repo_array_contains(GPtrArray *repos, DnfRepo *repo)
+{
+    for (guint i = 0; i < repos->len; i++) {
+        if (g_ptr_array_index(repos, i) == repo)
+            return TRUE;
+    }
+    return FALSE;
+}
+
 /**
  * dnf_sack_add_repos:
  */
@@ -1790,14 +2228,20 @@ dnf_sack_add_repos(DnfSack *sack,
                      GError **error)
 {
     gboolean ret;
-    guint cnt = 0;
     guint i;
     DnfRepo *repo;
     DnfState *state_local;
+    DnfState *state_loop;
     g_autoptr(GPtrArray) enabled_repos = g_ptr_array_new();
+    g_autoptr(GPtrArray) wanted_repos = g_ptr_array_new();
+    g_autoptr(GPtrArray) expired_repos = g_ptr_array_new();
+    g_autoptr(GPtrArray) failed_repos = g_ptr_array_new_with_free_func((GDestroyNotify) g_object_unref);
 
-    /* count the enabled repos */
+    /* find the enabled repos, and the ones that need refreshing */
     for (i = 0; i < repos->len; i++) {
+        g_autoptr(DnfState) state_check = NULL;
+        g_autoptr(GError) error_local = NULL;
+
         repo = g_ptr_array_index(repos, i);
         if (dnf_repo_get_enabled(repo) == DNF_REPO_ENABLED_NONE)
             continue;
@@ -1808,44 +2252,73 @@ dnf_sack_add_repos(DnfSack *sack,
                 continue;
         }
 
-        cnt++;
+        g_ptr_array_add(wanted_repos, repo);
+        state_check = dnf_state_new();
+        if (!dnf_repo_check(repo, permissible_cache_age,
+                            state_check, &error_local)) {
+            g_debug("failed to check %s, will update: %s",
+                    dnf_repo_get_id(repo), error_local->message);
+            g_ptr_array_add(expired_repos, repo);
+        }
+    }
+
+    /* refresh the expired repos at the same time */
+    if (expired_repos->len > 0) {
+        ret = dnf_state_set_steps(state, error,
+                                  50, /* refresh */
+                                  50, /* load */
+                                  -1);
+        if (!ret)
+            return FALSE;
+        state_local = dnf_state_get_child(state);
+        ret = dnf_repo_update_all(expired_repos,
+                                  DNF_REPO_UPDATE_FLAG_FORCE,
+                                  failed_repos,
+                                  state_local,
+                                  error);
+        if (!ret)
+            return FALSE;
+        if (!dnf_state_done(state, error))
+            return FALSE;
+        state_loop = dnf_state_get_child(state);
+    } else {
+        state_loop = state;
     }
 
     /* add each repo */
-    dnf_state_set_number_steps(state, cnt);
-    for (i = 0; i < repos->len; i++) {
-        repo = g_ptr_array_index(repos, i);
-        if (dnf_repo_get_enabled(repo) == DNF_REPO_ENABLED_NONE)
-            continue;
+    dnf_state_set_number_steps(state_loop, wanted_repos->len);
+    for (i = 0; i < wanted_repos->len; i++) {
+        repo = g_ptr_array_index(wanted_repos, i);
 
-        /* only allow metadata-only repos if FLAG_UNAVAILABLE is set */
-        if (dnf_repo_get_enabled(repo) == DNF_REPO_ENABLED_METADATA) {
-            if ((flags & DNF_SACK_ADD_FLAG_UNAVAILABLE) == 0)
-                continue;
+        /* not required and could not be refreshed */
+        if (dnf_sack_repo_array_contains(failed_repos, repo)) {
+            if (!dnf_state_done(state_loop, error))
+                return FALSE;
+            continue;
         }
 
-        state_local = dnf_state_get_child(state);
-        ret = dnf_sack_add_repo(sack,
-                                  repo,
-                                  permissible_cache_age,
-                                  flags,
-                                  state_local,
-                                  error);
+        /* the check above, or the one after the refresh, has passed */
+        state_local = dnf_state_get_child(state_loop);
+        ret = dnf_sack_add_repo_internal(sack,
+                                         repo,
+                                         permissible_cache_age,
+                                         flags,
+                                         dnf_repo_is_checked(repo),
+                                         state_local,
+                                         error);
         if (!ret)
             return FALSE;
 
         g_ptr_array_add(enabled_repos, repo);
 
         /* done */
-        if (!dnf_state_done(state, error))
+        if (!dnf_state_done(state_loop, error))
             return FALSE;
     }
+    if (state_loop != state && !dnf_state_done(state, error))
+        return FALSE;
 
-    for (i = 0; i < enabled_repos->len; i++) {
-        repo = enabled_repos->pdata[i];
-
-        process_excludes(sack, repo);
-    }
+    dnf_sack_add_repo_excludes(sack, enabled_repos);
 
     /* success */
     return TRUE;
@@ -135,6 +135,8 @@ gboolean     dnf_sack_load_repo             (DnfSack        *sack,
                                              HyRepo          hrepo,
                                              int             flags,
                                              GError        **error);
+DnfSack     *dnf_sack_snapshot              (DnfSack        *sack,
+                                             GError        **error);
 
 /**********************************************************************/
 
@@ -145,6 +147,7 @@ gboolean     dnf_sack_load_repo             (DnfSack        *sack,
  * @DNF_SACK_ADD_FLAG_UPDATEINFO:               Add the updateinfo
  * @DNF_SACK_ADD_FLAG_REMOTE:                   Use remote repos
  * @DNF_SACK_ADD_FLAG_UNAVAILABLE:              Add repos that are unavailable
+ * @DNF_SACK_ADD_FLAG_PRESTO:                   Add the deltarpm metadata
  *
  * The error code.
  **/
@@ -154,6 +157,7 @@ typedef enum {
         DNF_SACK_ADD_FLAG_UPDATEINFO            = 2,
         DNF_SACK_ADD_FLAG_REMOTE                = 4,
         DNF_SACK_ADD_FLAG_UNAVAILABLE           = 8,
+        DNF_SACK_ADD_FLAG_PRESTO                = 16,   /* Since: 0.8.0 */
         /*< private >*/
         DNF_SACK_ADD_FLAG_LAST
 } DnfSackAddFlags;
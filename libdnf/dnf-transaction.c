@@ -29,6 +29,11 @@
  */
 
 
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <glib/gstdio.h>
 #include <rpm/rpmlib.h>
 #include <rpm/rpmts.h>
 #include <rpm/rpmlog.h>
@@ -39,6 +44,7 @@
 #include "dnf-package.h"
 #include "dnf-rpmts.h"
 #include "dnf-transaction.h"
+#include "dnf-transaction-private.h"
 #include "dnf-utils.h"
 #include "hy-query.h"
 #include "dnf-sack.h"
@@ -51,6 +57,14 @@ typedef enum {
     DNF_TRANSACTION_STEP_IGNORE
 } DnfTransactionStep;
 
+/* lookups for one of the package arrays, built once per commit as the
+ * rpm callback needs to find the package many times for each element */
+typedef struct {
+    GHashTable          *nevra;         /* name-epoch:version-release.arch:DnfPackage */
+    GHashTable          *basename;      /* basename:DnfPackage */
+    GHashTable          *name;          /* name:DnfPackage */
+} DnfTransactionIndex;
+
 typedef struct
 {
     DnfDb              *db;
@@ -72,12 +86,115 @@ typedef struct
     GPtrArray           *install;
     GPtrArray           *pkgs_to_download;
     GHashTable          *erased_by_package_hash;
+    DnfTransactionIndex *install_index;
+    DnfTransactionIndex *remove_index;
+    DnfTransactionIndex *remove_helper_index;
+    GHashTable          *verified;      /* filename:DnfTransactionVerified */
+    DnfRepoPrefetch     *prefetch;
+    guint64             delta_bytes_saved;
+    gdouble             delta_rebuild_time;
     guint64             flags;
+    GPtrArray           *timings;       /* of DnfTransactionTiming */
+    DnfTransactionTiming *timing_element;
+    DnfTransactionTiming *timing_scriptlet;
+    gint64               timing_start;
+    gchar               *timings_filename;
+    GPtrArray           *download_timings;      /* of DnfTransactionTiming */
 } DnfTransactionPrivate;
 
+/* results of checking a package while the rest of the transaction was
+ * still downloading */
+typedef struct {
+    gboolean             gpg_checked;
+    GError              *gpg_error;     /* NULL if the signature is trusted */
+    Header               hdr;           /* NULL if the file was unreadable */
+    rpmRC                hdr_rc;
+} DnfTransactionVerified;
+
+typedef struct {
+    DnfTransaction      *transaction;
+    GThreadPool         *pool;
+    GMutex               mutex;
+    GAsyncQueue         *keyrings;      /* idle rpmKeyrings, one per worker */
+    rpmVSFlags           vs_flags;
+    gboolean             check_gpg;
+    gint                 cancelled;     /* atomic, set when a download failed */
+    gint64               verify_us;
+    gint64               header_us;
+    GPtrArray           *timings;       /* of DnfTransactionTiming */
+    gint64               timing_start;
+} DnfTransactionPipeline;
+
+/* an update rebuilt from a delta rather than downloaded */
+typedef struct {
+    DnfPackage          *pkg;
+    DnfPackageDelta     *delta;
+    gchar               *delta_path;
+    gchar               *rpm_path;
+    gboolean             rebuilt;
+} DnfTransactionDelta;
+
+/* the space a transaction needs on one filesystem */
+typedef struct {
+    guint64              dev;
+    gchar               *path;          /* a directory on it, for messages */
+    gint64               needed;        /* bytes, negative if freed */
+    guint                files;         /* of the package being added */
+} DnfTransactionMount;
+
+typedef struct {
+    const gchar         *root;          /* "" for / */
+    GHashTable          *mounts;        /* dev:DnfTransactionMount */
+    GHashTable          *dirs;          /* path:DnfTransactionMount */
+    GPtrArray           *touched;       /* by the package being added */
+} DnfTransactionSpace;
+
+typedef struct {
+    GThreadPool         *pool;
+    GHashTable          *items;         /* DnfPackage:DnfTransactionDelta */
+    GMutex               mutex;
+    gint                 cancelled;     /* atomic, set when a download failed */
+    gint64               rebuild_us;
+} DnfTransactionDeltaHelper;
+
 G_DEFINE_TYPE_WITH_PRIVATE(DnfTransaction, dnf_transaction, G_TYPE_OBJECT)
 #define GET_PRIVATE(o) (dnf_transaction_get_instance_private (o))
 
+/**
+ * dnf_transaction_verified_free:
+ **/
+static void
+dnf_transaction_verified_free(DnfTransactionVerified *item)
+{
+    if (item->gpg_error != NULL)
+        g_error_free(item->gpg_error);
+    if (item->hdr != NULL)
+        headerFree(item->hdr);
+    g_slice_free(DnfTransactionVerified, item);
+}
+
+/**
+ * dnf_transaction_index_free:
+ **/
+static void
+dnf_transaction_index_free(DnfTransactionIndex *index)
+{
+    g_hash_table_unref(index->nevra);
+    g_hash_table_unref(index->basename);
+    g_hash_table_unref(index->name);
+    g_slice_free(DnfTransactionIndex, index);
+}
+
+/**
+ * dnf_transaction_timing_free:
+ **/
+static void
+dnf_transaction_timing_free(DnfTransactionTiming *timing)
+{
+    g_free(timing->name);
+    g_slice_free(DnfTransactionTiming, timing);
+}
+
 /**
  * dnf_transaction_finalize:
  **/
@@ -87,6 +204,8 @@ dnf_transaction_finalize(GObject *object)
     DnfTransaction *transaction = DNF_TRANSACTION(object);
     DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
 
+    if (priv->prefetch != NULL)
+        dnf_repo_prefetch_free(priv->prefetch);
     g_ptr_array_unref(priv->pkgs_to_download);
     g_timer_destroy(priv->timer);
     rpmKeyringFree(priv->keyring);
@@ -104,6 +223,13 @@ dnf_transaction_finalize(GObject *object)
         g_ptr_array_unref(priv->remove_helper);
     if (priv->erased_by_package_hash != NULL)
         g_hash_table_unref(priv->erased_by_package_hash);
+    g_clear_pointer(&priv->install_index, dnf_transaction_index_free);
+    g_clear_pointer(&priv->remove_index, dnf_transaction_index_free);
+    g_clear_pointer(&priv->remove_helper_index, dnf_transaction_index_free);
+    g_hash_table_unref(priv->verified);
+    g_ptr_array_unref(priv->timings);
+    g_free(priv->timings_filename);
+    g_ptr_array_unref(priv->download_timings);
     if (priv->context != NULL)
         g_object_remove_weak_pointer(G_OBJECT(priv->context),
                                      (void **) &priv->context);
@@ -122,6 +248,10 @@ dnf_transaction_init(DnfTransaction *transaction)
     priv->keyring = rpmtsGetKeyring(priv->ts, 1);
     priv->timer = g_timer_new();
     priv->pkgs_to_download = g_ptr_array_new_with_free_func((GDestroyNotify) g_object_unref);
+    priv->verified = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                           (GDestroyNotify) dnf_transaction_verified_free);
+    priv->timings = g_ptr_array_new_with_free_func((GDestroyNotify) dnf_transaction_timing_free);
+    priv->download_timings = g_ptr_array_new_with_free_func((GDestroyNotify) dnf_transaction_timing_free);
 }
 
 /**
@@ -222,6 +352,24 @@ dnf_transaction_set_uid(DnfTransaction *transaction, guint uid)
     priv->uid = uid;
 }
 
+/**
+ * dnf_transaction_set_timings_filename:
+ * @transaction: a #DnfTransaction instance.
+ * @filename: a JSON file to write, or %NULL
+ *
+ * Sets a file where dnf_transaction_commit() writes what it timed, even
+ * when the commit fails. See dnf_transaction_get_timings().
+ *
+ * Since: 0.8.0
+ **/
+void
+dnf_transaction_set_timings_filename(DnfTransaction *transaction, const gchar *filename)
+{
+    DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+    g_free(priv->timings_filename);
+    priv->timings_filename = g_strdup(filename);
+}
+
 /**
  * dnf_transaction_set_flags:
  * @transaction: a #DnfTransaction instance.
@@ -328,6 +476,37 @@ dnf_transaction_ensure_repo_list(DnfTransaction *transaction,
     return TRUE;
 }
 
+/**
+ * dnf_transaction_import_keys:
+ */
+static gboolean
+dnf_transaction_import_keys(DnfTransaction *transaction,
+                            rpmKeyring keyring,
+                            GError **error)
+{
+    DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+    guint i;
+
+    /* import all system wide GPG keys */
+    if (!dnf_keyring_add_public_keys(keyring, error))
+        return FALSE;
+
+    /* import downloaded repo GPG keys */
+    for (i = 0; i < priv->repos->len; i++) {
+        DnfRepo *repo = g_ptr_array_index(priv->repos, i);
+        const gchar *pubkey;
+
+        /* does this file actually exist */
+        pubkey = dnf_repo_get_public_key(repo);
+        if (g_file_test(pubkey, G_FILE_TEST_EXISTS)) {
+            /* import */
+            if (!dnf_keyring_add_public_key(keyring, pubkey, error))
+                return FALSE;
+        }
+    }
+    return TRUE;
+}
+
 /**
  * dnf_transaction_check_untrusted:
  */
@@ -356,6 +535,8 @@ dnf_transaction_check_untrusted(DnfTransaction *transaction,
     for (i = 0; i < install->len; i++) {
         GError *error_local = NULL;
         DnfRepo *repo;
+        DnfTransactionVerified *verified;
+        gboolean trusted;
         pkg = g_ptr_array_index(install, i);
 
         /* ensure the filename is set */
@@ -375,8 +556,16 @@ dnf_transaction_check_untrusted(DnfTransaction *transaction,
             return FALSE;
         }
 
-        /* check file */
-        if (!dnf_keyring_check_untrusted_file(priv->keyring, fn, &error_local)) {
+        /* check file, unless already done while downloading */
+        verified = g_hash_table_lookup(priv->verified, fn);
+        if (verified != NULL && verified->gpg_checked) {
+            if (verified->gpg_error != NULL)
+                error_local = g_error_copy(verified->gpg_error);
+            trusted = verified->gpg_error == NULL;
+        } else {
+            trusted = dnf_keyring_check_untrusted_file(priv->keyring, fn, &error_local);
+        }
+        if (!trusted) {
 
             /* probably an i/o error */
             if (!g_error_matches(error_local,
@@ -417,82 +606,316 @@ dnf_transaction_check_untrusted(DnfTransaction *transaction,
 }
 
 /**
- * dnf_find_pkg_from_header:
+ * dnf_transaction_index_get_nevra:
  **/
-static DnfPackage *
-dnf_find_pkg_from_header(GPtrArray *array, Header hdr)
+static gchar *
+dnf_transaction_index_get_nevra(const gchar *name,
+                                guint epoch,
+                                const gchar *version,
+                                const gchar *release,
+                                const gchar *arch)
 {
-    const gchar *arch;
-    const gchar *name;
-    const gchar *release;
-    const gchar *version;
-    guint epoch;
-    guint i;
-    DnfPackage *pkg;
-
-    /* get details */
-    name = headerGetString(hdr, RPMTAG_NAME);
-    epoch = headerGetNumber(hdr, RPMTAG_EPOCH);
-    version = headerGetString(hdr, RPMTAG_VERSION);
-    release = headerGetString(hdr, RPMTAG_RELEASE);
-    arch = headerGetString(hdr, RPMTAG_ARCH);
-
-    /* find in array */
-    for (i = 0; i < array->len; i++) {
-        pkg = g_ptr_array_index(array, i);
-        if (g_strcmp0(name, dnf_package_get_name(pkg)) != 0)
-            continue;
-        if (g_strcmp0(version, dnf_package_get_version(pkg)) != 0)
-            continue;
-        if (g_strcmp0(release, dnf_package_get_release(pkg)) != 0)
-            continue;
-        if (g_strcmp0(arch, dnf_package_get_arch(pkg)) != 0)
-            continue;
-        if (epoch != dnf_package_get_epoch(pkg))
-            continue;
-        return pkg;
-    }
-    return NULL;
+    return g_strdup_printf("%s-%u:%s-%s.%s", name, epoch, version, release, arch);
 }
 
 /**
- * dnf_find_pkg_from_filename_suffix:
+ * dnf_transaction_index_new:
+ *
+ * Where several packages have the same key the first one is used, as
+ * the linear searches this replaces did.
  **/
-static DnfPackage *
-dnf_find_pkg_from_filename_suffix(GPtrArray *array, const gchar *filename_suffix)
+static DnfTransactionIndex *
+dnf_transaction_index_new(GPtrArray *array)
 {
+    DnfTransactionIndex *index;
+    DnfPackage *pkg;
     const gchar *filename;
+    const gchar *tmp;
     guint i;
-    DnfPackage *pkg;
 
-    /* find in array */
+    index = g_slice_new0(DnfTransactionIndex);
+    index->nevra = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    index->basename = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    index->name = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
     for (i = 0; i < array->len; i++) {
+        gchar *nevra;
+
         pkg = g_ptr_array_index(array, i);
+        nevra = dnf_transaction_index_get_nevra(dnf_package_get_name(pkg),
+                                                dnf_package_get_epoch(pkg),
+                                                dnf_package_get_version(pkg),
+                                                dnf_package_get_release(pkg),
+                                                dnf_package_get_arch(pkg));
+        if (g_hash_table_contains(index->nevra, nevra))
+            g_free(nevra);
+        else
+            g_hash_table_insert(index->nevra, nevra, pkg);
+        tmp = dnf_package_get_name(pkg);
+        if (!g_hash_table_contains(index->name, tmp))
+            g_hash_table_insert(index->name, g_strdup(tmp), pkg);
         filename = dnf_package_get_filename(pkg);
         if (filename == NULL)
             continue;
-        if (g_str_has_suffix(filename, filename_suffix))
-            return pkg;
+        tmp = strrchr(filename, '/');
+        tmp = tmp != NULL ? tmp + 1 : filename;
+        if (!g_hash_table_contains(index->basename, tmp))
+            g_hash_table_insert(index->basename, g_strdup(tmp), pkg);
     }
-    return NULL;
+    return index;
 }
 
 /**
- * dnf_find_pkg_from_name:
+ * dnf_transaction_index_find_header:
  **/
 static DnfPackage *
-dnf_find_pkg_from_name(GPtrArray *array, const gchar *pkgname)
+dnf_transaction_index_find_header(DnfTransactionIndex *index, Header hdr)
+{
+    g_autofree gchar *nevra = NULL;
+
+    if (index == NULL || hdr == NULL)
+        return NULL;
+    nevra = dnf_transaction_index_get_nevra(headerGetString(hdr, RPMTAG_NAME),
+                                            headerGetNumber(hdr, RPMTAG_EPOCH),
+                                            headerGetString(hdr, RPMTAG_VERSION),
+                                            headerGetString(hdr, RPMTAG_RELEASE),
+                                            headerGetString(hdr, RPMTAG_ARCH));
+    return g_hash_table_lookup(index->nevra, nevra);
+}
+
+/**
+ * dnf_transaction_index_find_filename_suffix:
+ **/
+static DnfPackage *
+dnf_transaction_index_find_filename_suffix(DnfTransactionIndex *index,
+                                           const gchar *filename_suffix)
 {
-    guint i;
     DnfPackage *pkg;
+    const gchar *basename;
+
+    if (index == NULL || filename_suffix == NULL)
+        return NULL;
+
+    /* the basename has to match for the suffix to match */
+    basename = strrchr(filename_suffix, '/');
+    basename = basename != NULL ? basename + 1 : filename_suffix;
+    pkg = g_hash_table_lookup(index->basename, basename);
+    if (pkg == NULL)
+        return NULL;
+    if (!g_str_has_suffix(dnf_package_get_filename(pkg), filename_suffix))
+        return NULL;
+    return pkg;
+}
 
-    /* find in array */
-    for (i = 0; i < array->len; i++) {
-        pkg = g_ptr_array_index(array, i);
-        if (g_strcmp0(dnf_package_get_name(pkg), pkgname) == 0)
-            return pkg;
+/**
+ * dnf_transaction_index_find_name:
+ **/
+static DnfPackage *
+dnf_transaction_index_find_name(DnfTransactionIndex *index, const gchar *pkgname)
+{
+    if (index == NULL || pkgname == NULL)
+        return NULL;
+    return g_hash_table_lookup(index->name, pkgname);
+}
+
+/**
+ * dnf_transaction_timing_begin:
+ **/
+static DnfTransactionTiming *
+dnf_transaction_timing_begin(DnfTransaction *transaction,
+                             DnfTransactionTimingKind kind,
+                             const gchar *name,
+                             const gchar *scriptlet)
+{
+    DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+    DnfTransactionTiming *timing;
+
+    timing = g_slice_new0(DnfTransactionTiming);
+    timing->kind = kind;
+    timing->name = g_strdup(name);
+    timing->scriptlet = scriptlet;
+    timing->start = (g_get_monotonic_time() - priv->timing_start) / (gdouble) G_USEC_PER_SEC;
+    timing->duration = -1;
+    g_ptr_array_add(priv->timings, timing);
+    return timing;
+}
+
+/**
+ * dnf_transaction_timing_end:
+ **/
+static void
+dnf_transaction_timing_end(DnfTransaction *transaction, DnfTransactionTiming *timing)
+{
+    DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+    if (timing == NULL)
+        return;
+    timing->duration = (g_get_monotonic_time() - priv->timing_start) /
+                       (gdouble) G_USEC_PER_SEC - timing->start;
+}
+
+/**
+ * dnf_transaction_get_scriptlet_name:
+ **/
+static const gchar *
+dnf_transaction_get_scriptlet_name(rpmTag tag)
+{
+    switch (tag) {
+    case RPMTAG_PRETRANS:
+        return "%pretrans";
+    case RPMTAG_PREIN:
+        return "%pre";
+    case RPMTAG_POSTIN:
+        return "%post";
+    case RPMTAG_PREUN:
+        return "%preun";
+    case RPMTAG_POSTUN:
+        return "%postun";
+    case RPMTAG_POSTTRANS:
+        return "%posttrans";
+    case RPMTAG_TRIGGERPREIN:
+        return "%triggerprein";
+    case RPMTAG_TRIGGERIN:
+        return "%triggerin";
+    case RPMTAG_TRIGGERUN:
+        return "%triggerun";
+    case RPMTAG_TRIGGERPOSTUN:
+        return "%triggerpostun";
+    case RPMTAG_VERIFYSCRIPT:
+        return "%verifyscript";
+    default:
+        return "%unknown";
+    }
+}
+
+/**
+ * dnf_transaction_get_header_nevra:
+ **/
+static gchar *
+dnf_transaction_get_header_nevra(Header hdr)
+{
+    gchar *nevra;
+    char *tmp;
+
+    if (hdr == NULL)
+        return g_strdup("unknown");
+    tmp = headerGetAsString(hdr, RPMTAG_NEVRA);
+    nevra = g_strdup(tmp);
+    free(tmp);
+    return nevra;
+}
+
+/**
+ * dnf_transaction_record_timing:
+ *
+ * Elements and scriptlets are timed from their START to their STOP
+ * callback; scriptlets, including triggers, run inside an element.
+ **/
+static void
+dnf_transaction_record_timing(DnfTransaction *transaction,
+                              rpmCallbackType what,
+                              Header hdr,
+                              rpm_loff_t amount,
+                              rpm_loff_t total)
+{
+    DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+    g_autofree gchar *nevra = NULL;
+
+    switch (what) {
+    case RPMCALLBACK_INST_START:
+    case RPMCALLBACK_UNINST_START:
+        dnf_transaction_timing_end(transaction, priv->timing_element);
+        nevra = dnf_transaction_get_header_nevra(hdr);
+        priv->timing_element =
+            dnf_transaction_timing_begin(transaction,
+                                         what == RPMCALLBACK_INST_START ?
+                                            DNF_TRANSACTION_TIMING_KIND_INSTALL :
+                                            DNF_TRANSACTION_TIMING_KIND_ERASE,
+                                         nevra, NULL);
+        break;
+    case RPMCALLBACK_INST_STOP:
+    case RPMCALLBACK_UNINST_STOP:
+        dnf_transaction_timing_end(transaction, priv->timing_element);
+        priv->timing_element = NULL;
+        break;
+    case RPMCALLBACK_SCRIPT_START:
+        dnf_transaction_timing_end(transaction, priv->timing_scriptlet);
+        nevra = dnf_transaction_get_header_nevra(hdr);
+        priv->timing_scriptlet =
+            dnf_transaction_timing_begin(transaction,
+                                         DNF_TRANSACTION_TIMING_KIND_SCRIPTLET,
+                                         nevra,
+                                         dnf_transaction_get_scriptlet_name((rpmTag) amount));
+        break;
+    case RPMCALLBACK_SCRIPT_ERROR:
+        if (priv->timing_scriptlet == NULL) {
+            nevra = dnf_transaction_get_header_nevra(hdr);
+            priv->timing_scriptlet =
+                dnf_transaction_timing_begin(transaction,
+                                             DNF_TRANSACTION_TIMING_KIND_SCRIPTLET,
+                                             nevra,
+                                             dnf_transaction_get_scriptlet_name((rpmTag) amount));
+        }
+        priv->timing_scriptlet->failed = TRUE;
+        priv->timing_scriptlet->rc = (gint) total;
+        break;
+    case RPMCALLBACK_SCRIPT_STOP:
+        dnf_transaction_timing_end(transaction, priv->timing_scriptlet);
+        priv->timing_scriptlet = NULL;
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * dnf_transaction_json_append_string:
+ **/
+static void
+dnf_transaction_json_append_string(GString *str, const gchar *value)
+{
+    const gchar *tmp;
+
+    g_string_append_c(str, '"');
+    for (tmp = value; *tmp != '\0'; tmp++) {
+        if (*tmp == '"' || *tmp == '\\')
+            g_string_append_printf(str, "\\%c", *tmp);
+        else if ((guchar) *tmp < 0x20)
+            g_string_append_printf(str, "\\u%04x", (guint) (guchar) *tmp);
+        else
+            g_string_append_c(str, *tmp);
+    }
+    g_string_append_c(str, '"');
+}
+
+/**
+ * dnf_transaction_timings_to_json:
+ **/
+gchar *
+dnf_transaction_timings_to_json(GPtrArray *timings)
+{
+    const gchar *kinds[] = { "phase", "install", "erase", "scriptlet",
+                             "verify", "header" };
+    gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+    GString *str;
+    guint i;
+
+    str = g_string_new("{\n  \"timings\": [");
+    for (i = 0; i < timings->len; i++) {
+        DnfTransactionTiming *timing = g_ptr_array_index(timings, i);
+        g_string_append_printf(str, "%s\n    {\"kind\": \"%s\", \"name\": ",
+                               i > 0 ? "," : "", kinds[timing->kind]);
+        dnf_transaction_json_append_string(str, timing->name);
+        if (timing->scriptlet != NULL)
+            g_string_append_printf(str, ", \"scriptlet\": \"%s\"", timing->scriptlet);
+        g_string_append_printf(str, ", \"start\": %s",
+                               g_ascii_formatd(buf, sizeof(buf), "%.6f", timing->start));
+        g_string_append_printf(str, ", \"duration\": %s",
+                               g_ascii_formatd(buf, sizeof(buf), "%.6f", timing->duration));
+        if (timing->failed)
+            g_string_append_printf(str, ", \"failed\": true, \"rc\": %i", timing->rc);
+        g_string_append_c(str, '}');
     }
-    return NULL;
+    g_string_append(str, "\n  ]\n}\n");
+    return g_string_free(str, FALSE);
 }
 
 /**
@@ -526,6 +949,7 @@ dnf_transaction_ts_progress_cb(const void *arg,
            (gint32) total,
            (const gchar *) key,
             name);
+    dnf_transaction_record_timing(transaction, what, hdr, amount, total);
 
     switch(what) {
     case RPMCALLBACK_INST_OPEN_FILE:
@@ -551,8 +975,8 @@ dnf_transaction_ts_progress_cb(const void *arg,
     case RPMCALLBACK_INST_START:
 
         /* find pkg */
-        pkg = dnf_find_pkg_from_filename_suffix(priv->install,
-                                                filename);
+        pkg = dnf_transaction_index_find_filename_suffix(priv->install_index,
+                                                         filename);
         if (pkg == NULL)
             g_assert_not_reached();
 
@@ -583,15 +1007,15 @@ dnf_transaction_ts_progress_cb(const void *arg,
     case RPMCALLBACK_UNINST_START:
 
         /* find pkg */
-        pkg = dnf_find_pkg_from_header(priv->remove, hdr);
-        if (pkg == NULL && filename != NULL) {
-            pkg = dnf_find_pkg_from_filename_suffix(priv->remove,
-                                                    filename);
+        pkg = dnf_transaction_index_find_header(priv->remove_index, hdr);
+        if (pkg == NULL) {
+            pkg = dnf_transaction_index_find_filename_suffix(priv->remove_index,
+                                                             filename);
         }
-        if (pkg == NULL && name != NULL)
-            pkg = dnf_find_pkg_from_name(priv->remove, name);
-        if (pkg == NULL && name != NULL)
-            pkg = dnf_find_pkg_from_name(priv->remove_helper, name);
+        if (pkg == NULL)
+            pkg = dnf_transaction_index_find_name(priv->remove_index, name);
+        if (pkg == NULL)
+            pkg = dnf_transaction_index_find_name(priv->remove_helper_index, name);
         if (pkg == NULL) {
             g_warning("cannot find %s in uninst-start", name);
             priv->step = DNF_TRANSACTION_STEP_WRITING;
@@ -636,10 +1060,10 @@ dnf_transaction_ts_progress_cb(const void *arg,
             dnf_state_set_percentage(priv->child, percentage);
 
         /* update UI */
-        pkg = dnf_find_pkg_from_header(priv->install, hdr);
+        pkg = dnf_transaction_index_find_header(priv->install_index, hdr);
         if (pkg == NULL) {
-            pkg = dnf_find_pkg_from_filename_suffix(priv->install,
-                                                    filename);
+            pkg = dnf_transaction_index_find_filename_suffix(priv->install_index,
+                                                             filename);
         }
         if (pkg == NULL) {
             g_debug("cannot find %s(%s)", filename, name);
@@ -668,15 +1092,15 @@ dnf_transaction_ts_progress_cb(const void *arg,
             dnf_state_set_percentage(priv->child, percentage);
 
         /* update UI */
-        pkg = dnf_find_pkg_from_header(priv->remove, hdr);
-        if (pkg == NULL && filename != NULL) {
-            pkg = dnf_find_pkg_from_filename_suffix(priv->remove,
-                                                    filename);
+        pkg = dnf_transaction_index_find_header(priv->remove_index, hdr);
+        if (pkg == NULL) {
+            pkg = dnf_transaction_index_find_filename_suffix(priv->remove_index,
+                                                             filename);
         }
-        if (pkg == NULL && name != NULL)
-            pkg = dnf_find_pkg_from_name(priv->remove, name);
-        if (pkg == NULL && name != NULL)
-            pkg = dnf_find_pkg_from_name(priv->remove_helper, name);
+        if (pkg == NULL)
+            pkg = dnf_transaction_index_find_name(priv->remove_index, name);
+        if (pkg == NULL)
+            pkg = dnf_transaction_index_find_name(priv->remove_helper_index, name);
         if (pkg == NULL) {
             g_warning("cannot find %s in uninst-progress", name);
             break;
@@ -855,9 +1279,7 @@ dnf_transaction_write_yumdb_install_item(DnfTransaction *transaction,
                                          GError **error)
 {
     DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
-    const gchar *tmp;
-    g_autofree gchar *euid = NULL;
-    g_autofree gchar *reason = NULL;
+    g_autoptr(GHashTable) values = NULL;
 
     /* should be set by dnf_transaction_ts_progress_cb() */
     if (dnf_package_get_pkgid(pkg) == NULL) {
@@ -872,24 +1294,24 @@ dnf_transaction_write_yumdb_install_item(DnfTransaction *transaction,
     /* uncancellable */
     dnf_state_set_allow_cancel(state, FALSE);
 
+    values = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+
     /* set the repo this came from */
-    tmp = dnf_package_get_reponame(pkg);
-    if (!dnf_db_set_string(priv->db, pkg, "from_repo", tmp, error))
-        return FALSE;
+    g_hash_table_insert(values, (gpointer) "from_repo",
+                        g_strdup(dnf_package_get_reponame(pkg)));
 
     /* write euid */
-    euid = g_strdup_printf("%i", priv->uid);
-    if (!dnf_db_set_string(priv->db, pkg, "installed_by", euid, error))
-        return FALSE;
+    g_hash_table_insert(values, (gpointer) "installed_by",
+                        g_strdup_printf("%i", priv->uid));
 
     /* set the correct reason */
-    reason = dnf_transaction_get_propagated_reason(transaction, goal, pkg);
-    if (!dnf_db_set_string(priv->db, pkg, "reason", reason, error))
-        return FALSE;
+    g_hash_table_insert(values, (gpointer) "reason",
+                        dnf_transaction_get_propagated_reason(transaction, goal, pkg));
 
     /* set the correct release */
-    tmp = dnf_context_get_release_ver(priv->context);
-    return dnf_db_set_string(priv->db, pkg, "releasever", tmp, error);
+    g_hash_table_insert(values, (gpointer) "releasever",
+                        g_strdup(dnf_context_get_release_ver(priv->context)));
+    return dnf_db_set_strings(priv->db, pkg, values, error);
 }
 
 /**
@@ -906,13 +1328,13 @@ _dnf_state_get_step_multiple_pair(guint first, guint second)
 }
 
 /**
- * dnf_transaction_write_yumdb:
+ * dnf_transaction_write_yumdb_items:
  **/
 static gboolean
-dnf_transaction_write_yumdb(DnfTransaction *transaction,
-                 HyGoal goal,
-                 DnfState *state,
-                 GError **error)
+dnf_transaction_write_yumdb_items(DnfTransaction *transaction,
+                                  HyGoal goal,
+                                  DnfState *state,
+                                  GError **error)
 {
     DnfState *state_local;
     DnfState *state_loop;
@@ -981,6 +1403,35 @@ dnf_transaction_write_yumdb(DnfTransaction *transaction,
     return dnf_state_done(state, error);
 }
 
+/**
+ * dnf_transaction_write_yumdb:
+ *
+ * All the changes are committed together, which for the store backend
+ * is a single write rather than a few files for every package.
+ **/
+static gboolean
+dnf_transaction_write_yumdb(DnfTransaction *transaction,
+                 HyGoal goal,
+                 DnfState *state,
+                 GError **error)
+{
+    DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+    g_autoptr(GTimer) timer = g_timer_new();
+
+    dnf_db_begin(priv->db);
+    if (!dnf_transaction_write_yumdb_items(transaction, goal, state, error)) {
+        dnf_db_rollback(priv->db);
+        return FALSE;
+    }
+    if (!dnf_db_commit(priv->db, error))
+        return FALSE;
+    g_debug("wrote yumdb for %u installed and %u removed packages in %.0fms",
+            priv->install->len,
+            priv->remove->len + priv->remove_helper->len,
+            g_timer_elapsed(timer, NULL) * 1000);
+    return TRUE;
+}
+
 static gboolean
 dnf_transaction_check_free_space(DnfTransaction *transaction,
                                  GError **error)
@@ -1040,64 +1491,1107 @@ dnf_transaction_check_free_space(DnfTransaction *transaction,
 }
 
 /**
- * dnf_transaction_download:
- * @transaction: a #DnfTransaction instance.
- * @state: A #DnfState
- * @error: A #GError or %NULL
- *
- * Downloads all the packages needed for a transaction.
- *
- * Returns: %TRUE for success, %FALSE otherwise
+ * dnf_transaction_mount_free:
+ */
+static void
+dnf_transaction_mount_free(DnfTransactionMount *mount)
+{
+    g_free(mount->path);
+    g_slice_free(DnfTransactionMount, mount);
+}
+
+/**
+ * dnf_transaction_space_get_mount:
  *
- * Since: 0.1.0
- **/
-gboolean
-dnf_transaction_download(DnfTransaction *transaction,
-                         DnfState *state,
-                         GError **error)
+ * Directories that do not exist yet are created on the filesystem of
+ * their closest existing parent. Results are cached by directory, so
+ * each one is only looked up once.
+ */
+static DnfTransactionMount *
+dnf_transaction_space_get_mount(DnfTransactionSpace *space, const gchar *path)
 {
-    DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+    DnfTransactionMount *mount;
+    guint64 dev;
+    struct stat buf;
 
-    /* check that we have enough free space */
-    if (!dnf_transaction_check_free_space(transaction, error))
-        return FALSE;
+    mount = g_hash_table_lookup(space->dirs, path);
+    if (mount != NULL)
+        return mount;
 
-    /* just download the list */
-    return dnf_package_array_download(priv->pkgs_to_download,
-                                      NULL,
-                                      state,
-                                      error);
+    if (stat(path, &buf) != 0) {
+        g_autofree gchar *parent = g_path_get_dirname(path);
+        if (g_strcmp0(parent, path) == 0)
+            return NULL;
+        mount = dnf_transaction_space_get_mount(space, parent);
+    } else {
+        dev = buf.st_dev;
+        mount = g_hash_table_lookup(space->mounts, &dev);
+        if (mount == NULL) {
+            mount = g_slice_new0(DnfTransactionMount);
+            mount->dev = dev;
+            mount->path = g_strdup(path);
+            g_hash_table_insert(space->mounts, &mount->dev, mount);
+        }
+    }
+    if (mount != NULL)
+        g_hash_table_insert(space->dirs, g_strdup(path), mount);
+    return mount;
 }
 
 /**
- * dnf_transaction_depsolve:
- * @transaction: a #DnfTransaction instance.
- * @goal: A #HyGoal
- * @state: A #DnfState
- * @error: A #GError or %NULL
- *
- * Depsolves the transaction.
+ * dnf_transaction_space_add_package:
  *
- * Returns: %TRUE for success, %FALSE otherwise
+ * Filelists do not have file sizes, so the install size is shared out
+ * between filesystems by the number of files on each. A package with no
+ * filelist in the sack is charged to the filesystem of the install root.
+ */
+static void
+dnf_transaction_space_add_package(DnfTransactionSpace *space,
+                                  DnfPackage *pkg,
+                                  gint sign)
+{
+    DnfTransactionMount *mount = NULL;
+    const gchar *slash;
+    guint i;
+    guint n_counted = 0;
+    guint n_files;
+    guint64 size;
+    g_auto(GStrv) files = NULL;
+    g_autoptr(GString) dir = g_string_new(NULL);
+    g_autoptr(GString) dir_last = g_string_new(NULL);
+
+    size = dnf_package_get_installsize(pkg);
+    if (size == 0)
+        return;
+    files = dnf_package_get_files(pkg);
+    n_files = g_strv_length(files);
+    for (i = 0; i < n_files; i++) {
+        slash = strrchr(files[i], '/');
+        if (slash == NULL)
+            continue;
+        g_string_assign(dir, space->root);
+        if (slash == files[i])
+            g_string_append_c(dir, '/');
+        else
+            g_string_append_len(dir, files[i], slash - files[i]);
+
+        /* files are mostly grouped by directory */
+        if (mount == NULL || g_strcmp0(dir->str, dir_last->str) != 0) {
+            mount = dnf_transaction_space_get_mount(space, dir->str);
+            g_string_assign(dir_last, dir->str);
+        }
+        if (mount == NULL)
+            continue;
+        if (mount->files++ == 0)
+            g_ptr_array_add(space->touched, mount);
+        n_counted++;
+    }
+    if (n_counted == 0) {
+        mount = dnf_transaction_space_get_mount(space, space->root[0] != '\0' ? space->root : "/");
+        if (mount != NULL)
+            mount->needed += sign * (gint64) size;
+        return;
+    }
+    for (i = 0; i < space->touched->len; i++) {
+        mount = g_ptr_array_index(space->touched, i);
+        mount->needed += sign * (gint64) (size * mount->files / n_counted);
+        mount->files = 0;
+    }
+    g_ptr_array_set_size(space->touched, 0);
+}
+
+/**
+ * dnf_transaction_check_install_space:
  *
- * Since: 0.1.0
- **/
-gboolean
-dnf_transaction_depsolve(DnfTransaction *transaction,
-                         HyGoal goal,
-                         DnfState *state,
-                         GError **error)
+ * Works out the space the transaction needs on each filesystem below the
+ * install root. It uses the filelists and install sizes that are already
+ * in the sack, plus the downloads going into the cache. A transaction
+ * that cannot fit then fails straight after depsolving, not after
+ * downloading, when rpm would notice.
+ */
+static gboolean
+dnf_transaction_check_install_space(DnfTransaction *transaction,
+                                    HyGoal goal,
+                                    GError **error)
 {
     DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+    DnfTransactionMount *mount;
+    DnfTransactionSpace space;
     DnfPackage *pkg;
-    gboolean valid;
+    DnfPackage *pkg_tmp;
+    GHashTableIter iter;
+    const gchar *cachedir;
     guint i;
-    g_autoptr(GPtrArray) packages = NULL;
-
-    /* depsolve */
-    if (!dnf_goal_depsolve(goal, DNF_ALLOW_UNINSTALL, error))
-        return FALSE;
-
+    guint j;
+    g_autoptr(GHashTable) erased = NULL;
+    g_autoptr(GPtrArray) install = NULL;
+    g_autoptr(GPtrArray) remove = NULL;
+    g_autoptr(GString) problems = g_string_new(NULL);
+    g_autoptr(GTimer) timer = g_timer_new();
+
+    space.root = dnf_context_get_install_root(priv->context);
+    if (space.root == NULL || g_strcmp0(space.root, "/") == 0)
+        space.root = "";
+    space.mounts = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL,
+                                         (GDestroyNotify) dnf_transaction_mount_free);
+    space.dirs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    space.touched = g_ptr_array_new();
+
+    /* packages that will be installed */
+    install = dnf_goal_get_packages(goal,
+                                    DNF_PACKAGE_INFO_INSTALL,
+                                    DNF_PACKAGE_INFO_REINSTALL,
+                                    DNF_PACKAGE_INFO_DOWNGRADE,
+                                    DNF_PACKAGE_INFO_UPDATE,
+                                    -1);
+    for (i = 0; i < install->len; i++)
+        dnf_transaction_space_add_package(&space, g_ptr_array_index(install, i), 1);
+
+    /* packages that will be erased, including replaced versions */
+    erased = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_object_unref);
+    remove = dnf_goal_get_packages(goal,
+                                   DNF_PACKAGE_INFO_OBSOLETE,
+                                   DNF_PACKAGE_INFO_REMOVE,
+                                   -1);
+    for (i = 0; i < remove->len; i++) {
+        pkg = g_ptr_array_index(remove, i);
+        g_hash_table_replace(erased,
+                             (gpointer) dnf_package_get_package_id(pkg),
+                             g_object_ref(pkg));
+    }
+    for (i = 0; i < install->len; i++) {
+        g_autoptr(GPtrArray) pkglist = NULL;
+        pkg = g_ptr_array_index(install, i);
+        if (dnf_package_get_action(pkg) != DNF_STATE_ACTION_UPDATE &&
+            dnf_package_get_action(pkg) != DNF_STATE_ACTION_DOWNGRADE &&
+            dnf_package_get_action(pkg) != DNF_STATE_ACTION_REINSTALL)
+            continue;
+        pkglist = hy_goal_list_obsoleted_by_package(goal, pkg);
+        for (j = 0; j < pkglist->len; j++) {
+            pkg_tmp = g_ptr_array_index(pkglist, j);
+            g_hash_table_replace(erased,
+                                 (gpointer) dnf_package_get_package_id(pkg_tmp),
+                                 g_object_ref(pkg_tmp));
+        }
+    }
+    g_hash_table_iter_init(&iter, erased);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &pkg))
+        dnf_transaction_space_add_package(&space, pkg, -1);
+
+    /* the downloads have to fit too */
+    cachedir = dnf_context_get_cache_dir(priv->context);
+    if (cachedir != NULL && priv->pkgs_to_download->len > 0) {
+        mount = dnf_transaction_space_get_mount(&space, cachedir);
+        if (mount != NULL)
+            mount->needed += dnf_package_array_get_download_size(priv->pkgs_to_download);
+    }
+
+    /* compare with what is free */
+    g_hash_table_iter_init(&iter, space.mounts);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &mount)) {
+        struct statvfs buf;
+        guint64 free_space;
+        g_autofree gchar *formatted_needed = NULL;
+        g_autofree gchar *formatted_free = NULL;
+
+        if (mount->needed <= 0)
+            continue;
+        if (statvfs(mount->path, &buf) != 0) {
+            g_debug("failed to get free space for %s", mount->path);
+            continue;
+        }
+        free_space = (guint64) buf.f_bavail * buf.f_frsize;
+        if ((guint64) mount->needed <= free_space)
+            continue;
+        formatted_needed = g_format_size(mount->needed);
+        formatted_free = g_format_size(free_space);
+        if (problems->len > 0)
+            g_string_append(problems, "; ");
+        g_string_append_printf(problems, "needed %s on the filesystem of %s, available %s",
+                               formatted_needed, mount->path, formatted_free);
+    }
+    g_debug("checked space on %u filesystems for %u packages in %.0fms",
+            g_hash_table_size(space.mounts),
+            install->len + g_hash_table_size(erased),
+            g_timer_elapsed(timer, NULL) * 1000);
+
+    /* the directory cache points into mounts */
+    g_hash_table_unref(space.dirs);
+    g_hash_table_unref(space.mounts);
+    g_ptr_array_unref(space.touched);
+    if (problems->len > 0) {
+        g_set_error(error,
+                    DNF_ERROR,
+                    DNF_ERROR_NO_SPACE,
+                    "Not enough free space: %s",
+                    problems->str);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * dnf_transaction_pipeline_get_keyring:
+ *
+ * An rpmKeyring must not be used by several threads at once, so each
+ * worker takes one of its own, importing the keys when there is no idle
+ * one left. Returns %NULL if the keys could not be imported.
+ */
+static rpmKeyring
+dnf_transaction_pipeline_get_keyring(DnfTransactionPipeline *pipeline)
+{
+    rpmKeyring keyring;
+    g_autoptr(GError) error_local = NULL;
+
+    keyring = g_async_queue_try_pop(pipeline->keyrings);
+    if (keyring != NULL)
+        return keyring;
+    keyring = rpmKeyringNew();
+    if (!dnf_transaction_import_keys(pipeline->transaction, keyring, &error_local)) {
+        g_debug("not checking on a worker: %s", error_local->message);
+        rpmKeyringFree(keyring);
+        return NULL;
+    }
+    return keyring;
+}
+
+/**
+ * dnf_transaction_pipeline_add_timing:
+ *
+ * Must be called with the pipeline mutex held.
+ */
+static void
+dnf_transaction_pipeline_add_timing(DnfTransactionPipeline *pipeline,
+                                    DnfTransactionTimingKind kind,
+                                    const gchar *name,
+                                    gint64 start,
+                                    gint64 end)
+{
+    DnfTransactionTiming *timing;
+
+    timing = g_slice_new0(DnfTransactionTiming);
+    timing->kind = kind;
+    timing->name = g_strdup(name);
+    timing->start = (start - pipeline->timing_start) / (gdouble) G_USEC_PER_SEC;
+    timing->duration = (end - start) / (gdouble) G_USEC_PER_SEC;
+    g_ptr_array_add(pipeline->timings, timing);
+}
+
+/**
+ * dnf_transaction_verify_cb:
+ *
+ * Runs in a worker thread; checks the signature and reads the header of
+ * one downloaded file so dnf_transaction_commit() does not have to.
+ */
+static void
+dnf_transaction_verify_cb(gpointer data, gpointer user_data)
+{
+    gchar *filename = data;
+    DnfTransactionPipeline *pipeline = user_data;
+    DnfTransactionPrivate *priv = GET_PRIVATE(pipeline->transaction);
+    DnfTransactionVerified *item;
+    FD_t fd;
+    gint64 verify_start;
+    gint64 header_start;
+    gint64 header_end;
+    rpmKeyring keyring;
+    rpmts ts;
+    g_autofree gchar *basename = NULL;
+
+    /* the result is not going to be used */
+    if (g_atomic_int_get(&pipeline->cancelled)) {
+        g_free(filename);
+        return;
+    }
+
+    /* dnf_transaction_commit() checks it instead */
+    keyring = dnf_transaction_pipeline_get_keyring(pipeline);
+    if (keyring == NULL) {
+        g_free(filename);
+        return;
+    }
+
+    item = g_slice_new0(DnfTransactionVerified);
+
+    /* GPG signature */
+    verify_start = g_get_monotonic_time();
+    if (pipeline->check_gpg) {
+        dnf_keyring_check_untrusted_file(keyring, filename, &item->gpg_error);
+        item->gpg_checked = TRUE;
+    }
+
+    /* header, read the same way dnf_rpmts_add_install_filename() would */
+    header_start = g_get_monotonic_time();
+    ts = rpmtsCreate();
+    rpmtsSetKeyring(ts, keyring);
+    rpmtsSetVSFlags(ts, pipeline->vs_flags);
+    fd = Fopen(filename, "r.ufdio");
+    if (fd != NULL && !Ferror(fd))
+        item->hdr_rc = rpmReadPackageFile(ts, fd, filename, &item->hdr);
+    if (fd != NULL)
+        Fclose(fd);
+    rpmtsFree(ts);
+    header_end = g_get_monotonic_time();
+    g_async_queue_push(pipeline->keyrings, keyring);
+
+    basename = g_path_get_basename(filename);
+    g_mutex_lock(&pipeline->mutex);
+    pipeline->verify_us += header_start - verify_start;
+    pipeline->header_us += header_end - header_start;
+    if (pipeline->check_gpg)
+        dnf_transaction_pipeline_add_timing(pipeline,
+                                            DNF_TRANSACTION_TIMING_KIND_VERIFY,
+                                            basename,
+                                            verify_start,
+                                            header_start);
+    dnf_transaction_pipeline_add_timing(pipeline,
+                                        DNF_TRANSACTION_TIMING_KIND_HEADER,
+                                        basename,
+                                        header_start,
+                                        header_end);
+    g_hash_table_insert(priv->verified, filename, item);
+    g_mutex_unlock(&pipeline->mutex);
+}
+
+/**
+ * dnf_transaction_pipeline_init:
+ *
+ * Starts a worker for each processor, recording what they do in @timings
+ * relative to @timing_start.
+ */
+static void
+dnf_transaction_pipeline_init(DnfTransactionPipeline *pipeline,
+                              DnfTransaction *transaction,
+                              gboolean check_gpg,
+                              GPtrArray *timings,
+                              gint64 timing_start)
+{
+    DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+
+    pipeline->transaction = transaction;
+    pipeline->vs_flags = rpmtsVSFlags(priv->ts);
+    pipeline->check_gpg = check_gpg;
+    pipeline->timings = timings;
+    pipeline->timing_start = timing_start;
+    pipeline->keyrings = g_async_queue_new_full((GDestroyNotify) rpmKeyringFree);
+    g_mutex_init(&pipeline->mutex);
+    pipeline->pool = g_thread_pool_new(dnf_transaction_verify_cb,
+                                       pipeline,
+                                       (gint) g_get_num_processors(),
+                                       TRUE,
+                                       NULL);
+}
+
+/**
+ * dnf_transaction_pipeline_clear:
+ *
+ * Waits for the workers to finish the files that were pushed; if the
+ * pipeline was cancelled, the queued ones only free their filename.
+ */
+static void
+dnf_transaction_pipeline_clear(DnfTransactionPipeline *pipeline)
+{
+    g_thread_pool_free(pipeline->pool, FALSE, TRUE);
+    g_async_queue_unref(pipeline->keyrings);
+    g_mutex_clear(&pipeline->mutex);
+}
+
+/**
+ * dnf_transaction_read_headers:
+ *
+ * Reads the headers that were not already read while downloading on a
+ * worker pool, so that only adding them to the rpm transaction is done
+ * in order.
+ */
+static void
+dnf_transaction_read_headers(DnfTransaction *transaction, GPtrArray *packages)
+{
+    DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+    DnfTransactionPipeline pipeline = { 0, };
+    const gchar *filename;
+    guint i;
+    g_autoptr(GPtrArray) filenames = g_ptr_array_new_with_free_func(g_free);
+    g_autoptr(GTimer) timer = g_timer_new();
+
+    /* the workers add to priv->verified, so decide before starting */
+    for (i = 0; i < packages->len; i++) {
+        filename = dnf_package_get_filename(g_ptr_array_index(packages, i));
+        if (filename == NULL || g_hash_table_contains(priv->verified, filename))
+            continue;
+        g_ptr_array_add(filenames, g_strdup(filename));
+    }
+
+    /* not worth the threads, the commit reads it */
+    if (filenames->len < 2)
+        return;
+
+    dnf_transaction_pipeline_init(&pipeline, transaction, FALSE,
+                                  priv->timings, priv->timing_start);
+    for (i = 0; i < filenames->len; i++)
+        g_thread_pool_push(pipeline.pool, g_strdup(g_ptr_array_index(filenames, i)), NULL);
+    dnf_transaction_pipeline_clear(&pipeline);
+    g_debug("read %u headers in %.2fs using %.2fs of worker time",
+            filenames->len,
+            g_timer_elapsed(timer, NULL),
+            pipeline.header_us / (gdouble) G_USEC_PER_SEC);
+}
+
+/**
+ * dnf_transaction_downloaded_cb:
+ */
+static void
+dnf_transaction_downloaded_cb(DnfPackage *pkg, gpointer user_data)
+{
+    DnfTransactionPipeline *pipeline = user_data;
+    const gchar *filename = dnf_package_get_filename(pkg);
+
+    if (filename == NULL)
+        return;
+    g_thread_pool_push(pipeline->pool, g_strdup(filename), NULL);
+}
+
+/**
+ * dnf_transaction_delta_free:
+ */
+static void
+dnf_transaction_delta_free(DnfTransactionDelta *item)
+{
+    g_object_unref(item->pkg);
+    g_object_unref(item->delta);
+    g_free(item->delta_path);
+    g_free(item->rpm_path);
+    g_slice_free(DnfTransactionDelta, item);
+}
+
+/**
+ * dnf_transaction_select_deltas:
+ *
+ * Finds the updates that are cheaper to rebuild from a delta against
+ * the installed version than to download in full.
+ */
+static GPtrArray *
+dnf_transaction_select_deltas(DnfTransaction *transaction)
+{
+    DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+    DnfSack *sack;
+    GPtrArray *deltas;
+    guint i;
+    g_autofree gchar *applydeltarpm = NULL;
+
+    deltas = g_ptr_array_new_with_free_func((GDestroyNotify) dnf_transaction_delta_free);
+    if (!dnf_context_get_use_deltarpm(priv->context))
+        return deltas;
+
+    /* the rebuild reads the installed files from the running system */
+    if (g_strcmp0(dnf_context_get_install_root(priv->context), "/") != 0)
+        return deltas;
+    applydeltarpm = g_find_program_in_path("applydeltarpm");
+    if (applydeltarpm == NULL) {
+        g_debug("not using deltas as applydeltarpm is not installed");
+        return deltas;
+    }
+    sack = dnf_context_get_sack(priv->context);
+    if (sack == NULL)
+        return deltas;
+
+    for (i = 0; i < priv->pkgs_to_download->len; i++) {
+        DnfPackage *pkg = g_ptr_array_index(priv->pkgs_to_download, i);
+        DnfPackage *installed;
+        DnfPackageDelta *delta;
+        DnfRepo *repo = dnf_package_get_repo(pkg);
+        DnfTransactionDelta *item;
+        HyQuery query;
+        g_autofree gchar *basename = NULL;
+        g_autoptr(GPtrArray) installed_pkgs = NULL;
+
+        if (dnf_package_get_action(pkg) != DNF_STATE_ACTION_UPDATE)
+            continue;
+        if (repo == NULL || dnf_repo_is_local(repo))
+            continue;
+
+        /* installonly packages can have more than one version installed,
+         * so only use deltas when the base is unambiguous */
+        query = hy_query_create(sack);
+        hy_query_filter(query, HY_PKG_NAME, HY_EQ, dnf_package_get_name(pkg));
+        hy_query_filter(query, HY_PKG_ARCH, HY_EQ, dnf_package_get_arch(pkg));
+        hy_query_filter(query, HY_PKG_REPONAME, HY_EQ, HY_SYSTEM_REPO_NAME);
+        installed_pkgs = hy_query_run(query);
+        hy_query_free(query);
+        if (installed_pkgs->len != 1)
+            continue;
+        installed = g_ptr_array_index(installed_pkgs, 0);
+
+        delta = dnf_package_get_delta_from_evr(pkg, dnf_package_get_evr(installed));
+        if (delta == NULL)
+            continue;
+        if (!dnf_packagedelta_is_worthwhile(delta, dnf_package_get_downloadsize(pkg))) {
+            g_object_unref(delta);
+            continue;
+        }
+
+        /* dnf_repo_download_deltas() saves next to the packages */
+        item = g_slice_new0(DnfTransactionDelta);
+        item->pkg = g_object_ref(pkg);
+        item->delta = delta;
+        basename = g_path_get_basename(dnf_packagedelta_get_location(delta));
+        item->delta_path = g_build_filename(dnf_repo_get_packages(repo), basename, NULL);
+        item->rpm_path = g_strdup(dnf_package_get_filename(pkg));
+        g_ptr_array_add(deltas, item);
+    }
+    return deltas;
+}
+
+/**
+ * dnf_transaction_rebuild_cb:
+ *
+ * Runs in a worker thread; rebuilds one full package from its delta and
+ * the installed files.
+ */
+static void
+dnf_transaction_rebuild_cb(gpointer data, gpointer user_data)
+{
+    DnfTransactionDelta *item = data;
+    DnfTransactionDeltaHelper *helper = user_data;
+    gboolean ret;
+    gint exit_status = 0;
+    gint64 start = g_get_monotonic_time();
+    const gchar *argv[] = { "applydeltarpm",
+                            item->delta_path,
+                            item->rpm_path,
+                            NULL };
+    g_autofree gchar *standard_error = NULL;
+    g_autoptr(GError) error = NULL;
+
+    if (g_atomic_int_get(&helper->cancelled))
+        return;
+
+    ret = g_spawn_sync(NULL, (gchar **) argv, NULL,
+                       G_SPAWN_SEARCH_PATH | G_SPAWN_STDOUT_TO_DEV_NULL,
+                       NULL, NULL, NULL, &standard_error,
+                       &exit_status, &error);
+    if (ret)
+        ret = g_spawn_check_exit_status(exit_status, &error);
+    if (!ret) {
+        g_debug("failed to rebuild %s: %s %s", item->rpm_path,
+                error->message, standard_error != NULL ? standard_error : "");
+        g_unlink(item->rpm_path);
+    }
+    g_unlink(item->delta_path);
+
+    g_mutex_lock(&helper->mutex);
+    item->rebuilt = ret;
+    helper->rebuild_us += g_get_monotonic_time() - start;
+    g_mutex_unlock(&helper->mutex);
+}
+
+/**
+ * dnf_transaction_delta_downloaded_cb:
+ */
+static void
+dnf_transaction_delta_downloaded_cb(DnfPackage *pkg, gpointer user_data)
+{
+    DnfTransactionDeltaHelper *helper = user_data;
+    DnfTransactionDelta *item = g_hash_table_lookup(helper->items, pkg);
+
+    if (item != NULL)
+        g_thread_pool_push(helper->pool, item, NULL);
+}
+
+/**
+ * dnf_transaction_download_deltas:
+ *
+ * Downloads the deltas and rebuilds each package on a pool of threads as
+ * soon as its delta has arrived.
+ */
+static gboolean
+dnf_transaction_download_deltas(DnfTransaction *transaction,
+                                GPtrArray *deltas,
+                                DnfState *state,
+                                GError **error)
+{
+    DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+    DnfTransactionDeltaHelper helper = { 0, };
+    gboolean ret;
+    guint i;
+    g_autoptr(GPtrArray) pkgs = g_ptr_array_new();
+    g_autoptr(GPtrArray) pkg_deltas = g_ptr_array_new();
+
+    helper.items = g_hash_table_new(NULL, NULL);
+    for (i = 0; i < deltas->len; i++) {
+        DnfTransactionDelta *item = g_ptr_array_index(deltas, i);
+        g_ptr_array_add(pkgs, item->pkg);
+        g_ptr_array_add(pkg_deltas, item->delta);
+        g_hash_table_insert(helper.items, item->pkg, item);
+    }
+
+    /* applydeltarpm is CPU bound, so use a thread per core */
+    g_mutex_init(&helper.mutex);
+    helper.pool = g_thread_pool_new(dnf_transaction_rebuild_cb,
+                                    &helper,
+                                    (gint) g_get_num_processors(),
+                                    TRUE,
+                                    NULL);
+    ret = dnf_repo_download_deltas(pkgs,
+                                   pkg_deltas,
+                                   dnf_transaction_delta_downloaded_cb,
+                                   &helper,
+                                   state,
+                                   error);
+
+    /* let the queued items return at once rather than dropping them */
+    if (!ret)
+        g_atomic_int_set(&helper.cancelled, TRUE);
+    g_thread_pool_free(helper.pool, FALSE, TRUE);
+    g_mutex_clear(&helper.mutex);
+    g_hash_table_unref(helper.items);
+    priv->delta_rebuild_time = helper.rebuild_us / (gdouble) G_USEC_PER_SEC;
+    return ret;
+}
+
+/**
+ * dnf_transaction_download_full:
+ *
+ * Downloads @packages, verifying each one as soon as it has arrived.
+ * The packages in @verify_only are already there and just verified.
+ */
+gboolean
+dnf_transaction_download_full(DnfTransaction *transaction,
+                              GPtrArray *packages,
+                              GPtrArray *verify_only,
+                              DnfState *state,
+                              GError **error)
+{
+    DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+    DnfTransactionPipeline pipeline = { 0, };
+    DnfTransactionTiming *timing;
+    gboolean ret;
+    gdouble download_secs;
+    guint i;
+    g_autoptr(GError) error_local = NULL;
+    g_autoptr(GTimer) timer = g_timer_new();
+
+    /* the signature checks need the keys, so failing to import them
+     * just means the checks are done later in dnf_transaction_commit() */
+    g_ptr_array_set_size(priv->download_timings, 0);
+    if (priv->repos == NULL ||
+        !dnf_transaction_import_keys(transaction, priv->keyring, &error_local)) {
+        g_debug("not verifying while downloading: %s",
+                error_local != NULL ? error_local->message : "no repos");
+        return dnf_package_array_download(packages,
+                                          NULL,
+                                          state,
+                                          error);
+    }
+
+    /* verify each package as soon as it is downloaded */
+    dnf_transaction_pipeline_init(&pipeline, transaction, TRUE,
+                                  priv->download_timings,
+                                  g_get_monotonic_time());
+    for (i = 0; verify_only != NULL && i < verify_only->len; i++)
+        dnf_transaction_downloaded_cb(g_ptr_array_index(verify_only, i), &pipeline);
+    ret = dnf_repo_download_packages_all(packages,
+                                         NULL,
+                                         dnf_transaction_downloaded_cb,
+                                         &pipeline,
+                                         state,
+                                         error);
+    download_secs = g_timer_elapsed(timer, NULL);
+
+    /* wait for the packages still being verified; after a failure the
+     * queued ones only free their filename */
+    if (!ret)
+        g_atomic_int_set(&pipeline.cancelled, TRUE);
+    dnf_transaction_pipeline_clear(&pipeline);
+
+    /* the workers have stopped, so the phases can be added */
+    timing = g_slice_new0(DnfTransactionTiming);
+    timing->kind = DNF_TRANSACTION_TIMING_KIND_PHASE;
+    timing->name = g_strdup("download");
+    timing->duration = download_secs;
+    g_ptr_array_add(priv->download_timings, timing);
+    timing = g_slice_new0(DnfTransactionTiming);
+    timing->kind = DNF_TRANSACTION_TIMING_KIND_PHASE;
+    timing->name = g_strdup("verify-wait");
+    timing->start = download_secs;
+    timing->duration = g_timer_elapsed(timer, NULL) - download_secs;
+    g_ptr_array_add(priv->download_timings, timing);
+
+    g_debug("downloaded %u packages in %.2fs, waited %.2fs more for "
+            "verification; signature checks took %.2fs, header reads %.2fs",
+            packages->len,
+            download_secs,
+            g_timer_elapsed(timer, NULL) - download_secs,
+            pipeline.verify_us / (gdouble) G_USEC_PER_SEC,
+            pipeline.header_us / (gdouble) G_USEC_PER_SEC);
+    if (!ret)
+        g_hash_table_remove_all(priv->verified);
+    return ret;
+}
+
+/**
+ * dnf_transaction_prefetch_start:
+ *
+ * Starts downloading the packages that are not going to be rebuilt from
+ * deltas in the background.
+ */
+static void
+dnf_transaction_prefetch_start(DnfTransaction *transaction)
+{
+    DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+    guint i;
+    g_autoptr(GPtrArray) deltas = NULL;
+    g_autoptr(GPtrArray) packages = g_ptr_array_new();
+    g_autoptr(GHashTable) with_delta = g_hash_table_new(NULL, NULL);
+    g_autoptr(GError) error_local = NULL;
+
+    deltas = dnf_transaction_select_deltas(transaction);
+    for (i = 0; i < deltas->len; i++) {
+        DnfTransactionDelta *item = g_ptr_array_index(deltas, i);
+        g_hash_table_add(with_delta, item->pkg);
+    }
+    for (i = 0; i < priv->pkgs_to_download->len; i++) {
+        DnfPackage *pkg = g_ptr_array_index(priv->pkgs_to_download, i);
+        if (!g_hash_table_contains(with_delta, pkg))
+            g_ptr_array_add(packages, pkg);
+    }
+    if (packages->len == 0)
+        return;
+    priv->prefetch = dnf_repo_prefetch_start(packages, &error_local);
+    if (priv->prefetch == NULL && error_local != NULL)
+        g_debug("not prefetching: %s", error_local->message);
+}
+
+/**
+ * dnf_transaction_prefetch_finish:
+ *
+ * Waits for the background download and adds the packages it completed
+ * to @prefetched. A failed prefetch is not an error as the packages are
+ * just downloaded again, unless the user cancelled.
+ */
+gboolean
+dnf_transaction_prefetch_finish(DnfTransaction *transaction,
+                                GPtrArray *prefetched,
+                                DnfState *state,
+                                GError **error)
+{
+    DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+    gboolean ret;
+    guint i;
+    g_autoptr(DnfState) state_local = dnf_state_new();
+    g_autoptr(GPtrArray) invalid = NULL;
+    g_autoptr(GHashTable) invalid_set = g_hash_table_new(NULL, NULL);
+    g_autoptr(GError) error_local = NULL;
+    g_autoptr(GTimer) timer = g_timer_new();
+
+    if (priv->prefetch == NULL)
+        return TRUE;
+
+    /* the time left waiting is all the prefetch did not save */
+    dnf_state_set_cancellable(state_local, dnf_state_get_cancellable(state));
+    ret = dnf_repo_prefetch_wait(priv->prefetch, state_local, &error_local);
+    dnf_repo_prefetch_free(priv->prefetch);
+    priv->prefetch = NULL;
+    g_debug("waited %.2fs for the prefetch", g_timer_elapsed(timer, NULL));
+    if (!ret) {
+        if (g_error_matches(error_local, DNF_ERROR, DNF_ERROR_CANCELLED)) {
+            g_propagate_error(error, g_steal_pointer(&error_local));
+            return FALSE;
+        }
+        g_debug("prefetch failed: %s", error_local->message);
+    }
+
+    /* the verified index makes this cheap for what was just downloaded */
+    invalid = g_ptr_array_new_with_free_func((GDestroyNotify) g_object_unref);
+    dnf_state_reset(state_local);
+    if (!dnf_package_array_check_filenames(priv->pkgs_to_download, invalid,
+                                           state_local, error))
+        return FALSE;
+    for (i = 0; i < invalid->len; i++)
+        g_hash_table_add(invalid_set, g_ptr_array_index(invalid, i));
+    for (i = 0; i < priv->pkgs_to_download->len; i++) {
+        DnfPackage *pkg = g_ptr_array_index(priv->pkgs_to_download, i);
+        if (!g_hash_table_contains(invalid_set, pkg))
+            g_ptr_array_add(prefetched, pkg);
+    }
+    return TRUE;
+}
+
+/**
+ * dnf_transaction_download:
+ * @transaction: a #DnfTransaction instance.
+ * @state: A #DnfState
+ * @error: A #GError or %NULL
+ *
+ * Downloads all the packages needed for a transaction.
+ *
+ * Each package has its GPG signature checked and its header read on a
+ * worker thread as soon as it has been downloaded, so that this work
+ * overlaps with the remaining downloads rather than being done later in
+ * dnf_transaction_commit().
+ *
+ * If dnf_context_set_use_deltarpm() is enabled, updates for which a
+ * delta is cheap enough are rebuilt from the delta and the installed
+ * files instead, falling back to the full package if anything fails.
+ *
+ * If dnf_context_set_prefetch() is enabled, the download started by
+ * dnf_transaction_depsolve() is waited for and only what it did not
+ * manage to download is downloaded here.
+ *
+ * Returns: %TRUE for success, %FALSE otherwise
+ *
+ * Since: 0.1.0
+ **/
+gboolean
+dnf_transaction_download(DnfTransaction *transaction,
+                         DnfState *state,
+                         GError **error)
+{
+    DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+    DnfState *state_local;
+    guint i;
+    g_autoptr(GPtrArray) deltas = NULL;
+    g_autoptr(GPtrArray) rebuilt = g_ptr_array_new();
+    g_autoptr(GPtrArray) invalid = NULL;
+    g_autoptr(GPtrArray) full = g_ptr_array_new();
+    g_autoptr(GPtrArray) prefetched = g_ptr_array_new();
+    g_autoptr(GHashTable) rebuilt_ok = g_hash_table_new(NULL, NULL);
+    g_autoptr(GHashTable) prefetched_set = g_hash_table_new(NULL, NULL);
+
+    /* check that we have enough free space */
+    if (!dnf_transaction_check_free_space(transaction, error))
+        return FALSE;
+
+    /* anything verified by an earlier download may have changed on disk */
+    g_hash_table_remove_all(priv->verified);
+    priv->delta_bytes_saved = 0;
+    priv->delta_rebuild_time = 0;
+
+    /* the prefetched packages only need verifying */
+    if (!dnf_transaction_prefetch_finish(transaction, prefetched, state, error))
+        return FALSE;
+    for (i = 0; i < prefetched->len; i++)
+        g_hash_table_add(prefetched_set, g_ptr_array_index(prefetched, i));
+
+    /* nothing to rebuild */
+    deltas = dnf_transaction_select_deltas(transaction);
+    if (deltas->len == 0) {
+        for (i = 0; i < priv->pkgs_to_download->len; i++) {
+            DnfPackage *pkg = g_ptr_array_index(priv->pkgs_to_download, i);
+            if (!g_hash_table_contains(prefetched_set, pkg))
+                g_ptr_array_add(full, pkg);
+        }
+        return dnf_transaction_download_full(transaction,
+                                             full,
+                                             prefetched,
+                                             state,
+                                             error);
+    }
+    if (!dnf_state_set_steps(state, error,
+                             25, /* deltas */
+                             5, /* check rebuilt */
+                             70, /* full packages */
+                             -1))
+        return FALSE;
+
+    /* download deltas and rebuild */
+    state_local = dnf_state_get_child(state);
+    if (!dnf_transaction_download_deltas(transaction, deltas, state_local, error))
+        return FALSE;
+    if (!dnf_state_done(state, error))
+        return FALSE;
+
+    /* the rebuilt packages have to match the repo checksum */
+    for (i = 0; i < deltas->len; i++) {
+        DnfTransactionDelta *item = g_ptr_array_index(deltas, i);
+        if (item->rebuilt)
+            g_ptr_array_add(rebuilt, item->pkg);
+    }
+    invalid = g_ptr_array_new_with_free_func((GDestroyNotify) g_object_unref);
+    state_local = dnf_state_get_child(state);
+    if (!dnf_package_array_check_filenames(rebuilt, invalid, state_local, error))
+        return FALSE;
+    for (i = 0; i < rebuilt->len; i++)
+        g_hash_table_add(rebuilt_ok, g_ptr_array_index(rebuilt, i));
+    for (i = 0; i < invalid->len; i++) {
+        g_debug("rebuilt %s does not match, downloading it in full",
+                dnf_package_get_nevra(g_ptr_array_index(invalid, i)));
+        g_hash_table_remove(rebuilt_ok, g_ptr_array_index(invalid, i));
+    }
+    for (i = 0; i < deltas->len; i++) {
+        DnfTransactionDelta *item = g_ptr_array_index(deltas, i);
+        if (g_hash_table_contains(rebuilt_ok, item->pkg))
+            priv->delta_bytes_saved += dnf_package_get_downloadsize(item->pkg) -
+                                       dnf_packagedelta_get_downloadsize(item->delta);
+    }
+    if (!dnf_state_done(state, error))
+        return FALSE;
+    g_debug("rebuilt %u of %u packages from deltas in %.2fs, saving %" G_GUINT64_FORMAT " bytes",
+            g_hash_table_size(rebuilt_ok), deltas->len,
+            priv->delta_rebuild_time, priv->delta_bytes_saved);
+
+    /* download everything else, in the original order */
+    for (i = 0; i < priv->pkgs_to_download->len; i++) {
+        DnfPackage *pkg = g_ptr_array_index(priv->pkgs_to_download, i);
+        if (!g_hash_table_contains(rebuilt_ok, pkg) &&
+            !g_hash_table_contains(prefetched_set, pkg))
+            g_ptr_array_add(full, pkg);
+    }
+    state_local = dnf_state_get_child(state);
+    g_ptr_array_set_size(rebuilt, 0);
+    for (i = 0; i < deltas->len; i++) {
+        DnfTransactionDelta *item = g_ptr_array_index(deltas, i);
+        if (g_hash_table_contains(rebuilt_ok, item->pkg))
+            g_ptr_array_add(rebuilt, item->pkg);
+    }
+    for (i = 0; i < prefetched->len; i++)
+        g_ptr_array_add(rebuilt, g_ptr_array_index(prefetched, i));
+    if (!dnf_transaction_download_full(transaction, full, rebuilt, state_local, error))
+        return FALSE;
+    return dnf_state_done(state, error);
+}
+
+/**
+ * dnf_transaction_get_delta_bytes_saved:
+ * @transaction: a #DnfTransaction instance.
+ *
+ * Gets how many bytes the last dnf_transaction_download() did not have
+ * to download because packages were rebuilt from deltas.
+ *
+ * Returns: number of bytes
+ *
+ * Since: 0.8.0
+ **/
+guint64
+dnf_transaction_get_delta_bytes_saved(DnfTransaction *transaction)
+{
+    DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+    return priv->delta_bytes_saved;
+}
+
+/**
+ * dnf_transaction_get_delta_rebuild_time:
+ * @transaction: a #DnfTransaction instance.
+ *
+ * Gets the time the last dnf_transaction_download() spent rebuilding
+ * packages from deltas, added up over all the worker threads.
+ *
+ * Returns: time in seconds
+ *
+ * Since: 0.8.0
+ **/
+gdouble
+dnf_transaction_get_delta_rebuild_time(DnfTransaction *transaction)
+{
+    DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+    return priv->delta_rebuild_time;
+}
+
+/**
+ * dnf_transaction_get_download_timings:
+ * @transaction: a #DnfTransaction instance.
+ *
+ * Gets how long the last dnf_transaction_download() spent downloading
+ * and then waiting for the packages to be verified, and how long the
+ * signature check and header read of each package took on the worker
+ * threads while the rest were still downloading.
+ *
+ * Returns: (transfer none) (element-type DnfTransactionTiming): the timings
+ *
+ * Since: 0.8.0
+ **/
+GPtrArray *
+dnf_transaction_get_download_timings(DnfTransaction *transaction)
+{
+    DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+    return priv->download_timings;
+}
+
+/**
+ * dnf_transaction_get_timings:
+ * @transaction: a #DnfTransaction instance.
+ *
+ * Gets how long the phases of the last dnf_transaction_commit() took, and
+ * how long each package and scriptlet took while running it, in the order
+ * they were started.
+ *
+ * Returns: (transfer none) (element-type DnfTransactionTiming): the timings
+ *
+ * Since: 0.8.0
+ **/
+GPtrArray *
+dnf_transaction_get_timings(DnfTransaction *transaction)
+{
+    DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+    return priv->timings;
+}
+
+/**
+ * dnf_transaction_is_in_place:
+ *
+ * Returns %TRUE if @pkg can be installed from where it is in a local
+ * repo, whose metadata checksums dnf_repo_check() has already verified.
+ */
+static gboolean
+dnf_transaction_is_in_place(DnfPackage *pkg)
+{
+    DnfRepo *repo = dnf_package_get_repo(pkg);
+    const gchar *filename;
+    struct stat st;
+
+    if (repo == NULL || !dnf_repo_is_local(repo) || !dnf_repo_is_checked(repo))
+        return FALSE;
+
+    /* the file must be in the repo itself, not in the cache */
+    filename = dnf_package_get_filename(pkg);
+    if (!g_str_has_prefix(filename, dnf_repo_get_location(repo)))
+        return FALSE;
+
+    /* cheap sanity check, rpm checks the digests when installing */
+    if (g_stat(filename, &st) != 0)
+        return FALSE;
+    return (guint64) st.st_size == dnf_package_get_downloadsize(pkg);
+}
+
+/**
+ * dnf_transaction_depsolve:
+ * @transaction: a #DnfTransaction instance.
+ * @goal: A #HyGoal
+ * @state: A #DnfState
+ * @error: A #GError or %NULL
+ *
+ * Depsolves the transaction.
+ *
+ * If dnf_context_set_prefetch() is enabled, the packages that need to
+ * be downloaded start downloading in the background before this
+ * returns; see dnf_transaction_download().
+ *
+ * Returns: %TRUE for success, %FALSE otherwise
+ *
+ * Since: 0.1.0
+ **/
+gboolean
+dnf_transaction_depsolve(DnfTransaction *transaction,
+                         HyGoal goal,
+                         DnfState *state,
+                         GError **error)
+{
+    DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
+    DnfPackage *pkg;
+    guint i;
+    g_autoptr(GPtrArray) packages = NULL;
+    gboolean local_in_place = dnf_context_get_local_repos_in_place(priv->context);
+    g_autoptr(GPtrArray) to_check = g_ptr_array_new();
+
+    /* whatever an earlier depsolve was prefetching may not be needed */
+    if (priv->prefetch != NULL) {
+        dnf_repo_prefetch_free(priv->prefetch);
+        priv->prefetch = NULL;
+    }
+
+    /* depsolve */
+    if (!dnf_goal_depsolve(goal, DNF_ALLOW_UNINSTALL, error))
+        return FALSE;
+
     /* find a list of all the packages we have to download */
     g_ptr_array_set_size(priv->pkgs_to_download, 0);
     packages = dnf_goal_get_packages(goal,
@@ -1120,16 +2614,30 @@ dnf_transaction_depsolve(DnfTransaction *transaction,
             continue;
         }
 
-        /* check package exists and checksum is okay */
-        if (!dnf_package_check_filename(pkg, &valid, error))
-            return FALSE;
-
-        /* package needs to be downloaded */
-        if (!valid) {
-            g_ptr_array_add(priv->pkgs_to_download,
-                            g_object_ref(pkg));
+        /* install straight from a checked local repo */
+        if (local_in_place && dnf_transaction_is_in_place(pkg)) {
+            g_debug("installing %s in place", dnf_package_get_filename(pkg));
+            continue;
         }
+        g_ptr_array_add(to_check, pkg);
     }
+
+    /* check packages exist and checksums are okay, anything else needs
+     * to be downloaded */
+    if (!dnf_package_array_check_filenames(to_check,
+                                           priv->pkgs_to_download,
+                                           state,
+                                           error))
+        return FALSE;
+
+    /* fail now rather than after downloading everything */
+    if (dnf_context_get_check_disk_space(priv->context) &&
+        !dnf_transaction_check_install_space(transaction, goal, error))
+        return FALSE;
+
+    /* start downloading while the frontend asks for confirmation */
+    if (dnf_context_get_prefetch(priv->context))
+        dnf_transaction_prefetch_start(transaction);
     return TRUE;
 }
 
@@ -1143,6 +2651,10 @@ dnf_transaction_reset(DnfTransaction *transaction)
 
     /* reset */
     priv->child = NULL;
+    if (priv->prefetch != NULL) {
+        dnf_repo_prefetch_free(priv->prefetch);
+        priv->prefetch = NULL;
+    }
     g_ptr_array_set_size(priv->pkgs_to_download, 0);
     rpmtsEmpty(priv->ts);
     rpmtsSetNotifyCallback(priv->ts, NULL, NULL);
@@ -1164,6 +2676,10 @@ dnf_transaction_reset(DnfTransaction *transaction)
         g_hash_table_unref(priv->erased_by_package_hash);
         priv->erased_by_package_hash = NULL;
     }
+    g_clear_pointer(&priv->install_index, dnf_transaction_index_free);
+    g_clear_pointer(&priv->remove_index, dnf_transaction_index_free);
+    g_clear_pointer(&priv->remove_helper_index, dnf_transaction_index_free);
+    g_hash_table_remove_all(priv->verified);
 }
 
 /**
@@ -1202,10 +2718,18 @@ dnf_transaction_commit(DnfTransaction *transaction,
     GPtrArray *pkglist;
     DnfPackage *pkg;
     DnfPackage *pkg_tmp;
+    DnfTransactionTiming *timing;
+    DnfTransactionVerified *verified;
     rpmprobFilterFlags problems_filter = 0;
     rpmtransFlags rpmts_flags = RPMTRANS_FLAG_NONE;
     DnfTransactionPrivate *priv = GET_PRIVATE(transaction);
 
+    /* start timing */
+    g_ptr_array_set_size(priv->timings, 0);
+    priv->timing_element = NULL;
+    priv->timing_scriptlet = NULL;
+    priv->timing_start = g_get_monotonic_time();
+
     /* take lock */
     ret = dnf_state_take_lock(state,
                               DNF_LOCK_TYPE_RPMDB,
@@ -1237,26 +2761,11 @@ dnf_transaction_commit(DnfTransaction *transaction,
     if (!ret)
         goto out;
 
-    /* import all system wide GPG keys */
-    ret = dnf_keyring_add_public_keys(priv->keyring, error);
+    /* import all system wide and downloaded repo GPG keys */
+    ret = dnf_transaction_import_keys(transaction, priv->keyring, error);
     if (!ret)
         goto out;
 
-    /* import downloaded repo GPG keys */
-    for (i = 0; i < priv->repos->len; i++) {
-        DnfRepo *repo = g_ptr_array_index(priv->repos, i);
-        const gchar *pubkey;
-
-        /* does this file actually exist */
-        pubkey = dnf_repo_get_public_key(repo);
-        if (g_file_test(pubkey, G_FILE_TEST_EXISTS)) {
-            /* import */
-            ret = dnf_keyring_add_public_key(priv->keyring, pubkey, error);
-            if (!ret)
-                goto out;
-        }
-    }
-
     /* find any packages without valid GPG signatures */
     ret = dnf_transaction_check_untrusted(transaction, goal, error);
     if (!ret)
@@ -1292,26 +2801,41 @@ dnf_transaction_commit(DnfTransaction *transaction,
                                           DNF_PACKAGE_INFO_DOWNGRADE,
                                           DNF_PACKAGE_INFO_UPDATE,
                                           -1);
+    for (i = 0; i < priv->install->len; i++) {
+        pkg = g_ptr_array_index(priv->install, i);
+        ret = dnf_transaction_ensure_repo(transaction, pkg, error);
+        if (!ret)
+            goto out;
+    }
+    dnf_transaction_read_headers(transaction, priv->install);
     if (priv->install->len > 0)
         dnf_state_set_number_steps(state_local,
                                    priv->install->len);
     for (i = 0; i < priv->install->len; i++) {
 
         pkg = g_ptr_array_index(priv->install, i);
-        ret = dnf_transaction_ensure_repo(transaction, pkg, error);
-        if (!ret)
-            goto out;
 
         /* add the install */
         filename = dnf_package_get_filename(pkg);
         allow_untrusted =(priv->flags & DNF_TRANSACTION_FLAG_ONLY_TRUSTED) == 0;
         is_update = dnf_package_get_action(pkg) == DNF_STATE_ACTION_UPDATE ||
                 dnf_package_get_action(pkg) == DNF_STATE_ACTION_DOWNGRADE;
-        ret = dnf_rpmts_add_install_filename(priv->ts,
-                                             filename,
-                                             allow_untrusted,
-                                             is_update,
-                                             error);
+        verified = g_hash_table_lookup(priv->verified, filename);
+        if (verified != NULL && verified->hdr != NULL) {
+            ret = dnf_rpmts_add_install_header(priv->ts,
+                                               filename,
+                                               verified->hdr,
+                                               verified->hdr_rc,
+                                               allow_untrusted,
+                                               is_update,
+                                               error);
+        } else {
+            ret = dnf_rpmts_add_install_filename(priv->ts,
+                                                 filename,
+                                                 allow_untrusted,
+                                                 is_update,
+                                                 error);
+        }
         if (!ret)
             goto out;
 
@@ -1325,17 +2849,18 @@ dnf_transaction_commit(DnfTransaction *transaction,
     ret = dnf_state_done(state, error);
     if (!ret)
         goto out;
+    priv->install_index = dnf_transaction_index_new(priv->install);
 
     /* add things to remove */
     priv->remove = dnf_goal_get_packages(goal,
                                          DNF_PACKAGE_INFO_OBSOLETE,
                                          DNF_PACKAGE_INFO_REMOVE,
                                          -1);
+    ret = dnf_rpmts_add_remove_pkgs(priv->ts, priv->remove, error);
+    if (!ret)
+        goto out;
     for (i = 0; i < priv->remove->len; i++) {
         pkg = g_ptr_array_index(priv->remove, i);
-        ret = dnf_rpmts_add_remove_pkg(priv->ts, pkg, error);
-        if (!ret)
-            goto out;
 
         /* pre-get the pkgid, as this isn't possible to get after
          * the sack is invalidated */
@@ -1345,8 +2870,8 @@ dnf_transaction_commit(DnfTransaction *transaction,
         }
 
         /* are the things being removed actually being upgraded */
-        pkg_tmp = dnf_find_pkg_from_name(priv->install,
-                                         dnf_package_get_name(pkg));
+        pkg_tmp = dnf_transaction_index_find_name(priv->install_index,
+                                                  dnf_package_get_name(pkg));
         if (pkg_tmp != NULL)
             dnf_package_set_action(pkg, DNF_STATE_ACTION_CLEANUP);
     }
@@ -1369,6 +2894,8 @@ dnf_transaction_commit(DnfTransaction *transaction,
         }
         g_ptr_array_unref(pkglist);
     }
+    priv->remove_index = dnf_transaction_index_new(priv->remove);
+    priv->remove_helper_index = dnf_transaction_index_new(priv->remove_helper);
 
     /* this section done */
     ret = dnf_state_done(state, error);
@@ -1400,7 +2927,11 @@ dnf_transaction_commit(DnfTransaction *transaction,
     g_ptr_array_unref(all_obsoleted);
 
     /* generate ordering for the transaction */
+    timing = dnf_transaction_timing_begin(transaction,
+                                          DNF_TRANSACTION_TIMING_KIND_PHASE,
+                                          "order", NULL);
     rpmtsOrder(priv->ts);
+    dnf_transaction_timing_end(transaction, timing);
 
     /* run the test transaction */
     if (dnf_context_get_check_transaction(priv->context)) {
@@ -1411,7 +2942,11 @@ dnf_transaction_commit(DnfTransaction *transaction,
         priv->state = dnf_state_get_child(state);
         priv->step = DNF_TRANSACTION_STEP_IGNORE;
         /* the output value of rpmtsCheck is not meaningful */
+        timing = dnf_transaction_timing_begin(transaction,
+                                              DNF_TRANSACTION_TIMING_KIND_PHASE,
+                                              "check", NULL);
         rpmtsCheck(priv->ts);
+        dnf_transaction_timing_end(transaction, timing);
         dnf_state_action_stop(state);
         ret = dnf_rpmts_look_for_problems(priv->ts, error);
         if (!ret)
@@ -1448,7 +2983,11 @@ dnf_transaction_commit(DnfTransaction *transaction,
         rpmtsSetFlags(priv->ts, rpmts_flags);
         g_debug("Running transaction in test mode");
         dnf_state_set_allow_cancel(state, FALSE);
+        timing = dnf_transaction_timing_begin(transaction,
+                                              DNF_TRANSACTION_TIMING_KIND_PHASE,
+                                              "test", NULL);
         rc = rpmtsRun(priv->ts, NULL, problems_filter);
+        dnf_transaction_timing_end(transaction, timing);
         if (rc < 0) {
             ret = FALSE;
             g_set_error(error,
@@ -1474,7 +3013,11 @@ dnf_transaction_commit(DnfTransaction *transaction,
     rpmtsSetFlags(priv->ts, rpmts_flags);
     g_debug("Running actual transaction");
     dnf_state_set_allow_cancel(state, FALSE);
+    timing = dnf_transaction_timing_begin(transaction,
+                                          DNF_TRANSACTION_TIMING_KIND_PHASE,
+                                          "run", NULL);
     rc = rpmtsRun(priv->ts, NULL, problems_filter);
+    dnf_transaction_timing_end(transaction, timing);
     if (rc < 0) {
         ret = FALSE;
         g_set_error(error,
@@ -1508,10 +3051,14 @@ dnf_transaction_commit(DnfTransaction *transaction,
 
     /* write to the yumDB */
     state_local = dnf_state_get_child(state);
+    timing = dnf_transaction_timing_begin(transaction,
+                                          DNF_TRANSACTION_TIMING_KIND_PHASE,
+                                          "yumdb", NULL);
     ret = dnf_transaction_write_yumdb(transaction,
                                       goal,
                                       state_local,
                                       error);
+    dnf_transaction_timing_end(transaction, timing);
     if (!ret)
         goto out;
 
@@ -1540,6 +3087,15 @@ dnf_transaction_commit(DnfTransaction *transaction,
     if (!ret)
         goto out;
 out:
+    /* anything still open never finished */
+    priv->timing_element = NULL;
+    priv->timing_scriptlet = NULL;
+    if (priv->timings_filename != NULL) {
+        g_autoptr(GError) error_local = NULL;
+        g_autofree gchar *json = dnf_transaction_timings_to_json(priv->timings);
+        if (!g_file_set_contents(priv->timings_filename, json, -1, &error_local))
+            g_warning("failed to write timings: %s", error_local->message);
+    }
     dnf_transaction_reset(transaction);
     dnf_state_release_locks(state);
     return ret;
@@ -72,12 +72,64 @@ typedef enum {
         DNF_TRANSACTION_FLAG_LAST
 } DnfTransactionFlag;
 
+/**
+ * DnfTransactionTimingKind:
+ * @DNF_TRANSACTION_TIMING_KIND_PHASE:          A step of the commit, e.g. "order"
+ * @DNF_TRANSACTION_TIMING_KIND_INSTALL:        Installing one package
+ * @DNF_TRANSACTION_TIMING_KIND_ERASE:          Erasing one package
+ * @DNF_TRANSACTION_TIMING_KIND_SCRIPTLET:      Running one scriptlet or trigger
+ * @DNF_TRANSACTION_TIMING_KIND_VERIFY:         Checking the signature of one file
+ * @DNF_TRANSACTION_TIMING_KIND_HEADER:         Reading the header of one file
+ *
+ * What a #DnfTransactionTiming measured.
+ **/
+typedef enum {
+        DNF_TRANSACTION_TIMING_KIND_PHASE,
+        DNF_TRANSACTION_TIMING_KIND_INSTALL,
+        DNF_TRANSACTION_TIMING_KIND_ERASE,
+        DNF_TRANSACTION_TIMING_KIND_SCRIPTLET,
+        DNF_TRANSACTION_TIMING_KIND_VERIFY,
+        DNF_TRANSACTION_TIMING_KIND_HEADER,
+        /*< private >*/
+        DNF_TRANSACTION_TIMING_KIND_LAST
+} DnfTransactionTimingKind;
+
+/**
+ * DnfTransactionTiming:
+ * @kind:       a #DnfTransactionTimingKind
+ * @name:       the phase name, the NEVRA of the package, or the file name
+ *              of the package for %DNF_TRANSACTION_TIMING_KIND_VERIFY and
+ *              %DNF_TRANSACTION_TIMING_KIND_HEADER
+ * @scriptlet:  the scriptlet, e.g. "%post", or %NULL
+ * @start:      seconds since the commit or the download started
+ * @duration:   seconds taken, or -1 if it never finished
+ * @failed:     %TRUE if rpm reported an error for the scriptlet
+ * @rc:         the error rpm reported, which is 0 for non-fatal scriptlets
+ *
+ * How long part of dnf_transaction_commit() or dnf_transaction_download()
+ * took. Signature checks and header reads run on worker threads, so they
+ * can overlap each other and the phase they belong to.
+ **/
+typedef struct {
+        DnfTransactionTimingKind         kind;
+        gchar                           *name;
+        const gchar                     *scriptlet;
+        gdouble                          start;
+        gdouble                          duration;
+        gboolean                         failed;
+        gint                             rc;
+} DnfTransactionTiming;
+
 DnfTransaction  *dnf_transaction_new                    (DnfContext     *context);
 
 /* getters */
 guint64          dnf_transaction_get_flags              (DnfTransaction *transaction);
 GPtrArray       *dnf_transaction_get_remote_pkgs        (DnfTransaction *transaction);
 DnfDb           *dnf_transaction_get_db                 (DnfTransaction *transaction);
+guint64          dnf_transaction_get_delta_bytes_saved  (DnfTransaction *transaction);
+gdouble          dnf_transaction_get_delta_rebuild_time (DnfTransaction *transaction);
+GPtrArray       *dnf_transaction_get_timings            (DnfTransaction *transaction);
+GPtrArray       *dnf_transaction_get_download_timings   (DnfTransaction *transaction);
 
 /* setters */
 void             dnf_transaction_set_repos            (DnfTransaction *transaction,
@@ -86,6 +138,8 @@ void             dnf_transaction_set_uid                (DnfTransaction *transac
                                                          guint           uid);
 void             dnf_transaction_set_flags              (DnfTransaction *transaction,
                                                          guint64         flags);
+void             dnf_transaction_set_timings_filename   (DnfTransaction *transaction,
+                                                         const gchar    *filename);
 
 /* object methods */
 gboolean         dnf_transaction_depsolve               (DnfTransaction *transaction,
@@ -0,0 +1,38 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef __DNF_VERIFIED_CACHE_PRIVATE_H
+#define __DNF_VERIFIED_CACHE_PRIVATE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gboolean         dnf_verified_cache_check_checksum      (const gchar    *path,
+                                                         gint            checksum_type,
+                                                         const gchar    *checksum);
+void             dnf_verified_cache_add_checksum        (const gchar    *path,
+                                                         gint            checksum_type,
+                                                         const gchar    *checksum);
+
+G_END_DECLS
+
+#endif /* __DNF_VERIFIED_CACHE_PRIVATE_H */
@@ -0,0 +1,361 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/**
+ * SECTION:dnf-verified-cache
+ * @short_description: Remembers which downloaded packages were verified
+ * @include: libdnf.h
+ * @stability: Unstable
+ *
+ * Checksumming a cached package means reading all of it, which is slow
+ * for big transactions that are run again after a failure. librepo can
+ * keep the result in an extended attribute, but many cache directories
+ * live on filesystems without user xattrs.
+ *
+ * This keeps a small index file in each package directory instead. An
+ * entry is only trusted while the device, inode, size and modification
+ * time of the file still match, and it records the checksum that was
+ * verified. GPG verdicts are not kept: they depend on the keyring of the
+ * run that checks them, not only on the file.
+ * New entries are appended to the index; it is rewritten when it has
+ * collected too many stale lines.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "dnf-verified-cache-private.h"
+
+#define DNF_VERIFIED_CACHE_FILENAME     ".verified"
+
+typedef struct {
+    guint64      dev;
+    guint64      ino;
+    guint64      size;
+    gint64       mtime_ns;
+    gint         checksum_type;
+    gchar       *checksum;
+} DnfVerifiedEntry;
+
+typedef struct {
+    gchar       *filename;
+    GHashTable  *entries;               /* basename:DnfVerifiedEntry */
+    guint        n_lines;
+} DnfVerifiedIndex;
+
+/* dirname:DnfVerifiedIndex, shared by every thread in the process */
+static GHashTable *indexes = NULL;
+static GMutex indexes_mutex;
+
+/**
+ * dnf_verified_entry_free:
+ **/
+static void
+dnf_verified_entry_free(DnfVerifiedEntry *entry)
+{
+    g_free(entry->checksum);
+    g_slice_free(DnfVerifiedEntry, entry);
+}
+
+/**
+ * dnf_verified_index_free:
+ **/
+static void
+dnf_verified_index_free(DnfVerifiedIndex *index)
+{
+    g_free(index->filename);
+    g_hash_table_unref(index->entries);
+    g_slice_free(DnfVerifiedIndex, index);
+}
+
+/**
+ * dnf_verified_entry_to_line:
+ **/
+static gchar *
+dnf_verified_entry_to_line(const gchar *basename, DnfVerifiedEntry *entry)
+{
+    return g_strdup_printf("%s\t%" G_GUINT64_FORMAT "\t%" G_GUINT64_FORMAT
+                           "\t%" G_GUINT64_FORMAT "\t%" G_GINT64_FORMAT
+                           "\t%i\t%s\n",
+                           basename,
+                           entry->dev,
+                           entry->ino,
+                           entry->size,
+                           entry->mtime_ns,
+                           entry->checksum_type,
+                           entry->checksum);
+}
+
+/**
+ * dnf_verified_entry_set_stat:
+ **/
+static gboolean
+dnf_verified_entry_set_stat(DnfVerifiedEntry *entry, const gchar *path)
+{
+    struct stat st;
+
+    if (g_stat(path, &st) != 0)
+        return FALSE;
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    entry->size = st.st_size;
+    entry->mtime_ns = (gint64) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return TRUE;
+}
+
+/**
+ * dnf_verified_entry_matches:
+ **/
+static gboolean
+dnf_verified_entry_matches(DnfVerifiedEntry *entry, DnfVerifiedEntry *current)
+{
+    return entry->dev == current->dev &&
+           entry->ino == current->ino &&
+           entry->size == current->size &&
+           entry->mtime_ns == current->mtime_ns;
+}
+
+/**
+ * dnf_verified_index_rewrite:
+ *
+ * Writes only the live entries, dropping the ones superseded by later
+ * lines or whose file has changed or gone away.
+ **/
+static void
+dnf_verified_index_rewrite(DnfVerifiedIndex *index, const gchar *dirname)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    g_autoptr(GString) str = g_string_new(NULL);
+    g_autoptr(GError) error = NULL;
+
+    g_hash_table_iter_init(&iter, index->entries);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        DnfVerifiedEntry current = { 0, };
+        g_autofree gchar *path = g_build_filename(dirname, key, NULL);
+        g_autofree gchar *line = NULL;
+
+        if (!dnf_verified_entry_set_stat(&current, path) ||
+            !dnf_verified_entry_matches(value, &current)) {
+            g_hash_table_iter_remove(&iter);
+            continue;
+        }
+        line = dnf_verified_entry_to_line(key, value);
+        g_string_append(str, line);
+    }
+    index->n_lines = g_hash_table_size(index->entries);
+    if (!g_file_set_contents(index->filename, str->str, str->len, &error))
+        g_debug("failed to rewrite %s: %s", index->filename, error->message);
+}
+
+/**
+ * dnf_verified_index_load:
+ **/
+static DnfVerifiedIndex *
+dnf_verified_index_load(const gchar *dirname)
+{
+    DnfVerifiedIndex *index;
+    guint i;
+    g_autofree gchar *data = NULL;
+    g_auto(GStrv) lines = NULL;
+
+    index = g_slice_new0(DnfVerifiedIndex);
+    index->filename = g_build_filename(dirname, DNF_VERIFIED_CACHE_FILENAME, NULL);
+    index->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                           (GDestroyNotify) dnf_verified_entry_free);
+    if (!g_file_get_contents(index->filename, &data, NULL, NULL))
+        return index;
+
+    /* later lines replace earlier ones */
+    lines = g_strsplit(data, "\n", -1);
+    for (i = 0; lines[i] != NULL; i++) {
+        DnfVerifiedEntry *entry;
+        g_auto(GStrv) split = NULL;
+
+        if (lines[i][0] == '\0')
+            continue;
+        index->n_lines++;
+        split = g_strsplit(lines[i], "\t", -1);
+        if (g_strv_length(split) != 7)
+            continue;
+        entry = g_slice_new0(DnfVerifiedEntry);
+        entry->dev = g_ascii_strtoull(split[1], NULL, 10);
+        entry->ino = g_ascii_strtoull(split[2], NULL, 10);
+        entry->size = g_ascii_strtoull(split[3], NULL, 10);
+        entry->mtime_ns = g_ascii_strtoll(split[4], NULL, 10);
+        entry->checksum_type = atoi(split[5]);
+        entry->checksum = g_strdup(split[6]);
+        g_hash_table_insert(index->entries, g_strdup(split[0]), entry);
+    }
+
+    /* mostly stale, so compact it */
+    if (index->n_lines > 2 * g_hash_table_size(index->entries) + 64)
+        dnf_verified_index_rewrite(index, dirname);
+    return index;
+}
+
+/**
+ * dnf_verified_index_get:
+ *
+ * Must be called with indexes_mutex held.
+ **/
+static DnfVerifiedIndex *
+dnf_verified_index_get(const gchar *dirname)
+{
+    DnfVerifiedIndex *index;
+
+    if (indexes == NULL)
+        indexes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                        (GDestroyNotify) dnf_verified_index_free);
+    index = g_hash_table_lookup(indexes, dirname);
+    if (index == NULL) {
+        index = dnf_verified_index_load(dirname);
+        g_hash_table_insert(indexes, g_strdup(dirname), index);
+    }
+    return index;
+}
+
+/**
+ * dnf_verified_cache_lookup:
+ *
+ * Returns the entry for @path if the file is unchanged since it was
+ * recorded. Must be called with indexes_mutex held.
+ **/
+static DnfVerifiedEntry *
+dnf_verified_cache_lookup(const gchar *path)
+{
+    DnfVerifiedEntry current = { 0, };
+    DnfVerifiedEntry *entry;
+    DnfVerifiedIndex *index;
+    g_autofree gchar *dirname = g_path_get_dirname(path);
+    g_autofree gchar *basename = g_path_get_basename(path);
+
+    index = dnf_verified_index_get(dirname);
+    entry = g_hash_table_lookup(index->entries, basename);
+    if (entry == NULL)
+        return NULL;
+    if (!dnf_verified_entry_set_stat(&current, path))
+        return NULL;
+    if (!dnf_verified_entry_matches(entry, &current))
+        return NULL;
+    return entry;
+}
+
+/**
+ * dnf_verified_cache_update:
+ *
+ * Records @path as it is now, verified against @checksum.
+ **/
+static void
+dnf_verified_cache_update(const gchar *path,
+                          gint checksum_type,
+                          const gchar *checksum)
+{
+    DnfVerifiedEntry *entry;
+    DnfVerifiedIndex *index;
+    gssize len;
+    int fd;
+    g_autofree gchar *dirname = g_path_get_dirname(path);
+    g_autofree gchar *basename = g_path_get_basename(path);
+    g_autofree gchar *line = NULL;
+
+    entry = g_slice_new0(DnfVerifiedEntry);
+    if (!dnf_verified_entry_set_stat(entry, path)) {
+        dnf_verified_entry_free(entry);
+        return;
+    }
+    entry->checksum_type = checksum_type;
+    entry->checksum = g_strdup(checksum);
+
+    g_mutex_lock(&indexes_mutex);
+    index = dnf_verified_index_get(dirname);
+    line = dnf_verified_entry_to_line(basename, entry);
+    g_hash_table_insert(index->entries, g_strdup(basename), entry);
+
+    /* a short O_APPEND write does not interleave with other writers */
+    fd = g_open(index->filename, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        g_debug("failed to open %s: %s", index->filename, strerror(errno));
+        goto out;
+    }
+    len = strlen(line);
+    if (write(fd, line, len) != len)
+        g_debug("failed to write %s: %s", index->filename, strerror(errno));
+    else
+        index->n_lines++;
+    g_close(fd, NULL);
+out:
+    g_mutex_unlock(&indexes_mutex);
+}
+
+/**
+ * dnf_verified_cache_check_checksum:
+ * @path: a package filename
+ * @checksum_type: a #LrChecksumType
+ * @checksum: the expected checksum as a hex string
+ *
+ * Checks if @path was already verified to have @checksum and has not
+ * changed since.
+ *
+ * Returns: %TRUE if the file does not need to be checksummed again
+ *
+ * Since: 0.8.0
+ **/
+gboolean
+dnf_verified_cache_check_checksum(const gchar *path,
+                                  gint checksum_type,
+                                  const gchar *checksum)
+{
+    DnfVerifiedEntry *entry;
+    gboolean ret = FALSE;
+
+    g_mutex_lock(&indexes_mutex);
+    entry = dnf_verified_cache_lookup(path);
+    if (entry != NULL &&
+        entry->checksum_type == checksum_type &&
+        g_ascii_strcasecmp(entry->checksum, checksum) == 0)
+        ret = TRUE;
+    g_mutex_unlock(&indexes_mutex);
+    return ret;
+}
+
+/**
+ * dnf_verified_cache_add_checksum:
+ * @path: a package filename
+ * @checksum_type: a #LrChecksumType
+ * @checksum: the checksum @path was verified to have
+ *
+ * Records that @path has been checksummed.
+ *
+ * Since: 0.8.0
+ **/
+void
+dnf_verified_cache_add_checksum(const gchar *path,
+                                gint checksum_type,
+                                const gchar *checksum)
+{
+    dnf_verified_cache_update(path, checksum_type, checksum);
+}
@@ -33,10 +33,16 @@ struct _HyGoal {
     DnfSack *sack;
     Queue staging;
     Solver *solv;
+    int solv_nsolvables;
     Transaction *trans;
     DnfGoalActions actions;
     Map *protected;
+    Map *kernel_deps;
+    Map *kernel_deps_known;
     GPtrArray *removal_of_protected;
+    Queue *cached_reasons;
+    Queue *cached_unneeded;
+    HyGoalStats stats;
 };
 
 int sltr2job(const HySelector sltr, Queue *job, int solver_action);
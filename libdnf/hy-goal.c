@@ -22,8 +22,10 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 // libsolv
+#include <solv/chksum.h>
 #include <solv/evr.h>
 #include <solv/policy.h>
 #include <solv/selection.h>
@@ -53,6 +55,7 @@
 #include "dnf-solution-private.h"
 
 #define BLOCK_SIZE 15
+#define SOLUTION_CACHE_MAX 16
 
 struct _SolutionCallback {
     HyGoal goal;
@@ -60,9 +63,16 @@ struct _SolutionCallback {
     void *callback_data;
 };
 
+typedef struct {
+    Transaction *trans;
+    Queue        reasons;       /* (solvable, HY_REASON_*) sorted by solvable */
+    Queue        unneeded;
+} SolutionCacheEntry;
+
 struct InstallonliesSortCallback {
     Pool *pool;
     Id running_kernel;
+    Map *kernel_deps;
 };
 
 static int
@@ -136,6 +146,39 @@ can_depend_on(Pool *pool, Solvable *sa, Id b)
     return ret;
 }
 
+/**
+ * goal_kernel_deps:
+ *
+ * Marks which of the solvables in @q are the running kernel or depend on it.
+ * The answers are kept in the goal, so every solvable is only looked at once
+ * no matter how many sorts and solver passes need it.
+ **/
+static Map *
+goal_kernel_deps(HyGoal goal, Queue *q, Id kernel)
+{
+    Pool *pool = dnf_sack_get_pool(goal->sack);
+
+    if (goal->kernel_deps == NULL) {
+        goal->kernel_deps = g_malloc0(sizeof(Map));
+        map_init(goal->kernel_deps, pool->nsolvables);
+        goal->kernel_deps_known = g_malloc0(sizeof(Map));
+        map_init(goal->kernel_deps_known, pool->nsolvables);
+    } else {
+        map_grow(goal->kernel_deps, pool->nsolvables);
+        map_grow(goal->kernel_deps_known, pool->nsolvables);
+    }
+
+    for (int i = 0; i < q->count; ++i) {
+        Id p = q->elements[i];
+        if (MAPTST(goal->kernel_deps_known, p))
+            continue;
+        MAPSET(goal->kernel_deps_known, p);
+        if (p == kernel || can_depend_on(pool, pool_id2solvable(pool, p), kernel))
+            MAPSET(goal->kernel_deps, p);
+    }
+    return goal->kernel_deps;
+}
+
 static int
 sort_packages(const void *ap, const void *bp, void *s_cb)
 {
@@ -143,6 +186,7 @@ sort_packages(const void *ap, const void *bp, void *s_cb)
     Id b = *(Id*)bp;
     Pool *pool = ((struct InstallonliesSortCallback*) s_cb)->pool;
     Id kernel = ((struct InstallonliesSortCallback*) s_cb)->running_kernel;
+    Map *kernel_deps = ((struct InstallonliesSortCallback*) s_cb)->kernel_deps;
     Solvable *sa = pool_id2solvable(pool, a);
     Solvable *sb = pool_id2solvable(pool, b);
 
@@ -154,9 +198,9 @@ sort_packages(const void *ap, const void *bp, void *s_cb)
 
     /* same name, if one is/depends on the running kernel put it last */
     if (kernel >= 0) {
-        if (a == kernel || can_depend_on(pool, sa, kernel))
+        if (MAPTST(kernel_deps, a))
             return 1;
-        if (b == kernel || can_depend_on(pool, sb, kernel))
+        if (MAPTST(kernel_deps, b))
             return -1;
     }
 
@@ -187,7 +231,9 @@ limit_installonly_packages(HyGoal goal, Solver *solv, Queue *job)
             continue;
         }
 
-        struct InstallonliesSortCallback s_cb = {pool, dnf_sack_running_kernel(sack)};
+        Id kernel = dnf_sack_running_kernel(sack);
+        Map *kernel_deps = kernel >= 0 ? goal_kernel_deps(goal, &q, kernel) : NULL;
+        struct InstallonliesSortCallback s_cb = {pool, kernel, kernel_deps};
         solv_sort(q.elements, q.count, sizeof(q.elements[0]), sort_packages, &s_cb);
         Queue same_names;
         queue_init(&same_names);
@@ -229,11 +275,27 @@ static Solver *
 init_solver(HyGoal goal, DnfGoalActions flags)
 {
     Pool *pool = dnf_sack_get_pool(goal->sack);
-    Solver *solv = solver_create(pool);
+    Solver *solv = goal->solv;
 
-    if (goal->solv)
-        solver_free(goal->solv);
-    goal->solv = solv;
+    /* solver_solve() rebuilds all the rules on every call, so the Solver of
+     * the previous run is reused unless the pool has grown or got a new
+     * installed repo since it was created */
+    if (solv != NULL &&
+        goal->solv_nsolvables == pool->nsolvables &&
+        solv->installed == pool->installed) {
+        g_debug("reusing the solver of the previous run");
+        goal->stats.reused_solver = TRUE;
+        solv->solution_callback = NULL;
+        solv->solution_callback_data = NULL;
+        solver_set_flag(solv, SOLVER_FLAG_IGNORE_RECOMMENDED, 0);
+        solver_set_flag(solv, SOLVER_FLAG_ALLOW_DOWNGRADE, 0);
+    } else {
+        if (solv)
+            solver_free(solv);
+        solv = solver_create(pool);
+        goal->solv = solv;
+        goal->solv_nsolvables = pool->nsolvables;
+    }
 
     /* no vendor locking */
     solver_set_flag(solv, SOLVER_FLAG_ALLOW_VENDORCHANGE, 1);
@@ -277,22 +339,276 @@ allow_uninstall_all_but_protected(HyGoal goal, Queue *job, DnfGoalActions flags)
         }
 }
 
+static int
+solver_reason(Solver *solv, Id p)
+{
+    Id info;
+    int reason = solver_describe_decision(solv, p, &info);
+
+    if ((reason == SOLVER_REASON_UNIT_RULE ||
+         reason == SOLVER_REASON_RESOLVE_JOB) &&
+        solver_ruleclass(solv, info) == SOLVER_RULE_JOB)
+        return HY_REASON_USER;
+    if (reason == SOLVER_REASON_CLEANDEPS_ERASE)
+        return HY_REASON_CLEAN;
+    if (reason == SOLVER_REASON_WEAKDEP)
+        return HY_REASON_WEAKDEP;
+    return HY_REASON_DEP;
+}
+
+/**
+ * solution_cache_entry_free:
+ **/
+static void
+solution_cache_entry_free(SolutionCacheEntry *entry)
+{
+    transaction_free(entry->trans);
+    queue_free(&entry->reasons);
+    queue_free(&entry->unneeded);
+    g_free(entry);
+}
+
+static void
+goal_clear_cached(HyGoal goal)
+{
+    if (goal->cached_reasons != NULL) {
+        queue_free(goal->cached_reasons);
+        g_free(goal->cached_reasons);
+        goal->cached_reasons = NULL;
+    }
+    if (goal->cached_unneeded != NULL) {
+        queue_free(goal->cached_unneeded);
+        g_free(goal->cached_unneeded);
+        goal->cached_unneeded = NULL;
+    }
+}
+
+static void
+chksum_add_map(void *h, const Map *m)
+{
+    if (m == NULL) {
+        solv_chksum_add(h, "", 1);
+        return;
+    }
+    solv_chksum_add(h, &m->size, sizeof(m->size));
+    solv_chksum_add(h, m->map, m->size);
+}
+
+/**
+ * solution_cache_key:
+ *
+ * Hashes everything the solver result depends on: the job, the run flags,
+ * the installonly setup, the considered and protected maps and the state
+ * of every repo including the rpmdb.
+ **/
+static char *
+solution_cache_key(HyGoal goal, Queue *job, DnfGoalActions flags)
+{
+    DnfSack *sack = goal->sack;
+    Pool *pool = dnf_sack_get_pool(sack);
+    Queue *onlies = dnf_sack_get_installonly(sack);
+    int actions = (goal->actions | flags) & ~DNF_SOLUTION_CACHE;
+    guint limit = dnf_sack_get_installonly_limit(sack);
+    Id kernel = dnf_sack_running_kernel(sack);
+    unsigned char cs[CHKSUM_BYTES];
+    void *h = solv_chksum_create(REPOKEY_TYPE_SHA256);
+    Repo *repo;
+    Id i;
+
+    for (int j = 0; j < job->count; j += 2) {
+        Id how = job->elements[j];
+        Id what = job->elements[j + 1];
+
+        solv_chksum_add(h, &how, sizeof(how));
+        /* ONE_OF refers to a whatprovides offset, which is only meaningful
+           until the next whatprovides rebuild, so hash what it points at */
+        if ((how & SOLVER_SELECTMASK) == SOLVER_SOLVABLE_ONE_OF) {
+            Id *wp = pool->whatprovidesdata + what;
+            int n = 0;
+            while (wp[n])
+                n++;
+            solv_chksum_add(h, wp, (n + 1) * sizeof(Id));
+        } else {
+            solv_chksum_add(h, &what, sizeof(what));
+        }
+    }
+    solv_chksum_add(h, &actions, sizeof(actions));
+    solv_chksum_add(h, onlies->elements, onlies->count * sizeof(Id));
+    solv_chksum_add(h, &limit, sizeof(limit));
+    solv_chksum_add(h, &kernel, sizeof(kernel));
+    chksum_add_map(h, pool->considered);
+    chksum_add_map(h, goal->protected);
+
+    solv_chksum_add(h, &pool->nsolvables, sizeof(pool->nsolvables));
+    FOR_REPOS(i, repo) {
+        HyRepo hrepo = repo->appdata;
+        int installed = pool->installed == repo;
+
+        if (repo->name != NULL)
+            solv_chksum_add(h, repo->name, strlen(repo->name) + 1);
+        solv_chksum_add(h, &installed, sizeof(installed));
+        solv_chksum_add(h, &repo->start, sizeof(repo->start));
+        solv_chksum_add(h, &repo->end, sizeof(repo->end));
+        solv_chksum_add(h, &repo->nsolvables, sizeof(repo->nsolvables));
+        solv_chksum_add(h, &repo->priority, sizeof(repo->priority));
+        solv_chksum_add(h, &repo->subpriority, sizeof(repo->subpriority));
+        if (hrepo != NULL)
+            solv_chksum_add(h, hrepo->checksum, CHKSUM_BYTES);
+    }
+    solv_chksum_free(h, cs);
+    return g_strdup(pool_checksum_str(pool, cs));
+}
+
+static int
+reason_cmp(const void *ap, const void *bp, void *dp)
+{
+    return *(const Id *) ap - *(const Id *) bp;
+}
+
+/**
+ * solution_cache_lookup:
+ *
+ * Sets up the goal from a cached solution, leaving it without a Solver.
+ **/
+static gboolean
+solution_cache_lookup(HyGoal goal, const char *key)
+{
+    GHashTable *cache = dnf_sack_get_solution_cache(goal->sack);
+    SolutionCacheEntry *entry;
+
+    if (cache == NULL)
+        return FALSE;
+    entry = g_hash_table_lookup(cache, key);
+    if (entry == NULL)
+        return FALSE;
+
+    if (goal->solv) {
+        solver_free(goal->solv);
+        goal->solv = NULL;
+    }
+    goal->trans = transaction_create_clone(entry->trans);
+    goal->cached_reasons = g_malloc(sizeof(Queue));
+    queue_init_clone(goal->cached_reasons, &entry->reasons);
+    goal->cached_unneeded = g_malloc(sizeof(Queue));
+    queue_init_clone(goal->cached_unneeded, &entry->unneeded);
+    g_ptr_array_unref(goal->removal_of_protected);
+    goal->removal_of_protected = g_ptr_array_new();
+    goal->stats.cached = TRUE;
+    g_debug("using cached solution %s", key);
+    return TRUE;
+}
+
+static void
+solution_cache_store(HyGoal goal, const char *key)
+{
+    GHashTable *cache = dnf_sack_get_solution_cache(goal->sack);
+    Queue *steps = &goal->trans->steps;
+    SolutionCacheEntry *entry;
+
+    if (cache == NULL) {
+        cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                      (GDestroyNotify) solution_cache_entry_free);
+        dnf_sack_set_solution_cache(goal->sack, cache);
+    } else if (g_hash_table_size(cache) >= SOLUTION_CACHE_MAX) {
+        g_hash_table_remove_all(cache);
+    }
+
+    entry = g_new0(SolutionCacheEntry, 1);
+    entry->trans = transaction_create_clone(goal->trans);
+    queue_init(&entry->reasons);
+    for (int i = 0; i < steps->count; ++i)
+        queue_push2(&entry->reasons, steps->elements[i],
+                    solver_reason(goal->solv, steps->elements[i]));
+    solv_sort(entry->reasons.elements, entry->reasons.count / 2,
+              2 * sizeof(Id), reason_cmp, NULL);
+    queue_init(&entry->unneeded);
+    solver_get_unneeded(goal->solv, &entry->unneeded, 0);
+    g_hash_table_insert(cache, g_strdup(key), entry);
+}
+
+static void
+goal_stats_rules(HyGoalStats *stats, Solver *solv)
+{
+    /* rule 0 is never used */
+    stats->rules = solv->nrules - 1;
+    stats->pkg_rules = solv->pkgrules_end - 1;
+    stats->feature_rules = solv->featurerules_end - solv->featurerules;
+    stats->update_rules = solv->updaterules_end - solv->updaterules;
+    stats->job_rules = solv->jobrules_end - solv->jobrules;
+    stats->infarch_rules = solv->infarchrules_end - solv->infarchrules;
+    stats->dup_rules = solv->duprules_end - solv->duprules;
+    stats->best_rules = solv->bestrules_end - solv->bestrules;
+    stats->choice_rules = solv->choicerules_end - solv->choicerules;
+    stats->learnt_rules = solv->nrules - solv->learntrules;
+    stats->decisions = solv->decisionq.count;
+}
+
+static void
+goal_stats_pool(HyGoalStats *stats, Pool *pool)
+{
+    stats->pool_solvables = pool->nsolvables;
+    if (pool->considered == NULL) {
+        stats->considered_solvables = pool->nsolvables;
+        return;
+    }
+    Id end = MIN(pool->nsolvables, pool->considered->size << 3);
+    stats->considered_solvables = 0;
+    for (Id p = 0; p < end; ++p)
+        if (MAPTST(pool->considered, p))
+            stats->considered_solvables++;
+}
+
+/**
+ * run_solver:
+ *
+ * Runs solver_solve() and records how long it took and how many rules it used.
+ **/
+static int
+run_solver(HyGoal goal, Solver *solv, Queue *job, const char *pass,
+           gdouble *elapsed)
+{
+    g_autoptr(GTimer) timer = g_timer_new();
+    int ret = solver_solve(solv, job);
+
+    *elapsed = g_timer_elapsed(timer, NULL);
+    goal->stats.solver_runs++;
+    goal->stats.jobs = job->count / 2;
+    goal_stats_rules(&goal->stats, solv);
+    g_debug("%s solve took %.0fms: %u jobs, %u rules (%u learnt), %u decisions",
+            pass, *elapsed * 1000, goal->stats.jobs, goal->stats.rules,
+            goal->stats.learnt_rules, goal->stats.decisions);
+    return ret;
+}
+
 static int
 solve(HyGoal goal, Queue *job, DnfGoalActions flags,
       hy_solution_callback user_cb, void * user_cb_data) {
     DnfSack *sack = goal->sack;
     struct _SolutionCallback cb_tuple;
+    g_autofree char *cache_key = NULL;
+    g_autoptr(GTimer) timer = NULL;
 
     /* apply the excludes */
     dnf_sack_recompute_considered(sack);
+    goal_stats_pool(&goal->stats, dnf_sack_get_pool(sack));
 
     dnf_sack_make_provides_ready(sack);
     if (goal->trans) {
         transaction_free(goal->trans);
         goal->trans = NULL;
     }
+    goal_clear_cached(goal);
+
+    /* enumerating the solutions needs a real solver run */
+    if ((DNF_SOLUTION_CACHE & flags) && !user_cb) {
+        cache_key = solution_cache_key(goal, job, flags);
+        if (solution_cache_lookup(goal, cache_key))
+            return 0;
+    }
 
+    timer = g_timer_new();
     Solver *solv = init_solver(goal, flags);
+    goal->stats.init_solver = g_timer_elapsed(timer, NULL);
     if (user_cb) {
         cb_tuple = (struct _SolutionCallback){goal, user_cb, user_cb_data};
         solv->solution_callback = internal_solver_callback;
@@ -305,7 +621,7 @@ solve(HyGoal goal, Queue *job, DnfGoalActions flags,
     if (DNF_ALLOW_DOWNGRADE & goal->actions)
         solver_set_flag(solv, SOLVER_FLAG_ALLOW_DOWNGRADE, 1);
 
-    if (solver_solve(solv, job))
+    if (run_solver(goal, solv, job, "initial", &goal->stats.solve))
         return 1;
     // either allow solutions callback or installonlies, both at the same time
     // are not supported
@@ -313,14 +629,19 @@ solve(HyGoal goal, Queue *job, DnfGoalActions flags,
         // allow erasing non-installonly packages that depend on a kernel about
         // to be erased
         allow_uninstall_all_but_protected(goal, job, DNF_ALLOW_UNINSTALL);
-        if (solver_solve(solv, job))
+        if (run_solver(goal, solv, job, "installonly",
+                       &goal->stats.installonly_solve))
             return 1;
     }
+    g_timer_start(timer);
     goal->trans = solver_create_transaction(solv);
+    goal->stats.transaction = g_timer_elapsed(timer, NULL);
 
     if (protected_in_removals(goal))
         return 1;
 
+    if (cache_key != NULL)
+        solution_cache_store(goal, cache_key);
     return 0;
 }
 
@@ -731,7 +1052,10 @@ hy_goal_free(HyGoal goal)
         solver_free(goal->solv);
     queue_free(&goal->staging);
     free_map_fully(goal->protected);
+    free_map_fully(goal->kernel_deps);
+    free_map_fully(goal->kernel_deps_known);
     g_ptr_array_unref(goal->removal_of_protected);
+    goal_clear_cached(goal);
     g_free(goal);
 }
 
@@ -962,7 +1286,11 @@ int
 hy_goal_run_all_flags(HyGoal goal, hy_solution_callback cb, void *cb_data,
                       DnfGoalActions flags)
 {
+    g_autoptr(GTimer) timer = g_timer_new();
+
+    memset(&goal->stats, 0, sizeof(goal->stats));
     Queue *job = construct_job(goal, flags);
+    goal->stats.construct_job = g_timer_elapsed(timer, NULL);
     goal->actions |= flags;
     int ret = solve(goal, job, flags, cb, cb_data);
     free_job(job);
@@ -972,6 +1300,9 @@ hy_goal_run_all_flags(HyGoal goal, hy_solution_callback cb, void *cb_data,
 int
 hy_goal_count_problems(HyGoal goal)
 {
+    /* only successful solutions are cached */
+    if (goal->solv == NULL && goal->cached_reasons != NULL)
+        return 0;
     assert(goal->solv);
     return solver_problem_count(goal->solv) + MIN(1, goal->removal_of_protected->len);
 }
@@ -1075,6 +1406,53 @@ hy_goal_log_decisions(HyGoal goal)
     return 0;
 }
 
+static void
+json_append_seconds(GString *str, const char *key, gdouble value)
+{
+    gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+    g_string_append_printf(str, "  \"%s\": %s,\n", key,
+                           g_ascii_formatd(buf, sizeof(buf), "%.6f", value));
+}
+
+/**
+ * goal_stats_to_json:
+ **/
+static char *
+goal_stats_to_json(const HyGoalStats *stats)
+{
+    GString *str = g_string_new("{\n");
+
+    json_append_seconds(str, "construct_job", stats->construct_job);
+    json_append_seconds(str, "init_solver", stats->init_solver);
+    json_append_seconds(str, "solve", stats->solve);
+    json_append_seconds(str, "installonly_solve", stats->installonly_solve);
+    json_append_seconds(str, "transaction", stats->transaction);
+    g_string_append_printf(str,
+                           "  \"cached\": %s,\n"
+                           "  \"reused_solver\": %s,\n"
+                           "  \"solver_runs\": %u,\n"
+                           "  \"jobs\": %u,\n"
+                           "  \"rules\": {\"total\": %u, \"pkg\": %u, "
+                           "\"feature\": %u, \"update\": %u, \"job\": %u, "
+                           "\"infarch\": %u, \"dup\": %u, \"best\": %u, "
+                           "\"choice\": %u, \"learnt\": %u},\n"
+                           "  \"decisions\": %u,\n"
+                           "  \"pool_solvables\": %u,\n"
+                           "  \"considered_solvables\": %u\n"
+                           "}\n",
+                           stats->cached ? "true" : "false",
+                           stats->reused_solver ? "true" : "false",
+                           stats->solver_runs, stats->jobs,
+                           stats->rules, stats->pkg_rules,
+                           stats->feature_rules, stats->update_rules,
+                           stats->job_rules, stats->infarch_rules,
+                           stats->dup_rules, stats->best_rules,
+                           stats->choice_rules, stats->learnt_rules,
+                           stats->decisions, stats->pool_solvables,
+                           stats->considered_solvables);
+    return g_string_free(str, FALSE);
+}
+
 /**
  * hy_goal_write_debugdata:
  * @goal: A #HyGoal
@@ -1118,7 +1496,26 @@ hy_goal_write_debugdata(HyGoal goal, const char *dir, GError **error)
                      absdir, strerror(errno));
         return FALSE;
     }
-    return TRUE;
+
+    g_autofree char *json = goal_stats_to_json(&goal->stats);
+    g_autofree char *fn = g_build_filename(absdir, "stats.json", NULL);
+    return g_file_set_contents(fn, json, -1, error);
+}
+
+/**
+ * hy_goal_get_stats:
+ * @goal: A #HyGoal
+ * @stats: (out): the statistics of the last run
+ *
+ * Gets where the time of the last hy_goal_run*() went and how big the
+ * problem handed to the solver was. Everything is zero before the first run.
+ *
+ * Since: 0.8.0
+ */
+void
+hy_goal_get_stats(HyGoal goal, HyGoalStats *stats)
+{
+    *stats = goal->stats;
 }
 
 GPtrArray *
@@ -1153,6 +1550,10 @@ hy_goal_list_unneeded(HyGoal goal, GError **error)
     Queue q;
     Solver *solv = goal->solv;
 
+    if (solv == NULL && goal->cached_unneeded != NULL) {
+        queue2plist(goal->sack, goal->cached_unneeded, plist);
+        return plist;
+    }
     queue_init(&q);
     solver_get_unneeded(solv, &q, 0);
     queue2plist(goal->sack, &q, plist);
@@ -1194,20 +1595,26 @@ int
 hy_goal_get_reason(HyGoal goal, DnfPackage *pkg)
 {
     //solver_get_recommendations
-    if (goal->solv == NULL)
+    Id p = dnf_package_get_id(pkg);
+
+    if (goal->solv == NULL && goal->cached_reasons != NULL) {
+        Queue *reasons = goal->cached_reasons;
+        int lo = 0, hi = reasons->count / 2;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            Id q = reasons->elements[2 * mid];
+            if (q == p)
+                return reasons->elements[2 * mid + 1];
+            if (q < p)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
         return HY_REASON_USER;
-    Id info;
-    int reason = solver_describe_decision(goal->solv, dnf_package_get_id(pkg), &info);
-
-    if ((reason == SOLVER_REASON_UNIT_RULE ||
-         reason == SOLVER_REASON_RESOLVE_JOB) &&
-        solver_ruleclass(goal->solv, info) == SOLVER_RULE_JOB)
+    }
+    if (goal->solv == NULL)
         return HY_REASON_USER;
-    if (reason == SOLVER_REASON_CLEANDEPS_ERASE)
-        return HY_REASON_CLEAN;
-    if (reason == SOLVER_REASON_WEAKDEP)
-        return HY_REASON_WEAKDEP;
-    return HY_REASON_DEP;
+    return solver_reason(goal->solv, p);
 }
 
 /**
@@ -1224,6 +1631,9 @@ hy_goal_get_reason(HyGoal goal, DnfPackage *pkg)
 GPtrArray *
 hy_goal_get_solution(HyGoal goal, guint problem_id)
 {
+    /* a cached solution has no problems to solve */
+    if (goal->solv == NULL && goal->cached_reasons != NULL)
+        return g_ptr_array_new_with_free_func((GDestroyNotify)g_object_unref);
     assert(goal->solv);
     assert(goal->sack);
 
@@ -48,9 +48,36 @@ typedef enum {
     DNF_FORCE_BEST               = 1 << 11,
     DNF_VERIFY                   = 1 << 12,
     DNF_IGNORE_WEAK_DEPS         = 1 << 13,
-    DNF_ALLOW_DOWNGRADE          = 1 << 14
+    DNF_ALLOW_DOWNGRADE          = 1 << 14,
+    DNF_SOLUTION_CACHE           = 1 << 15
 } DnfGoalActions;
 
+/* statistics of the last hy_goal_run*(), times are in seconds */
+typedef struct {
+    gdouble     construct_job;
+    gdouble     init_solver;
+    gdouble     solve;
+    gdouble     installonly_solve;      /* re-solve after installonly limiting */
+    gdouble     transaction;
+    gboolean    cached;                 /* answered from the solution cache */
+    gboolean    reused_solver;
+    guint       solver_runs;
+    guint       jobs;
+    guint       rules;                  /* all rules, by type below */
+    guint       pkg_rules;
+    guint       feature_rules;
+    guint       update_rules;
+    guint       job_rules;
+    guint       infarch_rules;
+    guint       dup_rules;
+    guint       best_rules;
+    guint       choice_rules;
+    guint       learnt_rules;
+    guint       decisions;
+    guint       pool_solvables;
+    guint       considered_solvables;
+} HyGoalStats;
+
 #define HY_REASON_DEP 1
 #define HY_REASON_USER 2
 #define HY_REASON_CLEAN 3
@@ -105,6 +132,7 @@ char *hy_goal_describe_problem(HyGoal goal, unsigned i);
 char **hy_goal_describe_problem_rules(HyGoal goal, unsigned i);
 int hy_goal_log_decisions(HyGoal goal);
 gboolean hy_goal_write_debugdata(HyGoal goal, const char *dir, GError **error);
+void hy_goal_get_stats(HyGoal goal, HyGoalStats *stats);
 
 /* result processing */
 GPtrArray *hy_goal_list_erasures(HyGoal goal, GError **error);
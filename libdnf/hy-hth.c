@@ -34,6 +34,7 @@
 #include "dnf-reldep-list.h"
 #include "hy-repo.h"
 #include "dnf-sack.h"
+#include "dnf-sack-client.h"
 #include "hy-util.h"
 
 #define CFG_FILE "~/.hawkey/main.config"
@@ -379,9 +380,26 @@ need_filelists(int argc, const char **argv)
     return argc == 3 && !strcmp(argv[1], "-f");
 }
 
+static int
+query_server(const char *socket_path, const char *command, const char *argument)
+{
+    g_autoptr(DnfSackClient) client = dnf_sack_client_new(socket_path);
+    g_autoptr(GError) error = NULL;
+    g_auto(GStrv) lines = NULL;
+
+    lines = dnf_sack_client_request(client, command, argument, &error);
+    if (lines == NULL) {
+        fprintf(stderr, "%s\n", error->message);
+        return 1;
+    }
+    for (int i = 0; lines[i] != NULL; ++i)
+        printf("%s\n", lines[i]);
+    return 0;
+}
+
 int main(int argc, const char **argv)
 {
-    DnfSack *sack = dnf_sack_new ();
+    DnfSack *sack;
     HyRepo repo;
     char *md_repo;
     char *md_primary_xml;
@@ -392,6 +410,13 @@ int main(int argc, const char **argv)
     int ret;
     g_autoptr(GError) error = NULL;
 
+    /* hth -s <socket> [command [argument]]: ask a resident sack server */
+    if (argc >= 3 && !strcmp(argv[1], "-s"))
+        return query_server(argv[2],
+                            argc > 3 ? argv[3] : "ping",
+                            argc > 4 ? argv[4] : NULL);
+
+    sack = dnf_sack_new();
     if (!dnf_sack_setup(sack, DNF_SACK_SETUP_FLAG_MAKE_CACHE_DIR, NULL))
         return 1;
 
@@ -37,6 +37,8 @@
 #include <libdnf/dnf-repo-loader.h>
 #include <libdnf/dnf-rpmts.h>
 #include <libdnf/dnf-sack.h>
+#include <libdnf/dnf-sack-client.h>
+#include <libdnf/dnf-sack-server.h>
 #include <libdnf/dnf-repo.h>
 #include <libdnf/dnf-state.h>
 #include <libdnf/dnf-transaction.h>
@@ -527,6 +527,40 @@ write_debugdata(_GoalObject *self, PyObject *dir_str)
     Py_RETURN_NONE;
 }
 
+static PyObject *
+get_stats(_GoalObject *self, PyObject *unused)
+{
+    HyGoalStats stats;
+
+    hy_goal_get_stats(self->goal, &stats);
+    return Py_BuildValue("{s:d,s:d,s:d,s:d,s:d,s:O,s:O,s:I,s:I,"
+                         "s:{s:I,s:I,s:I,s:I,s:I,s:I,s:I,s:I,s:I,s:I},"
+                         "s:I,s:I,s:I}",
+                         "construct_job", stats.construct_job,
+                         "init_solver", stats.init_solver,
+                         "solve", stats.solve,
+                         "installonly_solve", stats.installonly_solve,
+                         "transaction", stats.transaction,
+                         "cached", stats.cached ? Py_True : Py_False,
+                         "reused_solver", stats.reused_solver ? Py_True : Py_False,
+                         "solver_runs", stats.solver_runs,
+                         "jobs", stats.jobs,
+                         "rules",
+                         "total", stats.rules,
+                         "pkg", stats.pkg_rules,
+                         "feature", stats.feature_rules,
+                         "update", stats.update_rules,
+                         "job", stats.job_rules,
+                         "infarch", stats.infarch_rules,
+                         "dup", stats.dup_rules,
+                         "best", stats.best_rules,
+                         "choice", stats.choice_rules,
+                         "learnt", stats.learnt_rules,
+                         "decisions", stats.decisions,
+                         "pool_solvables", stats.pool_solvables,
+                         "considered_solvables", stats.considered_solvables);
+}
+
 static PyObject *
 list_generic(_GoalObject *self, GPtrArray *(*func)(HyGoal, GError **))
 {
@@ -699,6 +733,7 @@ static struct PyMethodDef goal_methods[] = {
     {"describe_problem_rules",(PyCFunction)describe_problem_rules,        METH_O,                NULL},
     {"log_decisions",   (PyCFunction)log_decisions,        METH_NOARGS,        NULL},
     {"write_debugdata", (PyCFunction)write_debugdata,        METH_O,                NULL},
+    {"get_stats",       (PyCFunction)get_stats,        METH_NOARGS,        NULL},
     {"list_erasures",        (PyCFunction)list_erasures,        METH_NOARGS,        NULL},
     {"list_installs",        (PyCFunction)list_installs,        METH_NOARGS,        NULL},
     {"list_obsoleted",        (PyCFunction)list_obsoleted,        METH_NOARGS,        NULL},
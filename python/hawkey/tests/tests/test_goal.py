@@ -53,6 +53,19 @@ class GoalTest(base.TestCase):
         goal3.add_protected(hawkey.Query(self.sack).filter(name="flying"))
         self.assertFalse(goal3.run(allow_uninstall=True))
 
+    def test_stats(self):
+        goal = hawkey.Goal(self.sack)
+        self.assertEqual(goal.get_stats()["solver_runs"], 0)
+        goal.install(name="walrus")
+        self.assertTrue(goal.run())
+        stats = goal.get_stats()
+        self.assertEqual(stats["solver_runs"], 1)
+        self.assertFalse(stats["cached"])
+        self.assertGreater(stats["rules"]["total"], 0)
+        self.assertGreater(stats["decisions"], 0)
+        self.assertGreaterEqual(stats["pool_solvables"],
+                                stats["considered_solvables"])
+
     def test_list_err(self):
         goal = hawkey.Goal(self.sack)
         self.assertRaises(hawkey.ValueException, goal.list_installs)
@@ -0,0 +1,851 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Offline performance harness.
+ *
+ * For every requested size this generates a synthetic rpm-md repository
+ * (primary, filelists and updateinfo) and an installed repository holding
+ * older versions of 80% of its packages, then times sack loading, provides
+ * preparation, common queries, advisory filtering and goal resolution. The
+ * yumdb entries a transaction writes for the installed packages are timed
+ * with both #DnfDb backends, and the generated repository is served by a
+ * #DnfSackServer to time requests over its socket.
+ * Results are written as JSON so they can be compared between builds:
+ *
+ *   hawkey_benchmark --sizes 1000,10000,100000 --output results.json
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gio/gio.h>
+#include <solv/pool.h>
+
+#include "libdnf/dnf-context.h"
+#include "libdnf/dnf-db.h"
+#include "libdnf/dnf-sack-client.h"
+#include "libdnf/dnf-sack-private.h"
+#include "libdnf/dnf-sack-server.h"
+#include "libdnf/dnf-utils.h"
+#include "libdnf/hy-goal.h"
+#include "libdnf/hy-query.h"
+#include "libdnf/hy-repo-private.h"
+#include "libdnf/hy-selector.h"
+
+#define BENCH_FILES_PER_PACKAGE     5
+#define BENCH_MAX_REQUIRES          8
+#define BENCH_QUERY_ITERATIONS      10
+#define BENCH_SERVER_REQUESTS       100
+
+typedef struct {
+    guint        npkgs;
+    guint        ncaps;
+    gchar       *repo_dir;
+    gchar       *system_dir;
+    gchar       *cache_dir;
+} BenchFixture;
+
+typedef struct {
+    GString     *json;
+    guint        count;
+} BenchResults;
+
+static guint32
+bench_mix(guint32 a, guint32 b)
+{
+    guint32 h = a * 2654435761u ^ (b + 0x9e3779b9u + (a << 6) + (a >> 2));
+    h ^= h >> 15;
+    h *= 2246822519u;
+    h ^= h >> 13;
+    return h;
+}
+
+/* installed packages are the ones not divisible by 5 */
+static gboolean
+bench_is_installed(guint i)
+{
+    return i % 5 != 0;
+}
+
+/* pick the i-th dependency target of a package, always an installed one so
+ * the system repo stays consistent */
+static guint
+bench_require_target(const BenchFixture *fx, guint pkg, guint k)
+{
+    guint j = bench_mix(pkg, k + 1) % fx->npkgs;
+    while (!bench_is_installed(j) || j == pkg)
+        j = (j + 1) % fx->npkgs;
+    return j;
+}
+
+static GOutputStream *
+bench_create_gz(const gchar *path, GError **error)
+{
+    g_autoptr(GFile) file = g_file_new_for_path(path);
+    g_autoptr(GFileOutputStream) stream = NULL;
+    g_autoptr(GZlibCompressor) compressor = NULL;
+
+    stream = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, error);
+    if (stream == NULL)
+        return NULL;
+    compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, 1);
+    return g_converter_output_stream_new(G_OUTPUT_STREAM(stream),
+                                         G_CONVERTER(compressor));
+}
+
+static gboolean
+bench_write_primary(const BenchFixture *fx, const gchar *dir,
+                    gboolean installed, GError **error)
+{
+    const gchar *version = installed ? "1.0" : "2.0";
+    g_autofree gchar *path = g_build_filename(dir, "primary.xml.gz", NULL);
+    g_autoptr(GOutputStream) out = bench_create_gz(path, error);
+    g_autoptr(GString) str = g_string_sized_new(4096);
+
+    if (out == NULL)
+        return FALSE;
+    g_string_append(str,
+                    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                    "<metadata xmlns=\"http://linux.duke.edu/metadata/common\" "
+                    "xmlns:rpm=\"http://linux.duke.edu/metadata/rpm\">\n");
+    for (guint i = 0; i < fx->npkgs; i++) {
+        guint nreqs;
+        if (installed && !bench_is_installed(i))
+            continue;
+        g_string_append_printf(str,
+            "<package type=\"rpm\">\n"
+            " <name>pkg%06u</name>\n"
+            " <arch>noarch</arch>\n"
+            " <version epoch=\"0\" ver=\"%s\" rel=\"1\"/>\n"
+            " <checksum type=\"sha256\" pkgid=\"YES\">%08x%056x</checksum>\n"
+            " <summary>Synthetic package %u</summary>\n"
+            " <description>Synthetic benchmark package number %u.</description>\n"
+            " <packager>bench</packager>\n"
+            " <url>http://example.com/pkg%06u</url>\n"
+            " <time file=\"1\" build=\"1\"/>\n"
+            " <size package=\"%u\" installed=\"%u\" archive=\"%u\"/>\n"
+            " <location href=\"Packages/pkg%06u-%s-1.noarch.rpm\"/>\n"
+            " <format>\n"
+            "  <rpm:license>MIT</rpm:license>\n"
+            "  <rpm:sourcerpm>pkg%06u-%s-1.src.rpm</rpm:sourcerpm>\n"
+            "  <rpm:provides>\n"
+            "   <rpm:entry name=\"pkg%06u\" flags=\"EQ\" epoch=\"0\" ver=\"%s\" rel=\"1\"/>\n"
+            "   <rpm:entry name=\"libpkg%06u.so.1()(64bit)\"/>\n"
+            "   <rpm:entry name=\"cap-%u\"/>\n"
+            "  </rpm:provides>\n",
+            i, version, i, installed ? 1 : 2, i, i, i,
+            1000 + i % 5000, 4000 + i % 9000, 4100 + i % 9000,
+            i, version, i, version, i, version, i, i % fx->ncaps);
+        nreqs = bench_mix(i, 0) % (BENCH_MAX_REQUIRES + 1);
+        if (nreqs > 0) {
+            g_string_append(str, "  <rpm:requires>\n");
+            for (guint k = 0; k < nreqs; k++) {
+                guint j = bench_require_target(fx, i, k);
+                if (k % 2 == 0)
+                    g_string_append_printf(str,
+                        "   <rpm:entry name=\"libpkg%06u.so.1()(64bit)\"/>\n", j);
+                else
+                    g_string_append_printf(str,
+                        "   <rpm:entry name=\"cap-%u\"/>\n", j % fx->ncaps);
+            }
+            g_string_append(str, "  </rpm:requires>\n");
+        }
+        g_string_append_printf(str,
+            "  <file>/usr/bin/pkg%06u</file>\n"
+            " </format>\n"
+            "</package>\n", i);
+        if (str->len > 65536) {
+            if (!g_output_stream_write_all(out, str->str, str->len, NULL, NULL, error))
+                return FALSE;
+            g_string_truncate(str, 0);
+        }
+    }
+    g_string_append(str, "</metadata>\n");
+    if (!g_output_stream_write_all(out, str->str, str->len, NULL, NULL, error))
+        return FALSE;
+    return g_output_stream_close(out, NULL, error);
+}
+
+static gboolean
+bench_write_filelists(const BenchFixture *fx, const gchar *dir,
+                      gboolean installed, GError **error)
+{
+    const gchar *version = installed ? "1.0" : "2.0";
+    g_autofree gchar *path = g_build_filename(dir, "filelists.xml.gz", NULL);
+    g_autoptr(GOutputStream) out = bench_create_gz(path, error);
+    g_autoptr(GString) str = g_string_sized_new(4096);
+
+    if (out == NULL)
+        return FALSE;
+    g_string_append(str,
+                    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                    "<filelists xmlns=\"http://linux.duke.edu/metadata/filelists\">\n");
+    for (guint i = 0; i < fx->npkgs; i++) {
+        if (installed && !bench_is_installed(i))
+            continue;
+        g_string_append_printf(str,
+            "<package pkgid=\"%08x%056x\" name=\"pkg%06u\" arch=\"noarch\">\n"
+            " <version epoch=\"0\" ver=\"%s\" rel=\"1\"/>\n"
+            " <file>/usr/bin/pkg%06u</file>\n"
+            " <file>/usr/lib64/libpkg%06u.so.1</file>\n",
+            i, installed ? 1 : 2, i, version, i, i);
+        for (guint k = 0; k < BENCH_FILES_PER_PACKAGE; k++)
+            g_string_append_printf(str,
+                " <file>/usr/share/pkg%06u/data-%u</file>\n", i, k);
+        g_string_append(str, "</package>\n");
+        if (str->len > 65536) {
+            if (!g_output_stream_write_all(out, str->str, str->len, NULL, NULL, error))
+                return FALSE;
+            g_string_truncate(str, 0);
+        }
+    }
+    g_string_append(str, "</filelists>\n");
+    if (!g_output_stream_write_all(out, str->str, str->len, NULL, NULL, error))
+        return FALSE;
+    return g_output_stream_close(out, NULL, error);
+}
+
+/* one advisory for every tenth package that has an installed older version */
+static gboolean
+bench_write_updateinfo(const BenchFixture *fx, const gchar *dir, GError **error)
+{
+    const gchar *types[] = { "security", "bugfix", "enhancement" };
+    g_autofree gchar *path = g_build_filename(dir, "updateinfo.xml.gz", NULL);
+    g_autoptr(GOutputStream) out = bench_create_gz(path, error);
+    g_autoptr(GString) str = g_string_sized_new(4096);
+
+    if (out == NULL)
+        return FALSE;
+    g_string_append(str, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<updates>\n");
+    for (guint i = 1; i < fx->npkgs; i += 10) {
+        g_string_append_printf(str,
+            "<update from=\"bench@example.com\" status=\"stable\" type=\"%s\" version=\"1\">\n"
+            " <id>BENCH-%06u</id>\n"
+            " <title>Update for pkg%06u</title>\n"
+            " <issued date=\"2017-01-01 00:00:00\"/>\n"
+            " <severity>Moderate</severity>\n"
+            " <description>Synthetic advisory.</description>\n"
+            " <references>\n"
+            "  <reference href=\"http://example.com/%u\" id=\"%u\" type=\"bugzilla\" title=\"bug %u\"/>\n"
+            " </references>\n"
+            " <pkglist>\n"
+            "  <collection short=\"bench\">\n"
+            "   <name>bench</name>\n"
+            "   <package name=\"pkg%06u\" version=\"2.0\" release=\"1\" epoch=\"0\" arch=\"noarch\" src=\"pkg%06u-2.0-1.src.rpm\">\n"
+            "    <filename>pkg%06u-2.0-1.noarch.rpm</filename>\n"
+            "   </package>\n"
+            "  </collection>\n"
+            " </pkglist>\n"
+            "</update>\n",
+            types[(i / 10) % G_N_ELEMENTS(types)], i, i, i, i, i, i, i, i);
+        if (str->len > 65536) {
+            if (!g_output_stream_write_all(out, str->str, str->len, NULL, NULL, error))
+                return FALSE;
+            g_string_truncate(str, 0);
+        }
+    }
+    g_string_append(str, "</updates>\n");
+    if (!g_output_stream_write_all(out, str->str, str->len, NULL, NULL, error))
+        return FALSE;
+    return g_output_stream_close(out, NULL, error);
+}
+
+static gboolean
+bench_append_repomd_data(GString *str, const gchar *dir, const gchar *type,
+                         GError **error)
+{
+    gsize len;
+    g_autofree gchar *basename = g_strdup_printf("%s.xml.gz", type);
+    g_autofree gchar *path = g_build_filename(dir, basename, NULL);
+    g_autofree gchar *contents = NULL;
+    g_autofree gchar *checksum = NULL;
+
+    if (!g_file_get_contents(path, &contents, &len, error))
+        return FALSE;
+    checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (const guchar *) contents, len);
+    g_string_append_printf(str,
+        " <data type=\"%s\">"
+        "<checksum type=\"sha256\">%s</checksum>"
+        "<location href=\"repodata/%s\"/></data>\n",
+        type, checksum, basename);
+    return TRUE;
+}
+
+/* the checksums let librepo use the available repo as a local repo */
+static gboolean
+bench_write_repomd(const gchar *dir, gboolean updateinfo, GError **error)
+{
+    g_autofree gchar *path = g_build_filename(dir, "repomd.xml", NULL);
+    g_autoptr(GString) str = g_string_new(NULL);
+
+    g_string_append(str,
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<repomd xmlns=\"http://linux.duke.edu/metadata/repo\">\n"
+        " <revision>1</revision>\n");
+    if (!bench_append_repomd_data(str, dir, "primary", error) ||
+        !bench_append_repomd_data(str, dir, "filelists", error))
+        return FALSE;
+    if (updateinfo && !bench_append_repomd_data(str, dir, "updateinfo", error))
+        return FALSE;
+    g_string_append(str, "</repomd>\n");
+    return g_file_set_contents(path, str->str, -1, error);
+}
+
+static gboolean
+bench_fixture_generate(BenchFixture *fx, const gchar *workdir, GError **error)
+{
+    g_autofree gchar *base = g_strdup_printf("%s/%u", workdir, fx->npkgs);
+
+    fx->ncaps = MAX(fx->npkgs / 10, 1);
+    fx->repo_dir = g_build_filename(base, "available", "repodata", NULL);
+    fx->system_dir = g_build_filename(base, "system", NULL);
+    fx->cache_dir = g_build_filename(base, "cache", NULL);
+    if (g_mkdir_with_parents(fx->repo_dir, 0755) != 0 ||
+        g_mkdir_with_parents(fx->system_dir, 0755) != 0) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                    "failed to create %s", base);
+        return FALSE;
+    }
+    return bench_write_primary(fx, fx->repo_dir, FALSE, error) &&
+           bench_write_filelists(fx, fx->repo_dir, FALSE, error) &&
+           bench_write_updateinfo(fx, fx->repo_dir, error) &&
+           bench_write_repomd(fx->repo_dir, TRUE, error) &&
+           bench_write_primary(fx, fx->system_dir, TRUE, error) &&
+           bench_write_filelists(fx, fx->system_dir, TRUE, error) &&
+           bench_write_repomd(fx->system_dir, FALSE, error);
+}
+
+static void
+bench_fixture_clear(BenchFixture *fx)
+{
+    g_free(fx->repo_dir);
+    g_free(fx->system_dir);
+    g_free(fx->cache_dir);
+}
+
+static HyRepo
+bench_repo_create(const gchar *name, const gchar *dir, gboolean updateinfo)
+{
+    HyRepo repo = hy_repo_create(name);
+    g_autofree gchar *md = g_build_filename(dir, "repomd.xml", NULL);
+    g_autofree gchar *primary = g_build_filename(dir, "primary.xml.gz", NULL);
+    g_autofree gchar *filelists = g_build_filename(dir, "filelists.xml.gz", NULL);
+    g_autofree gchar *ui = g_build_filename(dir, "updateinfo.xml.gz", NULL);
+
+    hy_repo_set_string(repo, HY_REPO_MD_FN, md);
+    hy_repo_set_string(repo, HY_REPO_PRIMARY_FN, primary);
+    hy_repo_set_string(repo, HY_REPO_FILELISTS_FN, filelists);
+    if (updateinfo)
+        hy_repo_set_string(repo, HY_REPO_UPDATEINFO_FN, ui);
+    return repo;
+}
+
+static void
+bench_record(BenchResults *results, const BenchFixture *fx, DnfSack *sack,
+             const gchar *name, guint iterations, gint64 usec)
+{
+    gdouble seconds = (gdouble) usec / G_USEC_PER_SEC / iterations;
+
+    g_string_append_printf(results->json,
+                           "%s    {\"packages\": %u, \"solvables\": %i, "
+                           "\"benchmark\": \"%s\", \"iterations\": %u, "
+                           "\"seconds\": %.6f}",
+                           results->count > 0 ? ",\n" : "",
+                           fx->npkgs, sack != NULL ? dnf_sack_count(sack) : 0,
+                           name, iterations, seconds);
+    results->count++;
+    g_print("%8u %-24s %12.6f s\n", fx->npkgs, name, seconds);
+}
+
+/* the synthetic system repo is loaded like any rpm-md repo and then marked
+ * installed, as the real rpmdb cannot be faked offline */
+static DnfSack *
+bench_sack_load(BenchResults *results, const BenchFixture *fx,
+                const gchar *suffix, GError **error)
+{
+    const int flags = DNF_SACK_LOAD_FLAG_BUILD_CACHE |
+                      DNF_SACK_LOAD_FLAG_USE_FILELISTS |
+                      DNF_SACK_LOAD_FLAG_USE_UPDATEINFO;
+    g_autoptr(DnfSack) sack = dnf_sack_new();
+    g_autofree gchar *name_system = g_strdup_printf("load_system_%s", suffix);
+    g_autofree gchar *name_repo = g_strdup_printf("load_repo_%s", suffix);
+    HyRepo repo;
+    gint64 start;
+
+    dnf_sack_set_cachedir(sack, fx->cache_dir);
+    if (!dnf_sack_setup(sack, DNF_SACK_SETUP_FLAG_MAKE_CACHE_DIR, error))
+        return NULL;
+
+    repo = bench_repo_create(HY_SYSTEM_REPO_NAME, fx->system_dir, FALSE);
+    start = g_get_monotonic_time();
+    if (!dnf_sack_load_repo(sack, repo, flags, error)) {
+        hy_repo_free(repo);
+        return NULL;
+    }
+    pool_set_installed(dnf_sack_get_pool(sack), repo->libsolv_repo);
+    bench_record(results, fx, sack, name_system, 1, g_get_monotonic_time() - start);
+    hy_repo_free(repo);
+
+    repo = bench_repo_create("available", fx->repo_dir, TRUE);
+    start = g_get_monotonic_time();
+    if (!dnf_sack_load_repo(sack, repo, flags, error)) {
+        hy_repo_free(repo);
+        return NULL;
+    }
+    bench_record(results, fx, sack, name_repo, 1, g_get_monotonic_time() - start);
+    hy_repo_free(repo);
+    return g_steal_pointer(&sack);
+}
+
+typedef void (*BenchQueryFunc) (HyQuery query, const BenchFixture *fx);
+
+static void
+bench_query_name_eq(HyQuery query, const BenchFixture *fx)
+{
+    g_autofree gchar *name = g_strdup_printf("pkg%06u", fx->npkgs / 2);
+    hy_query_filter(query, HY_PKG_NAME, HY_EQ, name);
+}
+
+static void
+bench_query_name_glob(HyQuery query, const BenchFixture *fx)
+{
+    hy_query_filter(query, HY_PKG_NAME, HY_GLOB, "pkg*1");
+}
+
+static void
+bench_query_provides(HyQuery query, const BenchFixture *fx)
+{
+    g_autofree gchar *cap = g_strdup_printf("cap-%u", fx->ncaps / 2);
+    hy_query_filter(query, HY_PKG_PROVIDES, HY_EQ, cap);
+}
+
+static void
+bench_query_file(HyQuery query, const BenchFixture *fx)
+{
+    g_autofree gchar *fn = g_strdup_printf("/usr/share/pkg%06u/data-0", fx->npkgs / 3);
+    hy_query_filter(query, HY_PKG_FILE, HY_EQ, fn);
+}
+
+static void
+bench_query_upgrades(HyQuery query, const BenchFixture *fx)
+{
+    hy_query_filter_upgrades(query, 1);
+}
+
+static void
+bench_query_latest(HyQuery query, const BenchFixture *fx)
+{
+    hy_query_filter_latest_per_arch(query, 1);
+}
+
+static void
+bench_query_advisory(HyQuery query, const BenchFixture *fx)
+{
+    hy_query_filter(query, HY_PKG_ADVISORY_TYPE, HY_EQ, "security");
+}
+
+static void
+bench_queries(BenchResults *results, const BenchFixture *fx, DnfSack *sack)
+{
+    const struct {
+        const gchar     *name;
+        BenchQueryFunc   func;
+    } queries[] = {
+        { "query_name_eq",      bench_query_name_eq },
+        { "query_name_glob",    bench_query_name_glob },
+        { "query_provides",     bench_query_provides },
+        { "query_file",         bench_query_file },
+        { "query_upgrades",     bench_query_upgrades },
+        { "query_latest",       bench_query_latest },
+        { "filter_advisory",    bench_query_advisory },
+        { NULL,                 NULL }
+    };
+
+    for (guint i = 0; queries[i].name != NULL; i++) {
+        gint64 start = g_get_monotonic_time();
+        for (guint j = 0; j < BENCH_QUERY_ITERATIONS; j++) {
+            hy_autoquery HyQuery query = hy_query_create(sack);
+            g_autoptr(GPtrArray) pkgs = NULL;
+            queries[i].func(query, fx);
+            pkgs = hy_query_run(query);
+        }
+        bench_record(results, fx, sack, queries[i].name,
+                     BENCH_QUERY_ITERATIONS, g_get_monotonic_time() - start);
+    }
+}
+
+static gboolean
+bench_goals(BenchResults *results, const BenchFixture *fx, DnfSack *sack,
+            GError **error)
+{
+    HyGoal goal;
+    HySelector sltr;
+    gint64 start;
+    int rc;
+    g_autofree gchar *name = NULL;
+
+    /* install a package that is not installed yet */
+    name = g_strdup_printf("pkg%06u", (fx->npkgs / 2) - (fx->npkgs / 2) % 5);
+    goal = hy_goal_create(sack);
+    sltr = hy_selector_create(sack);
+    hy_selector_set(sltr, HY_PKG_NAME, HY_EQ, name);
+    start = g_get_monotonic_time();
+    if (!hy_goal_install_selector(goal, sltr, error)) {
+        hy_selector_free(sltr);
+        hy_goal_free(goal);
+        return FALSE;
+    }
+    rc = hy_goal_run(goal);
+    bench_record(results, fx, sack, "goal_install", 1, g_get_monotonic_time() - start);
+    hy_selector_free(sltr);
+    hy_goal_free(goal);
+    if (rc != 0)
+        g_printerr("goal_install for %s found no solution\n", name);
+
+    goal = hy_goal_create(sack);
+    start = g_get_monotonic_time();
+    hy_goal_upgrade_all(goal);
+    rc = hy_goal_run(goal);
+    bench_record(results, fx, sack, "goal_upgrade_all", 1, g_get_monotonic_time() - start);
+    if (rc != 0)
+        g_printerr("goal_upgrade_all found no solution\n");
+
+    /* add one request to the solved goal and run it again */
+    sltr = hy_selector_create(sack);
+    hy_selector_set(sltr, HY_PKG_NAME, HY_EQ, name);
+    start = g_get_monotonic_time();
+    if (!hy_goal_install_selector(goal, sltr, error)) {
+        hy_selector_free(sltr);
+        hy_goal_free(goal);
+        return FALSE;
+    }
+    rc = hy_goal_run(goal);
+    bench_record(results, fx, sack, "goal_rerun", 1, g_get_monotonic_time() - start);
+    hy_selector_free(sltr);
+    hy_goal_free(goal);
+    if (rc != 0)
+        g_printerr("goal_rerun for %s found no solution\n", name);
+    return TRUE;
+}
+
+static gboolean
+bench_yumdb_write(DnfDb *db, GPtrArray *pkgs, GError **error)
+{
+    dnf_db_begin(db);
+    for (guint i = 0; i < pkgs->len; i++) {
+        DnfPackage *pkg = g_ptr_array_index(pkgs, i);
+        if (!dnf_db_set_string(db, pkg, "from_repo", "available", error) ||
+            !dnf_db_set_string(db, pkg, "installed_by", "0", error) ||
+            !dnf_db_set_string(db, pkg, "reason", "user", error) ||
+            !dnf_db_set_string(db, pkg, "releasever", "26", error)) {
+            dnf_db_rollback(db);
+            return FALSE;
+        }
+    }
+    return dnf_db_commit(db, error);
+}
+
+static gboolean
+bench_yumdb(BenchResults *results, const BenchFixture *fx, DnfSack *sack,
+            const gchar *workdir, GError **error)
+{
+    gint64 start;
+    g_autofree gchar *root = g_strdup_printf("%s/%u/yumdb-root", workdir, fx->npkgs);
+    g_autoptr(DnfContext) context = dnf_context_new();
+    g_autoptr(DnfDb) db_files = NULL;
+    g_autoptr(DnfDb) db_import = NULL;
+    g_autoptr(DnfDb) db_store = NULL;
+    g_autoptr(GPtrArray) pkgs = NULL;
+    hy_autoquery HyQuery query = hy_query_create(sack);
+
+    hy_query_filter(query, HY_PKG_REPONAME, HY_EQ, HY_SYSTEM_REPO_NAME);
+    pkgs = hy_query_run(query);
+    for (guint i = 0; i < pkgs->len; i++) {
+        g_autofree gchar *pkgid = g_strdup_printf("%040x", i);
+        dnf_package_set_pkgid(g_ptr_array_index(pkgs, i), pkgid);
+    }
+    dnf_context_set_install_root(context, root);
+
+    /* one file per key, as yum does */
+    db_files = dnf_db_new(context);
+    dnf_db_set_enabled(db_files, TRUE);
+    start = g_get_monotonic_time();
+    if (!bench_yumdb_write(db_files, pkgs, error))
+        return FALSE;
+    bench_record(results, fx, sack, "yumdb_write_files", 1, g_get_monotonic_time() - start);
+
+    /* the one-time conversion of that tree */
+    db_import = dnf_db_new(context);
+    dnf_db_set_enabled(db_import, TRUE);
+    dnf_db_set_backend(db_import, DNF_DB_BACKEND_STORE);
+    start = g_get_monotonic_time();
+    if (!dnf_db_import_yumdb(db_import, error))
+        return FALSE;
+    bench_record(results, fx, sack, "yumdb_import", 1, g_get_monotonic_time() - start);
+
+    /* the same transaction committed to a fresh store */
+    if (!dnf_remove_recursive(root, error))
+        return FALSE;
+    db_store = dnf_db_new(context);
+    dnf_db_set_enabled(db_store, TRUE);
+    dnf_db_set_backend(db_store, DNF_DB_BACKEND_STORE);
+    start = g_get_monotonic_time();
+    if (!bench_yumdb_write(db_store, pkgs, error))
+        return FALSE;
+    bench_record(results, fx, sack, "yumdb_write_store", 1, g_get_monotonic_time() - start);
+    return dnf_remove_recursive(root, error);
+}
+
+typedef struct {
+    const BenchFixture  *fx;
+    const gchar         *socket_path;
+    GMainLoop           *loop;
+    gint64               connect_us;
+    gint64               requests_us;
+    GError              *error;
+} BenchServer;
+
+static gboolean
+bench_quit_cb(gpointer user_data)
+{
+    g_main_loop_quit(user_data);
+    return G_SOURCE_REMOVE;
+}
+
+/* the client blocks, so it runs here while the server uses the main loop */
+static gpointer
+bench_sack_server_client(gpointer user_data)
+{
+    BenchServer *bs = user_data;
+    gint64 start;
+    g_autofree gchar *name = g_strdup_printf("pkg%06u", bs->fx->npkgs / 2);
+    g_autoptr(DnfSackClient) client = dnf_sack_client_new(bs->socket_path);
+
+    start = g_get_monotonic_time();
+    if (!dnf_sack_client_connect(client, &bs->error))
+        goto out;
+    bs->connect_us = g_get_monotonic_time() - start;
+
+    start = g_get_monotonic_time();
+    for (guint i = 0; i < BENCH_SERVER_REQUESTS; i++) {
+        g_auto(GStrv) lines = dnf_sack_client_request(client, "name", name, &bs->error);
+        if (lines == NULL)
+            goto out;
+    }
+    bs->requests_us = g_get_monotonic_time() - start;
+out:
+    g_idle_add(bench_quit_cb, bs->loop);
+    return NULL;
+}
+
+static gboolean
+bench_sack_server(BenchResults *results, const BenchFixture *fx,
+                  const gchar *workdir, GError **error)
+{
+    BenchServer bs = { fx, NULL, NULL, 0, 0, NULL };
+    GThread *thread;
+    gint64 start;
+    g_autofree gchar *base = g_strdup_printf("%s/%u/server", workdir, fx->npkgs);
+    g_autofree gchar *repos_dir = g_build_filename(base, "repos.d", NULL);
+    g_autofree gchar *repo_file = g_build_filename(repos_dir, "available.repo", NULL);
+    g_autofree gchar *repo_root = g_path_get_dirname(fx->repo_dir);
+    g_autofree gchar *repo_data = NULL;
+    g_autofree gchar *cache_dir = g_build_filename(base, "cache", NULL);
+    g_autofree gchar *solv_dir = g_build_filename(base, "solv", NULL);
+    g_autofree gchar *lock_dir = g_build_filename(base, "lock", NULL);
+    g_autofree gchar *root = g_build_filename(base, "root", NULL);
+    g_autofree gchar *socket_path = g_build_filename(base, "socket", NULL);
+    g_autoptr(DnfContext) context = dnf_context_new();
+    g_autoptr(DnfSackServer) server = NULL;
+    g_autoptr(GMainLoop) loop = NULL;
+
+    if (g_mkdir_with_parents(repos_dir, 0755) != 0) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                    "failed to create %s", repos_dir);
+        return FALSE;
+    }
+    repo_data = g_strdup_printf("[available]\n"
+                                "name=available\n"
+                                "baseurl=file://%s\n"
+                                "enabled=1\n"
+                                "gpgcheck=0\n",
+                                repo_root);
+    if (!g_file_set_contents(repo_file, repo_data, -1, error))
+        return FALSE;
+    dnf_context_set_repo_dir(context, repos_dir);
+    dnf_context_set_cache_dir(context, cache_dir);
+    dnf_context_set_solv_dir(context, solv_dir);
+    dnf_context_set_lock_dir(context, lock_dir);
+    dnf_context_set_install_root(context, root);
+    dnf_context_set_release_ver(context, "26");
+    if (!dnf_context_setup(context, NULL, error))
+        return FALSE;
+
+    /* starting loads the sack, which is what every client saves */
+    server = dnf_sack_server_new(context);
+    start = g_get_monotonic_time();
+    if (!dnf_sack_server_start(server, socket_path, error))
+        return FALSE;
+    bench_record(results, fx, dnf_context_get_sack(context), "server_start", 1,
+                 g_get_monotonic_time() - start);
+
+    loop = g_main_loop_new(NULL, FALSE);
+    bs.socket_path = socket_path;
+    bs.loop = loop;
+    thread = g_thread_new("bench-client", bench_sack_server_client, &bs);
+    g_main_loop_run(loop);
+    g_thread_join(thread);
+    dnf_sack_server_stop(server);
+    if (bs.error != NULL) {
+        g_propagate_error(error, bs.error);
+        return FALSE;
+    }
+    bench_record(results, fx, dnf_context_get_sack(context), "server_connect", 1,
+                 bs.connect_us);
+    bench_record(results, fx, dnf_context_get_sack(context), "server_request",
+                 BENCH_SERVER_REQUESTS, bs.requests_us);
+    return TRUE;
+}
+
+static gboolean
+bench_run_size(BenchResults *results, guint npkgs, const gchar *workdir,
+               GError **error)
+{
+    BenchFixture fx = { npkgs, 0, NULL, NULL, NULL };
+    gboolean ret = FALSE;
+    gint64 start;
+    g_autoptr(DnfSack) sack = NULL;
+
+    start = g_get_monotonic_time();
+    if (!bench_fixture_generate(&fx, workdir, error))
+        goto out;
+    bench_record(results, &fx, NULL, "generate", 1, g_get_monotonic_time() - start);
+
+    /* cold: parse the XML and write the solv cache */
+    if (!dnf_remove_recursive(fx.cache_dir, NULL))
+        g_debug("no cache to remove in %s", fx.cache_dir);
+    sack = bench_sack_load(results, &fx, "cold", error);
+    if (sack == NULL)
+        goto out;
+    g_clear_object(&sack);
+
+    /* warm: read back the solv cache */
+    sack = bench_sack_load(results, &fx, "warm", error);
+    if (sack == NULL)
+        goto out;
+
+    start = g_get_monotonic_time();
+    dnf_sack_make_provides_ready(sack);
+    bench_record(results, &fx, sack, "make_provides_ready", 1,
+                 g_get_monotonic_time() - start);
+
+    bench_queries(results, &fx, sack);
+    if (!bench_goals(results, &fx, sack, error))
+        goto out;
+    if (!bench_yumdb(results, &fx, sack, workdir, error))
+        goto out;
+    if (!bench_sack_server(results, &fx, workdir, error))
+        goto out;
+    ret = TRUE;
+out:
+    bench_fixture_clear(&fx);
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    gboolean keep = FALSE;
+    gboolean ret = TRUE;
+    gboolean workdir_is_tmp = FALSE;
+    guint sizes_run = 0;
+    g_autofree gchar *opt_sizes = NULL;
+    g_autofree gchar *opt_output = NULL;
+    g_autofree gchar *workdir = NULL;
+    g_auto(GStrv) sizes = NULL;
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GOptionContext) context = NULL;
+    BenchResults results = { NULL, 0 };
+    const GOptionEntry options[] = {
+        { "sizes", 's', 0, G_OPTION_ARG_STRING, &opt_sizes,
+            "Comma separated package counts, default 1000,10000", NULL },
+        { "output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output,
+            "Write JSON results to this file", NULL },
+        { "workdir", 'w', 0, G_OPTION_ARG_FILENAME, &workdir,
+            "Directory for the generated repositories", NULL },
+        { "keep", 'k', 0, G_OPTION_ARG_NONE, &keep,
+            "Keep the generated repositories", NULL },
+        { NULL }
+    };
+
+    context = g_option_context_new("- time sack loading, queries, goals and yumdb writes");
+    g_option_context_add_main_entries(context, options, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_printerr("%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+    if (workdir == NULL) {
+        workdir = g_dir_make_tmp("hawkey-benchmark-XXXXXX", &error);
+        if (workdir == NULL) {
+            g_printerr("%s\n", error->message);
+            return EXIT_FAILURE;
+        }
+        workdir_is_tmp = TRUE;
+    }
+    sizes = g_strsplit(opt_sizes != NULL ? opt_sizes : "1000,10000", ",", -1);
+
+    results.json = g_string_new("{\n  \"results\": [\n");
+    for (guint i = 0; sizes[i] != NULL; i++) {
+        guint64 npkgs = g_ascii_strtoull(sizes[i], NULL, 10);
+        if (npkgs < 10 || npkgs > 999999) {
+            g_printerr("invalid size %s, expected 10..999999\n", sizes[i]);
+            ret = FALSE;
+            break;
+        }
+        sizes_run = i + 1;
+        if (!bench_run_size(&results, (guint) npkgs, workdir, &error)) {
+            g_printerr("benchmark failed: %s\n", error->message);
+            ret = FALSE;
+            break;
+        }
+    }
+    g_string_append(results.json, "\n  ]\n}\n");
+
+    if (ret && opt_output != NULL &&
+        !g_file_set_contents(opt_output, results.json->str, -1, &error)) {
+        g_printerr("%s\n", error->message);
+        ret = FALSE;
+    }
+
+    /* a --workdir may hold other things, so only remove what was generated */
+    if (!keep && workdir_is_tmp) {
+        dnf_remove_recursive(workdir, NULL);
+    } else if (!keep) {
+        for (guint i = 0; i < sizes_run; i++) {
+            g_autofree gchar *base = NULL;
+            base = g_strdup_printf("%s/%u", workdir,
+                                   (guint) g_ascii_strtoull(sizes[i], NULL, 10));
+            dnf_remove_recursive(base, NULL);
+        }
+    }
+    g_string_free(results.json, TRUE);
+    return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
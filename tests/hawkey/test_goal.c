@@ -338,6 +338,28 @@ START_TEST(test_goal_install_weak_deps)
 }
 END_TEST
 
+START_TEST(test_goal_rerun_weak_deps)
+{
+    HySelector sltr = hy_selector_create(test_globals.sack);
+    hy_selector_set(sltr, HY_PKG_NAME, HY_EQ, "B");
+    HyGoal goal = hy_goal_create(test_globals.sack);
+    fail_if(!hy_goal_install_selector(goal, sltr, NULL));
+    fail_if(hy_goal_run_flags(goal, DNF_IGNORE_WEAK_DEPS));
+    assert_iueo(goal, 1, 0, 0, 0);
+
+    // the solver is reused, the flag must not stick
+    fail_if(hy_goal_run(goal));
+    assert_iueo(goal, 2, 0, 0, 0);
+    HyGoalStats stats;
+    hy_goal_get_stats(goal, &stats);
+    fail_unless(stats.reused_solver);
+    ck_assert_int_eq(stats.solver_runs, 1);
+    fail_unless(stats.rules > stats.learnt_rules);
+    hy_goal_free(goal);
+    hy_selector_free(sltr);
+}
+END_TEST
+
 START_TEST(test_goal_selector_glob)
 {
     HySelector sltr = hy_selector_create(test_globals.sack);
@@ -1099,6 +1121,43 @@ START_TEST(test_goal_unneeded)
 }
 END_TEST
 
+START_TEST(test_goal_solution_cache)
+{
+    DnfSack *sack = test_globals.sack;
+    DnfPackage *pkg = get_latest_pkg(sack, "walrus");
+    HyGoal goal = hy_goal_create(sack);
+
+    hy_goal_install(goal, pkg);
+    fail_if(hy_goal_run_flags(goal, DNF_SOLUTION_CACHE));
+    fail_if(hy_goal_log_decisions(goal));
+    hy_goal_free(goal);
+
+    // the same request is answered without a solver
+    goal = hy_goal_create(sack);
+    hy_goal_install(goal, pkg);
+    fail_if(hy_goal_run_flags(goal, DNF_SOLUTION_CACHE));
+    fail_unless(hy_goal_log_decisions(goal));
+    HyGoalStats stats;
+    hy_goal_get_stats(goal, &stats);
+    fail_unless(stats.cached);
+    ck_assert_int_eq(stats.solver_runs, 0);
+    ck_assert_int_eq(hy_goal_count_problems(goal), 0);
+    assert_iueo(goal, 2, 0, 0, 0);
+    fail_unless(hy_goal_get_reason(goal, pkg) == HY_REASON_USER);
+
+    // a different job misses the cache
+    DnfPackage *dog = by_name_repo(sack, "dog", HY_SYSTEM_REPO_NAME);
+    hy_goal_erase(goal, dog);
+    fail_if(hy_goal_run_flags(goal, DNF_SOLUTION_CACHE));
+    fail_if(hy_goal_log_decisions(goal));
+    assert_iueo(goal, 2, 0, 1, 0);
+    g_object_unref(dog);
+
+    g_object_unref(pkg);
+    hy_goal_free(goal);
+}
+END_TEST
+
 struct Solutions {
     int solutions;
     GPtrArray *installs;
@@ -1450,6 +1509,7 @@ goal_suite(void)
     tcase_add_test(tc, test_goal_install_selector_file);
     tcase_add_test(tc, test_goal_rerun);
     tcase_add_test(tc, test_goal_unneeded);
+    tcase_add_test(tc, test_goal_solution_cache);
     tcase_add_test(tc, test_goal_distupgrade_all_excludes);
     suite_add_tcase(s, tc);
 
@@ -1458,6 +1518,7 @@ goal_suite(void)
     tcase_add_test(tc, test_goal_run_all);
     tcase_add_test(tc, test_goal_install_selector_obsoletes_first);
     tcase_add_test(tc, test_goal_install_weak_deps);
+    tcase_add_test(tc, test_goal_rerun_weak_deps);
     suite_add_tcase(s, tc);
 
     tc = tcase_create("Installonly");
@@ -23,6 +23,7 @@
 
 
 #include "libdnf/dnf-advisory.h"
+#include "libdnf/dnf-package.h"
 #include "libdnf/hy-package.h"
 #include "libdnf/hy-package-private.h"
 #include "libdnf/hy-query.h"
@@ -323,6 +324,85 @@ START_TEST(test_presto)
 }
 END_TEST
 
+START_TEST(test_presto_worthwhile)
+{
+    DnfSack *sack = test_globals.sack;
+    DnfPackage *tour = by_name(sack, "tour");
+    DnfPackageDelta *delta = dnf_package_get_delta_from_evr(tour, "4-5");
+    fail_if(delta == NULL);
+
+    /* the delta is 3132 bytes, the rebuild counts as a quarter */
+    fail_unless(dnf_packagedelta_is_worthwhile(delta, 100000));
+    fail_unless(dnf_packagedelta_is_worthwhile(delta, 4200));
+    fail_if(dnf_packagedelta_is_worthwhile(delta, 4176));
+    fail_if(dnf_packagedelta_is_worthwhile(delta, 3000));
+    fail_if(dnf_packagedelta_is_worthwhile(delta, 0));
+    g_object_unref(delta);
+    g_object_unref(tour);
+}
+END_TEST
+
+START_TEST(test_check_filenames)
+{
+    DnfSack *sack = test_globals.sack;
+    DnfPackage *missing = by_name(sack, "tour");
+    DnfPackage *valid = by_name(sack, "tour");
+    DnfPackage *corrupt = by_name(sack, "mystery-devel");
+    GError *error = NULL;
+    gchar *contents;
+    gsize len;
+    char *src = solv_dupjoin(test_globals.repo_dir, "yum/tour-4-6.noarch.rpm", NULL);
+    char *dir = solv_dupjoin(test_globals.tmpdir, "/check-filenames", NULL);
+    char *fn_valid = solv_dupjoin(dir, "/tour-4-6.noarch.rpm", NULL);
+    char *fn_corrupt = solv_dupjoin(dir, "/mystery-devel-19.67-1.noarch.rpm", NULL);
+    char *fn_missing = solv_dupjoin(dir, "/missing.rpm", NULL);
+    GPtrArray *packages = g_ptr_array_new();
+    GPtrArray *invalid = g_ptr_array_new_with_free_func(g_object_unref);
+
+    /* the files live in the tmpdir as the check writes an index next to them */
+    fail_if(g_mkdir_with_parents(dir, 0755) != 0);
+    fail_unless(g_file_get_contents(src, &contents, &len, NULL));
+    fail_unless(g_file_set_contents(fn_valid, contents, len, NULL));
+    fail_unless(g_file_set_contents(fn_corrupt, contents, len / 2, NULL));
+    g_free(contents);
+    dnf_package_set_filename(missing, fn_missing);
+    dnf_package_set_filename(valid, fn_valid);
+    dnf_package_set_filename(corrupt, fn_corrupt);
+
+    /* no state is needed, and the invalid ones keep their order */
+    g_ptr_array_add(packages, corrupt);
+    g_ptr_array_add(packages, valid);
+    g_ptr_array_add(packages, missing);
+    fail_unless(dnf_package_array_check_filenames(packages, invalid, NULL, &error));
+    g_assert_no_error(error);
+    fail_unless(invalid->len == 2);
+    fail_unless(g_ptr_array_index(invalid, 0) == corrupt);
+    fail_unless(g_ptr_array_index(invalid, 1) == missing);
+
+    g_ptr_array_set_size(invalid, 0);
+    g_ptr_array_set_size(packages, 0);
+    g_ptr_array_add(packages, missing);
+    g_ptr_array_add(packages, valid);
+    g_ptr_array_add(packages, corrupt);
+    fail_unless(dnf_package_array_check_filenames(packages, invalid, NULL, &error));
+    g_assert_no_error(error);
+    fail_unless(invalid->len == 2);
+    fail_unless(g_ptr_array_index(invalid, 0) == missing);
+    fail_unless(g_ptr_array_index(invalid, 1) == corrupt);
+
+    g_ptr_array_unref(invalid);
+    g_ptr_array_unref(packages);
+    g_object_unref(missing);
+    g_object_unref(valid);
+    g_object_unref(corrupt);
+    g_free(src);
+    g_free(dir);
+    g_free(fn_valid);
+    g_free(fn_corrupt);
+    g_free(fn_missing);
+}
+END_TEST
+
 START_TEST(test_get_files_cmdline)
 {
     DnfSack *sack = test_globals.sack;
@@ -370,6 +450,8 @@ package_suite(void)
     tcase_add_test(tc, test_packager);
     tcase_add_test(tc, test_sourcerpm);
     tcase_add_test(tc, test_presto);
+    tcase_add_test(tc, test_presto_worthwhile);
+    tcase_add_test(tc, test_check_filenames);
     suite_add_tcase(s, tc);
 
     tc = tcase_create("WithCmdlinePackage");
@@ -29,8 +29,14 @@
 
 #include <glib/gstdio.h>
 
+#include "libdnf/dnf-context.h"
+#include "libdnf/dnf-repo.h"
 #include "libdnf/dnf-types.h"
+#include "libdnf/hy-goal.h"
+#include "libdnf/hy-package.h"
 #include "libdnf/hy-package-private.h"
+#include "libdnf/hy-packageset.h"
+#include "libdnf/hy-query.h"
 #include "libdnf/hy-repo-private.h"
 #include "libdnf/dnf-sack-private.h"
 #include "libdnf/hy-util.h"
@@ -295,6 +301,323 @@ START_TEST(test_dnf_sack_knows_version)
 }
 END_TEST
 
+START_TEST(test_considered_incremental)
+{
+    DnfSack *sack = test_globals.sack;
+    DnfSackConsideredStats before, after;
+    HyQuery q;
+
+    /* start from an up to date considered map and whatprovides index */
+    DnfPackageSet *empty = dnf_packageset_new(sack);
+    dnf_sack_set_excludes(sack, empty);
+    g_object_unref(empty);
+    dnf_sack_recompute_considered(sack);
+    dnf_sack_make_provides_ready(sack);
+    dnf_sack_get_considered_stats(sack, &before);
+
+    const char *names[] = {"jay", "fool", NULL};
+    for (const char **name = names; *name; ++name) {
+        q = hy_query_create_flags(sack, HY_IGNORE_EXCLUDES);
+        hy_query_filter(q, HY_PKG_NAME, HY_EQ, *name);
+        DnfPackageSet *pset = hy_query_run_set(q);
+        dnf_sack_add_excludes(sack, pset);
+        g_object_unref(pset);
+        hy_query_free(q);
+
+        /* a name-only query applies the excludes, no provides needed */
+        q = hy_query_create(sack);
+        hy_query_filter(q, HY_PKG_NAME, HY_EQ, *name);
+        DnfPackageSet *excluded = hy_query_run_set(q);
+        fail_unless(dnf_packageset_count(excluded) == 0);
+        g_object_unref(excluded);
+        hy_query_free(q);
+    }
+
+    dnf_sack_get_considered_stats(sack, &after);
+    fail_unless(after.full_recomputes == before.full_recomputes);
+    fail_unless(after.incremental_updates == before.incremental_updates + 2);
+    fail_unless(after.whatprovides_rebuilds == before.whatprovides_rebuilds);
+    fail_unless(after.whatprovides_avoided == before.whatprovides_avoided + 1);
+
+    dnf_sack_make_provides_ready(sack);
+    dnf_sack_get_considered_stats(sack, &after);
+    fail_unless(after.whatprovides_rebuilds == before.whatprovides_rebuilds + 1);
+}
+END_TEST
+
+static DnfPackageSet *
+query_visible(DnfSack *sack)
+{
+    HyQuery q = hy_query_create(sack);
+    DnfPackageSet *pset = hy_query_run_set(q);
+    hy_query_free(q);
+    return pset;
+}
+
+static DnfPackageSet *
+query_names(DnfSack *sack, const char **names)
+{
+    HyQuery q = hy_query_create_flags(sack, HY_IGNORE_EXCLUDES);
+    hy_query_filter_in(q, HY_PKG_NAME, HY_EQ, names);
+    DnfPackageSet *pset = hy_query_run_set(q);
+    hy_query_free(q);
+    return pset;
+}
+
+/* what queries see after the in-place updates must match a full recompute */
+static void
+assert_considered_matches_full(DnfSack *sack, DnfPackageSet *excludes,
+                               DnfPackageSet *includes)
+{
+    DnfPackageSet *incremental = query_visible(sack);
+
+    dnf_sack_set_excludes(sack, excludes);
+    dnf_sack_set_includes(sack, includes);
+    DnfPackageSet *full = query_visible(sack);
+
+    ck_assert_int_eq(dnf_packageset_count(incremental),
+                     dnf_packageset_count(full));
+    for (unsigned i = 0; i < dnf_packageset_count(full); ++i) {
+        DnfPackage *pkg = dnf_packageset_get_clone(full, i);
+        fail_unless(dnf_packageset_has(incremental, pkg),
+                    "%s missing after an incremental update",
+                    dnf_package_get_nevra(pkg));
+        g_object_unref(pkg);
+    }
+    g_object_unref(incremental);
+    g_object_unref(full);
+}
+
+START_TEST(test_considered_incremental_includes)
+{
+    DnfSack *sack = test_globals.sack;
+    DnfSackConsideredStats before, after;
+    const char *first[] = {"jay", NULL};
+    const char *second[] = {"fool", NULL};
+    const char *both[] = {"jay", "fool", NULL};
+
+    dnf_sack_set_excludes(sack, NULL);
+    dnf_sack_set_includes(sack, NULL);
+    dnf_sack_recompute_considered(sack);
+
+    /* the first include recomputes, the second one is applied in place */
+    DnfPackageSet *pset = query_names(sack, first);
+    dnf_sack_add_includes(sack, pset);
+    g_object_unref(pset);
+    dnf_sack_recompute_considered(sack);
+    dnf_sack_get_considered_stats(sack, &before);
+
+    pset = query_names(sack, second);
+    dnf_sack_add_includes(sack, pset);
+    g_object_unref(pset);
+    DnfPackageSet *visible = query_visible(sack);
+    dnf_sack_get_considered_stats(sack, &after);
+    fail_unless(after.full_recomputes == before.full_recomputes);
+    fail_unless(after.incremental_updates == before.incremental_updates + 1);
+
+    pset = query_names(sack, both);
+    ck_assert_int_eq(dnf_packageset_count(visible), dnf_packageset_count(pset));
+    g_object_unref(visible);
+    assert_considered_matches_full(sack, NULL, pset);
+    g_object_unref(pset);
+    dnf_sack_set_includes(sack, NULL);
+}
+END_TEST
+
+START_TEST(test_considered_incremental_repo_enabled)
+{
+    DnfSack *sack = test_globals.sack;
+    DnfSackConsideredStats before, after;
+    const char *names[] = {"jay", NULL};
+
+    DnfPackageSet *excludes = query_names(sack, names);
+    dnf_sack_set_includes(sack, NULL);
+    dnf_sack_set_excludes(sack, excludes);
+    dnf_sack_recompute_considered(sack);
+    DnfPackageSet *enabled = query_visible(sack);
+    dnf_sack_get_considered_stats(sack, &before);
+
+    dnf_sack_repo_enabled(sack, "updates", 0);
+    DnfPackageSet *disabled = query_visible(sack);
+    fail_unless(dnf_packageset_count(disabled) < dnf_packageset_count(enabled));
+    g_object_unref(disabled);
+
+    dnf_sack_repo_enabled(sack, "updates", 1);
+    DnfPackageSet *reenabled = query_visible(sack);
+    ck_assert_int_eq(dnf_packageset_count(reenabled),
+                     dnf_packageset_count(enabled));
+    g_object_unref(reenabled);
+    g_object_unref(enabled);
+
+    dnf_sack_get_considered_stats(sack, &after);
+    fail_unless(after.full_recomputes == before.full_recomputes);
+    fail_unless(after.incremental_updates == before.incremental_updates + 2);
+
+    assert_considered_matches_full(sack, excludes, NULL);
+    g_object_unref(excludes);
+    dnf_sack_set_excludes(sack, NULL);
+}
+END_TEST
+
+static DnfRepo *
+repo_with_excludes(DnfContext *ctx, const char *id, const char *excludes)
+{
+    g_autoptr(GKeyFile) keyfile = g_key_file_new();
+    DnfRepo *repo = dnf_repo_new(ctx);
+
+    g_key_file_set_string(keyfile, "general", "arch", TEST_FIXED_ARCH);
+    g_key_file_set_string(keyfile, "general", "version", "26");
+    g_key_file_set_boolean(keyfile, id, "enabled_metadata", FALSE);
+    g_key_file_set_string(keyfile, id, "exclude", excludes);
+    dnf_repo_set_id(repo, id);
+    dnf_repo_set_location(repo, test_globals.tmpdir);
+    dnf_repo_set_keyfile(repo, keyfile);
+    fail_unless(dnf_repo_setup(repo, NULL));
+    return repo;
+}
+
+static guint
+query_repo_name_count(DnfSack *sack, const char *reponame, const char *name)
+{
+    HyQuery q = hy_query_create(sack);
+    hy_query_filter(q, HY_PKG_REPONAME, HY_EQ, reponame);
+    hy_query_filter(q, HY_PKG_NAME, HY_EQ, name);
+    g_autoptr(GPtrArray) plist = hy_query_run(q);
+    hy_query_free(q);
+    return plist->len;
+}
+
+START_TEST(test_repo_excludes)
+{
+    DnfSack *sack = test_globals.sack;
+    DnfSackConsideredStats before, after;
+    const char *names[] = {"jay", "penny", "penny-lib", "penny-lib-devel", NULL};
+    g_autoptr(DnfContext) ctx = dnf_context_new();
+    g_autoptr(GPtrArray) repos = g_ptr_array_new_with_free_func(g_object_unref);
+
+    dnf_sack_set_excludes(sack, NULL);
+    dnf_sack_set_includes(sack, NULL);
+    dnf_sack_recompute_considered(sack);
+    DnfPackageSet *all = query_visible(sack);
+
+    /* patterns matching nothing in their own repo leave the map alone */
+    g_ptr_array_add(repos, repo_with_excludes(ctx, "updates",
+                                              "nothing nothing-* penny*"));
+    dnf_sack_get_considered_stats(sack, &before);
+    dnf_sack_add_repo_excludes(sack, repos);
+    DnfPackageSet *visible = query_visible(sack);
+    dnf_sack_get_considered_stats(sack, &after);
+    fail_unless(after.full_recomputes == before.full_recomputes);
+    fail_unless(after.incremental_updates == before.incremental_updates);
+    ck_assert_int_eq(dnf_packageset_count(visible), dnf_packageset_count(all));
+    g_object_unref(visible);
+
+    /* a glob and an exact name, applied to the listing repo only */
+    g_ptr_array_set_size(repos, 0);
+    g_ptr_array_add(repos, repo_with_excludes(ctx, "main", "penny* jay"));
+    dnf_sack_add_repo_excludes(sack, repos);
+    for (const char **name = names; *name; ++name)
+        ck_assert_int_eq(query_repo_name_count(sack, "main", *name), 0);
+    ck_assert_int_eq(query_repo_name_count(sack, "main", "fool"), 1);
+    ck_assert_int_eq(query_repo_name_count(sack, HY_SYSTEM_REPO_NAME, "jay"), 2);
+    ck_assert_int_eq(query_repo_name_count(sack, HY_SYSTEM_REPO_NAME, "penny"), 1);
+    dnf_sack_get_considered_stats(sack, &after);
+    fail_unless(after.incremental_updates == before.incremental_updates + 1);
+
+    HyQuery q = hy_query_create_flags(sack, HY_IGNORE_EXCLUDES);
+    hy_query_filter(q, HY_PKG_REPONAME, HY_EQ, "main");
+    hy_query_filter_in(q, HY_PKG_NAME, HY_EQ, names);
+    DnfPackageSet *excludes = hy_query_run_set(q);
+    hy_query_free(q);
+    visible = query_visible(sack);
+    ck_assert_int_eq(dnf_packageset_count(visible),
+                     dnf_packageset_count(all) - dnf_packageset_count(excludes));
+    g_object_unref(visible);
+    assert_considered_matches_full(sack, excludes, NULL);
+    g_object_unref(excludes);
+    g_object_unref(all);
+    dnf_sack_set_excludes(sack, NULL);
+}
+END_TEST
+
+static guint
+query_name_count(DnfSack *sack, const char *name, int flags)
+{
+    HyQuery q = hy_query_create_flags(sack, flags);
+    hy_query_filter(q, HY_PKG_NAME, HY_EQ, name);
+    g_autoptr(GPtrArray) plist = hy_query_run(q);
+    hy_query_free(q);
+    return plist->len;
+}
+
+static gpointer
+snapshot_upgrade_all_thread(gpointer data)
+{
+    DnfSack *sack = data;
+    HyGoal goal = hy_goal_create(sack);
+    hy_goal_upgrade_all(goal);
+    if (hy_goal_run(goal)) {
+        hy_goal_free(goal);
+        return GUINT_TO_POINTER(G_MAXUINT);
+    }
+    g_autoptr(GPtrArray) plist = hy_goal_list_upgrades(goal, NULL);
+    hy_goal_free(goal);
+    return GUINT_TO_POINTER(plist->len);
+}
+
+START_TEST(test_snapshot)
+{
+    DnfSack *sack = test_globals.sack;
+    g_autoptr(GError) error = NULL;
+    g_autoptr(DnfSack) snap1 = NULL;
+    g_autoptr(DnfSack) snap2 = NULL;
+    g_autoptr(DnfSack) snap3 = NULL;
+
+    HyQuery q = hy_query_create_flags(sack, HY_IGNORE_EXCLUDES);
+    hy_query_filter(q, HY_PKG_NAME, HY_EQ, "jay");
+    DnfPackageSet *pset = hy_query_run_set(q);
+    dnf_sack_add_excludes(sack, pset);
+    g_object_unref(pset);
+    hy_query_free(q);
+
+    snap1 = dnf_sack_snapshot(sack, &error);
+    fail_unless(snap1 != NULL);
+    fail_unless(error == NULL);
+    snap2 = dnf_sack_snapshot(sack, &error);
+    fail_unless(snap2 != NULL);
+    snap3 = dnf_sack_snapshot(sack, &error);
+    fail_unless(snap3 != NULL);
+
+    /* same packages, same excludes, separate pools */
+    fail_unless(dnf_sack_count(snap1) == dnf_sack_count(sack));
+    fail_unless(dnf_sack_get_pool(snap1) != dnf_sack_get_pool(sack));
+    fail_unless(query_name_count(snap1, "jay", 0) == 0);
+    fail_unless(query_name_count(snap1, "jay", HY_IGNORE_EXCLUDES) ==
+                query_name_count(sack, "jay", HY_IGNORE_EXCLUDES));
+    fail_if(dnf_sack_get_pool(snap1)->installed == NULL);
+
+    /* excluding in a snapshot does not leak into the original */
+    q = hy_query_create(snap1);
+    hy_query_filter(q, HY_PKG_NAME, HY_EQ, "fool");
+    pset = hy_query_run_set(q);
+    dnf_sack_add_excludes(snap1, pset);
+    g_object_unref(pset);
+    hy_query_free(q);
+    fail_unless(query_name_count(snap1, "fool", 0) == 0);
+    fail_if(query_name_count(sack, "fool", 0) == 0);
+
+    /* goals on different snapshots can run concurrently */
+    gpointer expected = snapshot_upgrade_all_thread(sack);
+    GThread *t1 = g_thread_new("snap2", snapshot_upgrade_all_thread, snap2);
+    GThread *t2 = g_thread_new("snap3", snapshot_upgrade_all_thread, snap3);
+    gpointer r1 = g_thread_join(t1);
+    gpointer r2 = g_thread_join(t2);
+    fail_if(GPOINTER_TO_UINT(expected) == G_MAXUINT);
+    fail_unless(r1 == expected);
+    fail_unless(r2 == expected);
+}
+END_TEST
+
 Suite *
 sack_suite(void)
 {
@@ -329,5 +652,18 @@ sack_suite(void)
     tcase_add_test(tc, test_dnf_sack_knows_version);
     suite_add_tcase(s, tc);
 
+    tc = tcase_create("Considered");
+    tcase_add_unchecked_fixture(tc, fixture_all, teardown);
+    tcase_add_test(tc, test_considered_incremental);
+    tcase_add_test(tc, test_considered_incremental_includes);
+    tcase_add_test(tc, test_considered_incremental_repo_enabled);
+    tcase_add_test(tc, test_repo_excludes);
+    suite_add_tcase(s, tc);
+
+    tc = tcase_create("Snapshot");
+    tcase_add_unchecked_fixture(tc, fixture_all, teardown);
+    tcase_add_test(tc, test_snapshot);
+    suite_add_tcase(s, tc);
+
     return s;
 }
@@ -21,9 +21,15 @@
 
 
 #include <glib-object.h>
+#include <glib/gstdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <librepo/librepo.h>
 
 #include "libdnf/libdnf.h"
+#include "libdnf/dnf-mirror-stats-private.h"
+#include "libdnf/dnf-transaction-private.h"
+#include "libdnf/dnf-verified-cache-private.h"
 
 /**
  * cd_test_get_filename:
@@ -46,6 +52,299 @@ out:
     return full;
 }
 
+/**
+ * dnf_test_copy_tree:
+ **/
+static void
+dnf_test_copy_tree(const gchar *src, const gchar *dest)
+{
+    const gchar *name;
+    g_autoptr(GDir) dir = NULL;
+    g_autoptr(GError) error = NULL;
+
+    dir = g_dir_open(src, 0, &error);
+    g_assert_no_error(error);
+    g_assert_cmpint(g_mkdir_with_parents(dest, 0755), ==, 0);
+    while ((name = g_dir_read_name(dir)) != NULL) {
+        gsize len;
+        g_autofree gchar *contents = NULL;
+        g_autofree gchar *dest_fn = g_build_filename(dest, name, NULL);
+        g_autofree gchar *src_fn = g_build_filename(src, name, NULL);
+
+        if (g_file_test(src_fn, G_FILE_TEST_IS_DIR)) {
+            dnf_test_copy_tree(src_fn, dest_fn);
+            continue;
+        }
+        g_file_get_contents(src_fn, &contents, &len, &error);
+        g_assert_no_error(error);
+        g_file_set_contents(dest_fn, contents, len, &error);
+        g_assert_no_error(error);
+    }
+}
+
+/**
+ * dnf_test_context_new:
+ *
+ * Sets up a context that only uses @dir.
+ **/
+static DnfContext *
+dnf_test_context_new(const gchar *dir)
+{
+    DnfContext *ctx;
+    gboolean ret;
+    g_autofree gchar *cache_dir = g_build_filename(dir, "cache", NULL);
+    g_autofree gchar *repos_dir = g_build_filename(dir, "repos.d", NULL);
+    g_autofree gchar *solv_dir = g_build_filename(dir, "solv", NULL);
+    g_autoptr(GError) error = NULL;
+
+    g_assert_cmpint(g_mkdir_with_parents(repos_dir, 0755), ==, 0);
+    ctx = dnf_context_new();
+    dnf_context_set_repo_dir(ctx, repos_dir);
+    dnf_context_set_cache_dir(ctx, cache_dir);
+    dnf_context_set_solv_dir(ctx, solv_dir);
+    dnf_context_set_install_root(ctx, dir);
+    dnf_context_set_release_ver(ctx, "26");
+    ret = dnf_context_setup(ctx, NULL, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    return ctx;
+}
+
+/**
+ * dnf_test_sack_new:
+ **/
+static DnfSack *
+dnf_test_sack_new(const gchar *dir)
+{
+    DnfSack *sack;
+    gboolean ret;
+    g_autofree gchar *cache_dir = g_build_filename(dir, "sack", NULL);
+    g_autoptr(GError) error = NULL;
+
+    sack = dnf_sack_new();
+    dnf_sack_set_cachedir(sack, cache_dir);
+    ret = dnf_sack_setup(sack, DNF_SACK_SETUP_FLAG_MAKE_CACHE_DIR, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    return sack;
+}
+
+/**
+ * dnf_test_add_local_repo:
+ *
+ * Copies the hawkey yum repo to @dir/@id and sets it up as a local repo,
+ * adding it to @sack unless that is %NULL.
+ **/
+static DnfRepo *
+dnf_test_add_local_repo(DnfContext *ctx, DnfSack *sack,
+                        const gchar *dir, const gchar *id)
+{
+    DnfRepo *repo;
+    gboolean ret;
+    g_autofree gchar *baseurl = NULL;
+    g_autofree gchar *filename = NULL;
+    g_autofree gchar *location = g_build_filename(dir, id, NULL);
+    g_autofree gchar *src = dnf_test_get_filename("hawkey/yum");
+    g_autoptr(DnfState) state = dnf_state_new();
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GKeyFile) keyfile = g_key_file_new();
+
+    dnf_test_copy_tree(src, location);
+    baseurl = g_strconcat("file://", location, NULL);
+    g_key_file_set_string(keyfile, id, "baseurl", baseurl);
+    g_key_file_set_boolean(keyfile, id, "enabled", TRUE);
+    g_key_file_set_boolean(keyfile, id, "gpgcheck", FALSE);
+    filename = g_strconcat(location, ".repo", NULL);
+    ret = g_key_file_save_to_file(keyfile, filename, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+
+    repo = dnf_repo_new(ctx);
+    dnf_repo_set_id(repo, id);
+    dnf_repo_set_filename(repo, filename);
+    dnf_repo_set_keyfile(repo, keyfile);
+    ret = dnf_repo_setup(repo, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    g_assert_cmpint(dnf_repo_get_kind(repo), ==, DNF_REPO_KIND_LOCAL);
+    if (sack == NULL)
+        return repo;
+    ret = dnf_sack_add_repo(sack, repo, G_MAXUINT, DNF_SACK_ADD_FLAG_NONE,
+                            state, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    return repo;
+}
+
+/**
+ * dnf_test_write_mirror:
+ *
+ * Writes a repo with the hawkey test packages to @dir. Unlike the
+ * original its primary has no xml:base, so librepo can download the
+ * packages from it, and no filelists. Each package claims to need
+ * @installsize bytes once installed.
+ **/
+static void
+dnf_test_write_mirror(const gchar *dir, guint64 installsize)
+{
+    const gchar *nevras[] = { "tour", "4", "6",
+                              "mystery-devel", "19.67", "1",
+                              NULL };
+    gboolean ret;
+    gsize len;
+    g_autofree gchar *checksum = NULL;
+    g_autofree gchar *primary_fn = NULL;
+    g_autofree gchar *repodata = g_build_filename(dir, "repodata", NULL);
+    g_autofree gchar *repomd = NULL;
+    g_autofree gchar *repomd_fn = NULL;
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GString) primary = g_string_new(NULL);
+
+    g_assert_cmpint(g_mkdir_with_parents(repodata, 0755), ==, 0);
+    g_string_append(primary,
+                    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                    "<metadata xmlns=\"http://linux.duke.edu/metadata/common\" "
+                    "xmlns:rpm=\"http://linux.duke.edu/metadata/rpm\" packages=\"2\">\n");
+    for (guint i = 0; nevras[i] != NULL; i += 3) {
+        g_autofree gchar *basename = NULL;
+        g_autofree gchar *contents = NULL;
+        g_autofree gchar *dest_fn = NULL;
+        g_autofree gchar *pkg_checksum = NULL;
+        g_autofree gchar *src_fn = NULL;
+        g_autofree gchar *testdata_fn = NULL;
+
+        basename = g_strdup_printf("%s-%s-%s.noarch.rpm",
+                                   nevras[i], nevras[i + 1], nevras[i + 2]);
+        testdata_fn = g_build_filename("hawkey", "yum", basename, NULL);
+        src_fn = dnf_test_get_filename(testdata_fn);
+        dest_fn = g_build_filename(dir, basename, NULL);
+        ret = g_file_get_contents(src_fn, &contents, &len, &error);
+        g_assert_no_error(error);
+        g_assert(ret);
+        ret = g_file_set_contents(dest_fn, contents, len, &error);
+        g_assert_no_error(error);
+        g_assert(ret);
+        pkg_checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+                                                   (const guchar *) contents, len);
+        g_string_append_printf(primary,
+            "<package type=\"rpm\">\n"
+            " <name>%s</name>\n"
+            " <arch>noarch</arch>\n"
+            " <version epoch=\"0\" ver=\"%s\" rel=\"%s\"/>\n"
+            " <checksum type=\"sha256\" pkgid=\"YES\">%s</checksum>\n"
+            " <summary>%s</summary>\n"
+            " <description>%s</description>\n"
+            " <time file=\"1\" build=\"1\"/>\n"
+            " <size package=\"%" G_GSIZE_FORMAT "\" installed=\"%" G_GUINT64_FORMAT "\" archive=\"0\"/>\n"
+            " <location href=\"%s\"/>\n"
+            " <format><rpm:license>GPL</rpm:license></format>\n"
+            "</package>\n",
+            nevras[i], nevras[i + 1], nevras[i + 2], pkg_checksum,
+            nevras[i], nevras[i], len, installsize, basename);
+    }
+    g_string_append(primary, "</metadata>\n");
+    primary_fn = g_build_filename(repodata, "primary.xml", NULL);
+    ret = g_file_set_contents(primary_fn, primary->str, primary->len, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+
+    checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA256, primary->str, primary->len);
+    repomd = g_strdup_printf("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                             "<repomd xmlns=\"http://linux.duke.edu/metadata/repo\">\n"
+                             " <revision>1</revision>\n"
+                             " <data type=\"primary\">"
+                             "<checksum type=\"sha256\">%s</checksum>"
+                             "<location href=\"repodata/primary.xml\"/>"
+                             "<timestamp>1</timestamp></data>\n"
+                             "</repomd>\n",
+                             checksum);
+    repomd_fn = g_build_filename(repodata, "repomd.xml", NULL);
+    ret = g_file_set_contents(repomd_fn, repomd, -1, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+}
+
+/**
+ * dnf_test_add_remote_repo:
+ *
+ * Writes a mirror to @dir/@id-mirror with packages of @installsize bytes
+ * and sets up a remote repo for it, which keeps its metadata and
+ * packages in the cache dir of @ctx. The mirrorlist stops the file://
+ * baseurl from making it a local repo.
+ * The repo is added to @sack unless that is %NULL.
+ **/
+static DnfRepo *
+dnf_test_add_remote_repo(DnfContext *ctx, DnfSack *sack,
+                         const gchar *dir, const gchar *id,
+                         guint64 installsize)
+{
+    DnfRepo *repo;
+    gboolean ret;
+    g_autofree gchar *baseurl = NULL;
+    g_autofree gchar *filename = NULL;
+    g_autofree gchar *mirror = g_strdup_printf("%s/%s-mirror", dir, id);
+    g_autofree gchar *mirrorlist = NULL;
+    g_autofree gchar *mirrorlist_fn = NULL;
+    g_autoptr(DnfState) state = dnf_state_new();
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GKeyFile) keyfile = g_key_file_new();
+
+    dnf_test_write_mirror(mirror, installsize);
+    baseurl = g_strconcat("file://", mirror, NULL);
+    mirrorlist_fn = g_strdup_printf("%s/%s.mirrorlist", dir, id);
+    ret = g_file_set_contents(mirrorlist_fn, baseurl, -1, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    mirrorlist = g_strconcat("file://", mirrorlist_fn, NULL);
+    g_key_file_set_string(keyfile, id, "baseurl", baseurl);
+    g_key_file_set_string(keyfile, id, "mirrorlist", mirrorlist);
+    g_key_file_set_boolean(keyfile, id, "enabled", TRUE);
+    g_key_file_set_boolean(keyfile, id, "gpgcheck", FALSE);
+    filename = g_strdup_printf("%s/%s.repo", dir, id);
+    ret = g_key_file_save_to_file(keyfile, filename, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+
+    repo = dnf_repo_new(ctx);
+    dnf_repo_set_id(repo, id);
+    dnf_repo_set_filename(repo, filename);
+    dnf_repo_set_keyfile(repo, keyfile);
+    ret = dnf_repo_setup(repo, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    g_assert_cmpint(dnf_repo_get_kind(repo), ==, DNF_REPO_KIND_REMOTE);
+    if (sack == NULL)
+        return repo;
+    ret = dnf_sack_add_repo(sack, repo, G_MAXUINT, DNF_SACK_ADD_FLAG_NONE,
+                            state, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    return repo;
+}
+
+/**
+ * dnf_test_get_package:
+ *
+ * Returns: the package called @name from @repo, with the repo set
+ **/
+static DnfPackage *
+dnf_test_get_package(DnfSack *sack, DnfRepo *repo, const gchar *name)
+{
+    DnfPackage *pkg;
+    HyQuery query;
+    g_autoptr(GPtrArray) packages = NULL;
+
+    query = hy_query_create(sack);
+    hy_query_filter(query, HY_PKG_REPONAME, HY_EQ, dnf_repo_get_id(repo));
+    hy_query_filter(query, HY_PKG_NAME, HY_EQ, name);
+    packages = hy_query_run(query);
+    hy_query_free(query);
+    g_assert_cmpint(packages->len, ==, 1);
+    pkg = g_object_ref(g_ptr_array_index(packages, 0));
+    dnf_package_set_repo(pkg, repo);
+    return pkg;
+}
+
 static guint _dnf_lock_state_changed = 0;
 
 static void
@@ -890,6 +1189,1048 @@ dnf_context_func(void)
     g_object_unref(ctx);
 }
 
+static void
+dnf_verified_cache_func(void)
+{
+    gboolean ret;
+    g_autofree gchar *dir = NULL;
+    g_autofree gchar *fn = NULL;
+    g_autofree gchar *index = NULL;
+    g_autoptr(GError) error = NULL;
+
+    dir = g_dir_make_tmp("libdnf-verified-XXXXXX", &error);
+    g_assert_no_error(error);
+    fn = g_build_filename(dir, "foo-1-1.noarch.rpm", NULL);
+    ret = g_file_set_contents(fn, "payload", -1, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+
+    /* nothing known yet */
+    g_assert(!dnf_verified_cache_check_checksum(fn, 2, "abcd"));
+
+    /* only the recorded checksum matches */
+    dnf_verified_cache_add_checksum(fn, 2, "abcd");
+    g_assert(dnf_verified_cache_check_checksum(fn, 2, "ABCD"));
+    g_assert(!dnf_verified_cache_check_checksum(fn, 2, "ef01"));
+    g_assert(!dnf_verified_cache_check_checksum(fn, 3, "abcd"));
+    index = g_build_filename(dir, ".verified", NULL);
+    g_assert(g_file_test(index, G_FILE_TEST_EXISTS));
+
+    /* changing the file forgets everything */
+    ret = g_file_set_contents(fn, "a different payload", -1, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    g_assert(!dnf_verified_cache_check_checksum(fn, 2, "abcd"));
+
+    g_unlink(fn);
+    g_unlink(index);
+    g_rmdir(dir);
+}
+
+static void
+dnf_mirror_stats_func(void)
+{
+    gboolean ret;
+    const gchar *mirrors[] = { "http://a/", "http://b/", "http://c/", "http://d/", NULL };
+    g_autofree gchar *dir = NULL;
+    g_autofree gchar *fn = NULL;
+    g_autoptr(DnfMirrorStats) stats = NULL;
+    g_autoptr(DnfMirrorStats) stats2 = NULL;
+    g_autoptr(GError) error = NULL;
+    g_auto(GStrv) urls = NULL;
+    g_auto(GStrv) urls2 = NULL;
+
+    dir = g_dir_make_tmp("libdnf-mirrors-XXXXXX", &error);
+    g_assert_no_error(error);
+    fn = g_build_filename(dir, "mirrorstats", NULL);
+
+    /* nothing known, so the order is left alone */
+    stats = dnf_mirror_stats_new(fn);
+    dnf_mirror_stats_set_mirrors(stats, mirrors);
+    g_assert(dnf_mirror_stats_sort_urls(stats, NULL) == NULL);
+
+    /* fast first, then unknown in list order, then broken */
+    dnf_mirror_stats_add_transfer(stats, "http://c/", 10 * 1024 * 1024, 1.0, 0.1);
+    dnf_mirror_stats_add_transfer(stats, "http://d/", 10 * 1024 * 1024, 10.0, 0.1);
+    dnf_mirror_stats_add_failure(stats, "http://a/Packages/f/foo-1-1.noarch.rpm");
+    dnf_mirror_stats_add_failure(stats, "http://unknown/foo.rpm");
+    urls = dnf_mirror_stats_sort_urls(stats, NULL);
+    g_assert(urls != NULL);
+    g_assert_cmpstr(urls[0], ==, "http://c/");
+    g_assert_cmpstr(urls[1], ==, "http://d/");
+    g_assert_cmpstr(urls[2], ==, "http://b/");
+    g_assert_cmpstr(urls[3], ==, "http://a/");
+    g_assert_cmpstr(urls[4], ==, NULL);
+
+    /* survives a reload */
+    ret = dnf_mirror_stats_save(stats, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    stats2 = dnf_mirror_stats_new(fn);
+    urls2 = dnf_mirror_stats_sort_urls(stats2, NULL);
+    g_assert(urls2 != NULL);
+    g_assert(g_strv_length(urls2) == 4);
+    for (guint i = 0; i < 4; i++)
+        g_assert_cmpstr(urls[i], ==, urls2[i]);
+
+    g_unlink(fn);
+    g_rmdir(dir);
+}
+
+static void
+dnf_db_store_func(void)
+{
+    gboolean ret;
+    g_autofree gchar *dir = NULL;
+    g_autofree gchar *fn = NULL;
+    g_autofree gchar *value = NULL;
+    g_autoptr(DnfContext) ctx = NULL;
+    g_autoptr(DnfDb) db = NULL;
+    g_autoptr(DnfDb) db2 = NULL;
+    g_autoptr(DnfPackage) pkg = NULL;
+    g_autoptr(DnfSack) sack = NULL;
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GHashTable) values = NULL;
+
+    dir = g_dir_make_tmp("libdnf-db-XXXXXX", &error);
+    g_assert_no_error(error);
+    ctx = dnf_context_new();
+    dnf_context_set_install_root(ctx, dir);
+    sack = dnf_sack_new();
+    fn = dnf_test_get_filename("hawkey/yum/tour-4-6.noarch.rpm");
+    pkg = dnf_sack_add_cmdline_package(sack, fn);
+    g_assert(pkg != NULL);
+    dnf_package_set_pkgid(pkg, "0123456789abcdef");
+
+    /* values in the yumdb tree are imported on first use */
+    db = dnf_db_new(ctx);
+    dnf_db_set_enabled(db, TRUE);
+    ret = dnf_db_set_string(db, pkg, "reason", "user", &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    dnf_db_set_backend(db, DNF_DB_BACKEND_STORE);
+    value = dnf_db_get_string(db, pkg, "reason", &error);
+    g_assert_no_error(error);
+    g_assert_cmpstr(value, ==, "user");
+    g_clear_pointer(&value, g_free);
+
+    /* a batch is visible at once but only written on commit */
+    dnf_db_begin(db);
+    ret = dnf_db_set_string(db, pkg, "from_repo", "fedora\tupdates", &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    ret = dnf_db_remove(db, pkg, "reason", &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    value = dnf_db_get_string(db, pkg, "from_repo", &error);
+    g_assert_no_error(error);
+    g_assert_cmpstr(value, ==, "fedora\tupdates");
+    g_clear_pointer(&value, g_free);
+    db2 = dnf_db_new(ctx);
+    dnf_db_set_backend(db2, DNF_DB_BACKEND_STORE);
+    value = dnf_db_get_string(db2, pkg, "from_repo", &error);
+    g_assert_error(error, DNF_ERROR, DNF_ERROR_FAILED);
+    g_assert(value == NULL);
+    g_clear_error(&error);
+    g_clear_object(&db2);
+    ret = dnf_db_commit(db, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+
+    /* a rolled back batch leaves the committed values */
+    dnf_db_begin(db);
+    ret = dnf_db_remove_all(db, pkg, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    dnf_db_rollback(db);
+
+    db2 = dnf_db_new(ctx);
+    dnf_db_set_backend(db2, DNF_DB_BACKEND_STORE);
+    values = dnf_db_get_strings(db2, pkg, &error);
+    g_assert_no_error(error);
+    g_assert(values != NULL);
+    g_assert_cmpint(g_hash_table_size(values), ==, 1);
+    g_assert_cmpstr(g_hash_table_lookup(values, "from_repo"), ==, "fedora\tupdates");
+    g_clear_object(&db2);
+
+    /* importing again only adds the keys the store does not have */
+    dnf_db_set_backend(db, DNF_DB_BACKEND_YUMDB);
+    ret = dnf_db_set_string(db, pkg, "from_repo", "tree", &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    ret = dnf_db_set_string(db, pkg, "installed_by", "1000", &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    dnf_db_set_backend(db, DNF_DB_BACKEND_STORE);
+    ret = dnf_db_import_yumdb(db, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    value = dnf_db_get_string(db, pkg, "from_repo", &error);
+    g_assert_no_error(error);
+    g_assert_cmpstr(value, ==, "fedora\tupdates");
+    g_clear_pointer(&value, g_free);
+    value = dnf_db_get_string(db, pkg, "installed_by", &error);
+    g_assert_no_error(error);
+    g_assert_cmpstr(value, ==, "1000");
+    g_clear_pointer(&value, g_free);
+
+    /* a package cleared in the store stays cleared, also once rewritten */
+    ret = dnf_db_remove_all(db, pkg, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    ret = dnf_db_import_yumdb(db, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    db2 = dnf_db_new(ctx);
+    dnf_db_set_enabled(db2, TRUE);
+    dnf_db_set_backend(db2, DNF_DB_BACKEND_STORE);
+    ret = dnf_db_import_yumdb(db2, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    value = dnf_db_get_string(db2, pkg, "installed_by", &error);
+    g_assert_error(error, DNF_ERROR, DNF_ERROR_FAILED);
+    g_assert(value == NULL);
+    g_clear_error(&error);
+
+    dnf_remove_recursive(dir, NULL);
+}
+
+static void
+dnf_sack_server_func(void)
+{
+    gboolean ret;
+    g_autofree gchar *response = NULL;
+    g_autoptr(GError) error = NULL;
+    g_autoptr(DnfContext) ctx = NULL;
+    g_autoptr(DnfSackServer) server = NULL;
+
+    ctx = dnf_context_new();
+    dnf_context_set_solv_dir(ctx, "/tmp/hawkey");
+    dnf_context_set_repo_dir(ctx, "/tmp");
+    ret = dnf_context_setup(ctx, NULL, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    server = dnf_sack_server_new(ctx);
+
+    /* ping does not need a sack */
+    response = dnf_sack_server_handle_line(server, "ping");
+    g_assert_cmpstr(response, ==, "OK 0\n");
+    g_assert_cmpint(dnf_sack_server_get_reloads(server), ==, 0);
+    g_clear_pointer(&response, g_free);
+
+    /* the first real request loads the sack, later ones reuse it */
+    response = dnf_sack_server_handle_line(server, "name");
+    g_assert(g_str_has_prefix(response, "ERR "));
+    g_clear_pointer(&response, g_free);
+    response = dnf_sack_server_handle_line(server, "frobnicate foo");
+    g_assert(g_str_has_prefix(response, "ERR "));
+    g_clear_pointer(&response, g_free);
+    response = dnf_sack_server_handle_line(server, "name does-not-exist");
+    g_assert_cmpstr(response, ==, "OK 0\n");
+    g_clear_pointer(&response, g_free);
+    g_assert_cmpint(dnf_sack_server_get_reloads(server), ==, 1);
+
+    /* an rpmdb change reloads on the next request */
+    dnf_context_invalidate(ctx, "test");
+    response = dnf_sack_server_handle_line(server, "name does-not-exist");
+    g_assert_cmpstr(response, ==, "OK 0\n");
+    g_assert_cmpint(dnf_sack_server_get_reloads(server), ==, 2);
+    g_assert_cmpint(dnf_sack_server_get_requests(server), ==, 5);
+}
+
+typedef struct {
+    const gchar     *socket_path;
+    GMainLoop       *loop;
+} DnfSackServerHelper;
+
+static gboolean
+dnf_sack_server_quit_cb(gpointer user_data)
+{
+    g_main_loop_quit(user_data);
+    return G_SOURCE_REMOVE;
+}
+
+/* the client blocks, so it runs here while the server uses the main loop */
+static gpointer
+dnf_sack_server_client_thread(gpointer user_data)
+{
+    DnfSackServerHelper *helper = user_data;
+    g_auto(GStrv) lines = NULL;
+    g_autoptr(DnfSackClient) client = NULL;
+    g_autoptr(GError) error = NULL;
+
+    client = dnf_sack_client_new(helper->socket_path);
+    lines = dnf_sack_client_request(client, "ping", NULL, &error);
+    g_assert_no_error(error);
+    g_assert_cmpint(g_strv_length(lines), ==, 0);
+    g_clear_pointer(&lines, g_strfreev);
+
+    /* the error comes back as it was, and the connection stays usable */
+    lines = dnf_sack_client_request(client, "frob\\n\ticate", "foo", &error);
+    g_assert_error(error, DNF_ERROR, DNF_ERROR_FAILED);
+    g_assert_cmpstr(error->message, ==, "unknown command: frob\\n\ticate");
+    g_assert(lines == NULL);
+    g_clear_error(&error);
+    lines = dnf_sack_client_request(client, "name", "does-not-exist", &error);
+    g_assert_no_error(error);
+    g_assert_cmpint(g_strv_length(lines), ==, 0);
+
+    g_idle_add(dnf_sack_server_quit_cb, helper->loop);
+    return NULL;
+}
+
+static void
+dnf_sack_server_socket_func(void)
+{
+    DnfSackServerHelper helper;
+    GThread *thread;
+    gboolean ret;
+    g_autofree gchar *dir = NULL;
+    g_autofree gchar *repos_dir = NULL;
+    g_autofree gchar *response = NULL;
+    g_autofree gchar *socket_path = NULL;
+    g_autofree gchar *solv_dir = NULL;
+    g_autoptr(DnfContext) ctx = NULL;
+    g_autoptr(DnfSackServer) server = NULL;
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GMainLoop) loop = NULL;
+
+    dir = g_dir_make_tmp("libdnf-sack-server-XXXXXX", &error);
+    g_assert_no_error(error);
+    repos_dir = g_build_filename(dir, "repos.d", NULL);
+    solv_dir = g_build_filename(dir, "solv", NULL);
+    socket_path = g_build_filename(dir, "socket", NULL);
+    g_assert_cmpint(g_mkdir(repos_dir, 0755), ==, 0);
+
+    ctx = dnf_context_new();
+    dnf_context_set_repo_dir(ctx, repos_dir);
+    dnf_context_set_solv_dir(ctx, solv_dir);
+    dnf_context_set_install_root(ctx, dir);
+    dnf_context_set_release_ver(ctx, "26");
+    ret = dnf_context_setup(ctx, NULL, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    server = dnf_sack_server_new(ctx);
+    ret = dnf_sack_server_start(server, socket_path, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+
+    /* an escaped error is still a single line */
+    response = dnf_sack_server_handle_line(server, "frob\nicate foo");
+    g_assert_cmpstr(response, ==, "ERR unknown command: frob\\nicate\n");
+    g_clear_pointer(&response, g_free);
+    response = dnf_sack_server_handle_line(server, "frob\\n\ticate foo");
+    g_assert_cmpstr(response, ==, "ERR unknown command: frob\\\\n\\ticate\n");
+
+    loop = g_main_loop_new(NULL, FALSE);
+    helper.socket_path = socket_path;
+    helper.loop = loop;
+    thread = g_thread_new("sack-client", dnf_sack_server_client_thread, &helper);
+    g_main_loop_run(loop);
+    g_thread_join(thread);
+    g_assert_cmpint(dnf_sack_server_get_requests(server), ==, 5);
+
+    dnf_sack_server_stop(server);
+    g_assert(!g_file_test(socket_path, G_FILE_TEST_EXISTS));
+    dnf_remove_recursive(dir, NULL);
+}
+
+static void
+dnf_repo_download_all_downloaded_cb(DnfPackage *pkg, gpointer user_data)
+{
+    GPtrArray *downloaded = user_data;
+    g_ptr_array_add(downloaded, pkg);
+}
+
+static void
+dnf_repo_download_all_func(void)
+{
+    DnfRepo *repos[2];
+    const gchar *basenames[] = { "tour-4-6.noarch.rpm",
+                                 "mystery-devel-19.67-1.noarch.rpm",
+                                 NULL };
+    const gchar *ids[] = { "first", "second", NULL };
+    gboolean ret;
+    guint i;
+    g_autofree gchar *dir = NULL;
+    g_autoptr(DnfContext) ctx = NULL;
+    g_autoptr(DnfSack) sack = NULL;
+    g_autoptr(DnfState) state = dnf_state_new();
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GPtrArray) downloaded = g_ptr_array_new();
+    g_autoptr(GPtrArray) packages = g_ptr_array_new_with_free_func(g_object_unref);
+
+    dir = g_dir_make_tmp("libdnf-download-all-XXXXXX", &error);
+    g_assert_no_error(error);
+    ctx = dnf_test_context_new(dir);
+    sack = dnf_test_sack_new(dir);
+    for (i = 0; ids[i] != NULL; i++) {
+        repos[i] = dnf_test_add_local_repo(ctx, sack, dir, ids[i]);
+        g_ptr_array_add(packages, dnf_test_get_package(sack, repos[i], "tour"));
+        g_ptr_array_add(packages, dnf_test_get_package(sack, repos[i], "mystery-devel"));
+    }
+
+    /* both repos in one batch, each file into the cache dir of its repo */
+    ret = dnf_repo_download_packages_all(packages, NULL,
+                                         dnf_repo_download_all_downloaded_cb,
+                                         downloaded, state, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    g_assert_cmpint(downloaded->len, ==, packages->len);
+    for (i = 0; ids[i] != NULL; i++) {
+        const gchar *cache_dir = dnf_repo_get_packages(repos[i]);
+        g_autofree gchar *expected = g_build_filename(dir, ids[i], "packages", NULL);
+
+        g_assert_cmpstr(cache_dir, ==, expected);
+        for (guint j = 0; basenames[j] != NULL; j++) {
+            g_autofree gchar *fn = g_build_filename(cache_dir, basenames[j], NULL);
+            g_assert(g_file_test(fn, G_FILE_TEST_EXISTS));
+        }
+    }
+
+    g_ptr_array_set_size(packages, 0);
+    for (i = 0; ids[i] != NULL; i++)
+        g_object_unref(repos[i]);
+    dnf_remove_recursive(dir, NULL);
+}
+
+static void
+dnf_repo_download_resume_func(void)
+{
+    gboolean ret;
+    gsize len;
+    g_autofree gchar *checksum = NULL;
+    g_autofree gchar *contents = NULL;
+    g_autofree gchar *dir = NULL;
+    g_autofree gchar *downloaded = NULL;
+    g_autofree gchar *fn = NULL;
+    g_autofree gchar *info = NULL;
+    g_autofree gchar *info_fn = NULL;
+    g_autofree gchar *part_fn = NULL;
+    g_autofree gchar *src_fn = NULL;
+    g_autoptr(DnfContext) ctx = NULL;
+    g_autoptr(DnfRepo) repo = NULL;
+    g_autoptr(DnfSack) sack = NULL;
+    g_autoptr(DnfState) state = dnf_state_new();
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GPtrArray) packages = g_ptr_array_new_with_free_func(g_object_unref);
+
+    dir = g_dir_make_tmp("libdnf-resume-XXXXXX", &error);
+    g_assert_no_error(error);
+    ctx = dnf_test_context_new(dir);
+    sack = dnf_test_sack_new(dir);
+    repo = dnf_test_add_remote_repo(ctx, sack, dir, "remote", 0);
+    g_ptr_array_add(packages, dnf_test_get_package(sack, repo, "tour"));
+
+    /* an interrupted download of the first half, with what it is for */
+    src_fn = g_build_filename(dir, "remote-mirror", "tour-4-6.noarch.rpm", NULL);
+    ret = g_file_get_contents(src_fn, &contents, &len, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+                                           (const guchar *) contents, len);
+    g_assert_cmpint(g_mkdir_with_parents(dnf_repo_get_packages(repo), 0755), ==, 0);
+    fn = g_build_filename(dnf_repo_get_packages(repo), "tour-4-6.noarch.rpm", NULL);
+    part_fn = g_strconcat(fn, ".part", NULL);
+    info_fn = g_strconcat(fn, ".part.info", NULL);
+    ret = g_file_set_contents(part_fn, contents, len / 2, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    info = g_strdup_printf("%" G_GSIZE_FORMAT "\t%i\t%s\n",
+                           len, LR_CHECKSUM_SHA256, checksum);
+    ret = g_file_set_contents(info_fn, info, -1, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+
+    /* it is completed, checked and moved into place */
+    ret = dnf_repo_download_packages_all(packages, NULL, NULL, NULL, state, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    g_assert(!g_file_test(part_fn, G_FILE_TEST_EXISTS));
+    g_assert(!g_file_test(info_fn, G_FILE_TEST_EXISTS));
+    ret = g_file_get_contents(fn, &downloaded, NULL, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    g_assert(memcmp(downloaded, contents, len) == 0);
+
+    g_ptr_array_set_size(packages, 0);
+    dnf_remove_recursive(dir, NULL);
+}
+
+static void
+dnf_repo_download_failures_func(void)
+{
+    gboolean ret;
+    g_autofree gchar *dir = NULL;
+    g_autofree gchar *fn = NULL;
+    g_autofree gchar *missing_fn = NULL;
+    g_autoptr(DnfContext) ctx = NULL;
+    g_autoptr(DnfRepo) repo = NULL;
+    g_autoptr(DnfSack) sack = NULL;
+    g_autoptr(DnfState) state = dnf_state_new();
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GPtrArray) packages = g_ptr_array_new_with_free_func(g_object_unref);
+
+    dir = g_dir_make_tmp("libdnf-failures-XXXXXX", &error);
+    g_assert_no_error(error);
+    ctx = dnf_test_context_new(dir);
+    sack = dnf_test_sack_new(dir);
+    repo = dnf_test_add_remote_repo(ctx, sack, dir, "remote", 0);
+    g_ptr_array_add(packages, dnf_test_get_package(sack, repo, "tour"));
+    g_ptr_array_add(packages, dnf_test_get_package(sack, repo, "mystery-devel"));
+
+    /* one package is already there, the other one has gone missing */
+    ret = dnf_repo_download_packages_all(packages, NULL, NULL, NULL, state, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    fn = g_build_filename(dnf_repo_get_packages(repo), "mystery-devel-19.67-1.noarch.rpm", NULL);
+    g_assert_cmpint(g_unlink(fn), ==, 0);
+    missing_fn = g_build_filename(dir, "remote-mirror", "mystery-devel-19.67-1.noarch.rpm", NULL);
+    g_assert_cmpint(g_unlink(missing_fn), ==, 0);
+
+    /* librepo finishes the batch, the failure is only in the summary */
+    dnf_state_reset(state);
+    ret = dnf_repo_download_packages_all(packages, NULL, NULL, NULL, state, &error);
+    g_assert_error(error, DNF_ERROR, DNF_ERROR_CANNOT_FETCH_SOURCE);
+    g_assert(!ret);
+    g_assert(g_str_has_prefix(error->message, "failed to download 1 file: "));
+    g_assert(strstr(error->message, "mystery-devel-19.67-1.noarch.rpm") != NULL);
+    g_clear_error(&error);
+    g_clear_pointer(&fn, g_free);
+    fn = g_build_filename(dnf_repo_get_packages(repo), "tour-4-6.noarch.rpm", NULL);
+    g_assert(g_file_test(fn, G_FILE_TEST_EXISTS));
+
+    g_ptr_array_set_size(packages, 0);
+    dnf_remove_recursive(dir, NULL);
+}
+
+static void
+dnf_repo_prefetch_cancel_func(void)
+{
+    DnfRepoPrefetch *prefetch;
+    const gchar *name;
+    gboolean ret;
+    g_autofree gchar *dir = NULL;
+    g_autoptr(DnfContext) ctx = NULL;
+    g_autoptr(DnfRepo) repo = NULL;
+    g_autoptr(DnfSack) sack = NULL;
+    g_autoptr(DnfState) state = dnf_state_new();
+    g_autoptr(GDir) packages_dir = NULL;
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GPtrArray) packages = g_ptr_array_new_with_free_func(g_object_unref);
+
+    dir = g_dir_make_tmp("libdnf-prefetch-XXXXXX", &error);
+    g_assert_no_error(error);
+    ctx = dnf_test_context_new(dir);
+    sack = dnf_test_sack_new(dir);
+    repo = dnf_test_add_remote_repo(ctx, sack, dir, "remote", 0);
+    g_ptr_array_add(packages, dnf_test_get_package(sack, repo, "tour"));
+    g_ptr_array_add(packages, dnf_test_get_package(sack, repo, "mystery-devel"));
+
+    /* however far it got, only complete packages are left behind */
+    prefetch = dnf_repo_prefetch_start(packages, &error);
+    g_assert_no_error(error);
+    g_assert(prefetch != NULL);
+    dnf_repo_prefetch_cancel(prefetch);
+    dnf_repo_prefetch_free(prefetch);
+    packages_dir = g_dir_open(dnf_repo_get_packages(repo), 0, &error);
+    g_assert_no_error(error);
+    while ((name = g_dir_read_name(packages_dir)) != NULL) {
+        g_autofree gchar *contents = NULL;
+        g_autofree gchar *fn = NULL;
+        g_autofree gchar *mirror_contents = NULL;
+        g_autofree gchar *mirror_fn = NULL;
+        gsize len;
+        gsize mirror_len;
+
+        g_assert(g_str_has_suffix(name, ".rpm"));
+        fn = g_build_filename(dnf_repo_get_packages(repo), name, NULL);
+        mirror_fn = g_build_filename(dir, "remote-mirror", name, NULL);
+        ret = g_file_get_contents(fn, &contents, &len, &error);
+        g_assert_no_error(error);
+        g_assert(ret);
+        ret = g_file_get_contents(mirror_fn, &mirror_contents, &mirror_len, &error);
+        g_assert_no_error(error);
+        g_assert(ret);
+        g_assert_cmpint(len, ==, mirror_len);
+        g_assert(memcmp(contents, mirror_contents, len) == 0);
+    }
+
+    /* the repo can be used again */
+    ret = dnf_repo_download_packages_all(packages, NULL, NULL, NULL, state, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+
+    g_ptr_array_set_size(packages, 0);
+    dnf_remove_recursive(dir, NULL);
+}
+
+static void
+dnf_transaction_prefetch_finish_func(void)
+{
+    HyGoal goal;
+    gboolean ret;
+    guint i;
+    g_autofree gchar *dir = NULL;
+    g_autoptr(DnfContext) ctx = NULL;
+    g_autoptr(DnfPackage) mystery = NULL;
+    g_autoptr(DnfPackage) tour = NULL;
+    g_autoptr(DnfRepo) repo = NULL;
+    g_autoptr(DnfSack) sack = NULL;
+    g_autoptr(DnfState) state = dnf_state_new();
+    g_autoptr(DnfTransaction) transaction = NULL;
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GPtrArray) prefetched = g_ptr_array_new();
+    g_autoptr(GPtrArray) repos = g_ptr_array_new();
+
+    dir = g_dir_make_tmp("libdnf-prefetch-XXXXXX", &error);
+    g_assert_no_error(error);
+    ctx = dnf_test_context_new(dir);
+    dnf_context_set_prefetch(ctx, TRUE);
+    dnf_context_set_check_disk_space(ctx, FALSE);
+    sack = dnf_test_sack_new(dir);
+    repo = dnf_test_add_remote_repo(ctx, sack, dir, "remote", 0);
+    tour = dnf_test_get_package(sack, repo, "tour");
+    mystery = dnf_test_get_package(sack, repo, "mystery-devel");
+    g_ptr_array_add(repos, repo);
+    transaction = dnf_transaction_new(ctx);
+    dnf_transaction_set_repos(transaction, repos);
+
+    /* the depsolve starts the download in the background */
+    goal = hy_goal_create(sack);
+    hy_goal_install(goal, tour);
+    hy_goal_install(goal, mystery);
+    ret = dnf_transaction_depsolve(transaction, goal, state, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+
+    /* and what it downloaded is handed over rather than fetched again */
+    dnf_state_reset(state);
+    ret = dnf_transaction_prefetch_finish(transaction, prefetched, state, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    g_assert_cmpint(prefetched->len, ==, 2);
+    for (i = 0; i < prefetched->len; i++) {
+        DnfPackage *pkg = g_ptr_array_index(prefetched, i);
+        g_assert(g_file_test(dnf_package_get_filename(pkg), G_FILE_TEST_EXISTS));
+    }
+
+    hy_goal_free(goal);
+    dnf_remove_recursive(dir, NULL);
+}
+
+static void
+dnf_transaction_install_space_func(void)
+{
+    HyGoal goal;
+    gboolean ret;
+    g_autofree gchar *dir = NULL;
+    g_autoptr(DnfContext) ctx = NULL;
+    g_autoptr(DnfPackage) tour = NULL;
+    g_autoptr(DnfRepo) repo = NULL;
+    g_autoptr(DnfSack) sack = NULL;
+    g_autoptr(DnfState) state = dnf_state_new();
+    g_autoptr(DnfTransaction) transaction = NULL;
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GPtrArray) repos = g_ptr_array_new();
+
+    dir = g_dir_make_tmp("libdnf-space-XXXXXX", &error);
+    g_assert_no_error(error);
+    ctx = dnf_test_context_new(dir);
+    dnf_context_set_check_disk_space(ctx, TRUE);
+    sack = dnf_test_sack_new(dir);
+
+    /* no filelist, but far more than any filesystem here has free */
+    repo = dnf_test_add_remote_repo(ctx, sack, dir, "remote", G_GUINT64_CONSTANT(1) << 60);
+    tour = dnf_test_get_package(sack, repo, "tour");
+    g_assert_cmpint(dnf_package_get_installsize(tour), ==, G_GUINT64_CONSTANT(1) << 60);
+    g_ptr_array_add(repos, repo);
+    transaction = dnf_transaction_new(ctx);
+    dnf_transaction_set_repos(transaction, repos);
+
+    /* it is charged to the filesystem of the install root */
+    goal = hy_goal_create(sack);
+    hy_goal_install(goal, tour);
+    ret = dnf_transaction_depsolve(transaction, goal, state, &error);
+    g_assert_error(error, DNF_ERROR, DNF_ERROR_NO_SPACE);
+    g_assert(!ret);
+    g_assert(strstr(error->message, dir) != NULL);
+
+    hy_goal_free(goal);
+    dnf_remove_recursive(dir, NULL);
+}
+
+static void
+dnf_repo_update_all_percentage_cb(DnfState *state, guint value, GArray *percentages)
+{
+    g_array_append_val(percentages, value);
+}
+
+static void
+dnf_repo_update_all_func(void)
+{
+    const gchar *ids[] = { "one", "broken", "three", "four", NULL };
+    gboolean ret;
+    g_autofree gchar *dir = NULL;
+    g_autofree gchar *repomd = NULL;
+    g_autoptr(DnfContext) ctx = NULL;
+    g_autoptr(DnfLock) lock = NULL;
+    g_autoptr(DnfState) state = NULL;
+    g_autoptr(GArray) percentages = g_array_new(FALSE, FALSE, sizeof(guint));
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GPtrArray) failed = g_ptr_array_new_with_free_func(g_object_unref);
+    g_autoptr(GPtrArray) repos = g_ptr_array_new_with_free_func(g_object_unref);
+
+    lock = dnf_lock_new();
+    dnf_lock_set_lock_dir(lock, "/tmp");
+    dir = g_dir_make_tmp("libdnf-update-all-XXXXXX", &error);
+    g_assert_no_error(error);
+    ctx = dnf_test_context_new(dir);
+    dnf_context_set_max_parallel_refresh(ctx, 2);
+
+    /* none of them has been fetched yet, and one never can be */
+    for (guint i = 0; ids[i] != NULL; i++) {
+        g_autoptr(DnfState) state_check = dnf_state_new();
+        DnfRepo *repo = dnf_test_add_remote_repo(ctx, NULL, dir, ids[i], 0);
+        g_assert(!dnf_repo_check(repo, G_MAXUINT, state_check, NULL));
+        g_ptr_array_add(repos, repo);
+    }
+    repomd = g_build_filename(dir, "broken-mirror", "repodata", "repomd.xml", NULL);
+    g_assert_cmpint(g_unlink(repomd), ==, 0);
+
+    /* an optional repo is skipped, each job is reported done once */
+    dnf_repo_set_required(g_ptr_array_index(repos, 1), FALSE);
+    state = dnf_state_new();
+    g_signal_connect(state, "percentage-changed",
+                     G_CALLBACK(dnf_repo_update_all_percentage_cb), percentages);
+    g_test_expect_message("libdnf", G_LOG_LEVEL_WARNING, "Skipping refresh of broken: *");
+    ret = dnf_repo_update_all(repos, DNF_REPO_UPDATE_FLAG_NONE, failed, state, &error);
+    g_test_assert_expected_messages();
+    g_assert_no_error(error);
+    g_assert(ret);
+    g_assert_cmpint(failed->len, ==, 1);
+    g_assert(g_ptr_array_index(failed, 0) == g_ptr_array_index(repos, 1));
+    g_assert_cmpint(percentages->len, ==, repos->len);
+    g_assert_cmpint(g_array_index(percentages, guint, 0), ==, 25);
+    g_assert_cmpint(g_array_index(percentages, guint, 1), ==, 50);
+    g_assert_cmpint(g_array_index(percentages, guint, 2), ==, 75);
+    g_assert_cmpint(g_array_index(percentages, guint, 3), ==, 100);
+    for (guint i = 0; i < repos->len; i++) {
+        g_autoptr(DnfState) state_check = dnf_state_new();
+        ret = dnf_repo_check(g_ptr_array_index(repos, i), G_MAXUINT, state_check, NULL);
+        g_assert(ret == (i != 1));
+    }
+
+    /* a required one is an error, but the others are still refreshed */
+    for (guint i = 0; i < repos->len; i++)
+        dnf_remove_recursive(dnf_repo_get_location(g_ptr_array_index(repos, i)), NULL);
+    dnf_repo_set_required(g_ptr_array_index(repos, 1), TRUE);
+    g_ptr_array_set_size(failed, 0);
+    dnf_state_reset(state);
+    ret = dnf_repo_update_all(repos, DNF_REPO_UPDATE_FLAG_NONE, failed, state, &error);
+    g_assert_error(error, DNF_ERROR, DNF_ERROR_CANNOT_FETCH_SOURCE);
+    g_assert(!ret);
+    g_assert(strstr(error->message, "'broken'") != NULL);
+    g_assert_cmpint(failed->len, ==, 0);
+    for (guint i = 0; i < repos->len; i++) {
+        g_autoptr(DnfState) state_check = dnf_state_new();
+        ret = dnf_repo_check(g_ptr_array_index(repos, i), G_MAXUINT, state_check, NULL);
+        g_assert(ret == (i != 1));
+    }
+
+    dnf_remove_recursive(dir, NULL);
+}
+
+static void
+dnf_transaction_pipeline_percentage_cb(DnfState *state, guint value, gpointer user_data)
+{
+    gboolean *slowed = user_data;
+
+    /* give the workers time to pick up the first package */
+    if (value > 0 && !*slowed) {
+        *slowed = TRUE;
+        g_usleep(G_USEC_PER_SEC / 5);
+    }
+}
+
+static void
+dnf_transaction_pipeline_func(void)
+{
+    DnfTransactionTiming *download = NULL;
+    DnfTransactionTiming *verify = NULL;
+    GPtrArray *timings;
+    gboolean ret;
+    gboolean slowed = FALSE;
+    guint headers = 0;
+    guint i;
+    g_autofree gchar *dir = NULL;
+    g_autoptr(DnfContext) ctx = NULL;
+    g_autoptr(DnfRepo) repo = NULL;
+    g_autoptr(DnfSack) sack = NULL;
+    g_autoptr(DnfState) state = dnf_state_new();
+    g_autoptr(DnfTransaction) transaction = NULL;
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GPtrArray) packages = g_ptr_array_new_with_free_func(g_object_unref);
+    g_autoptr(GPtrArray) repos = g_ptr_array_new();
+
+    /* the signature checks need the system keys */
+    if (!g_file_test("/etc/pki/rpm-gpg", G_FILE_TEST_IS_DIR)) {
+        g_debug("skipping tests: no /etc/pki/rpm-gpg");
+        return;
+    }
+
+    dir = g_dir_make_tmp("libdnf-pipeline-XXXXXX", &error);
+    g_assert_no_error(error);
+    ctx = dnf_test_context_new(dir);
+    sack = dnf_test_sack_new(dir);
+    repo = dnf_test_add_local_repo(ctx, sack, dir, "pipeline");
+    g_ptr_array_add(packages, dnf_test_get_package(sack, repo, "tour"));
+    g_ptr_array_add(packages, dnf_test_get_package(sack, repo, "mystery-devel"));
+    g_ptr_array_add(repos, repo);
+    transaction = dnf_transaction_new(ctx);
+    dnf_transaction_set_repos(transaction, repos);
+
+    /* the first package is verified while the second one is copied */
+    g_signal_connect(state, "percentage-changed",
+                     G_CALLBACK(dnf_transaction_pipeline_percentage_cb), &slowed);
+    ret = dnf_transaction_download_full(transaction, packages, NULL, state, &error);
+    g_assert_no_error(error);
+    g_assert(ret);
+    g_assert(slowed);
+
+    timings = dnf_transaction_get_download_timings(transaction);
+    for (i = 0; i < timings->len; i++) {
+        DnfTransactionTiming *timing = g_ptr_array_index(timings, i);
+        if (timing->kind == DNF_TRANSACTION_TIMING_KIND_PHASE &&
+            g_strcmp0(timing->name, "download") == 0)
+            download = timing;
+        if (timing->kind == DNF_TRANSACTION_TIMING_KIND_VERIFY &&
+            g_strcmp0(timing->name, "tour-4-6.noarch.rpm") == 0)
+            verify = timing;
+        if (timing->kind == DNF_TRANSACTION_TIMING_KIND_HEADER)
+            headers++;
+    }
+    g_assert(download != NULL);
+    g_assert(verify != NULL);
+    g_assert_cmpfloat(verify->start, <, download->duration);
+    g_assert_cmpint(headers, ==, 2);
+
+    dnf_remove_recursive(dir, NULL);
+}
+
+static void
+dnf_transaction_pipeline_failed_func(void)
+{
+    GPtrArray *timings;
+    gboolean ret;
+    guint i;
+    g_autofree gchar *dir = NULL;
+    g_autofree gchar *fn = NULL;
+    g_autoptr(DnfContext) ctx = NULL;
+    g_autoptr(DnfRepo) repo = NULL;
+    g_autoptr(DnfSack) sack = NULL;
+    g_autoptr(DnfPackage) tour = NULL;
+    g_autoptr(DnfState) state = dnf_state_new();
+    g_autoptr(DnfTransaction) transaction = NULL;
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GPtrArray) packages = g_ptr_array_new_with_free_func(g_object_unref);
+    g_autoptr(GPtrArray) repos = g_ptr_array_new();
+    g_autoptr(GPtrArray) verify_only = g_ptr_array_new();
+
+    if (!g_file_test("/etc/pki/rpm-gpg", G_FILE_TEST_IS_DIR)) {
+        g_debug("skipping tests: no /etc/pki/rpm-gpg");
+        return;
+    }
+
+    dir = g_dir_make_tmp("libdnf-pipeline-XXXXXX", &error);
+    g_assert_no_error(error);
+    ctx = dnf_test_context_new(dir);
+    sack = dnf_test_sack_new(dir);
+    repo = dnf_test_add_local_repo(ctx, sack, dir, "pipeline");
+    tour = dnf_test_get_package(sack, repo, "tour");
+    g_ptr_array_add(packages, dnf_test_get_package(sack, repo, "mystery-devel"));
+    g_ptr_array_add(repos, repo);
+    transaction = dnf_transaction_new(ctx);
+    dnf_transaction_set_repos(transaction, repos);
+
+    /* plenty of files are still queued for the workers when the only
+     * download fails; under valgrind this also checks they are freed */
+    for (i = 0; i < 64; i++)
+        g_ptr_array_add(verify_only, tour);
+    fn = g_build_filename(dir, "pipeline", "mystery-devel-19.67-1.noarch.rpm", NULL);
+    g_assert_cmpint(g_unlink(fn), ==, 0);
+    ret = dnf_transaction_download_full(transaction, packages, verify_only, state, &error);
+    g_assert(error != NULL);
+    g_assert(!ret);
+
+    /* the missing package never reached a worker */
+    timings = dnf_transaction_get_download_timings(transaction);
+    for (i = 0; i < timings->len; i++) {
+        DnfTransactionTiming *timing = g_ptr_array_index(timings, i);
+        g_assert_cmpstr(timing->name, !=, "mystery-devel-19.67-1.noarch.rpm");
+    }
+
+    dnf_remove_recursive(dir, NULL);
+}
+
+/**
+ * dnf_test_json_skip:
+ *
+ * Checks that @json starts with a JSON value, adding the key of every
+ * object member to @keys.
+ *
+ * Returns: what follows the value, or %NULL if it is not valid
+ **/
+static const gchar *
+dnf_test_json_skip(const gchar *json, GHashTable *keys)
+{
+    gchar *end;
+
+    while (g_ascii_isspace(*json))
+        json++;
+    if (*json == '{' || *json == '[') {
+        gchar close = *json == '{' ? '}' : ']';
+        gboolean object = *json == '{';
+
+        json++;
+        while (g_ascii_isspace(*json))
+            json++;
+        if (*json == close)
+            return json + 1;
+        for (;;) {
+            if (object) {
+                const gchar *key = json;
+                while (g_ascii_isspace(*key))
+                    key++;
+                json = dnf_test_json_skip(key, keys);
+                if (json == NULL || *key != '"')
+                    return NULL;
+                g_hash_table_add(keys, g_strndup(key + 1, json - key - 2));
+                while (g_ascii_isspace(*json))
+                    json++;
+                if (*json++ != ':')
+                    return NULL;
+            }
+            json = dnf_test_json_skip(json, keys);
+            if (json == NULL)
+                return NULL;
+            while (g_ascii_isspace(*json))
+                json++;
+            if (*json == close)
+                return json + 1;
+            if (*json++ != ',')
+                return NULL;
+        }
+    }
+    if (*json == '"') {
+        for (json++; *json != '"'; json++) {
+            if ((guchar) *json < 0x20)
+                return NULL;
+            if (*json != '\\')
+                continue;
+            json++;
+            if (*json == 'u') {
+                for (guint i = 1; i <= 4; i++) {
+                    if (!g_ascii_isxdigit(json[i]))
+                        return NULL;
+                }
+                json += 4;
+            } else if (strchr("\"\\/bfnrt", *json) == NULL || *json == '\0') {
+                return NULL;
+            }
+        }
+        return json + 1;
+    }
+    if (g_str_has_prefix(json, "true"))
+        return json + 4;
+    if (g_str_has_prefix(json, "false"))
+        return json + 5;
+    if (g_str_has_prefix(json, "null"))
+        return json + 4;
+    if (*json != '-' && !g_ascii_isdigit(*json))
+        return NULL;
+    g_ascii_strtod(json, &end);
+    return end;
+}
+
+static void
+dnf_test_timing_free(DnfTransactionTiming *timing)
+{
+    g_free(timing->name);
+    g_free(timing);
+}
+
+static void
+dnf_test_timing_add(GPtrArray *timings,
+                    DnfTransactionTimingKind kind,
+                    const gchar *name,
+                    const gchar *scriptlet,
+                    gdouble start,
+                    gdouble duration)
+{
+    DnfTransactionTiming *timing = g_new0(DnfTransactionTiming, 1);
+    timing->kind = kind;
+    timing->name = g_strdup(name);
+    timing->scriptlet = scriptlet;
+    timing->start = start;
+    timing->duration = duration;
+    g_ptr_array_add(timings, timing);
+}
+
+static void
+dnf_transaction_timings_json_func(void)
+{
+    DnfTransactionTiming *timing;
+    const gchar *documented[] = { "timings", "kind", "name", "scriptlet",
+                                  "start", "duration", "failed", "rc",
+                                  NULL };
+    const gchar *end;
+    g_autofree gchar *json = NULL;
+    g_autoptr(GHashTable) keys = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    g_autoptr(GPtrArray) timings = NULL;
+
+    /* nothing timed is still a document */
+    timings = g_ptr_array_new_with_free_func((GDestroyNotify) dnf_test_timing_free);
+    json = dnf_transaction_timings_to_json(timings);
+    end = dnf_test_json_skip(json, keys);
+    g_assert(end != NULL);
+    g_assert_cmpstr(end, ==, "\n");
+    g_clear_pointer(&json, g_free);
+
+    /* a bit of everything, including a failed scriptlet that never
+     * finished and a name that needs escaping */
+    dnf_test_timing_add(timings, DNF_TRANSACTION_TIMING_KIND_PHASE, "order", NULL, 0, 0.25);
+    dnf_test_timing_add(timings, DNF_TRANSACTION_TIMING_KIND_INSTALL, "tour-4-6.noarch", NULL, 0.5, 1.5);
+    dnf_test_timing_add(timings, DNF_TRANSACTION_TIMING_KIND_SCRIPTLET, "tour-4-6.noarch", "%post", 1.75, -1);
+    timing = g_ptr_array_index(timings, timings->len - 1);
+    timing->failed = TRUE;
+    timing->rc = 1;
+    dnf_test_timing_add(timings, DNF_TRANSACTION_TIMING_KIND_SCRIPTLET, "tour-4-6.noarch", "%posttrans", 2, 0.125);
+    dnf_test_timing_add(timings, DNF_TRANSACTION_TIMING_KIND_ERASE, "odd \"name\"\\\n", NULL, 2.25, 0.5);
+    dnf_test_timing_add(timings, DNF_TRANSACTION_TIMING_KIND_VERIFY, "tour-4-6.noarch.rpm", NULL, 0, 0.1);
+    dnf_test_timing_add(timings, DNF_TRANSACTION_TIMING_KIND_HEADER, "tour-4-6.noarch.rpm", NULL, 0.1, 0.1);
+    json = dnf_transaction_timings_to_json(timings);
+    end = dnf_test_json_skip(json, keys);
+    g_assert(end != NULL);
+    g_assert_cmpstr(end, ==, "\n");
+
+    /* the keys are the ones DnfTransactionTiming documents */
+    for (guint i = 0; documented[i] != NULL; i++)
+        g_assert(g_hash_table_contains(keys, documented[i]));
+    g_assert_cmpint(g_hash_table_size(keys), ==, g_strv_length((gchar **) documented));
+
+    g_assert(strstr(json, "{\"kind\": \"phase\", \"name\": \"order\", "
+                          "\"start\": 0.000000, \"duration\": 0.250000}") != NULL);
+    g_assert(strstr(json, "{\"kind\": \"scriptlet\", \"name\": \"tour-4-6.noarch\", "
+                          "\"scriptlet\": \"%post\", \"start\": 1.750000, "
+                          "\"duration\": -1.000000, \"failed\": true, \"rc\": 1}") != NULL);
+    g_assert(strstr(json, "\"scriptlet\": \"%posttrans\", \"start\": 2.000000, "
+                          "\"duration\": 0.125000}") != NULL);
+    g_assert(strstr(json, "\"kind\": \"erase\", \"name\": \"odd \\\"name\\\"\\\\\\u000a\"") != NULL);
+    g_assert(strstr(json, "\"kind\": \"verify\"") != NULL);
+    g_assert(strstr(json, "\"kind\": \"header\"") != NULL);
+}
+
 static void
 dnf_repo_loader_gpg_no_pubkey_func(void)
 {
@@ -1084,6 +2425,21 @@ main(int argc, char **argv)
     g_test_add_func("/libdnf/repo_loader", dnf_repo_loader_func);
     g_test_add_func("/libdnf/repo_loader{gpg-no-pubkey}", dnf_repo_loader_gpg_no_pubkey_func);
     g_test_add_func("/libdnf/context", dnf_context_func);
+    g_test_add_func("/libdnf/sack-server", dnf_sack_server_func);
+    g_test_add_func("/libdnf/sack-server[socket]", dnf_sack_server_socket_func);
+    g_test_add_func("/libdnf/repo[download-all]", dnf_repo_download_all_func);
+    g_test_add_func("/libdnf/repo[download-resume]", dnf_repo_download_resume_func);
+    g_test_add_func("/libdnf/repo[download-failures]", dnf_repo_download_failures_func);
+    g_test_add_func("/libdnf/repo[update-all]", dnf_repo_update_all_func);
+    g_test_add_func("/libdnf/repo[prefetch-cancel]", dnf_repo_prefetch_cancel_func);
+    g_test_add_func("/libdnf/transaction[prefetch-finish]", dnf_transaction_prefetch_finish_func);
+    g_test_add_func("/libdnf/transaction[install-space]", dnf_transaction_install_space_func);
+    g_test_add_func("/libdnf/transaction[pipeline]", dnf_transaction_pipeline_func);
+    g_test_add_func("/libdnf/transaction[pipeline-failed]", dnf_transaction_pipeline_failed_func);
+    g_test_add_func("/libdnf/transaction[timings-json]", dnf_transaction_timings_json_func);
+    g_test_add_func("/libdnf/verified-cache", dnf_verified_cache_func);
+    g_test_add_func("/libdnf/mirror-stats", dnf_mirror_stats_func);
+    g_test_add_func("/libdnf/db{store}", dnf_db_store_func);
     g_test_add_func("/libdnf/lock", dnf_lock_func);
     g_test_add_func("/libdnf/lock[threads]", dnf_lock_threads_func);
     g_test_add_func("/libdnf/repo", ch_test_repo_func);